@@ -0,0 +1,189 @@
+// Class metadata benchmark: parses the same synthetic class file CLASSES
+// times with the metadata in one arena and with a malloc per array (the
+// path before the arena), and reports the time and the resident memory each
+// leaves. Every mode runs in its own child process, so the RSS of one does
+// not hide in the other's.
+//
+//   make bench
+//   ./bin/class_load_bench
+#define _DEFAULT_SOURCE
+#include "jvm.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLASSES 20000
+#define FIELDS 20          // each with a ConstantValue attribute
+#define METHODS 40         // each with a Code attribute
+
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+} Buffer;
+
+static void put_u1(Buffer *buffer, uint8_t value) {
+    buffer->bytes[buffer->length++] = value;
+}
+
+static void put_u2(Buffer *buffer, uint16_t value) {
+    put_u1(buffer, (uint8_t)(value >> 8));
+    put_u1(buffer, (uint8_t)value);
+}
+
+static void put_u4(Buffer *buffer, uint32_t value) {
+    put_u2(buffer, (uint16_t)(value >> 16));
+    put_u2(buffer, (uint16_t)value);
+}
+
+static void put_utf8(Buffer *buffer, const char *text) {
+    put_u1(buffer, 1); // CONSTANT_Utf8
+    put_u2(buffer, (uint16_t)strlen(text));
+    memcpy(buffer->bytes + buffer->length, text, strlen(text));
+    buffer->length += strlen(text);
+}
+
+// Constant pool: 1 this class name, 2 its Class, 3 java/lang/Object, 4 its
+// Class, 5 "Code", 6 "I", 7 "()V", 8 "ConstantValue", 9 Integer 7, then the
+// field names and the method names
+static Buffer build_class(void) {
+    Buffer buffer = { malloc(64 * 1024), 0 };
+    put_u4(&buffer, 0xCAFEBABE);
+    put_u2(&buffer, 0);
+    put_u2(&buffer, 52);
+    put_u2(&buffer, 10 + FIELDS + METHODS);
+    put_utf8(&buffer, "bench/Generated");
+    put_u1(&buffer, 7);
+    put_u2(&buffer, 1);
+    put_utf8(&buffer, "java/lang/Object");
+    put_u1(&buffer, 7);
+    put_u2(&buffer, 3);
+    put_utf8(&buffer, "Code");
+    put_utf8(&buffer, "I");
+    put_utf8(&buffer, "()V");
+    put_utf8(&buffer, "ConstantValue");
+    put_u1(&buffer, 3); // CONSTANT_Integer
+    put_u4(&buffer, 7);
+    char name[32];
+    for (int i = 0; i < FIELDS; i++) {
+        snprintf(name, sizeof(name), "field%d", i);
+        put_utf8(&buffer, name);
+    }
+    for (int i = 0; i < METHODS; i++) {
+        snprintf(name, sizeof(name), "method%d", i);
+        put_utf8(&buffer, name);
+    }
+
+    put_u2(&buffer, 0x0021); // public super
+    put_u2(&buffer, 2);
+    put_u2(&buffer, 4);
+    put_u2(&buffer, 0); // interfaces
+    put_u2(&buffer, FIELDS);
+    for (int i = 0; i < FIELDS; i++) {
+        put_u2(&buffer, 0x0019); // public static final
+        put_u2(&buffer, (uint16_t)(10 + i));
+        put_u2(&buffer, 6);
+        put_u2(&buffer, 1);
+        put_u2(&buffer, 8);
+        put_u4(&buffer, 2);
+        put_u2(&buffer, 9);
+    }
+    put_u2(&buffer, METHODS);
+    for (int i = 0; i < METHODS; i++) {
+        put_u2(&buffer, 0x0009); // public static
+        put_u2(&buffer, (uint16_t)(10 + FIELDS + i));
+        put_u2(&buffer, 7);
+        put_u2(&buffer, 1);
+        put_u2(&buffer, 5);
+        put_u4(&buffer, 13);
+        put_u2(&buffer, 0);  // max_stack
+        put_u2(&buffer, 0);  // max_locals
+        put_u4(&buffer, 1);
+        put_u1(&buffer, 0xB1); // return
+        put_u2(&buffer, 0);  // exception table
+        put_u2(&buffer, 0);  // attributes
+    }
+    put_u2(&buffer, 0); // class attributes
+    return buffer;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Parses every copy (parse_class_file takes over the bytes it is given, so
+// each class needs its own) and writes the seconds and the RSS growth to
+// the pipe
+static void run(const Buffer *class_bytes, bool use_arena, int result) {
+    uint8_t **copies = malloc(sizeof(uint8_t *) * CLASSES);
+    ClassFile *class_files = malloc(sizeof(ClassFile) * CLASSES);
+    for (int i = 0; i < CLASSES; i++) {
+        copies[i] = malloc(class_bytes->length);
+        memcpy(copies[i], class_bytes->bytes, class_bytes->length);
+    }
+    Arena arena = { NULL, 0 };
+
+    size_t before = resident_bytes();
+    double start = now_seconds();
+    for (int i = 0; i < CLASSES; i++) {
+        if (!parse_class_file(&class_files[i], copies[i], (long)class_bytes->length,
+                              use_arena ? &arena : NULL)) {
+            exit(1);
+        }
+    }
+    double seconds = now_seconds() - start;
+    size_t grown = resident_bytes() - before;
+
+    double report[2] = { seconds, (double)grown };
+    if (write(result, report, sizeof(report)) != sizeof(report)) {
+        exit(1);
+    }
+}
+
+int main(void) {
+    Buffer class_bytes = build_class();
+    printf("%d classes of %zu bytes, %d fields and %d methods each\n",
+           CLASSES, class_bytes.length, FIELDS, METHODS);
+    printf("%-8s %10s %14s\n", "metadata", "seconds", "RSS growth");
+    for (int mode = 0; mode < 2; mode++) {
+        bool use_arena = mode == 1;
+        int result[2];
+        if (pipe(result) != 0) {
+            return 1;
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            close(result[0]);
+            run(&class_bytes, use_arena, result[1]);
+            _exit(0);
+        }
+        close(result[1]);
+        double report[2];
+        bool received = read(result[0], report, sizeof(report)) == sizeof(report);
+        close(result[0]);
+        waitpid(child, NULL, 0);
+        if (!received) {
+            fprintf(stderr, "Benchmark run failed\n");
+            return 1;
+        }
+        printf("%-8s %10.3f %13.0fK\n", use_arena ? "arena" : "malloc", report[0], report[1] / 1024);
+    }
+    return 0;
+}
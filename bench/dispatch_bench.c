@@ -0,0 +1,121 @@
+// Dispatch benchmark: decodes synthetic int loops with predecode_method, runs
+// them through execute_bytecode and reports the time per executed instruction
+// for each opcode mix: interpreted on the checked handlers, interpreted on
+// the verified (unchecked) ones and, where supported, JIT compiled. Every
+// run prints its final locals; tests/jit_test.sh runs the same mixes from
+// tests/jit/Loops.class and diffs JIT against interpreter results.
+//
+//   make bench
+//   ./bin/dispatch_bench          (threaded dispatch)
+//   ./bin/dispatch_bench_table    (function-table fallback)
+#define _POSIX_C_SOURCE 199309L
+#include "jvm.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS_HI 1000
+#define ITERATIONS_LO 10000 // loop runs ITERATIONS_HI * ITERATIONS_LO times
+
+typedef struct {
+    const char *name;
+    uint8_t body[64];      // loop body, local_1 is the counter and local_3 the limit
+    uint32_t body_length;
+    uint32_t body_insns;   // instructions executed per iteration, excluding loop control
+} OpcodeMix;
+
+static const OpcodeMix mixes[] = {
+    { "arith (iadd/isub/imul)",
+      { ILOAD_2, ILOAD_1, IADD, ILOAD_1, ISUB, ICONST_3, IMUL, ISTORE_2 }, 8, 8 },
+    { "div/rem",
+      { ILOAD_1, ICONST_5, IDIV, ILOAD_1, BIPUSH, 7, IREM, IADD, ISTORE_2 }, 9, 8 },
+    { "locals (iload/istore)",
+      { ILOAD_1, ISTORE_2, ILOAD_2, ISTORE, 4, ILOAD, 4, ISTORE_2 }, 8, 6 },
+    { "bitwise (iand/ior/ishl)",
+      { ILOAD_2, ILOAD_1, IXOR, ICONST_1, ISHL, ILOAD_1, IAND, ICONST_2, IOR, ISTORE_2 }, 10, 10 },
+    { "branchy (if/goto)",
+      { ILOAD_1, ICONST_1, IAND, IFEQ, 0, 6, IINC, 2, 1 }, 9, 4 },
+};
+
+static uint32_t build_loop(const OpcodeMix *mix, uint8_t *code) {
+    uint32_t n = 0;
+    // local_3 = ITERATIONS_HI * ITERATIONS_LO; local_1 = 0; local_2 = 0
+    code[n++] = SIPUSH; code[n++] = ITERATIONS_HI >> 8; code[n++] = ITERATIONS_HI & 0xFF;
+    code[n++] = SIPUSH; code[n++] = ITERATIONS_LO >> 8; code[n++] = ITERATIONS_LO & 0xFF;
+    code[n++] = IMUL;
+    code[n++] = ISTORE_3;
+    code[n++] = ICONST_0; code[n++] = ISTORE_1;
+    code[n++] = ICONST_0; code[n++] = ISTORE_2;
+
+    uint32_t loop_start = n;
+    memcpy(code + n, mix->body, mix->body_length);
+    n += mix->body_length;
+
+    // iinc 1 1; iload_1; iload_3; if_icmplt loop_start
+    code[n++] = IINC; code[n++] = 1; code[n++] = 1;
+    code[n++] = ILOAD_1;
+    code[n++] = ILOAD_3;
+    int16_t offset = (int16_t)(loop_start - n);
+    code[n++] = IF_ICMPLT; code[n++] = (uint8_t)(offset >> 8); code[n++] = (uint8_t)offset;
+    code[n++] = RETURN;
+    return n;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    JVM jvm;
+    jvm_init(&jvm);
+
+    uint8_t code[128];
+    enum { CHECKED, VERIFIED, JIT };
+    double results[sizeof(mixes) / sizeof(mixes[0])][3];
+    int modes = jit_supported() ? 3 : 2;
+
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        for (int mode = 0; mode < modes; mode++) {
+            Method method = {0};
+            method.name = mixes[i].name;
+            method.descriptor = "()V";
+            method.access_flags = 0x0008; // static
+            method.max_stack = 4;
+            method.max_locals = 5;
+            method.bytecode = code;
+            method.code_length = build_loop(&mixes[i], code);
+            if (!predecode_method(&method)) {
+                return 1;
+            }
+            if (!method.verified) {
+                fprintf(stderr, "%s did not verify\n", method.name);
+                return 1;
+            }
+            method.verified = mode != CHECKED;
+
+            // Compile on the first call
+            jvm.jit_enabled = mode == JIT;
+            jvm.jit_threshold = 1;
+
+            double start = now_seconds();
+            execute_bytecode(&jvm, &method);
+            results[i][mode] = now_seconds() - start;
+            free(method.code);
+        }
+    }
+
+    printf("\n%-26s %10s %16s %12s %12s\n", "opcode mix", "seconds",
+           "checked ns/insn", "ns/insn", "jit ns/insn");
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        double insns = (double)ITERATIONS_HI * ITERATIONS_LO * (mixes[i].body_insns + 4);
+        printf("%-26s %10.3f %16.2f %12.2f", mixes[i].name, results[i][VERIFIED],
+               results[i][CHECKED] * 1e9 / insns, results[i][VERIFIED] * 1e9 / insns);
+        if (modes == 3) {
+            printf(" %12.2f", results[i][JIT] * 1e9 / insns);
+        }
+        printf("\n");
+    }
+    return 0;
+}
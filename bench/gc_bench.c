@@ -0,0 +1,108 @@
+// Full collection benchmark: builds a large graph of small arrays in the old
+// generation, drops half of it and times collect_full (marking the live half,
+// compacting it over the dead one) with 1, 2, 4 and 8 GC threads. Every run
+// prints the old generation it leaves, which must match.
+//
+//   make bench
+//   ./bin/gc_bench
+#define _POSIX_C_SOURCE 199309L
+#include "jvm.h"
+#include <stdio.h>
+#include <time.h>
+
+#define HEAP_BYTES (384u * 1024 * 1024)
+#define TREES 512
+#define TREE_DEPTH 10      // 2047 nodes per tree
+#define NODE_DATA 6        // ints hanging off each node
+
+static const uint32_t thread_counts[] = { 1, 2, 4, 8 };
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int32_t new_reference_array(JVM *jvm, int32_t length) {
+    Array *array = heap_allocate(jvm, sizeof(Array) + sizeof(int32_t) * length, HEAP_ARRAY);
+    array->length = length;
+    array->type = ARRAY_TYPE_REFERENCE;
+    array->element_shift = 2;
+    return make_reference(jvm, array);
+}
+
+static void store(JVM *jvm, int32_t array, int32_t index, int32_t value) {
+    int32_t *slot = (int32_t *)ARRAY_ELEMENTS(dereference(jvm, array)) + index;
+    *slot = value;
+    card_mark(jvm, slot);
+}
+
+// A node is an Object[3]: left child, right child and an int[NODE_DATA]
+static int32_t build_tree(JVM *jvm, int depth) {
+    int32_t children[3] = { 0, 0, 0 };
+    LocalRoot roots[3];
+    for (int i = 0; i < 3; i++) {
+        roots[i] = (LocalRoot){ &children[i], jvm->local_roots };
+        jvm->local_roots = &roots[i];
+    }
+    if (depth > 0) {
+        children[0] = build_tree(jvm, depth - 1);
+        children[1] = build_tree(jvm, depth - 1);
+    }
+    Array *data = heap_allocate(jvm, sizeof(Array) + sizeof(int32_t) * NODE_DATA, HEAP_ARRAY);
+    data->length = NODE_DATA;
+    data->type = ARRAY_TYPE_INT;
+    data->element_shift = 2;
+    children[2] = make_reference(jvm, data);
+
+    int32_t node = new_reference_array(jvm, 3);
+    for (int i = 0; i < 3; i++) {
+        store(jvm, node, i, children[i]);
+    }
+    jvm->local_roots = roots[0].next;
+    return node;
+}
+
+int main(void) {
+    VMOptions options;
+    vm_options_default(&options);
+    options.initial_heap = HEAP_BYTES;
+    options.max_heap = HEAP_BYTES;
+    JVM jvm;
+    jvm_init_with_options(&jvm, &options);
+
+    int32_t forest = 0;
+    LocalRoot root = { &forest, jvm.local_roots };
+    jvm.local_roots = &root;
+    forest = new_reference_array(&jvm, TREES);
+
+    printf("%-8s %10s %8s %12s\n", "threads", "seconds", "speedup", "old after");
+    double serial = 0;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        // Fresh trees, aged into the old generation by minor collections,
+        // then every other one dropped
+        jvm.gc_threads = 1;
+        for (int32_t i = 0; i < TREES; i++) {
+            int32_t tree = build_tree(&jvm, TREE_DEPTH);
+            store(&jvm, forest, i, tree);
+        }
+        for (int i = 0; i < 5; i++) {
+            collect_garbage(&jvm);
+        }
+        for (int32_t i = 1; i < TREES; i += 2) {
+            store(&jvm, forest, i, 0);
+        }
+
+        jvm.gc_threads = thread_counts[t];
+        double start = now_seconds();
+        collect_full(&jvm);
+        double seconds = now_seconds() - start;
+        if (t == 0) {
+            serial = seconds;
+        }
+        printf("%-8u %10.3f %8.2f %11zuK\n", thread_counts[t], seconds, serial / seconds,
+               jvm.heap.heap_top / 1024);
+    }
+    jvm.local_roots = root.next;
+    return 0;
+}
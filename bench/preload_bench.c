@@ -0,0 +1,182 @@
+// Class preloading benchmark: writes CLASSES synthetic class files into a
+// temporary classpath directory and times class_preload parsing all of them
+// with 1, 2, 4 and 8 threads. Every run prints how many classes it
+// preloaded, which must match. The files are read once before timing, so
+// every run finds them in the page cache.
+//
+//   make bench
+//   ./bin/preload_bench
+#define _DEFAULT_SOURCE
+#include "jvm.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLASSES 5000
+#define METHODS 40         // each with a Code attribute
+
+static const uint32_t thread_counts[] = { 1, 2, 4, 8 };
+
+typedef struct {
+    uint8_t bytes[16 * 1024];
+    size_t length;
+} Buffer;
+
+static void put_u1(Buffer *buffer, uint8_t value) {
+    buffer->bytes[buffer->length++] = value;
+}
+
+static void put_u2(Buffer *buffer, uint16_t value) {
+    put_u1(buffer, (uint8_t)(value >> 8));
+    put_u1(buffer, (uint8_t)value);
+}
+
+static void put_u4(Buffer *buffer, uint32_t value) {
+    put_u2(buffer, (uint16_t)(value >> 16));
+    put_u2(buffer, (uint16_t)value);
+}
+
+static void put_utf8(Buffer *buffer, const char *text) {
+    put_u1(buffer, 1); // CONSTANT_Utf8
+    put_u2(buffer, (uint16_t)strlen(text));
+    memcpy(buffer->bytes + buffer->length, text, strlen(text));
+    buffer->length += strlen(text);
+}
+
+// Constant pool: 1 this class name, 2 its Class, 3 java/lang/Object, 4 its
+// Class, 5 "Code", 6 "()V", then the method names
+static void build_class(Buffer *buffer, const char *name) {
+    buffer->length = 0;
+    put_u4(buffer, 0xCAFEBABE);
+    put_u2(buffer, 0);
+    put_u2(buffer, 52);
+    put_u2(buffer, 7 + METHODS);
+    put_utf8(buffer, name);
+    put_u1(buffer, 7);
+    put_u2(buffer, 1);
+    put_utf8(buffer, "java/lang/Object");
+    put_u1(buffer, 7);
+    put_u2(buffer, 3);
+    put_utf8(buffer, "Code");
+    put_utf8(buffer, "()V");
+    char method[32];
+    for (int i = 0; i < METHODS; i++) {
+        snprintf(method, sizeof(method), "method%d", i);
+        put_utf8(buffer, method);
+    }
+
+    put_u2(buffer, 0x0021); // public super
+    put_u2(buffer, 2);
+    put_u2(buffer, 4);
+    put_u2(buffer, 0); // interfaces
+    put_u2(buffer, 0); // fields
+    put_u2(buffer, METHODS);
+    for (int i = 0; i < METHODS; i++) {
+        put_u2(buffer, 0x0009); // public static
+        put_u2(buffer, (uint16_t)(7 + i));
+        put_u2(buffer, 6);
+        put_u2(buffer, 1);
+        put_u2(buffer, 5);
+        put_u4(buffer, 13);
+        put_u2(buffer, 0);  // max_stack
+        put_u2(buffer, 0);  // max_locals
+        put_u4(buffer, 1);
+        put_u1(buffer, 0xB1); // return
+        put_u2(buffer, 0);  // exception table
+        put_u2(buffer, 0);  // attributes
+    }
+    put_u2(buffer, 0); // class attributes
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool write_classes(const char *directory) {
+    static Buffer buffer;
+    char path[512], name[64];
+    snprintf(path, sizeof(path), "%s/bench", directory);
+    if (mkdir(path, 0700) != 0) {
+        return false;
+    }
+    for (int i = 0; i < CLASSES; i++) {
+        snprintf(name, sizeof(name), "bench/Generated%05d", i);
+        build_class(&buffer, name);
+        snprintf(path, sizeof(path), "%s/%s.class", directory, name);
+        FILE *file = fopen(path, "wb");
+        if (file == NULL || fwrite(buffer.bytes, 1, buffer.length, file) != buffer.length) {
+            return false;
+        }
+        fclose(file);
+    }
+    return true;
+}
+
+static void remove_classes(const char *directory) {
+    char path[512];
+    for (int i = 0; i < CLASSES; i++) {
+        snprintf(path, sizeof(path), "%s/bench/Generated%05d.class", directory, i);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/bench", directory);
+    rmdir(path);
+    rmdir(directory);
+}
+
+// Preloads the whole directory on threads threads; returns the seconds
+// taken and the classes preloaded in *count
+static double preload(const char *directory, uint32_t threads, uint32_t *count) {
+    // jvm_init announces itself on stdout
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+
+    VMOptions options;
+    vm_options_default(&options);
+    JVM jvm;
+    jvm_init_with_options(&jvm, &options);
+    jvm_set_class_path(&jvm, directory);
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null);
+
+    double start = now_seconds();
+    bool ok = class_preload(&jvm, NULL, threads);
+    double seconds = now_seconds() - start;
+
+    *count = ok ? jvm.preloaded.count : 0;
+    class_loader_release(&jvm);
+    return seconds;
+}
+
+int main(void) {
+    char directory[] = "/tmp/preload_benchXXXXXX";
+    if (mkdtemp(directory) == NULL || !write_classes(directory)) {
+        fprintf(stderr, "Cannot write the class files\n");
+        return 1;
+    }
+    printf("%d classes, %d methods each, %ld processors online\n",
+           CLASSES, METHODS, sysconf(_SC_NPROCESSORS_ONLN));
+
+    uint32_t count;
+    preload(directory, 1, &count); // warm the page cache
+    printf("%-8s %10s %8s %10s\n", "threads", "seconds", "speedup", "preloaded");
+    double serial = 0;
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        double seconds = preload(directory, thread_counts[t], &count);
+        if (t == 0) {
+            serial = seconds;
+        }
+        printf("%-8u %10.3f %8.2f %10u\n", thread_counts[t], seconds, serial / seconds, count);
+    }
+    remove_classes(directory);
+    return 0;
+}
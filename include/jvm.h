@@ -4,11 +4,40 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <setjmp.h>
+
+// Element types of arrays: the newarray atype codes, plus one of our own
+// for arrays of references (anewarray, multianewarray)
+#define ARRAY_TYPE_BOOLEAN   4
+#define ARRAY_TYPE_CHAR      5
+#define ARRAY_TYPE_FLOAT     6
+#define ARRAY_TYPE_DOUBLE    7
+#define ARRAY_TYPE_BYTE      8
+#define ARRAY_TYPE_SHORT     9
+#define ARRAY_TYPE_INT       10
+#define ARRAY_TYPE_LONG      11
+#define ARRAY_TYPE_REFERENCE 12
+
+// Bump allocator for class metadata (the ClassFile of every class and the
+// arrays hanging off it). Memory comes in chunks that are never freed one
+// by one: arena_release gives all of it back at once.
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;           // bytes of data
+    size_t used;
+    uint8_t data[];
+} ArenaChunk;
 
-#define ARRAY_TYPE_INT    10
-#define ARRAY_TYPE_LONG   11
-#define ARRAY_TYPE_FLOAT  6
-#define ARRAY_TYPE_DOUBLE 7
+typedef struct {
+    ArenaChunk *chunks;    // the one being filled first
+    size_t allocated;      // bytes handed out
+} Arena;
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+void *arena_allocate(Arena *arena, size_t size);
+void arena_adopt(Arena *arena, Arena *other);
+void arena_release(Arena *arena);
 
 typedef struct {
     uint8_t tag;
@@ -104,14 +133,248 @@ typedef struct {
     method_info *methods;
     uint16_t attributes_count;
     attribute_info *attributes;
+    // Bytes of the class file. Utf8 entries and attribute bodies point into
+    // them rather than holding copies (see parse_class_file). NULL once
+    // parsed if they belong to a JAR's mapping instead.
+    uint8_t *data;
+    size_t data_size;
+    bool data_mapped;     // mmap'ed rather than malloc'ed
 } ClassFile;
 
+// Pre-decoded instruction, built once per method at link time. Operands are
+// already in native byte order and width, branch operands hold the index of
+// the target instruction and short/wide forms are folded into one opcode.
+typedef struct {
+    uint8_t opcode;
+    uint8_t reserved;  // condition of SIPUSH_IF_ICMP
+    uint16_t aux;      // secondary small operand (e.g. newarray type); for
+                       // backward branches the loop number + 1
+    int32_t a;         // local index, constant, cp index or branch target
+    int32_t b;         // iinc delta, switch table length, multianewarray
+                       // shape (see array_shape)
+} Instruction;
+
+// Inline cache of one invokevirtual/invokeinterface call site. The site
+// starts out empty, caches its first receiver class (monomorphic), grows up
+// to INLINE_CACHE_SIZE classes (polymorphic) and then gives up and looks
+// the target up on every call (megamorphic). The instruction opcode tracks
+// the state, see the INVOKEVIRTUAL_* forms.
+#define INLINE_CACHE_SIZE 4
+
+typedef struct {
+    struct Class *classes[INLINE_CACHE_SIZE];
+    struct Method *targets[INLINE_CACHE_SIZE];
+    uint8_t count;
+    bool interface;        // invokeinterface site
+    uint16_t arg_slots;    // receiver included
+} CallSite;
+
+// Exception table entry, decoded at link time: the range and the handler
+// are instruction indexes in native byte order. The catch class is resolved
+// through the constant pool cache on the first throw that reaches it.
+typedef struct {
+    uint32_t start;        // first instruction covered
+    uint32_t end;          // first instruction past the range
+    uint32_t handler;
+    uint16_t catch_type;   // constant pool index, 0 catches everything
+} ExceptionHandler;
+
+typedef struct JVM JVM;
+typedef struct OperandStack OperandStack;
+struct Frame;
+
+// Entry point of a JIT compiled method; starts executing the frame at
+// instruction index pc
+typedef void (*compiled_method)(JVM *jvm, struct Frame *frame, uint32_t pc);
+
+// Built-in implementation of a library method; pops its own arguments
+typedef void (*native_method)(JVM *jvm, OperandStack *stack);
+
+typedef struct Method {
+    struct Class *class;
+    ClassFile *class_file;
+    method_info *info;
+    const char *name;
+    const char *descriptor;
+    uint16_t access_flags;
+    uint16_t max_stack;
+    uint16_t max_locals;
+    uint32_t code_length;
+    uint8_t *bytecode;             // raw Code attribute bytes
+    const uint8_t *exception_table; // raw Code attribute exception table
+    uint16_t exception_table_length;
+    ExceptionHandler *handlers;    // exception_table decoded, in table order
+    const uint8_t *stack_map;      // StackMapTable attribute body, if any
+    uint32_t stack_map_length;
+    bool verified;                 // runs on the unchecked handlers
+    uint8_t *reference_maps;       // verified methods: per instruction, a bit per
+                                   // local and stack slot holding a reference
+    uint32_t reference_map_stride; // bytes per instruction in reference_maps
+    Instruction *code;             // pre-decoded instruction stream
+    uint32_t instruction_count;
+    int32_t *switch_data;          // tableswitch/lookupswitch tables
+    CallSite *call_sites;          // one per invokevirtual/invokeinterface
+    uint16_t call_site_count;
+    uint16_t arg_slots;            // argument slots, including this
+    uint8_t return_slots;          // 0 for void, 2 for long/double
+    int32_t vtable_index;          // vtable slot (interface method table slot
+                                   // for interface methods), -1 if not virtual
+    uint32_t invocation_count;
+    uint32_t *loop_counters;       // taken backedges of each loop
+    uint16_t loop_count;
+    compiled_method jit_code;      // NULL while interpreted
+    void **jit_targets;            // native address of every instruction
+    bool jit_failed;               // do not try to compile again
+    native_method native;          // library methods, which have no code
+} Method;
+
+typedef struct {
+    field_info *info;
+    const char *name;
+    const char *descriptor;
+    uint16_t access_flags;
+    uint16_t slot;         // index into Class.static_values for static fields
+    uint32_t offset;       // byte offset in the instance for the others
+} Field;
+
+typedef enum {
+    RESOLVED_NONE = 0,
+    RESOLVED_STATIC_FIELD,
+    RESOLVED_INSTANCE_FIELD,
+    RESOLVED_METHOD,
+    RESOLVED_NATIVE,
+    RESOLVED_CLASS,
+    RESOLVED_CONSTANT,
+} ResolvedKind;
+
+// Constant pool cache entry, filled the first time a quickened instruction
+// refers to the constant pool index
+typedef struct {
+    uint8_t kind;
+    uint8_t slots;         // operand stack slots of a static field value
+    char field_type;       // first descriptor character of an instance field
+    union {
+        int32_t *static_value;
+        uint32_t field_offset;
+        struct Method *method;
+        native_method native;
+        struct Class *class;
+        int32_t constant;  // int, float bits or interned string reference
+        int64_t wide_constant; // long or double bits (ldc2_w)
+    };
+} ResolvedEntry;
+
+// Interface method table of a class: methods[i] implements
+// interface->vtable[i], or is NULL if the class leaves it abstract
+typedef struct {
+    struct Class *interface;
+    struct Method **methods;
+} Itable;
+
+// Runtime view of a loaded class, filled in by jvm_link_class
+typedef struct Class {
+    ClassFile *class_file;         // NULL for library placeholder classes
+    const char *name;
+    uint16_t access_flags;
+    struct Class *super;           // NULL only for java/lang/Object
+    struct Class **interfaces;     // direct superinterfaces
+    uint16_t interfaces_count;
+    Method *methods;
+    uint16_t methods_count;
+    Field *fields;
+    uint16_t fields_count;
+    int32_t *static_values;
+    uint16_t static_slots;
+    uint32_t id;               // index in JVM.classes, stored in instance headers
+    uint32_t instance_size;    // bytes of instance fields, inherited ones first
+    uint32_t *reference_offsets; // instance fields holding references
+    uint16_t reference_offsets_count;
+    ResolvedEntry *resolved;   // indexed by constant pool index
+    // Virtual methods, superclass slots first. For an interface this is its
+    // own method table, indexed by the itable slot of each method.
+    Method **vtable;
+    uint32_t vtable_length;
+    Itable *itables;           // every interface implemented, directly or not
+    uint16_t itables_count;
+} Class;
+
+// Managed heap. Every Java object, array and string is a block that starts
+// with a HeapHeader, so each space can be walked block by block. The heap is
+// split in two generations:
+//   [heap, heap + old_size)           old generation, filled up to heap_top
+//   [heap + old_size, heap_size)      nursery: eden, then two survivor spaces
+// New blocks are carved from eden (through TLABs); the ones that survive a
+// few minor collections are promoted to the old generation. Blocks too big
+// for a TLAB are allocated in the old generation directly.
+//
+// The whole heap is reserved as one range of address space up front, but
+// only the nursery and the first old_limit bytes of the old generation are
+// committed (usable). The old generation grows and shrinks within old_size
+// as full collections find it full or mostly empty.
 typedef struct {
     uint8_t *heap;
-    size_t heap_size;
-    size_t heap_top;
+    size_t heap_size;      // bytes reserved
+    size_t heap_top;       // end of the old generation's blocks
+    size_t old_size;       // reserved for the old generation
+    size_t old_limit;      // committed, old blocks go below it
+    size_t old_initial;    // old_limit never shrinks below this
+    size_t page_size;      // commit granularity
+    uint8_t *eden;
+    uint8_t *eden_top;     // TLABs are carved from [eden_top, eden_end)
+    uint8_t *eden_end;
+    uint8_t *eden_pinned;  // [eden, eden_pinned) may still hold blocks the
+                           // last minor collection pinned: TLABs go around
+    uint8_t *from;         // survivors of the last minor collection
+    uint8_t *from_top;
+    uint8_t *to;           // empty until the next minor collection, but for
+    uint8_t *to_start;     // [to, to_start): blocks pinned by the last one
+    size_t survivor_size;
+    uint8_t *cards;        // a byte per CARD_SIZE bytes of heap, see card_mark
+    uint32_t *card_starts; // old generation: offset of the block covering
+                           // the first byte of each card, in HEAP_ALIGNMENT
+                           // units
 } Heap;
 
+// Thread-local allocation buffer: a chunk of the heap that one thread
+// bump-allocates from with no synchronization. It is zeroed when it is
+// carved, so new blocks need no clearing.
+typedef struct {
+    uint8_t *top;
+    uint8_t *end;
+} Tlab;
+
+#define HEAP_ALIGNMENT 8
+#define TLAB_SIZE (32 * 1024)
+#define CACHE_LINE_SIZE 64
+#define CARD_SHIFT 9
+#define CARD_SIZE (1 << CARD_SHIFT)
+#define CARD_DIRTY 1
+
+enum {
+    HEAP_FILLER,  // unused space, e.g. the rest of a retired TLAB
+    HEAP_OBJECT,
+    HEAP_ARRAY,
+    HEAP_STRING,
+};
+
+typedef struct {
+    uint32_t size;        // bytes of the whole block, header included
+    uint8_t kind;         // HEAP_*
+    uint8_t gc_flags;     // used by the collector, clear outside of it
+    uint8_t age;          // minor collections survived
+    uint8_t pinned;       // never moved by the collector (interned strings)
+    int32_t forward;      // the block's reference after the collector moves it
+    uint32_t class_id;    // Class.id of an object; keeps the payload 8-byte aligned
+} HeapHeader;
+
+// The first block of the old generation is a filler of this size, so no
+// payload lies below offset 32 and references 1 to 3 are never objects:
+// the VM uses them as stand-ins for objects it does not model (System.out)
+#define OLD_GENERATION_START 16
+#define FIRST_REFERENCE ((OLD_GENERATION_START + sizeof(HeapHeader)) / HEAP_ALIGNMENT)
+
+// Per-thread Java stack: one contiguous array of slots holding every
+// frame's locals, header and operand stack (see frame_push)
 typedef struct {
     int32_t *stack;
     size_t stack_size;
@@ -124,21 +387,136 @@ typedef struct {
 } JVMState;
 
 
+// String on the heap. Interned constants point into the constant pool;
+// strings made by the VM keep their bytes right after this struct.
+typedef struct {
+    uint16_t length;
+    const uint8_t *bytes;  // modified UTF-8, not NUL terminated
+} JavaString;
+
+typedef struct {
+    int32_t *references;
+    int32_t count;
+    int32_t capacity;
+} StringTable;
+
+// Linked classes by name, for find_class: open addressing with linear
+// probing in a power-of-two table. Each slot keeps the hash of its class's
+// name, so a probe only compares names when the hashes match.
+typedef struct {
+    uint32_t hash;
+    Class *class;          // NULL for a free slot
+} ClassRegistrySlot;
+
+typedef struct {
+    ClassRegistrySlot *slots;
+    uint32_t capacity;     // 0 until the first class is registered
+    uint32_t count;
+} ClassRegistry;
+
+// A class file parsed ahead of its first use by class_preload, waiting to
+// be taken (and linked) by find_class
+typedef struct {
+    uint32_t hash;
+    const char *name;      // internal name it was found under on the classpath
+    ClassFile *class_file; // NULL once taken
+} PreloadedClass;
+
+// Preloaded classes by name. The workers publish into a table sized up front
+// (at most half full) by compare-and-swap on the slot; it is only read once
+// they are done.
+typedef struct {
+    PreloadedClass **slots;
+    uint32_t capacity;     // power of two, 0 without a preload
+    uint32_t count;
+} PreloadTable;
+
+// An entry of a JAR (ZIP) archive's central directory. The name points into
+// the mapped archive and is not NUL-terminated.
+typedef struct {
+    const char *name;
+    uint16_t name_length;
+    uint16_t flags;
+    uint16_t method;       // 0 stored, 8 deflated
+    uint32_t crc;
+    uint32_t compressed_size;
+    uint32_t size;
+    uint32_t local_offset; // of the entry's local header
+} JarEntry;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t entry;        // index in entries + 1, 0 for a free slot
+} JarIndexSlot;
+
+// A JAR on the classpath: the archive mapped once, with its central directory
+// indexed by entry name (open addressing, linear probing, at most half full)
 typedef struct {
+    uint8_t *data;
+    size_t size;
+    JarEntry *entries;
+    uint32_t entry_count;
+    JarIndexSlot *index;
+    uint32_t index_capacity; // power of two
+} JarFile;
+
+// A classpath element: a directory, or a .jar/.zip archive
+typedef struct {
+    char *directory;       // NULL for an archive
+    JarFile *jar;
+} ClassPathEntry;
+
+// A reference held in a C variable across an allocation, which may collect
+// garbage. Lives on the C stack; JVM.local_roots lists the active ones.
+typedef struct LocalRoot {
+    int32_t *slot;
+    struct LocalRoot *next;
+} LocalRoot;
+
+struct JVM {
     JVMStack jvm_stack;
     Heap heap;
+    Tlab tlab;
     ClassFile class_file; // Add this field to store the parsed class file
+    Class *main_class;    // class_file after linking
+    struct Frame *current_frame;
+    struct CatchPoint *catch_points;
+    StringTable strings;
+    LocalRoot *local_roots;
+    bool verbose_gc;      // report every collection on stderr
+    uint32_t gc_count;
+    uint32_t gc_threads;  // threads marking and compacting in a full collection
+    struct GcWorkers *gc_workers; // their pool, started by the first one
+
+    Class **classes;      // every linked class, in load order
+    int32_t classes_count;
+    int32_t classes_capacity;
+    ClassRegistry class_registry; // the same classes, by name
+    ClassPathEntry *class_path; // where classes are loaded from, in order
+    uint32_t class_path_count;
+    PreloadTable preloaded; // parsed by class_preload, not linked yet
+    Arena metadata;       // the parsed class files, freed by class_loader_release
+    bool jit_enabled;
+    uint32_t jit_threshold; // invocations before a method is compiled
+    uint32_t osr_threshold; // backedges of one loop before it moves to compiled code
     // Add other JVM state and data structures here
-} JVM;
+};
 
 
 typedef enum {
 
     GETSTATIC = 0xB2,
+    PUTSTATIC = 0xB3,
+    GETFIELD = 0xB4,
+    PUTFIELD = 0xB5,
     INVOKEVIRTUAL = 0xB6,
+    INVOKESPECIAL = 0xB7,
+    INVOKESTATIC = 0xB8,
+    INVOKEINTERFACE = 0xB9,
 
     LDC = 0x12,
     LDC_W = 0x13,
+    LDC2_W = 0x14,
 
    // Constants
     NOP = 0x00,
@@ -164,7 +542,6 @@ typedef enum {
     
     // Loads
     ILOAD = 0X15,
-    // TODO: test
     ILOAD_0 = 0x1A,
     ILOAD_1 = 0x1B,
     ILOAD_2 = 0x1C,
@@ -172,7 +549,7 @@ typedef enum {
 
     LLOAD = 0x16,
     FLOAD = 0x17,
-    // todo: test
+    ALOAD = 0x19,
     DLOAD = 0x18,
     DLOAD_0 = 0x26,
     DLOAD_1 = 0x27,
@@ -182,7 +559,6 @@ typedef enum {
 
     // Stores
     ISTORE = 0x36,
-    // TODO: test
     ISTORE_0 = 0x3B,
     ISTORE_1 = 0x3C,
     ISTORE_2 = 0x3D,
@@ -190,8 +566,8 @@ typedef enum {
 
     LSTORE = 0x37,
     FSTORE = 0x38,
+    ASTORE = 0x3A,
 
-// TODO: implement, prepare for 64 bits manipulation
     DSTORE = 0x39,
     DSTORE_0 = 0x47,
     DSTORE_1 = 0x48,
@@ -201,30 +577,177 @@ typedef enum {
     
     // Stack
     POP = 0x57,
+    POP2 = 0x58,
     DUP = 0x59,
+    DUP_X1 = 0x5A,
+    DUP_X2 = 0x5B,
+    DUP2 = 0x5C,
+    DUP2_X1 = 0x5D,
+    DUP2_X2 = 0x5E,
+    SWAP = 0x5F,
     
     // Math operations
     IADD = 0x60,
     ISUB = 0x64,
     IMUL = 0x68,
     IDIV = 0x6C,
+    IREM = 0x70,
+    INEG = 0x74,
+    ISHL = 0x78,
+    ISHR = 0x7A,
+    IUSHR = 0x7C,
+    IAND = 0x7E,
     IOR = 0x80,
+    IXOR = 0x82,
+    IINC = 0x84,
+
+    LADD = 0x61,
+    LSUB = 0x65,
+    LMUL = 0x69,
+    LDIV = 0x6D,
+    LREM = 0x71,
+    LNEG = 0x75,
+    LSHL = 0x79,
+    LSHR = 0x7B,
+    LUSHR = 0x7D,
+    LAND = 0x7F,
+    LOR = 0x81,
+    LXOR = 0x83,
+
+    FADD = 0x62,
+    FSUB = 0x66,
+    FMUL = 0x6A,
+    FDIV = 0x6E,
+    FREM = 0x72,
+    FNEG = 0x76,
 
     DADD = 0x63,
+    DSUB = 0x67,
+    DMUL = 0x6B,
+    DDIV = 0x6F,
+    DREM = 0x73,
+    DNEG = 0x77,
+
+    // Conversions
+    I2L = 0x85,
+    I2F = 0x86,
+    I2D = 0x87,
+    L2I = 0x88,
+    L2F = 0x89,
+    L2D = 0x8A,
+    F2I = 0x8B,
+    F2L = 0x8C,
+    F2D = 0x8D,
+    D2I = 0x8E,
+    D2L = 0x8F,
+    D2F = 0x90,
+    I2B = 0x91,
+    I2C = 0x92,
+    I2S = 0x93,
+
+    // Comparisons
+    LCMP = 0x94,
+    FCMPL = 0x95,
+    FCMPG = 0x96,
+    DCMPL = 0x97,
+    DCMPG = 0x98,
     
+    // Control flow
+    IFEQ = 0x99,
+    IFNE = 0x9A,
+    IFLT = 0x9B,
+    IFGE = 0x9C,
+    IFGT = 0x9D,
+    IFLE = 0x9E,
+    IF_ICMPEQ = 0x9F,
+    IF_ICMPNE = 0xA0,
+    IF_ICMPLT = 0xA1,
+    IF_ICMPGE = 0xA2,
+    IF_ICMPGT = 0xA3,
+    IF_ICMPLE = 0xA4,
+    GOTO = 0xA7,
+    TABLESWITCH = 0xAA,
+    LOOKUPSWITCH = 0xAB,
+    WIDE = 0xC4,
+    GOTO_W = 0xC8,
+
     NEW = 0xBB,
     NEWARRAY = 0xBC,
+    ANEWARRAY = 0xBD,
+    ARRAYLENGTH = 0xBE,
+    MULTIANEWARRAY = 0xC5,
+    IALOAD = 0x2E,
+    LALOAD = 0x2F,
+    FALOAD = 0x30,
+    DALOAD = 0x31,
+    AALOAD = 0x32,
+    BALOAD = 0x33,
+    CALOAD = 0x34,
+    SALOAD = 0x35,
     IASTORE = 0x4F,
+    LASTORE = 0x50,
+    FASTORE = 0x51,
+    DASTORE = 0x52,
+    AASTORE = 0x53,
+    BASTORE = 0x54,
+    CASTORE = 0x55,
+    SASTORE = 0x56,
+    ATHROW = 0xBF,
 
     // Method invocation
     INVOKEDYNAMIC = 0xBA,
 
     // Return
-    IRETURN = 0xB1,
+    IRETURN = 0xAC,
+    LRETURN = 0xAD,
+    FRETURN = 0xAE,
+    DRETURN = 0xAF,
+    ARETURN = 0xB0,
+    RETURN = 0xB1,
+
+    // Internal quickened forms, only ever found in the decoded instruction
+    // stream (0xCB-0xFD are unused by the class file format). Their operand
+    // indexes Class.resolved.
+    GETSTATIC_QUICK = 0xCB,
+    PUTSTATIC_QUICK = 0xCC,
+    INVOKEVIRTUAL_QUICK = 0xCD,
+    NEW_QUICK = 0xCE,
+    LDC_QUICK = 0xCF,
+    LDC2_W_QUICK = 0xDD,
+
+    // Superinstructions fused by predecode_method (see fuse_superinstructions)
+    ILOAD_ILOAD_IADD_ISTORE = 0xD0,  // a, b: loaded locals, aux: stored local
+    SIPUSH_IF_ICMP = 0xD1,           // a: target, b: constant, reserved: condition
+    ALOAD_ILOAD_IALOAD = 0xD2,       // a: array local, b: index local
+
+    // Resolved invocations. a is the cp index of the Methodref, b the call
+    // site index for the virtual forms.
+    INVOKE_DIRECT_QUICK = 0xD8,      // invokestatic, invokespecial, final targets
+    INVOKE_NATIVE_QUICK = 0xD9,
+    INVOKEVIRTUAL_MONO = 0xDA,
+    INVOKEVIRTUAL_POLY = 0xDB,
+    INVOKEVIRTUAL_MEGA = 0xDC,
+
+    // Resolved field accesses, one per width of the field; b is its offset
+    // in the object
+    GETFIELD_QUICK = 0xDE,           // int, float and references
+    GETFIELD_LONG_QUICK = 0xDF,      // long and double
+    GETFIELD_BYTE_QUICK = 0xE0,      // byte and boolean
+    GETFIELD_CHAR_QUICK = 0xE1,
+    GETFIELD_SHORT_QUICK = 0xE2,
+    PUTFIELD_QUICK = 0xE3,           // int and float
+    PUTFIELD_REFERENCE_QUICK = 0xE4, // with the write barrier
+    PUTFIELD_LONG_QUICK = 0xE5,
+    PUTFIELD_BYTE_QUICK = 0xE6,
+    PUTFIELD_BOOLEAN_QUICK = 0xE7,
+    PUTFIELD_CHAR_QUICK = 0xE8,      // char and short
 
 } Bytecode;
 
-// unions for bytecode operands
+// Category 2 (long/double) value. On the operand stack and in locals it
+// takes two adjacent slots holding its native 8-byte representation, so it
+// is read and written with a single 64-bit access; see load_long in
+// interpreter.c.
 typedef union {
     struct{
         uint32_t low;
@@ -236,14 +759,79 @@ typedef union {
     double    double_;
 } Cat2;
 
-typedef struct {
+struct OperandStack {
     int32_t *values;
     int size;
     int capacity;
-} OperandStack;
+};
+
+typedef struct Frame {
+    struct Frame *caller;
+    Method *method;
+    int32_t *locals;
+    OperandStack stack;    // values point into JVM.jvm_stack, right after this header
+    uint32_t pc;           // instruction of the pending call or allocation; where
+                           // the frame resumes after a throw lands in it
+    size_t saved_top;      // jvm_stack.stack_top of the caller
+} Frame;
+
+// Where an exception thrown further down the call chain lands in a frame
+// whose method has handlers. Lives on the C stack of run_catching_frame;
+// JVM.catch_points lists the active ones, innermost first.
+typedef struct CatchPoint {
+    jmp_buf buffer;
+    Frame *frame;
+    struct CatchPoint *outer;
+} CatchPoint;
+
+// Array object. The elements follow the 8-byte header in the same block,
+// each in the natural width of its type: 1 byte for boolean and byte, 2 for
+// char and short, 4 for int, float and references, 8 for long and double.
+typedef struct {
+    int32_t length;
+    uint8_t type;          // ARRAY_TYPE_*
+    uint8_t element_shift; // log2 of the element size
+    uint16_t reserved;
+} Array;
+
+#define ARRAY_ELEMENTS(array) ((void *)((Array *)(array) + 1))
+
+// Instance of a class: the payload of a HEAP_OBJECT block is just its
+// Class.instance_size bytes of fields, at the offsets link_fields assigned.
+// The class is found through the class_id of the block header.
+// java/lang/Throwable keeps its detail message (a string reference) at
+// offset THROWABLE_MESSAGE.
+typedef struct Object Object;
+
+#define THROWABLE_MESSAGE 0
+
+#define OBJECT_FIELD(object, type, offset) ((type *)((uint8_t *)(object) + (offset)))
+
+// Sizes the VM is started with (-Xms, -Xmx and -Xss)
+typedef struct {
+    size_t initial_heap;   // bytes committed at start
+    size_t max_heap;       // bytes reserved
+    size_t stack_size;     // bytes of Java stack
+    bool huge_pages;       // back the heap with transparent huge pages
+} VMOptions;
+
+#define DEFAULT_INITIAL_HEAP (4 * 1024 * 1024)
+#define DEFAULT_MAX_HEAP (64 * 1024 * 1024)
+#define DEFAULT_STACK_SIZE (1024 * 1024)
+
+void vm_options_default(VMOptions *options);
+void jvm_init_with_options(JVM *jvm, const VMOptions *options);
 
 void jvm_init(JVM *jvm);
-void jvm_load_class(JVM *jvm, const char *class_file);
+bool jvm_load_class(JVM *jvm, const char *class_file);
+bool jvm_set_class_path(JVM *jvm, const char *class_path);
+bool read_class_file(const char *path, ClassFile *class_file, Arena *arena);
+bool parse_class_file(ClassFile *out, uint8_t *buffer, long file_size, Arena *arena);
+bool read_class_from_class_path(JVM *jvm, const char *name, ClassFile *class_file, Arena *arena);
+void class_file_release(ClassFile *class_file);
+bool class_preload(JVM *jvm, const char *class_list, uint32_t threads);
+bool take_preloaded_class(JVM *jvm, const char *name, ClassFile *class_file);
+void class_loader_release(JVM *jvm);
 void jvm_execute(JVM *jvm);
 bool operand_stack_push(OperandStack *stack, int32_t value);
 bool operand_stack_pop(OperandStack *stack, int32_t *value);
@@ -251,13 +839,144 @@ void operand_stack_push_cat2(OperandStack *stack, Cat2 val);
 Cat2 operand_stack_pop_cat2(OperandStack *stack);
 void operand_stack_init(OperandStack *stack, int capacity);
 bool validate_constant_pool_index(ClassFile *class_file, uint16_t index);
+const char* get_constant_pool_string(ClassFile *class_file, uint16_t index);
 void print_stack_state(OperandStack *stack);
 
-typedef void (*instruction_handler)(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals);
+typedef void (*instruction_handler)(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals);
 
 void stack_push(JVMStack *stack, int32_t value);
 int32_t stack_pop(JVMStack *stack);
+Frame *frame_push(JVM *jvm, Method *method, OperandStack *caller_stack, uint16_t arg_slots);
+void frame_pop(JVM *jvm);
+
+void invoke_method(JVM *jvm, Method *method, OperandStack *stack);
+void execute_bytecode(JVM *jvm, Method *method);
+uint32_t interpret_instruction(JVM *jvm, Frame *frame, uint32_t pc);
+#ifdef JVM_PROFILE_SEQUENCES
+void print_sequence_profile(void);
+#endif
+
+Class *jvm_link_class(JVM *jvm, ClassFile *class_file);
+bool predecode_method(Method *method);
+bool verify_method(Method *method, const int32_t *index_of);
+Method *find_method(Class *class, const char *name, const char *descriptor);
+Class *find_class(JVM *jvm, const char *name);
+uint32_t name_hash(const char *name, size_t length);
+bool is_subclass_of(Class *class, Class *other);
+Method *lookup_virtual(Class *class, Method *declared);
+const char *opcode_name(uint8_t opcode);
+ResolvedEntry *resolve_static_field(JVM *jvm, Class *class, uint16_t index);
+ResolvedEntry *resolve_field(JVM *jvm, Class *class, uint16_t index);
+ResolvedEntry *resolve_method(JVM *jvm, Class *class, uint16_t index);
+ResolvedEntry *resolve_class(JVM *jvm, Class *class, uint16_t index);
+ResolvedEntry *resolve_constant(JVM *jvm, Class *class, uint16_t index);
+
+#define JIT_COMPILE_THRESHOLD 1000
+#define JIT_OSR_THRESHOLD 10000
+
+bool jit_supported(void);
+bool jit_compile(JVM *jvm, Method *method);
+
+JarFile *jar_open(const char *path);
+void jar_close(JarFile *jar);
+const JarEntry *jar_find(const JarFile *jar, const char *name);
+uint8_t *jar_read(JarFile *jar, const JarEntry *entry, bool *copied);
+
+native_method find_native_method(const char *class_name, const char *name, const char *descriptor);
+native_method find_native_virtual(const char *class_name, uint16_t index, const char **name, const char **descriptor);
+int32_t *find_native_static(const char *class_name, const char *name);
+
+void heap_init(Heap *heap, size_t initial, size_t max, bool huge_pages);
+bool heap_expand(Heap *heap, size_t bytes);
+void heap_resize_old(Heap *heap, size_t wanted_free);
+void heap_fill(uint8_t *start, uint8_t *end);
+void record_old_blocks(Heap *heap, size_t start, size_t end);
+void tlab_retire(JVM *jvm);
+void *heap_allocate_slow(JVM *jvm, size_t size, uint8_t kind);
+void *heap_allocate_aligned(JVM *jvm, size_t size, uint8_t kind, size_t line_offset);
+
+// Allocates a zeroed heap block of the given kind with a payload of size
+// bytes and returns the payload. The common case is a bump of the TLAB top;
+// heap_allocate_slow refills the TLAB or places large blocks directly.
+static inline void *heap_allocate(JVM *jvm, size_t size, uint8_t kind) {
+    size_t block = (sizeof(HeapHeader) + size + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+    uint8_t *top = jvm->tlab.top;
+    if ((size_t)(jvm->tlab.end - top) < block) {
+        return heap_allocate_slow(jvm, size, kind);
+    }
+    jvm->tlab.top = top + block;
+    HeapHeader *header = (HeapHeader *)top;
+    header->size = (uint32_t)block;
+    header->kind = kind;
+    return header + 1;
+}
+
+// Write barrier, run after a reference is stored into the heap slot at slot.
+// Dirtying its card lets a minor collection find references from the old
+// generation into the nursery by scanning only the dirty cards. The card
+// table covers the whole heap, so the barrier needs no test.
+static inline void card_mark(JVM *jvm, const void *slot) {
+    jvm->heap.cards[((uintptr_t)slot - (uintptr_t)jvm->heap.heap) >> CARD_SHIFT] = CARD_DIRTY;
+}
+
+// Object references are the int32 operand slots themselves: compressed
+// pointers holding the offset of the object (a block payload) from the heap
+// base in HEAP_ALIGNMENT units, so 32 bits reach a 32 GB heap. 0 is null.
+// Decoding is a shift and an add; the collector rewrites the slots of the
+// objects it moves.
+#define REFERENCE_SHIFT 3 // log2(HEAP_ALIGNMENT)
+
+static inline int32_t make_reference(JVM *jvm, void *object) {
+    if (object == NULL) {
+        return 0;
+    }
+    return (int32_t)(uint32_t)(((uint8_t *)object - jvm->heap.heap) >> REFERENCE_SHIFT);
+}
+
+static inline void *dereference(JVM *jvm, int32_t reference) {
+    if (reference == 0) {
+        return NULL;
+    }
+    return jvm->heap.heap + ((size_t)(uint32_t)reference << REFERENCE_SHIFT);
+}
+
+static inline Class *object_class(JVM *jvm, const Object *object) {
+    return jvm->classes[((const HeapHeader *)object - 1)->class_id];
+}
+
+void collect_garbage(JVM *jvm);
+void collect_full(JVM *jvm);
+
+// Chase-Lev work-stealing deque of pointers. The owning thread pushes and
+// pops at the bottom with no atomic read-modify-write in the common case;
+// other threads steal from the top. See gc_workers.c.
+typedef struct GcDequeArray {
+    int64_t capacity;              // a power of two
+    struct GcDequeArray *retired;  // the smaller array this one replaced
+    void *slots[];
+} GcDequeArray;
 
-void invoke_method(JVM *jvm, void *method_handle);
+typedef struct {
+    int64_t top;                   // next slot to steal
+    int64_t bottom;                // next slot to push
+    GcDequeArray *array;
+} GcDeque;
+
+void gc_deque_init(GcDeque *deque);
+void gc_deque_free(GcDeque *deque);
+void gc_deque_push(GcDeque *deque, void *item);
+void *gc_deque_pop(GcDeque *deque);
+void *gc_deque_steal(GcDeque *deque);
+bool gc_deque_empty(GcDeque *deque);
+
+// Runs task on jvm->gc_threads threads, the calling one being worker 0,
+// and returns once all of them are done
+typedef void (*GcTask)(void *context, uint32_t worker);
+void gc_run_parallel(JVM *jvm, GcTask task, void *context);
+// The same on any number of threads; the class preloader shares the pool
+void run_parallel(JVM *jvm, uint32_t threads, GcTask task, void *context);
+
+void *heap_allocate_pinned(JVM *jvm, size_t size, uint8_t kind);
+int32_t intern_string(JVM *jvm, const uint8_t *bytes, uint16_t length);
 
 #endif // JVM_H
\ No newline at end of file
@@ -1,7 +1,19 @@
+#define _DEFAULT_SOURCE
 #include "jvm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Saída de depuração do parse, ligada com -DJVM_TRACE (make TRACE=1)
+#ifdef JVM_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
 
 // Constant pool tags
 #define CONSTANT_Class              7
@@ -23,10 +35,35 @@
 #define ARRAY_TYPE_FLOAT  6
 #define ARRAY_TYPE_DOUBLE 7
 
-void jvm_load_class(JVM *jvm, const char *class_file);
-void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size);
+bool jvm_load_class(JVM *jvm, const char *class_file);
+
+// As entradas Utf8 são vistas do buffer do arquivo, sem cópia. O byte
+// seguinte a cada uma (a tag da próxima entrada, ou o início de
+// access_flags) já foi lido quando o parse termina, então ele pode virar o
+// '\0' que o resto da VM espera no fim da string.
+static bool terminate_utf8_entries(ClassFile *class_file, const uint8_t *end) {
+    for (int i = 0; i < class_file->constant_pool_count - 1; i++) {
+        cp_info *entry = &class_file->constant_pool[i];
+        if (entry->tag == CONSTANT_Long || entry->tag == CONSTANT_Double) {
+            i++; // a entrada seguinte não é usada
+        } else if (entry->tag == CONSTANT_Utf8) {
+            if (entry->info.Utf8.bytes + entry->info.Utf8.length >= end) {
+                return false;
+            }
+            entry->info.Utf8.bytes[entry->info.Utf8.length] = '\0';
+        }
+    }
+    return true;
+}
 
-void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
+// Os metadados vêm da arena do carregador de classes e são liberados todos
+// juntos por class_loader_release. Sem arena cada um é um malloc próprio,
+// como antes (o benchmark class_load_bench compara os dois).
+static void *metadata_allocate(Arena *arena, size_t size) {
+    return arena ? arena_allocate(arena, size) : malloc(size ? size : 1);
+}
+
+bool parse_class_file(ClassFile *out, uint8_t *buffer, long file_size, Arena *arena) {
     // Declaração de uma estrutura ClassFile para armazenar os dados do arquivo de classe
     ClassFile class_file;
     // Ponteiro para percorrer o buffer de bytes do arquivo de classe
@@ -36,29 +73,39 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
     class_file.magic = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
     ptr += 4;
 
-    printf("Magic number: 0x%08x\n", class_file.magic);
+    TRACE("Magic number: 0x%08x\n", class_file.magic);
     if (class_file.magic != 0xCAFEBABE) {
         fprintf(stderr, "Invalid class file magic number\n");
-        return;
+        return false;
     }
 
     // Lê a versão menor (2 bytes) do arquivo de classe
     class_file.minor_version = (ptr[0] << 8) | ptr[1];
     ptr += 2;
-    printf("Minor version: %d\n", class_file.minor_version);
+    TRACE("Minor version: %d\n", class_file.minor_version);
 
     // Lê a versão maior (2 bytes) do arquivo de classe
     class_file.major_version = (ptr[0] << 8) | ptr[1];
     ptr += 2;
-    printf("Major version: %d\n", class_file.major_version);
+    TRACE("Major version: %d\n", class_file.major_version);
 
     // Lê a contagem do pool de constantes (2 bytes)
     class_file.constant_pool_count = (ptr[0] << 8) | ptr[1];
-     printf("Constant pool count: %d\n", class_file.constant_pool_count);
+    TRACE("Constant pool count: %d\n", class_file.constant_pool_count);
     ptr += 2;
 
+    //check for reasonable constant pool count
+    if (class_file.constant_pool_count <= 0 || class_file.constant_pool_count > 65535) {
+        fprintf(stderr, "Invalid constant pool count: %d\n", class_file.constant_pool_count);
+        return false;
+    }
+
     // Aloca memória para o pool de constantes
-    class_file.constant_pool = (cp_info *)malloc(sizeof(cp_info) * (class_file.constant_pool_count - 1));
+    class_file.constant_pool = metadata_allocate(arena, sizeof(cp_info) * (class_file.constant_pool_count - 1));
+    if (class_file.constant_pool == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
     for (int i = 0; i < class_file.constant_pool_count - 1; i++) {
         // Lê o tag do pool de constantes
         class_file.constant_pool[i].tag = *ptr++;
@@ -72,22 +119,23 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
                 break;
 
             case CONSTANT_Utf8: {
+                // A string aponta para o próprio buffer; o '\0' é escrito
+                // no fim do parse (ver terminate_utf8_entries)
                 uint16_t length = (ptr[0] << 8) | ptr[1];
                 ptr += 2;
                 class_file.constant_pool[i].info.Utf8.length = length;
-                class_file.constant_pool[i].info.Utf8.bytes = malloc(length + 1);
-                memcpy(class_file.constant_pool[i].info.Utf8.bytes, ptr, length);
-                class_file.constant_pool[i].info.Utf8.bytes[length] = '\0';
+                class_file.constant_pool[i].info.Utf8.bytes = ptr;
                 ptr += length;
                 break;
             }
 
             case CONSTANT_Methodref:
+            case CONSTANT_InterfaceMethodref:
                 class_file.constant_pool[i].info.Methodref.class_index = (ptr[0] << 8) | ptr[1];
                 ptr += 2;
                 class_file.constant_pool[i].info.Methodref.name_and_type_index = (ptr[0] << 8) | ptr[1];
                 ptr += 2;
-                printf("Methodref: class_index=%d, name_and_type_index=%d\n", 
+                TRACE("Methodref: class_index=%d, name_and_type_index=%d\n",
                     class_file.constant_pool[i].info.Methodref.class_index,
                     class_file.constant_pool[i].info.Methodref.name_and_type_index);
                 break;
@@ -99,6 +147,15 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
                 break;
             }
 
+            case CONSTANT_Float: {
+                // Copia os bits IEEE 754 sem conversão numérica
+                uint32_t bits = ((uint32_t)ptr[0] << 24) | ((uint32_t)ptr[1] << 16) |
+                                ((uint32_t)ptr[2] << 8) | (uint32_t)ptr[3];
+                memcpy(&class_file.constant_pool[i].info.Float.bytes, &bits, sizeof(bits));
+                ptr += 4;
+                break;
+            }
+
             case CONSTANT_Fieldref:{
                 class_file.constant_pool[i].info.Fieldref.class_index = (ptr[0] << 8) | ptr[1];
                 ptr += 2;
@@ -126,7 +183,7 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
                 ptr += 2;
                 class_file.constant_pool[i].info.InvokeDynamic.name_and_type_index = (ptr[0] << 8) | ptr[1];
                 ptr += 2;
-                printf("InvokeDynamic: bootstrap_method_attr_index=%d, name_and_type_index=%d\n",
+                TRACE("InvokeDynamic: bootstrap_method_attr_index=%d, name_and_type_index=%d\n",
                     class_file.constant_pool[i].info.InvokeDynamic.bootstrap_method_attr_index,
                     class_file.constant_pool[i].info.InvokeDynamic.name_and_type_index);
                 break;
@@ -137,14 +194,23 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
                 ptr += 2;
                 break;
 
-            case CONSTANT_Double:
-                class_file.constant_pool[i].info.Double.bytes = ((uint64_t)ptr[0] << 56) | ((uint64_t)ptr[1] << 48) |
-                                                            ((uint64_t)ptr[2] << 40) | ((uint64_t)ptr[3] << 32) |
-                                                            ((uint64_t)ptr[4] << 24) | ((uint64_t)ptr[5] << 16) |
-                                                            ((uint64_t)ptr[6] << 8)  | (uint64_t)ptr[7];
+            case CONSTANT_MethodType:
+                class_file.constant_pool[i].info.MethodType.descriptor_index = (ptr[0] << 8) | ptr[1];
+                ptr += 2;
+                break;
+
+            case CONSTANT_Long:
+            case CONSTANT_Double: {
+                uint64_t bits = ((uint64_t)ptr[0] << 56) | ((uint64_t)ptr[1] << 48) |
+                                ((uint64_t)ptr[2] << 40) | ((uint64_t)ptr[3] << 32) |
+                                ((uint64_t)ptr[4] << 24) | ((uint64_t)ptr[5] << 16) |
+                                ((uint64_t)ptr[6] << 8)  | (uint64_t)ptr[7];
+                // Long e Double ocupam os mesmos 8 bytes; copia os bits crus
+                memcpy(&class_file.constant_pool[i].info.Long.bytes, &bits, sizeof(bits));
                 ptr += 8;
-                i++; // Skip next entry for doubles
+                i++; // Skip next entry for longs and doubles
                 break;
+            }
 
             default:
                 fprintf(stderr, "Unknown constant pool tag: %d\n", class_file.constant_pool[i].tag);
@@ -152,12 +218,6 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
         }
     }
 
-    //check for reasonable constant pool count
-    if (class_file.constant_pool_count <= 0 || class_file.constant_pool_count > 65535) {
-        fprintf(stderr, "Invalid constant pool count: %d\n", class_file.constant_pool_count);
-        return;
-    }  
-
     // Lê os flags de acesso (2 bytes)
     class_file.access_flags = (ptr[0] << 8) | ptr[1];
     ptr += 2;
@@ -175,7 +235,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
     ptr += 2;
 
     // Aloca memória para as interfaces
-    class_file.interfaces = (uint16_t *)malloc(sizeof(uint16_t) * class_file.interfaces_count);
+    class_file.interfaces = metadata_allocate(arena, sizeof(uint16_t) * class_file.interfaces_count);
+    if (class_file.interfaces == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
     for (int i = 0; i < class_file.interfaces_count; i++) {
         // Lê cada interface (2 bytes)
         class_file.interfaces[i] = (ptr[0] << 8) | ptr[1];
@@ -187,7 +251,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
     ptr += 2;
 
     // Aloca memória para os campos
-    class_file.fields = (field_info *)malloc(sizeof(field_info) * class_file.fields_count);
+    class_file.fields = metadata_allocate(arena, sizeof(field_info) * class_file.fields_count);
+    if (class_file.fields == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
     for (int i = 0; i < class_file.fields_count; i++) {
         // Lê os flags de acesso do campo (2 bytes)
         class_file.fields[i].access_flags = (ptr[0] << 8) | ptr[1];
@@ -206,7 +274,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
         ptr += 2;
 
         // Aloca memória para os atributos do campo
-        class_file.fields[i].attributes = (attribute_info *)malloc(sizeof(attribute_info) * class_file.fields[i].attributes_count);
+        class_file.fields[i].attributes = metadata_allocate(arena, sizeof(attribute_info) * class_file.fields[i].attributes_count);
+        if (class_file.fields[i].attributes == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
         for (int j = 0; j < class_file.fields[i].attributes_count; j++) {
             // Lê o índice do nome do atributo (2 bytes)
             class_file.fields[i].attributes[j].attribute_name_index = (ptr[0] << 8) | ptr[1];
@@ -216,12 +288,9 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
             class_file.fields[i].attributes[j].attribute_length = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
             ptr += 4;
 
-            // Aloca memória para a informação do atributo
-            class_file.fields[i].attributes[j].info = (uint8_t *)malloc(class_file.fields[i].attributes[j].attribute_length);
-            for (uint32_t k = 0; k < class_file.fields[i].attributes[j].attribute_length; k++) {
-                // Lê cada byte da informação do atributo
-                class_file.fields[i].attributes[j].info[k] = *ptr++;
-            }
+            // O corpo do atributo é lido direto do buffer
+            class_file.fields[i].attributes[j].info = ptr;
+            ptr += class_file.fields[i].attributes[j].attribute_length;
         }
     }
 
@@ -230,7 +299,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
     ptr += 2;
 
     // Aloca memória para os métodos
-    class_file.methods = (method_info *)malloc(sizeof(method_info) * class_file.methods_count);
+    class_file.methods = metadata_allocate(arena, sizeof(method_info) * class_file.methods_count);
+    if (class_file.methods == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
     for (int i = 0; i < class_file.methods_count; i++) {
         // Lê os flags de acesso do método (2 bytes)
         class_file.methods[i].access_flags = (ptr[0] << 8) | ptr[1];
@@ -249,7 +322,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
         ptr += 2;
 
         // Aloca memória para os atributos do método
-        class_file.methods[i].attributes = (attribute_info *)malloc(sizeof(attribute_info) * class_file.methods[i].attributes_count);
+        class_file.methods[i].attributes = metadata_allocate(arena, sizeof(attribute_info) * class_file.methods[i].attributes_count);
+        if (class_file.methods[i].attributes == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
         for (int j = 0; j < class_file.methods[i].attributes_count; j++) {
             // Lê o índice do nome do atributo (2 bytes)
             class_file.methods[i].attributes[j].attribute_name_index = (ptr[0] << 8) | ptr[1];
@@ -259,12 +336,9 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
             class_file.methods[i].attributes[j].attribute_length = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
             ptr += 4;
 
-            // Aloca memória para a informação do atributo
-            class_file.methods[i].attributes[j].info = (uint8_t *)malloc(class_file.methods[i].attributes[j].attribute_length);
-            for (uint32_t k = 0; k < class_file.methods[i].attributes[j].attribute_length; k++) {
-                // Lê cada byte da informação do atributo
-                class_file.methods[i].attributes[j].info[k] = *ptr++;
-            }
+            // O corpo do atributo é lido direto do buffer
+            class_file.methods[i].attributes[j].info = ptr;
+            ptr += class_file.methods[i].attributes[j].attribute_length;
         }
     }
 
@@ -273,7 +347,11 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
     ptr += 2;
 
     // Aloca memória para os atributos da classe
-    class_file.attributes = (attribute_info *)malloc(sizeof(attribute_info) * class_file.attributes_count);
+    class_file.attributes = metadata_allocate(arena, sizeof(attribute_info) * class_file.attributes_count);
+    if (class_file.attributes == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
     for (int i = 0; i < class_file.attributes_count; i++) {
         // Lê o índice do nome do atributo (2 bytes)
         class_file.attributes[i].attribute_name_index = (ptr[0] << 8) | ptr[1];
@@ -283,124 +361,286 @@ void parse_class_file(JVM *jvm, uint8_t *buffer, long file_size) {
         class_file.attributes[i].attribute_length = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
         ptr += 4;
 
-        // Aloca memória para a informação do atributo
-        class_file.attributes[i].info = (uint8_t *)malloc(class_file.attributes[i].attribute_length);
-        for (uint32_t j = 0; j < class_file.attributes[i].attribute_length; j++) {
-            // Lê cada byte da informação do atributo
-            class_file.attributes[i].info[j] = *ptr++;
+        // O corpo do atributo é lido direto do buffer
+        class_file.attributes[i].info = ptr;
+        ptr += class_file.attributes[i].attribute_length;
+    }
+
+    if (!terminate_utf8_entries(&class_file, buffer + file_size)) {
+        fprintf(stderr, "Truncated class file\n");
+        return false;
+    }
+
+    // Devolve a estrutura ClassFile preenchida; ela continua apontando para
+    // o buffer, que passa a pertencer a ela
+    class_file.data = buffer;
+    class_file.data_size = (size_t)file_size;
+    class_file.data_mapped = false;
+    *out = class_file;
+    return true;
+}
+
+// Traz o arquivo inteiro para a memória. Ele é mapeado com mmap em vez de
+// copiado: o parse só escreve nas páginas do pool de constantes (os '\0' das
+// strings), que o kernel copia sob demanda por ser um mapeamento privado; o
+// resto, como o bytecode dos métodos, é lido direto do cache de páginas. Se
+// o arquivo não puder ser mapeado (vazio, pipe), ele é lido com read.
+static uint8_t *load_file(const char *path, size_t *size, bool *mapped) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            *size = (size_t)info.st_size;
+            *mapped = true;
+            return data;
         }
     }
 
-    // Armazena a estrutura ClassFile no campo class_file da JVM
-    jvm->class_file = class_file;
+    size_t capacity = 4096, length = 0;
+    uint8_t *buffer = malloc(capacity);
+    for (;;) {
+        if (buffer == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            close(fd);
+            return NULL;
+        }
+        ssize_t count = read(fd, buffer + length, capacity - length);
+        if (count < 0) {
+            fprintf(stderr, "Error reading file\n");
+            free(buffer);
+            close(fd);
+            return NULL;
+        }
+        if (count == 0) {
+            break;
+        }
+        length += (size_t)count;
+        if (length == capacity) {
+            capacity *= 2;
+            uint8_t *grown = realloc(buffer, capacity);
+            if (grown == NULL) {
+                free(buffer);
+            }
+            buffer = grown;
+        }
+    }
+    close(fd);
+    *size = length;
+    *mapped = false;
+    return buffer;
 }
 
-void jvm_load_class(JVM *jvm, const char *class_file) {
-    FILE *file = fopen(class_file, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Error opening file: %s\n", class_file);
-        return;
+static void release_file(uint8_t *data, size_t size, bool mapped) {
+    if (mapped) {
+        munmap(data, size);
+    } else {
+        free(data);
     }
+}
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+// Lê e analisa o arquivo .class em path, com os metadados na arena. O
+// ClassFile aponta para os bytes do arquivo, que ficam carregados enquanto
+// ele existir.
+bool read_class_file(const char *path, ClassFile *class_file, Arena *arena) {
+    size_t size;
+    bool mapped;
+    uint8_t *data = load_file(path, &size, &mapped);
+    if (data == NULL) {
+        return false;
+    }
+    if (!parse_class_file(class_file, data, (long)size, arena)) {
+        release_file(data, size, mapped);
+        return false;
+    }
+    class_file->data_mapped = mapped;
+    return true;
+}
 
-    uint8_t *buffer = (uint8_t *)malloc(file_size);
-    if (buffer == NULL) {
-        fprintf(stderr, "Memory allocation error\n");
-        fclose(file);
-        return;
+// Libera os bytes do arquivo de class_file, se forem dele
+void class_file_release(ClassFile *class_file) {
+    if (class_file->data != NULL) {
+        release_file(class_file->data, class_file->data_size, class_file->data_mapped);
+        class_file->data = NULL;
     }
+}
 
-    if (fread(buffer, 1, file_size, file) != file_size) {
-        fprintf(stderr, "Error reading file\n");
-        free(buffer);
-        fclose(file);
-        return;
+// Descarrega tudo o que o carregador de classes leu: os arquivos, os JARs
+// e, de uma vez, a arena com os metadados. As classes ligadas apontam para
+// eles, então isso só acontece quando a VM termina.
+void class_loader_release(JVM *jvm) {
+    for (int32_t i = 0; i < jvm->classes_count; i++) {
+        if (jvm->classes[i]->class_file != NULL) {
+            class_file_release(jvm->classes[i]->class_file);
+        }
     }
+    class_file_release(&jvm->class_file);
+    // As classes pré-carregadas que o programa não chegou a usar
+    for (uint32_t i = 0; i < jvm->preloaded.capacity; i++) {
+        PreloadedClass *preloaded = jvm->preloaded.slots[i];
+        if (preloaded != NULL && preloaded->class_file != NULL) {
+            class_file_release(preloaded->class_file);
+        }
+    }
+    free(jvm->preloaded.slots);
+    memset(&jvm->preloaded, 0, sizeof(jvm->preloaded));
+    arena_release(&jvm->metadata);
+    for (uint32_t i = 0; i < jvm->class_path_count; i++) {
+        free(jvm->class_path[i].directory);
+        jar_close(jvm->class_path[i].jar);
+    }
+    free(jvm->class_path);
+    jvm->class_path = NULL;
+    jvm->class_path_count = 0;
+    free(jvm->class_registry.slots);
+    memset(&jvm->class_registry, 0, sizeof(jvm->class_registry));
+}
 
-    parse_class_file(jvm, buffer, file_size);
-    free(buffer);
-    fclose(file);
+static bool has_suffix(const char *text, size_t length, const char *suffix) {
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length && memcmp(text + length - suffix_length, suffix, suffix_length) == 0;
 }
 
-void parse_constant_pool(ClassFile *class_file, uint8_t *buffer, uint16_t constant_pool_count) {
-    class_file->constant_pool = (cp_info *)malloc(sizeof(cp_info) * (constant_pool_count - 1));
-    uint8_t *ptr = buffer;
+// Acrescenta um diretório ou, se terminar em .jar ou .zip, um arquivo JAR
+// ao classpath. O JAR é mapeado e o seu diretório central indexado já aqui.
+static bool add_class_path_entry(JVM *jvm, const char *path, size_t length) {
+    ClassPathEntry *entries = realloc(jvm->class_path, sizeof(ClassPathEntry) * (jvm->class_path_count + 1));
+    char *name = malloc(length + 1);
+    if (entries == NULL || name == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(name);
+        return false;
+    }
+    jvm->class_path = entries;
+    memcpy(name, path, length);
+    name[length] = '\0';
+
+    ClassPathEntry entry = { name, NULL };
+    if (has_suffix(name, length, ".jar") || has_suffix(name, length, ".zip")) {
+        entry.jar = jar_open(name);
+        free(name);
+        if (entry.jar == NULL) {
+            return false;
+        }
+        entry.directory = NULL;
+    }
+    entries[jvm->class_path_count++] = entry;
+    return true;
+}
 
-    for (int i = 0; i < constant_pool_count - 1; i++) {
-        class_file->constant_pool[i].tag = *ptr++;
-        switch (class_file->constant_pool[i].tag) {
-            case 7: // CONSTANT_Class
-                class_file->constant_pool[i].info.Class.name_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 9: // CONSTANT_Fieldref
-            case 10: // CONSTANT_Methodref
-            case 11: // CONSTANT_InterfaceMethodref
-                class_file->constant_pool[i].info.Fieldref.class_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                class_file->constant_pool[i].info.Fieldref.name_and_type_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 8: // CONSTANT_String
-                class_file->constant_pool[i].info.String.string_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 3: // CONSTANT_Integer
-                class_file->constant_pool[i].info.Integer.bytes = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
-                ptr += 4;
-                break;
-            case 4: // CONSTANT_Float
-                class_file->constant_pool[i].info.Float.bytes = *(float *)ptr;
-                ptr += 4;
-                break;
-            case 5: // CONSTANT_Long
-                class_file->constant_pool[i].info.Long.bytes = ((int64_t)ptr[0] << 56) | ((int64_t)ptr[1] << 48) | ((int64_t)ptr[2] << 40) | ((int64_t)ptr[3] << 32) |
-                                                              ((int64_t)ptr[4] << 24) | ((int64_t)ptr[5] << 16) | ((int64_t)ptr[6] << 8) | (int64_t)ptr[7];
-                ptr += 8;
-                break;
-            case 6: // CONSTANT_Double
-                class_file->constant_pool[i].info.Double.bytes = *(double *)ptr;
-                ptr += 8;
-                break;
-            case 12: // CONSTANT_NameAndType
-                class_file->constant_pool[i].info.NameAndType.name_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                class_file->constant_pool[i].info.NameAndType.descriptor_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 1: // CONSTANT_Utf8
-                class_file->constant_pool[i].info.Utf8.length = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                class_file->constant_pool[i].info.Utf8.bytes = (uint8_t *)malloc(class_file->constant_pool[i].info.Utf8.length);
-                for (int j = 0; j < class_file->constant_pool[i].info.Utf8.length; j++) {
-                    class_file->constant_pool[i].info.Utf8.bytes[j] = *ptr++;
-                }
-                break;
-            case 15: // CONSTANT_MethodHandle
-                class_file->constant_pool[i].info.MethodHandle.reference_kind = *ptr++;
-                class_file->constant_pool[i].info.MethodHandle.reference_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 16: // CONSTANT_MethodType
-                class_file->constant_pool[i].info.MethodType.descriptor_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                break;
-            case 18: // CONSTANT_InvokeDynamic
-                class_file->constant_pool[i].info.InvokeDynamic.bootstrap_method_attr_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                class_file->constant_pool[i].info.InvokeDynamic.name_and_type_index = (ptr[0] << 8) | ptr[1];
-                ptr += 2;
-                printf("InvokeDynamic: bootstrap_method_attr_index=%d, name_and_type_index=%d\n",
-                    class_file->constant_pool[i].info.InvokeDynamic.bootstrap_method_attr_index,
-                    class_file->constant_pool[i].info.InvokeDynamic.name_and_type_index);
-                break;
+// Define o classpath (-cp): diretórios e JARs separados por ':', onde
+// find_class procura, na ordem, as classes que ainda não foram carregadas
+bool jvm_set_class_path(JVM *jvm, const char *class_path) {
+    const char *start = class_path;
+    for (;;) {
+        const char *end = strchr(start, ':');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        if (length > 0 && !add_class_path_entry(jvm, start, length)) {
+            return false;
+        }
+        if (end == NULL) {
+            return true;
+        }
+        start = end + 1;
+    }
+}
 
-            default:
-                fprintf(stderr, "Unknown constant pool tag: %d\n", class_file->constant_pool[i].tag);
-                break;
+// Lê a entrada name.class do JAR. Uma entrada armazenada sem compressão é
+// analisada no lugar, dentro do mapeamento do JAR, e os seus bytes continuam
+// pertencendo a ele; uma comprimida é descomprimida num buffer próprio.
+static bool read_class_from_jar(JarFile *jar, const char *entry_name, ClassFile *class_file, Arena *arena) {
+    const JarEntry *entry = jar_find(jar, entry_name);
+    if (entry == NULL) {
+        return false;
+    }
+    bool copied;
+    uint8_t *data = jar_read(jar, entry, &copied);
+    if (data == NULL) {
+        return false;
+    }
+    if (!parse_class_file(class_file, data, (long)entry->size, arena)) {
+        if (copied) {
+            free(data);
+        }
+        return false;
+    }
+    if (!copied) {
+        class_file->data = NULL;
+    }
+    return true;
+}
+
+// Procura a classe de nome interno name (java/lang/String) nas entradas do
+// classpath, na ordem, e analisa a primeira encontrada, com os metadados na
+// arena. Só lê jvm->class_path, então pode rodar em várias threads ao mesmo
+// tempo, cada uma com a sua arena (ver class_preload).
+bool read_class_from_class_path(JVM *jvm, const char *name, ClassFile *class_file, Arena *arena) {
+    size_t entry_length = strlen(name) + sizeof(".class");
+    char *entry_name = malloc(entry_length);
+    if (!entry_name) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    snprintf(entry_name, entry_length, "%s.class", name);
+
+    bool found = false;
+    for (uint32_t i = 0; i < jvm->class_path_count && !found; i++) {
+        ClassPathEntry *entry = &jvm->class_path[i];
+        if (entry->jar != NULL) {
+            found = read_class_from_jar(entry->jar, entry_name, class_file, arena);
+            continue;
         }
+        size_t length = strlen(entry->directory) + 1 + entry_length;
+        char *path = malloc(length);
+        if (!path) {
+            fprintf(stderr, "Memory allocation error\n");
+            break;
+        }
+        snprintf(path, length, "%s/%s", entry->directory, entry_name);
+        found = read_class_file(path, class_file, arena);
+        free(path);
     }
-}
\ No newline at end of file
+    free(entry_name);
+    return found;
+}
+
+// class_file é o caminho de um arquivo .class ou, com um classpath, o nome
+// da classe principal (com '.' ou '/'), procurada nele como as demais.
+// Retorna false se a classe não foi encontrada ou não pôde ser lida.
+bool jvm_load_class(JVM *jvm, const char *class_file) {
+    size_t length = strlen(class_file);
+    if (!has_suffix(class_file, length, ".class") && jvm->class_path_count > 0) {
+        char *name = malloc(length + 1);
+        if (!name) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
+        for (size_t i = 0; i <= length; i++) {
+            name[i] = class_file[i] == '.' ? '/' : class_file[i];
+        }
+        bool found = take_preloaded_class(jvm, name, &jvm->class_file) ||
+                     read_class_from_class_path(jvm, name, &jvm->class_file, &jvm->metadata);
+        free(name);
+        if (!found) {
+            fprintf(stderr, "Main class not found: %s\n", class_file);
+        }
+        return found;
+    }
+
+    if (!read_class_file(class_file, &jvm->class_file, &jvm->metadata)) {
+        fprintf(stderr, "Error opening file: %s\n", class_file);
+        return false;
+    }
+
+    // Sem -cp, as demais classes (superclasses, classes referenciadas) são
+    // procuradas no mesmo diretório da classe principal
+    if (jvm->class_path_count == 0) {
+        const char *slash = strrchr(class_file, '/');
+        return add_class_path_entry(jvm, slash ? class_file : ".", slash ? (size_t)(slash - class_file) : 1);
+    }
+    return true;
+}
@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE
+#include "jvm.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Parallel class preloading. The names to load are gathered on the calling
+// thread, then worker threads parse them concurrently, each into its own
+// arena, and publish the ClassFiles into jvm->preloaded. Nothing is linked
+// here: find_class takes a preloaded class file when it first needs the
+// class and links it in order, as it would a file it had just read.
+
+typedef struct {
+    JVM *jvm;
+    char **names;          // internal names, from jvm->metadata
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *seen;        // names by hash, to drop repeats (index + 1)
+    uint32_t seen_capacity;
+    uint32_t next;         // next name to parse, taken with fetch-and-add
+    Arena *arenas;         // one per worker
+    uint32_t failed;       // workers that ran out of memory
+} Preload;
+
+static bool seen_before(Preload *preload, const char *name, size_t length, uint32_t hash) {
+    uint32_t mask = preload->seen_capacity - 1;
+    for (uint32_t i = hash & mask; preload->seen[i] != 0; i = (i + 1) & mask) {
+        const char *other = preload->names[preload->seen[i] - 1];
+        if (strncmp(other, name, length) == 0 && other[length] == '\0') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool grow_seen(Preload *preload) {
+    uint32_t capacity = preload->seen_capacity ? preload->seen_capacity * 2 : 1024;
+    uint32_t *seen = calloc(capacity, sizeof(uint32_t));
+    if (seen == NULL) {
+        return false;
+    }
+    for (uint32_t n = 0; n < preload->count; n++) {
+        uint32_t mask = capacity - 1;
+        uint32_t i = name_hash(preload->names[n], strlen(preload->names[n])) & mask;
+        while (seen[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        seen[i] = n + 1;
+    }
+    free(preload->seen);
+    preload->seen = seen;
+    preload->seen_capacity = capacity;
+    return true;
+}
+
+// Adds the first length bytes of name, with '.' read as '/', unless it is
+// already there
+static bool add_name(Preload *preload, const char *name, size_t length) {
+    if (length == 0) {
+        return true;
+    }
+    char *copy = arena_allocate(&preload->jvm->metadata, length + 1);
+    if (copy == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        copy[i] = name[i] == '.' ? '/' : name[i];
+    }
+    copy[length] = '\0';
+
+    if ((preload->count + 1) * 2 > preload->seen_capacity && !grow_seen(preload)) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    uint32_t hash = name_hash(copy, length);
+    if (seen_before(preload, copy, length, hash)) {
+        return true;
+    }
+    if (preload->count == preload->capacity) {
+        uint32_t capacity = preload->capacity ? preload->capacity * 2 : 256;
+        char **names = realloc(preload->names, sizeof(char *) * capacity);
+        if (names == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
+        preload->names = names;
+        preload->capacity = capacity;
+    }
+    preload->names[preload->count++] = copy;
+    uint32_t mask = preload->seen_capacity - 1;
+    uint32_t i = hash & mask;
+    while (preload->seen[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    preload->seen[i] = preload->count;
+    return true;
+}
+
+static bool is_class_name(const char *name, size_t length) {
+    return length > 6 && memcmp(name + length - 6, ".class", 6) == 0 &&
+           strncmp(name, "META-INF/", 9) != 0;
+}
+
+// Adds every class file under root/relative
+static bool add_directory(Preload *preload, const char *root, const char *relative) {
+    size_t length = strlen(root) + 1 + strlen(relative) + 1;
+    char *path = malloc(length);
+    if (path == NULL) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    snprintf(path, length, *relative ? "%s/%s" : "%s%s", root, relative);
+    DIR *directory = opendir(path);
+    free(path);
+    if (directory == NULL) {
+        return true; // a classpath entry that does not exist holds no classes
+    }
+
+    bool ok = true;
+    struct dirent *item;
+    while (ok && (item = readdir(directory)) != NULL) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) {
+            continue;
+        }
+        size_t child_length = strlen(relative) + 1 + strlen(item->d_name) + 1;
+        char *child = malloc(child_length);
+        size_t full_length = strlen(root) + 1 + child_length;
+        char *full = malloc(full_length);
+        if (child == NULL || full == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(child);
+            free(full);
+            ok = false;
+            break;
+        }
+        snprintf(child, child_length, *relative ? "%s/%s" : "%s%s", relative, item->d_name);
+        snprintf(full, full_length, "%s/%s", root, child);
+        struct stat info;
+        if (stat(full, &info) == 0) {
+            if (S_ISDIR(info.st_mode)) {
+                ok = add_directory(preload, root, child);
+            } else if (S_ISREG(info.st_mode) && is_class_name(child, strlen(child))) {
+                ok = add_name(preload, child, strlen(child) - 6);
+            }
+        }
+        free(child);
+        free(full);
+    }
+    closedir(directory);
+    return ok;
+}
+
+static bool add_class_path(Preload *preload) {
+    JVM *jvm = preload->jvm;
+    for (uint32_t i = 0; i < jvm->class_path_count; i++) {
+        ClassPathEntry *entry = &jvm->class_path[i];
+        if (entry->directory != NULL) {
+            if (!add_directory(preload, entry->directory, "")) {
+                return false;
+            }
+            continue;
+        }
+        for (uint32_t e = 0; e < entry->jar->entry_count; e++) {
+            const JarEntry *jar_entry = &entry->jar->entries[e];
+            if (is_class_name(jar_entry->name, jar_entry->name_length) &&
+                !add_name(preload, jar_entry->name, jar_entry->name_length - 6)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// One class name per line, as com.example.Main or com/example/Main
+static bool add_class_list(Preload *preload, const char *class_list) {
+    FILE *file = fopen(class_list, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening class list: %s\n", class_list);
+        return false;
+    }
+    char line[1024];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        size_t length = strcspn(line, " \t\r\n");
+        ok = add_name(preload, line, length);
+    }
+    fclose(file);
+    return ok;
+}
+
+// Lock-free insertion: names are distinct, so a worker only has to claim a
+// free slot. The release pairs with the join in run_parallel, after which
+// the table is read single-threaded.
+static void publish(PreloadTable *table, PreloadedClass *preloaded) {
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = preloaded->hash & mask;; i = (i + 1) & mask) {
+        PreloadedClass *expected = NULL;
+        if (__atomic_compare_exchange_n(&table->slots[i], &expected, preloaded, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&table->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+static void preload_task(void *context, uint32_t worker) {
+    Preload *preload = context;
+    Arena *arena = &preload->arenas[worker];
+    for (;;) {
+        uint32_t next = __atomic_fetch_add(&preload->next, 1, __ATOMIC_RELAXED);
+        if (next >= preload->count) {
+            return;
+        }
+        const char *name = preload->names[next];
+        ClassFile *class_file = arena_allocate(arena, sizeof(ClassFile));
+        PreloadedClass *preloaded = arena_allocate(arena, sizeof(PreloadedClass));
+        if (class_file == NULL || preloaded == NULL) {
+            // The classes left are read when they are first used
+            __atomic_fetch_add(&preload->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (!read_class_from_class_path(preload->jvm, name, class_file, arena)) {
+            continue;
+        }
+        preloaded->hash = name_hash(name, strlen(name));
+        preloaded->name = name;
+        preloaded->class_file = class_file;
+        publish(&preload->jvm->preloaded, preloaded);
+    }
+}
+
+// Parses the classes named in class_list, or every class on the classpath
+// if it is NULL, on threads threads (0 for one per online processor). The
+// main class, loaded already, is left out.
+bool class_preload(JVM *jvm, const char *class_list, uint32_t threads) {
+    if (jvm->preloaded.capacity != 0) {
+        fprintf(stderr, "Classes already preloaded\n");
+        return false;
+    }
+    Preload preload = { 0 };
+    preload.jvm = jvm;
+    if (jvm->class_file.constant_pool != NULL) {
+        ClassFile *main = &jvm->class_file;
+        uint16_t name_index = main->constant_pool[main->this_class - 1].info.Class.name_index;
+        const char *name = get_constant_pool_string(main, name_index);
+        if (!add_name(&preload, name, strlen(name))) {
+            return false;
+        }
+    }
+    uint32_t skipped = preload.count;
+    bool ok = class_list ? add_class_list(&preload, class_list) : add_class_path(&preload);
+    free(preload.seen);
+
+    uint32_t capacity = 16;
+    while (capacity < preload.count * 2) {
+        capacity *= 2;
+    }
+    jvm->preloaded.slots = ok ? calloc(capacity, sizeof(PreloadedClass *)) : NULL;
+    if (threads == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? (uint32_t)processors : 1;
+    }
+    preload.arenas = ok ? calloc(threads, sizeof(Arena)) : NULL;
+    if (!ok || jvm->preloaded.slots == NULL || preload.arenas == NULL) {
+        if (ok) {
+            fprintf(stderr, "Memory allocation error\n");
+        }
+        free(jvm->preloaded.slots);
+        jvm->preloaded.slots = NULL;
+        free(preload.arenas);
+        free(preload.names);
+        return false;
+    }
+    jvm->preloaded.capacity = capacity;
+
+    preload.next = skipped;
+    run_parallel(jvm, threads, preload_task, &preload);
+
+    for (uint32_t i = 0; i < threads; i++) {
+        arena_adopt(&jvm->metadata, &preload.arenas[i]);
+    }
+    free(preload.arenas);
+    free(preload.names);
+    if (preload.failed != 0) {
+        fprintf(stderr, "Memory allocation error\n");
+    }
+    return true;
+}
+
+// Moves the preloaded class file for name, if there is one, into class_file
+bool take_preloaded_class(JVM *jvm, const char *name, ClassFile *class_file) {
+    PreloadTable *table = &jvm->preloaded;
+    if (table->capacity == 0) {
+        return false;
+    }
+    uint32_t hash = name_hash(name, strlen(name));
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = hash & mask; table->slots[i] != NULL; i = (i + 1) & mask) {
+        PreloadedClass *preloaded = table->slots[i];
+        if (preloaded->hash == hash && strcmp(preloaded->name, name) == 0) {
+            if (preloaded->class_file == NULL) {
+                return false;
+            }
+            *class_file = *preloaded->class_file;
+            preloaded->class_file = NULL;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,938 @@
+#define _POSIX_C_SOURCE 200809L
+#include "jvm.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generational garbage collector (see Heap for the layout).
+//
+// A minor collection runs when eden is full. It copies the live blocks of
+// the nursery, Cheney style: the blocks the roots reach are copied first and
+// the copies are then scanned in order for the blocks they reach, so it
+// touches only live young data. A block goes to the empty survivor space,
+// or to the old generation once it has survived TENURE_AGE collections (or
+// the survivor space is full). Eden and the other survivor space are then
+// empty. References from the old generation into the nursery are found
+// through the card table kept by the write barrier (card_mark): only the
+// blocks on dirty cards are scanned.
+//
+// A full collection runs when the old generation is full. It marks
+// everything reachable, tracing through explicit work-stealing deques
+// instead of recursion, slides the live old blocks down over the dead ones
+// (Lisp-2 style: plan the new addresses, rewrite the references, then move)
+// and then empties the nursery with a minor collection. Marking and
+// compaction are shared by jvm->gc_threads threads.
+//
+// References are compressed heap offsets (see make_reference), so moving a
+// block means rewriting every slot that refers to it: a copied or planned
+// block keeps its new reference in HeapHeader.forward until the slots have
+// been visited.
+//
+// Roots are the frames of the Java stack, static fields, interned strings
+// and the LocalRoots of the VM itself. Frames of verified methods are
+// scanned precisely through the reference maps the verifier leaves for each
+// instruction (Method.reference_maps), read at the instruction the frame is
+// stopped at (Frame.pc). Frames of unverified methods have no maps, so any
+// of their slots whose value is the reference of a block is taken as one.
+// That may keep some garbage alive but never frees a live object. As the
+// slot may just as well hold an int it is never rewritten: the block it
+// names is pinned where it is for the collection instead. A young block
+// pinned by a minor collection stays where it is: TLABs are carved around
+// it in eden, and a survivor space is only reused past it.
+
+#define ACC_STATIC 0x0008
+
+#define GC_MARKED 1
+#define GC_FORWARDED 2  // copied by the minor collection, forward is the copy
+#define GC_PINNED 4     // named by a conservatively scanned slot
+#define TENURE_AGE 4
+
+// Called for each slot holding a reference; the minor collection returns
+// whether the object stays in the nursery
+typedef bool (*ReferenceVisitor)(void *context, int32_t *slot);
+
+static HeapHeader *header_of(void *payload) {
+    return (HeapHeader *)payload - 1;
+}
+
+// The block a reference names; NULL for null and the stand-ins of native.c
+static HeapHeader *block_of(JVM *jvm, int32_t reference) {
+    if ((uint32_t)reference < FIRST_REFERENCE) {
+        return NULL;
+    }
+    return header_of(dereference(jvm, reference));
+}
+
+static bool is_pinned(HeapHeader *header) {
+    return header->pinned || (header->gc_flags & GC_PINNED);
+}
+
+// The end of the blocks in eden, TLABs and pinned blocks alike
+static uint8_t *eden_used(Heap *heap) {
+    return heap->eden_top > heap->eden_pinned ? heap->eden_top : heap->eden_pinned;
+}
+
+// Visits the slots of the block within [low, high) that hold references;
+// true if any visit returned true
+static bool visit_block(JVM *jvm, void *payload, uintptr_t low, uintptr_t high,
+                        ReferenceVisitor visit, void *context) {
+    bool result = false;
+    switch (header_of(payload)->kind) {
+        case HEAP_OBJECT: {
+            Class *class = object_class(jvm, payload);
+            for (uint16_t i = 0; i < class->reference_offsets_count; i++) {
+                int32_t *slot = OBJECT_FIELD(payload, int32_t, class->reference_offsets[i]);
+                if ((uintptr_t)slot >= low && (uintptr_t)slot < high) {
+                    result |= visit(context, slot);
+                }
+            }
+            break;
+        }
+        case HEAP_ARRAY: {
+            Array *array = payload;
+            int32_t *elements = ARRAY_ELEMENTS(array);
+            if (array->type != ARRAY_TYPE_REFERENCE || (uintptr_t)elements >= high) {
+                break;
+            }
+            int32_t *first = elements;
+            int32_t *end = elements + array->length;
+            if ((uintptr_t)first < low) {
+                first = elements + (low - (uintptr_t)elements + sizeof(int32_t) - 1) / sizeof(int32_t);
+            }
+            if ((uintptr_t)end > high) {
+                end = elements + (high - (uintptr_t)elements + sizeof(int32_t) - 1) / sizeof(int32_t);
+            }
+            for (int32_t *slot = first; slot < end; slot++) {
+                result |= visit(context, slot);
+            }
+            break;
+        }
+        default:
+            break; // strings hold no references
+    }
+    return result;
+}
+
+// Visits the blocks of [start, end) that carry flag, or all of them if 0
+static void visit_space(JVM *jvm, uint8_t *start, uint8_t *end, uint8_t flag,
+                        ReferenceVisitor visit, void *context) {
+    while (start < end) {
+        HeapHeader *header = (HeapHeader *)start;
+        start += header->size;
+        if (header->kind != HEAP_FILLER && (flag == 0 || (header->gc_flags & flag))) {
+            visit_block(jvm, header + 1, 0, UINTPTR_MAX, visit, context);
+        }
+    }
+}
+
+static void visit_slots(int32_t *slots, size_t count, ReferenceVisitor visit, void *context) {
+    for (size_t i = 0; i < count; i++) {
+        visit(context, &slots[i]);
+    }
+}
+
+// Visits the slots of map (one bit per slot) that are set
+static void visit_mapped_slots(int32_t *slots, size_t count, const uint8_t *map,
+                               size_t first_bit, ReferenceVisitor visit, void *context) {
+    for (size_t i = 0; i < count; i++) {
+        size_t bit = first_bit + i;
+        if (map[bit / 8] & (1u << (bit % 8))) {
+            visit(context, &slots[i]);
+        }
+    }
+}
+
+static bool has_reference_map(Frame *frame) {
+    return frame->method->reference_maps && frame->pc < frame->method->instruction_count;
+}
+
+// Visits the reference slots of the frames with a reference map, and every
+// slot of the others with ambiguous; either visitor may be NULL.
+//
+// The live part of a frame's operand stack ends where its callee's locals
+// start (the arguments left for the callee belong to the callee). The
+// innermost frame's depth is not tracked, so for it the map decides, or the
+// whole stack is scanned.
+static void visit_frames(JVM *jvm, ReferenceVisitor visit, ReferenceVisitor ambiguous, void *context) {
+    Frame *callee = NULL;
+    for (Frame *frame = jvm->current_frame; frame != NULL; frame = frame->caller) {
+        Method *method = frame->method;
+        size_t depth = callee ? (size_t)(callee->locals - frame->stack.values)
+                              : (size_t)frame->stack.capacity;
+        if (depth > (size_t)frame->stack.capacity) {
+            depth = (size_t)frame->stack.capacity;
+        }
+
+        if (has_reference_map(frame)) {
+            if (visit) {
+                const uint8_t *map = method->reference_maps +
+                                     (size_t)frame->pc * method->reference_map_stride;
+                visit_mapped_slots(frame->locals, method->max_locals, map, 0, visit, context);
+                visit_mapped_slots(frame->stack.values, depth, map, method->max_locals, visit, context);
+            }
+        } else if (ambiguous) {
+            size_t locals = (size_t)((int32_t *)frame - frame->locals);
+            visit_slots(frame->locals, locals, ambiguous, context);
+            visit_slots(frame->stack.values, depth, ambiguous, context);
+        }
+        callee = frame;
+    }
+}
+
+static void visit_statics(JVM *jvm, ReferenceVisitor visit, void *context) {
+    for (int32_t i = 0; i < jvm->classes_count; i++) {
+        Class *class = jvm->classes[i];
+        for (uint16_t f = 0; f < class->fields_count; f++) {
+            Field *field = &class->fields[f];
+            if ((field->access_flags & ACC_STATIC) &&
+                (field->descriptor[0] == 'L' || field->descriptor[0] == '[')) {
+                visit(context, &class->static_values[field->slot]);
+            }
+        }
+    }
+}
+
+// The roots known to hold references; the conservatively scanned slots are
+// visited apart (see visit_frames)
+static void visit_roots(JVM *jvm, ReferenceVisitor visit, void *context) {
+    visit_frames(jvm, visit, NULL, context);
+    visit_statics(jvm, visit, context);
+    visit_slots(jvm->strings.references, (size_t)jvm->strings.count, visit, context);
+    for (LocalRoot *root = jvm->local_roots; root != NULL; root = root->next) {
+        visit(context, root->slot);
+    }
+}
+
+// A conservatively scanned slot names a block only if its value is the
+// reference of a block's payload. When some frame is scanned that way, the
+// collection checks values against a bitmap of those references, built
+// from the spaces in use.
+
+static bool has_ambiguous_frames(JVM *jvm) {
+    for (Frame *frame = jvm->current_frame; frame != NULL; frame = frame->caller) {
+        if (!has_reference_map(frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void set_block_starts(JVM *jvm, uint8_t *bits, uint8_t *start, uint8_t *end) {
+    while (start < end) {
+        HeapHeader *header = (HeapHeader *)start;
+        start += header->size;
+        if (header->kind != HEAP_FILLER) {
+            uint32_t reference = (uint32_t)make_reference(jvm, header + 1);
+            bits[reference / 8] |= (uint8_t)(1u << (reference % 8));
+        }
+    }
+}
+
+// NULL if no frame needs it
+static uint8_t *block_starts(JVM *jvm) {
+    if (!has_ambiguous_frames(jvm)) {
+        return NULL;
+    }
+    Heap *heap = &jvm->heap;
+    uint8_t *bits = calloc(heap->heap_size / HEAP_ALIGNMENT / 8 + 1, 1);
+    if (bits == NULL) {
+        fprintf(stderr, "Failed to allocate the block bitmap\n");
+        exit(1);
+    }
+    set_block_starts(jvm, bits, heap->heap, heap->heap + heap->heap_top);
+    set_block_starts(jvm, bits, heap->eden, eden_used(heap));
+    set_block_starts(jvm, bits, heap->from, heap->from_top);
+    set_block_starts(jvm, bits, heap->to, heap->to_start);
+    return bits;
+}
+
+static HeapHeader *ambiguous_block(JVM *jvm, const uint8_t *starts, int32_t value) {
+    uint32_t reference = (uint32_t)value;
+    if (reference < FIRST_REFERENCE || reference >= jvm->heap.heap_size / HEAP_ALIGNMENT ||
+        !(starts[reference / 8] & (1u << (reference % 8)))) {
+        return NULL;
+    }
+    return block_of(jvm, value);
+}
+
+// Bytes to skip before a block placed at address to keep the elements of a
+// large array on a cache line boundary, as heap_allocate_aligned placed them
+static size_t move_padding(uint8_t *address, HeapHeader *header) {
+    if (header->kind != HEAP_ARRAY) {
+        return 0;
+    }
+    Array *array = (Array *)(header + 1);
+    if (((size_t)array->length << array->element_shift) < CACHE_LINE_SIZE) {
+        return 0;
+    }
+    uintptr_t elements = (uintptr_t)(address + sizeof(HeapHeader) + sizeof(Array));
+    return (size_t)(-elements & (CACHE_LINE_SIZE - 1));
+}
+
+// Copies the block to destination, which may overlap it
+static HeapHeader *move_block(uint8_t *destination, HeapHeader *header) {
+    uint8_t *old_payload = (uint8_t *)(header + 1);
+    memmove(destination, header, header->size);
+    HeapHeader *moved = (HeapHeader *)destination;
+    moved->gc_flags = 0;
+    if (moved->kind == HEAP_STRING) {
+        // Strings made by the VM point at their own inline bytes
+        JavaString *string = (JavaString *)(moved + 1);
+        if (string->bytes == old_payload + sizeof(JavaString)) {
+            string->bytes = (const uint8_t *)(string + 1);
+        }
+    }
+    return moved;
+}
+
+// Turns the blocks of [start, end) without flag into fillers and returns
+// the end of the last block left (start if none is)
+static uint8_t *keep_blocks(uint8_t *start, uint8_t *end, uint8_t flag) {
+    uint8_t *kept = start;
+    while (start < end) {
+        HeapHeader *header = (HeapHeader *)start;
+        start += header->size;
+        if (header->kind != HEAP_FILLER && (header->gc_flags & flag)) {
+            heap_fill(kept, (uint8_t *)header);
+            kept = start;
+        }
+    }
+    return kept;
+}
+
+static void clear_gc_flags(uint8_t *start, uint8_t *end) {
+    while (start < end) {
+        HeapHeader *header = (HeapHeader *)start;
+        start += header->size;
+        header->gc_flags = 0;
+    }
+}
+
+// Minor collection
+
+typedef struct {
+    JVM *jvm;
+    const uint8_t *starts;   // see block_starts
+    uint8_t *to_top;
+    uint8_t *to_end;
+    HeapHeader **pinned;     // young blocks pinned, scanned where they are
+    size_t pinned_count;
+    size_t pinned_capacity;
+    size_t survived;         // bytes copied to the survivor space
+    size_t promoted;         // bytes copied to the old generation
+} Evacuator;
+
+static bool in_nursery(Heap *heap, const void *address) {
+    return (const uint8_t *)address >= heap->heap + heap->old_size &&
+           (const uint8_t *)address < heap->heap + heap->heap_size;
+}
+
+// Eden and the survivor space being emptied
+static bool in_from_space(Heap *heap, const void *address) {
+    const uint8_t *p = address;
+    return (p >= heap->eden && p < heap->eden_end) ||
+           (p >= heap->from && p < heap->from + heap->survivor_size);
+}
+
+// Copies the block to *top, keeping large arrays aligned if there is room,
+// and returns the copy; NULL if it does not fit before end
+static HeapHeader *copy_block(uint8_t **top, uint8_t *end, HeapHeader *header) {
+    size_t available = (size_t)(end - *top);
+    if (header->size > available) {
+        return NULL;
+    }
+    size_t padding = move_padding(*top, header);
+    if (padding + header->size > available) {
+        padding = 0;
+    }
+    heap_fill(*top, *top + padding);
+    HeapHeader *copy = move_block(*top + padding, header);
+    *top += padding + copy->size;
+    return copy;
+}
+
+static void dirty_block_cards(Heap *heap, HeapHeader *header) {
+    size_t start = (size_t)((uint8_t *)header - heap->heap);
+    size_t end = start + header->size;
+    for (size_t card = start >> CARD_SHIFT; card << CARD_SHIFT < end; card++) {
+        heap->cards[card] = CARD_DIRTY;
+    }
+}
+
+// Pins the young block a conservatively scanned slot names, if any
+static bool pin_young(void *context, int32_t *slot) {
+    Evacuator *evacuator = context;
+    HeapHeader *header = ambiguous_block(evacuator->jvm, evacuator->starts, *slot);
+    if (header == NULL || !in_from_space(&evacuator->jvm->heap, header) ||
+        (header->gc_flags & GC_PINNED)) {
+        return false;
+    }
+    header->gc_flags |= GC_PINNED;
+    if (evacuator->pinned_count == evacuator->pinned_capacity) {
+        size_t capacity = evacuator->pinned_capacity ? evacuator->pinned_capacity * 2 : 16;
+        HeapHeader **pinned = realloc(evacuator->pinned, sizeof(HeapHeader *) * capacity);
+        if (pinned == NULL) {
+            fprintf(stderr, "Failed to grow the pinned block list\n");
+            exit(1);
+        }
+        evacuator->pinned = pinned;
+        evacuator->pinned_capacity = capacity;
+    }
+    evacuator->pinned[evacuator->pinned_count++] = header;
+    return false;
+}
+
+// Moves the object out of eden or the from survivor space, if it is there
+// and was not moved yet, and points the slot at it
+static bool evacuate(void *context, int32_t *slot) {
+    Evacuator *evacuator = context;
+    JVM *jvm = evacuator->jvm;
+    Heap *heap = &jvm->heap;
+    HeapHeader *header = block_of(jvm, *slot);
+    if (header == NULL) {
+        return false;
+    }
+    if (!in_from_space(heap, header) || (header->gc_flags & GC_PINNED)) {
+        return in_nursery(heap, header); // old, already copied or pinned
+    }
+    if (header->gc_flags & GC_FORWARDED) {
+        *slot = header->forward;
+        return in_nursery(heap, block_of(jvm, header->forward));
+    }
+
+    uint8_t age = header->age < UINT8_MAX ? header->age + 1 : UINT8_MAX;
+    HeapHeader *copy = NULL;
+    if (age < TENURE_AGE) {
+        copy = copy_block(&evacuator->to_top, evacuator->to_end, header);
+    }
+    if (copy) {
+        evacuator->survived += copy->size;
+    } else {
+        uint8_t *top = heap->heap + heap->heap_top;
+        copy = copy_block(&top, heap->heap + heap->old_limit, header);
+        if (copy == NULL && heap_expand(heap, header->size)) {
+            copy = copy_block(&top, heap->heap + heap->old_limit, header);
+        }
+        if (copy == NULL) {
+            fprintf(stderr, "OutOfMemoryError: no room to promote %u bytes\n", header->size);
+            exit(1);
+        }
+        size_t start = heap->heap_top;
+        heap->heap_top = (size_t)(top - heap->heap);
+        record_old_blocks(heap, start, heap->heap_top);
+        evacuator->promoted += copy->size;
+    }
+    copy->age = age;
+    header->gc_flags |= GC_FORWARDED;
+    header->forward = make_reference(jvm, copy + 1);
+    *slot = header->forward;
+    return in_nursery(heap, copy);
+}
+
+// Visits the old generation blocks on dirty cards, up to old_top. A card
+// stays dirty while it still refers into the nursery.
+static void scan_cards(Evacuator *evacuator, size_t old_top) {
+    Heap *heap = &evacuator->jvm->heap;
+    size_t cards = (old_top + CARD_SIZE - 1) >> CARD_SHIFT;
+    for (size_t card = 0; card < cards; card++) {
+        if (heap->cards[card] != CARD_DIRTY) {
+            continue;
+        }
+        heap->cards[card] = 0;
+        size_t card_start = card << CARD_SHIFT;
+        size_t card_end = card_start + CARD_SIZE < old_top ? card_start + CARD_SIZE : old_top;
+        for (size_t offset = (size_t)heap->card_starts[card] * HEAP_ALIGNMENT; offset < card_end;) {
+            HeapHeader *header = (HeapHeader *)(heap->heap + offset);
+            offset += header->size;
+            if (header->kind != HEAP_FILLER &&
+                visit_block(evacuator->jvm, header + 1, (uintptr_t)(heap->heap + card_start),
+                            (uintptr_t)(heap->heap + card_end), evacuate, evacuator)) {
+                heap->cards[card] = CARD_DIRTY;
+            }
+        }
+    }
+}
+
+static void collect_young(JVM *jvm) {
+    Heap *heap = &jvm->heap;
+    tlab_retire(jvm);
+    size_t young = (size_t)(heap->eden_top - heap->eden) + (size_t)(heap->from_top - heap->from);
+    size_t old_top = heap->heap_top;
+
+    // Blocks are pinned before anything is copied, so none of them is
+    Evacuator evacuator = { .jvm = jvm, .to_top = heap->to_start,
+                            .to_end = heap->to + heap->survivor_size };
+    uint8_t *starts = block_starts(jvm);
+    if (starts) {
+        evacuator.starts = starts;
+        visit_frames(jvm, NULL, pin_young, &evacuator);
+    }
+    visit_roots(jvm, evacuate, &evacuator);
+    // What the last collection pinned in this survivor space is kept alive
+    visit_space(jvm, heap->to, heap->to_start, 0, evacuate, &evacuator);
+    scan_cards(&evacuator, old_top);
+
+    // Cheney scan: copies are visited in the order they were made, both in
+    // the survivor space and in the promoted part of the old generation,
+    // until no visit copies anything new. Pinned blocks are visited where
+    // they are.
+    uint8_t *scan_young = heap->to_start;
+    uint8_t *scan_old = heap->heap + old_top;
+    size_t scan_pinned = 0;
+    while (scan_young < evacuator.to_top || scan_old < heap->heap + heap->heap_top ||
+           scan_pinned < evacuator.pinned_count) {
+        while (scan_young < evacuator.to_top) {
+            HeapHeader *header = (HeapHeader *)scan_young;
+            scan_young += header->size;
+            if (header->kind != HEAP_FILLER) {
+                visit_block(jvm, header + 1, 0, UINTPTR_MAX, evacuate, &evacuator);
+            }
+        }
+        while (scan_old < heap->heap + heap->heap_top) {
+            HeapHeader *header = (HeapHeader *)scan_old;
+            scan_old += header->size;
+            if (header->kind != HEAP_FILLER &&
+                visit_block(jvm, header + 1, 0, UINTPTR_MAX, evacuate, &evacuator)) {
+                dirty_block_cards(heap, header);
+            }
+        }
+        while (scan_pinned < evacuator.pinned_count) {
+            HeapHeader *header = evacuator.pinned[scan_pinned++];
+            visit_block(jvm, header + 1, 0, UINTPTR_MAX, evacuate, &evacuator);
+        }
+    }
+    free(evacuator.pinned);
+    free(starts);
+
+    // Eden is reused around the blocks pinned in it, the emptied survivor
+    // space from the end of the last one pinned there
+    uint8_t *eden_pinned = keep_blocks(heap->eden, eden_used(heap), GC_PINNED);
+    uint8_t *to_start = keep_blocks(heap->from, heap->from_top, GC_PINNED);
+    clear_gc_flags(heap->eden, eden_pinned);
+    clear_gc_flags(heap->from, to_start);
+    clear_gc_flags(heap->to, heap->to_start);
+
+    uint8_t *emptied = heap->from;
+    heap->from = heap->to;
+    heap->from_top = evacuator.to_top;
+    heap->to = emptied;
+    heap->to_start = to_start;
+    heap->eden_top = heap->eden;
+    heap->eden_pinned = eden_pinned;
+    jvm->gc_count++;
+
+    if (jvm->verbose_gc) {
+        fprintf(stderr, "[GC %u (young): %zuK -> %zuK, %zuK promoted, old %zuK/%zuK]\n",
+                jvm->gc_count, young / 1024, evacuator.survived / 1024, evacuator.promoted / 1024,
+                heap->heap_top / 1024, heap->old_limit / 1024);
+    }
+}
+
+// A minor collection could have to promote everything in the nursery, so
+// it only runs when the old generation has that much room, committing more
+// of it if needed; otherwise a full collection makes room
+void collect_garbage(JVM *jvm) {
+    Heap *heap = &jvm->heap;
+    tlab_retire(jvm);
+    size_t young = (size_t)(heap->eden_top - heap->eden) + (size_t)(heap->from_top - heap->from);
+    if (!heap_expand(heap, young)) {
+        collect_full(jvm);
+    } else {
+        collect_young(jvm);
+    }
+}
+
+// Full collection
+
+// Marking is shared by the GC threads. Each has a deque of the marked blocks
+// it still has to scan; a thread whose deque is empty steals from the
+// others. When a thread finds no work anywhere it counts itself idle and
+// waits until either every thread is (marking is over: only a busy thread
+// pushes, so all deques are empty) or some deque has work again.
+
+typedef struct {
+    JVM *jvm;
+    const uint8_t *starts; // see block_starts
+    GcDeque *deques;       // one per thread
+    uint32_t workers;
+    uint32_t idle;         // threads that found no work
+} Marking;
+
+typedef struct {
+    Marking *marking;
+    GcDeque *deque;
+} Marker;
+
+static bool mark_reference(void *context, int32_t *slot) {
+    Marker *marker = context;
+    HeapHeader *header = block_of(marker->marking->jvm, *slot);
+    if (header == NULL) {
+        return false;
+    }
+    // The thread that sets the mark is the one that scans the block
+    if (__atomic_fetch_or(&header->gc_flags, GC_MARKED, __ATOMIC_RELAXED) & GC_MARKED) {
+        return false;
+    }
+    gc_deque_push(marker->deque, header + 1);
+    return false;
+}
+
+// Marks and pins the block a conservatively scanned slot names, if any
+static bool mark_ambiguous(void *context, int32_t *slot) {
+    Marker *marker = context;
+    HeapHeader *header = ambiguous_block(marker->marking->jvm, marker->marking->starts, *slot);
+    if (header != NULL) {
+        header->gc_flags |= GC_PINNED;
+        mark_reference(context, slot);
+    }
+    return false;
+}
+
+static void *steal_block(Marking *marking, uint32_t worker) {
+    for (uint32_t i = 1; i < marking->workers; i++) {
+        void *payload = gc_deque_steal(&marking->deques[(worker + i) % marking->workers]);
+        if (payload != NULL) {
+            return payload;
+        }
+    }
+    return NULL;
+}
+
+static bool work_left(Marking *marking) {
+    for (uint32_t i = 0; i < marking->workers; i++) {
+        if (!gc_deque_empty(&marking->deques[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mark_task(void *context, uint32_t worker) {
+    Marking *marking = context;
+    Marker marker = { .marking = marking, .deque = &marking->deques[worker] };
+    for (;;) {
+        void *payload;
+        while ((payload = gc_deque_pop(marker.deque)) != NULL ||
+               (payload = steal_block(marking, worker)) != NULL) {
+            visit_block(marking->jvm, payload, 0, UINTPTR_MAX, mark_reference, &marker);
+        }
+
+        __atomic_fetch_add(&marking->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&marking->idle, __ATOMIC_SEQ_CST) == marking->workers) {
+                return;
+            }
+            if (work_left(marking)) {
+                __atomic_fetch_sub(&marking->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+// Young blocks are marked too, as they may be all that keeps an old one
+// alive, and their references to old blocks must be rewritten
+static void mark(JVM *jvm) {
+    uint32_t workers = jvm->gc_threads > 1 ? jvm->gc_threads : 1;
+    Marking marking = { .jvm = jvm, .workers = workers };
+    marking.deques = malloc(sizeof(GcDeque) * workers);
+    if (marking.deques == NULL) {
+        fprintf(stderr, "Failed to grow the mark stack\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < workers; i++) {
+        gc_deque_init(&marking.deques[i]);
+    }
+
+    Marker roots = { .marking = &marking, .deque = &marking.deques[0] };
+    uint8_t *starts = block_starts(jvm);
+    if (starts) {
+        marking.starts = starts;
+        visit_frames(jvm, NULL, mark_ambiguous, &roots);
+    }
+    visit_roots(jvm, mark_reference, &roots);
+    gc_run_parallel(jvm, mark_task, &marking);
+
+    for (uint32_t i = 0; i < workers; i++) {
+        gc_deque_free(&marking.deques[i]);
+    }
+    free(marking.deques);
+    free(starts);
+}
+
+// Compaction slides the live old blocks down over the dead ones, Lisp-2
+// style. The old generation is cut into chunks at block boundaries; the
+// threads claim chunks in address order and
+//   1. measure the live bytes of each chunk,
+//   2. (one thread) give each chunk its destination, right after the live
+//      blocks of the previous one,
+//   3. record in every live block the reference it will have,
+//   4. rewrite the references the live blocks hold (one thread does the
+//      roots and the young blocks),
+//   5. move the blocks.
+// A chunk is moved once the chunks whose blocks its destination overlaps
+// have moved theirs. A chunk starts at the same address modulo a cache line
+// as before, so the padding that keeps large arrays aligned (move_padding)
+// can be worked out in step 1, from the old address. A pinned block stays
+// where it is; the live blocks after it in its chunk slide down to it.
+
+#define COMPACTION_CHUNK (16 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+typedef struct {
+    size_t source;         // offset of the first block
+    size_t destination;    // where it moves
+    size_t live;           // bytes the live blocks before any pinned one take
+    size_t pinned_end;     // with a pinned block, where the live blocks end
+                           // once moved; 0 without
+    uint32_t moved;
+} Chunk;
+
+typedef struct {
+    JVM *jvm;
+    Chunk *chunks;         // count of them, then one that starts at the top
+    uint32_t count;
+    uint32_t next;         // the next chunk to claim
+    size_t old_top;        // heap_top before compaction
+} Compaction;
+
+enum { FORWARD, UPDATE, MOVE };
+
+// Bytes to skip before a block at cursor, an address within the chunk as
+// if it did not move. Skipped when the block would move up.
+static size_t compact_padding(uint8_t *cursor, HeapHeader *header) {
+    size_t padding = move_padding(cursor, header);
+    return cursor + padding <= (uint8_t *)header ? padding : 0;
+}
+
+static Chunk *claim_chunk(Compaction *compaction) {
+    uint32_t index = __atomic_fetch_add(&compaction->next, 1, __ATOMIC_RELAXED);
+    return index < compaction->count ? &compaction->chunks[index] : NULL;
+}
+
+static size_t chunk_end(const Chunk *chunk) {
+    return chunk->pinned_end ? chunk->pinned_end : chunk->destination + chunk->live;
+}
+
+static void measure_task(void *context, uint32_t worker) {
+    (void)worker;
+    Compaction *compaction = context;
+    uint8_t *heap = compaction->jvm->heap.heap;
+    for (Chunk *chunk; (chunk = claim_chunk(compaction)) != NULL;) {
+        uint8_t *cursor = heap + chunk->source;
+        bool pinned = false;
+        for (size_t offset = chunk->source; offset < chunk[1].source;) {
+            HeapHeader *header = (HeapHeader *)(heap + offset);
+            offset += header->size;
+            if (!(header->gc_flags & GC_MARKED)) {
+                continue;
+            }
+            if (is_pinned(header)) {
+                if (!pinned) {
+                    chunk->live = (size_t)(cursor - (heap + chunk->source));
+                    pinned = true;
+                }
+                cursor = (uint8_t *)header + header->size;
+            } else {
+                cursor += compact_padding(cursor, header) + header->size;
+            }
+        }
+        if (pinned) {
+            chunk->pinned_end = (size_t)(cursor - heap);
+        } else {
+            chunk->live = (size_t)(cursor - (heap + chunk->source));
+        }
+    }
+}
+
+// Points the slot at the new address of the old block it refers to
+static bool update_reference(void *context, int32_t *slot) {
+    Compaction *compaction = context;
+    HeapHeader *header = block_of(compaction->jvm, *slot);
+    if (header != NULL && (uint8_t *)header < compaction->jvm->heap.heap + compaction->old_top) {
+        *slot = header->forward;
+    }
+    return false;
+}
+
+// Walks the live blocks of the chunk, finding where each one goes, for the
+// given step
+static void relocate_chunk(Compaction *compaction, Chunk *chunk, int step) {
+    JVM *jvm = compaction->jvm;
+    Heap *heap = &jvm->heap;
+    uint8_t *cursor = heap->heap + chunk->source;  // as if the blocks did not move
+    size_t distance = chunk->source - chunk->destination;
+    for (size_t offset = chunk->source; offset < chunk[1].source;) {
+        HeapHeader *header = (HeapHeader *)(heap->heap + offset);
+        uint32_t size = header->size;
+        offset += size;
+        if (!(header->gc_flags & GC_MARKED)) {
+            continue;
+        }
+
+        uint8_t *destination;
+        if (is_pinned(header)) {
+            destination = (uint8_t *)header;
+            if (step == MOVE) {
+                heap_fill(cursor - distance, destination);
+            }
+            distance = 0;
+        } else {
+            size_t padding = compact_padding(cursor, header);
+            if (step == MOVE) {
+                heap_fill(cursor - distance, cursor - distance + padding);
+            }
+            destination = cursor + padding - distance;
+        }
+        cursor = destination + distance + size;
+
+        if (step == FORWARD) {
+            header->forward = make_reference(jvm, destination + sizeof(HeapHeader));
+        } else if (step == UPDATE) {
+            visit_block(jvm, header + 1, 0, UINTPTR_MAX, update_reference, compaction);
+        } else if (destination == (uint8_t *)header) {
+            header->gc_flags = 0;
+        } else {
+            move_block(destination, header);
+        }
+    }
+    if (step == MOVE) {
+        heap_fill(cursor - distance, heap->heap + chunk[1].destination);
+        record_old_blocks(heap, chunk->destination, chunk[1].destination);
+    }
+}
+
+static void forward_task(void *context, uint32_t worker) {
+    (void)worker;
+    Compaction *compaction = context;
+    for (Chunk *chunk; (chunk = claim_chunk(compaction)) != NULL;) {
+        relocate_chunk(compaction, chunk, FORWARD);
+    }
+}
+
+static void update_task(void *context, uint32_t worker) {
+    (void)worker;
+    Compaction *compaction = context;
+    for (Chunk *chunk; (chunk = claim_chunk(compaction)) != NULL;) {
+        relocate_chunk(compaction, chunk, UPDATE);
+    }
+}
+
+static void move_task(void *context, uint32_t worker) {
+    (void)worker;
+    Compaction *compaction = context;
+    for (Chunk *chunk; (chunk = claim_chunk(compaction)) != NULL;) {
+        for (Chunk *earlier = compaction->chunks; earlier < chunk; earlier++) {
+            while (earlier[1].source > chunk->destination &&
+                   !__atomic_load_n(&earlier->moved, __ATOMIC_ACQUIRE)) {
+                sched_yield();
+            }
+        }
+        relocate_chunk(compaction, chunk, MOVE);
+        __atomic_store_n(&chunk->moved, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Cuts the old generation into chunks that start at blocks, found through
+// card_starts
+static Chunk *make_chunks(JVM *jvm, uint32_t *count) {
+    Heap *heap = &jvm->heap;
+    size_t top = heap->heap_top;
+    size_t wanted = 1;
+    if (jvm->gc_threads > 1) {
+        wanted = (size_t)jvm->gc_threads * CHUNKS_PER_THREAD;
+        if (wanted > top / COMPACTION_CHUNK + 1) {
+            wanted = top / COMPACTION_CHUNK + 1;
+        }
+    }
+    Chunk *chunks = calloc(wanted + 1, sizeof(Chunk));
+    if (chunks == NULL) {
+        fprintf(stderr, "Failed to allocate the compaction chunks\n");
+        exit(1);
+    }
+    size_t offset = OLD_GENERATION_START;
+    chunks[0].source = offset;
+    chunks[0].destination = offset;
+    for (size_t i = 1; i < wanted; i++) {
+        size_t target = top / wanted * i;
+        size_t start = (size_t)heap->card_starts[target >> CARD_SHIFT] * HEAP_ALIGNMENT;
+        if (offset < start) {
+            offset = start;
+        }
+        while (offset < target) {
+            offset += ((HeapHeader *)(heap->heap + offset))->size;
+        }
+        chunks[i].source = offset;
+    }
+    chunks[wanted].source = top;
+    *count = (uint32_t)wanted;
+    return chunks;
+}
+
+// Returns the new top of the old generation
+static size_t compact(JVM *jvm) {
+    Heap *heap = &jvm->heap;
+    Compaction compaction = { .jvm = jvm, .old_top = heap->heap_top };
+    compaction.chunks = make_chunks(jvm, &compaction.count);
+    Chunk *chunks = compaction.chunks;
+    gc_run_parallel(jvm, measure_task, &compaction);
+
+    // Each chunk keeps its old address modulo a cache line; the few bytes
+    // that takes are left as a filler
+    for (uint32_t i = 0; i + 1 < compaction.count; i++) {
+        size_t end = chunk_end(&chunks[i]);
+        chunks[i + 1].destination = end + ((chunks[i + 1].source - end) & (CACHE_LINE_SIZE - 1));
+    }
+    size_t top = chunk_end(&chunks[compaction.count - 1]);
+    chunks[compaction.count].destination = top;
+
+    compaction.next = 0;
+    gc_run_parallel(jvm, forward_task, &compaction);
+
+    compaction.next = 0;
+    gc_run_parallel(jvm, update_task, &compaction);
+    visit_roots(jvm, update_reference, &compaction);
+    visit_space(jvm, heap->eden, eden_used(heap), GC_MARKED, update_reference, &compaction);
+    visit_space(jvm, heap->from, heap->from_top, GC_MARKED, update_reference, &compaction);
+    visit_space(jvm, heap->to, heap->to_start, GC_MARKED, update_reference, &compaction);
+
+    compaction.next = 0;
+    gc_run_parallel(jvm, move_task, &compaction);
+    free(chunks);
+    return top;
+}
+
+void collect_full(JVM *jvm) {
+    Heap *heap = &jvm->heap;
+    size_t before = heap->heap_top;
+    tlab_retire(jvm);
+
+    mark(jvm);
+    // Only the live blocks a minor collection pinned in the survivor space
+    // have their references rewritten, so only they are kept
+    heap->to_start = keep_blocks(heap->to, heap->to_start, GC_MARKED);
+
+    size_t top = compact(jvm);
+    heap->heap_top = top;
+    jvm->gc_count++;
+    // The minor collection that follows pins young blocks anew
+    clear_gc_flags(heap->eden, eden_used(heap));
+    clear_gc_flags(heap->from, heap->from_top);
+    clear_gc_flags(heap->to, heap->to_start);
+    size_t young = (size_t)(heap->eden_top - heap->eden) + (size_t)(heap->from_top - heap->from);
+    heap_resize_old(heap, young);
+
+    // Blocks moved across cards: every card of the old generation is
+    // scanned once by the minor collection, which cleans them
+    size_t cards = (top + CARD_SIZE - 1) >> CARD_SHIFT;
+    memset(heap->cards, CARD_DIRTY, cards);
+    memset(heap->cards + cards, 0, (heap->old_size >> CARD_SHIFT) - cards);
+
+    if (jvm->verbose_gc) {
+        fprintf(stderr, "[GC %u (full): old %zuK -> %zuK/%zuK]\n", jvm->gc_count,
+                before / 1024, top / 1024, heap->old_limit / 1024);
+    }
+    collect_young(jvm);
+}
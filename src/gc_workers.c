@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+#include "jvm.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GC worker threads and the work-stealing deques they balance marking with.
+
+// Deque
+
+#define DEQUE_INITIAL_CAPACITY 1024
+
+static GcDequeArray *deque_array(int64_t capacity) {
+    GcDequeArray *array = malloc(sizeof(GcDequeArray) + sizeof(void *) * (size_t)capacity);
+    if (array == NULL) {
+        fprintf(stderr, "Failed to grow the mark stack\n");
+        exit(1);
+    }
+    array->capacity = capacity;
+    array->retired = NULL;
+    return array;
+}
+
+void gc_deque_init(GcDeque *deque) {
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = deque_array(DEQUE_INITIAL_CAPACITY);
+}
+
+// Thieves may still read an array the owner replaced, so they are all kept
+// until the deque is freed, when no thread uses it any more
+void gc_deque_free(GcDeque *deque) {
+    GcDequeArray *array = deque->array;
+    while (array != NULL) {
+        GcDequeArray *retired = array->retired;
+        free(array);
+        array = retired;
+    }
+    deque->array = NULL;
+}
+
+static void *load_slot(GcDequeArray *array, int64_t index) {
+    return __atomic_load_n(&array->slots[index & (array->capacity - 1)], __ATOMIC_RELAXED);
+}
+
+static void store_slot(GcDequeArray *array, int64_t index, void *item) {
+    __atomic_store_n(&array->slots[index & (array->capacity - 1)], item, __ATOMIC_RELAXED);
+}
+
+// The memory orderings follow Le, Pop, Cohen and Zappa Nardelli, "Correct
+// and efficient work-stealing for weak memory models" (PPoPP 2013)
+void gc_deque_push(GcDeque *deque, void *item) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    GcDequeArray *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    if (bottom - top > array->capacity - 1) {
+        GcDequeArray *grown = deque_array(array->capacity * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            store_slot(grown, i, load_slot(array, i));
+        }
+        grown->retired = array;
+        __atomic_store_n(&deque->array, grown, __ATOMIC_RELEASE);
+        array = grown;
+    }
+    store_slot(array, bottom, item);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+// Owner only: the item pushed last, or NULL when empty
+void *gc_deque_pop(GcDeque *deque) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    GcDequeArray *array = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    void *item = load_slot(array, bottom);
+    if (top == bottom) {
+        // The last item: whoever moves top first gets it
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            item = NULL;
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+// Any thread: the oldest item, or NULL when empty or lost to a race
+void *gc_deque_steal(GcDeque *deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    GcDequeArray *array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    void *item = load_slot(array, top);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return item;
+}
+
+bool gc_deque_empty(GcDeque *deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    return top >= bottom;
+}
+
+// Worker pool. The helper threads are started by the first parallel task
+// and then sleep between tasks; a task is posted by bumping generation.
+
+typedef struct GcWorkers {
+    pthread_mutex_t lock;
+    pthread_cond_t posted;     // a new task, or a new generation of one
+    pthread_cond_t finished;   // running dropped to 0
+    uint32_t started;          // helper threads
+    uint64_t generation;
+    uint32_t active;           // workers taking part in the current task
+    uint32_t running;          // helpers still inside it
+    GcTask task;
+    void *context;
+} GcWorkers;
+
+typedef struct {
+    GcWorkers *workers;
+    uint32_t id;
+    uint64_t generation;       // the last one before the thread started
+} Helper;
+
+static void *helper_main(void *argument) {
+    Helper *helper = argument;
+    GcWorkers *workers = helper->workers;
+    pthread_mutex_lock(&workers->lock);
+    uint64_t seen = helper->generation;
+    for (;;) {
+        while (workers->generation == seen) {
+            pthread_cond_wait(&workers->posted, &workers->lock);
+        }
+        seen = workers->generation;
+        if (helper->id >= workers->active) {
+            continue;
+        }
+        GcTask task = workers->task;
+        void *context = workers->context;
+        pthread_mutex_unlock(&workers->lock);
+        task(context, helper->id);
+        pthread_mutex_lock(&workers->lock);
+        if (--workers->running == 0) {
+            pthread_cond_signal(&workers->finished);
+        }
+    }
+    return NULL;
+}
+
+static GcWorkers *start_workers(JVM *jvm, uint32_t threads) {
+    GcWorkers *workers = jvm->gc_workers;
+    if (workers == NULL) {
+        workers = calloc(1, sizeof(GcWorkers));
+        if (workers == NULL) {
+            fprintf(stderr, "Failed to start GC threads\n");
+            exit(1);
+        }
+        pthread_mutex_init(&workers->lock, NULL);
+        pthread_cond_init(&workers->posted, NULL);
+        pthread_cond_init(&workers->finished, NULL);
+        jvm->gc_workers = workers;
+    }
+    while (workers->started + 1 < threads) {
+        Helper *helper = malloc(sizeof(Helper));
+        pthread_t thread;
+        if (helper == NULL) {
+            fprintf(stderr, "Failed to start GC threads\n");
+            exit(1);
+        }
+        helper->workers = workers;
+        helper->id = workers->started + 1;
+        pthread_mutex_lock(&workers->lock);
+        helper->generation = workers->generation;
+        int error = pthread_create(&thread, NULL, helper_main, helper);
+        if (error == 0) {
+            workers->started++;
+        }
+        pthread_mutex_unlock(&workers->lock);
+        if (error != 0) {
+            fprintf(stderr, "Failed to start GC threads: %s\n", strerror(error));
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+    return workers;
+}
+
+void gc_run_parallel(JVM *jvm, GcTask task, void *context) {
+    run_parallel(jvm, jvm->gc_threads, task, context);
+}
+
+void run_parallel(JVM *jvm, uint32_t threads, GcTask task, void *context) {
+    if (threads <= 1) {
+        task(context, 0);
+        return;
+    }
+    GcWorkers *workers = start_workers(jvm, threads);
+    pthread_mutex_lock(&workers->lock);
+    workers->task = task;
+    workers->context = context;
+    workers->active = threads;
+    workers->running = threads - 1;
+    workers->generation++;
+    pthread_cond_broadcast(&workers->posted);
+    pthread_mutex_unlock(&workers->lock);
+
+    task(context, 0);
+
+    pthread_mutex_lock(&workers->lock);
+    while (workers->running > 0) {
+        pthread_cond_wait(&workers->finished, &workers->lock);
+    }
+    pthread_mutex_unlock(&workers->lock);
+}
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <math.h>
 
 #define CONSTANT_Class              7
 #define CONSTANT_Fieldref           9
@@ -20,23 +21,64 @@
 #define CONSTANT_MethodHandle       15
 #define CONSTANT_MethodType         16
 #define CONSTANT_InvokeDynamic      18
-#define ARRAY_TYPE_INT    10
-#define ARRAY_TYPE_LONG   11
-#define ARRAY_TYPE_FLOAT  6
-#define ARRAY_TYPE_DOUBLE 7
-
-#define STACK_SIZE 1024
 
+#define ACC_PRIVATE 0x0002
+#define ACC_STATIC  0x0008
+#define ACC_FINAL   0x0010
+
+// Direct-threaded dispatch (GCC labels-as-values) is used whenever the
+// compiler supports it. Build with -DJVM_NO_THREADED_DISPATCH to fall back
+// to the portable instruction_table loop.
+#if defined(__GNUC__) && !defined(JVM_NO_THREADED_DISPATCH)
+#define JVM_THREADED_DISPATCH 1
+#endif
+
+// Handlers are inlined into the threaded loop so pc and the operand stack
+// never have to leave registers; the table loop calls them out of line.
+#ifdef JVM_THREADED_DISPATCH
+#define INLINE_HANDLER inline __attribute__((always_inline))
+#else
+#define INLINE_HANDLER
+#endif
+
+// Per-instruction trace output, enabled with -DJVM_TRACE (make TRACE=1)
+#ifdef JVM_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
+
+// Operand stack checks for the handlers of unverified methods. Code that
+// would run past either end of its operand stack cannot go on.
 #define CHECK_STACK(stack, required) \
     if ((stack)->size < (required)) { \
         fprintf(stderr, "Stack underflow - need %d values but have %d\n", \
-                required, (stack)->size); \
-        return; \
+                (int)(required), (stack)->size); \
+        exit(1); \
+    }
+
+#define CHECK_ROOM(stack, extra) \
+    if ((stack)->size + (extra) > (stack)->capacity) { \
+        fprintf(stderr, "Stack overflow - need %d more slots\n", (int)(extra)); \
+        exit(1); \
     }
 
+// An opcode without a handler cannot be skipped: the instructions after it
+// would run with the wrong stack depth or in the wrong order
+static void unknown_opcode(uint8_t opcode) {
+    fprintf(stderr, "Unknown opcode: 0x%02x\n", opcode);
+    exit(1);
+}
+
+// Neither can an instruction whose constant pool entry does not resolve;
+// the resolver has already reported why
+static void unresolved_entry(const Instruction *insn) {
+    fprintf(stderr, "Cannot resolve constant pool entry %d for opcode 0x%02x\n", insn->a, insn->opcode);
+    exit(1);
+}
+
 const char* get_constant_pool_string(ClassFile *class_file, uint16_t index);
 const char* get_string_constant(JVM *jvm, uint16_t index);
-void invoke_method(JVM *jvm, void *method_handle);
 
 bool operand_stack_push(OperandStack *stack, int32_t value);
 bool operand_stack_pop(OperandStack *stack, int32_t *value);
@@ -46,287 +88,1606 @@ bool validate_constant_pool_index(ClassFile *class_file, uint16_t index);
 void operand_stack_init(OperandStack *stack, int capacity);
 void print_stack_state(OperandStack *stack);
 
-typedef struct {
-    int32_t length;
-    void *elements;
-    uint8_t type; // ARRAY_TYPE_INT, etc.
-} Array;
+// Exceptions. Exception tables are decoded at link time (see
+// ExceptionHandler) and only looked at when something is thrown. A handler
+// in the throwing method continues right there; otherwise the frames are
+// searched outwards, each at the instruction of its pending call, and
+// control jumps straight to the run_frame activation of the frame that
+// catches it. Only methods with handlers set up such a catch point (see
+// run_catching_frame), so other calls and returns do no exception work.
+
+// An allocation may collect garbage, which finds the references of the
+// current frame through the reference map of the instruction at its pc, so
+// instructions that allocate record themselves there first
+static inline void allocation_point(JVM *jvm, uint32_t pc) {
+    jvm->current_frame->pc = pc;
+}
 
-typedef struct {
-    ClassFile *class;
-    void *fields;
-} Object;
+// The fields follow the block header directly. An object without fields
+// still gets a word, or its payload would be where the next block starts.
+static Object *new_object(JVM *jvm, Class *class) {
+    size_t size = class->instance_size ? class->instance_size : sizeof(int32_t);
+    Object *object = heap_allocate(jvm, size, HEAP_OBJECT);
+    ((HeapHeader *)object - 1)->class_id = class->id;
+    return object;
+}
 
-typedef struct {
-    uint16_t start_pc;
-    uint16_t end_pc;
-    uint16_t handler_pc;
-    uint16_t catch_type;
-} ExceptionHandler;
+static int32_t new_string(JVM *jvm, const char *text) {
+    size_t length = strlen(text);
+    JavaString *string = heap_allocate(jvm, sizeof(JavaString) + length, HEAP_STRING);
+    memcpy(string + 1, text, length);
+    string->length = (uint16_t)length;
+    string->bytes = (const uint8_t *)(string + 1);
+    return make_reference(jvm, string);
+}
 
-static void handle_nop(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    (*pc)++;
+static void print_class_name(const char *name) {
+    for (const char *c = name; *c; c++) {
+        fputc(*c == '/' ? '.' : *c, stderr);
+    }
 }
 
-static void handle_iconst(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint8_t opcode = bytecode[*pc];
-    int32_t value = opcode - ICONST_0;
-    operand_stack_push(stack, value);
-    printf("ICONST_%d: Pushed %d\n", value, value);
+// Prints the exception and the frames it went through, like the uncaught
+// exception handler of the main thread, and ends the program
+static void report_uncaught(JVM *jvm, Object *exception) {
+    fprintf(stderr, "Exception in thread \"main\" ");
+    print_class_name(object_class(jvm, exception)->name);
+    JavaString *message = dereference(jvm, *OBJECT_FIELD(exception, int32_t, THROWABLE_MESSAGE));
+    if (message) {
+        fprintf(stderr, ": %.*s", (int)message->length, (const char *)message->bytes);
+    }
+    fputc('\n', stderr);
+    for (Frame *frame = jvm->current_frame; frame != NULL; frame = frame->caller) {
+        fprintf(stderr, "\tat ");
+        print_class_name(frame->method->class->name);
+        fprintf(stderr, ".%s\n", frame->method->name);
+    }
+    exit(1);
+}
+
+// First handler of method covering instruction pc whose catch type is a
+// supertype of class. Catch types are resolved through the constant pool
+// cache, so each one is looked up by name only once.
+static ExceptionHandler *find_handler(JVM *jvm, Method *method, uint32_t pc, Class *class) {
+    for (uint16_t i = 0; i < method->exception_table_length; i++) {
+        ExceptionHandler *handler = &method->handlers[i];
+        if (pc < handler->start || pc >= handler->end) {
+            continue;
+        }
+        if (handler->catch_type == 0) {
+            return handler;
+        }
+        ResolvedEntry *entry = resolve_class(jvm, method->class, handler->catch_type);
+        if (entry && is_subclass_of(class, entry->class)) {
+            return handler;
+        }
+    }
+    return NULL;
+}
+
+// Throws exception (a non-null reference) at instruction *pc of the current
+// frame, whose live operand stack is stack
+static void throw_exception(JVM *jvm, uint32_t *pc, OperandStack *stack, int32_t exception) {
+    Class *class = object_class(jvm, dereference(jvm, exception));
+    ExceptionHandler *handler = find_handler(jvm, jvm->current_frame->method, *pc, class);
+    if (handler) {
+        stack->values[0] = exception;
+        stack->size = 1;
+        *pc = handler->handler;
+        return;
+    }
+
+    for (CatchPoint *point = jvm->catch_points; point != NULL; point = point->outer) {
+        Frame *frame = point->frame;
+        if (frame == jvm->current_frame) {
+            continue; // searched above
+        }
+        handler = find_handler(jvm, frame->method, frame->pc, class);
+        if (handler) {
+            while (jvm->current_frame != frame) {
+                frame_pop(jvm);
+            }
+            frame->stack.values[0] = exception;
+            frame->stack.size = 1;
+            frame->pc = handler->handler;
+            jvm->catch_points = point;
+            longjmp(point->buffer, 1);
+        }
+    }
+    report_uncaught(jvm, dereference(jvm, exception));
+}
+
+// Throws a new instance of one of the library exceptions
+static void throw_new(JVM *jvm, uint32_t *pc, OperandStack *stack, const char *class_name, const char *message) {
+    Class *class = find_class(jvm, class_name);
+    if (class == NULL) {
+        exit(1);
+    }
+    allocation_point(jvm, *pc);
+    int32_t exception = make_reference(jvm, new_object(jvm, class));
+    if (message) {
+        LocalRoot root = { &exception, jvm->local_roots };
+        jvm->local_roots = &root;
+        int32_t text = new_string(jvm, message);
+        int32_t *slot = OBJECT_FIELD(dereference(jvm, exception), int32_t, THROWABLE_MESSAGE);
+        *slot = text;
+        card_mark(jvm, slot);
+        jvm->local_roots = root.next;
+    }
+    throw_exception(jvm, pc, stack, exception);
+}
+
+static void throw_division_by_zero(JVM *jvm, uint32_t *pc, OperandStack *stack) {
+    throw_new(jvm, pc, stack, "java/lang/ArithmeticException", "/ by zero");
+}
+
+static void throw_index_out_of_bounds(JVM *jvm, uint32_t *pc, OperandStack *stack, int32_t index, int32_t length) {
+    char message[64];
+    snprintf(message, sizeof(message), "Index %d out of bounds for length %d", index, length);
+    throw_new(jvm, pc, stack, "java/lang/ArrayIndexOutOfBoundsException", message);
+}
+
+static void throw_null_pointer(JVM *jvm, uint32_t *pc, OperandStack *stack) {
+    throw_new(jvm, pc, stack, "java/lang/NullPointerException", NULL);
+}
+
+static INLINE_HANDLER void handle_athrow(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t exception = 0;
+    operand_stack_pop(stack, &exception);
+    if (dereference(jvm, exception) == NULL) {
+        throw_null_pointer(jvm, pc, stack);
+        return;
+    }
+    throw_exception(jvm, pc, stack, exception);
+}
+
+static INLINE_HANDLER void handle_nop(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     (*pc)++;
 }
 
 // Math operations
-static void handle_iadd(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_iadd(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t val2, val1;
+    CHECK_STACK(stack, 2);
     operand_stack_pop(stack, &val2);
     operand_stack_pop(stack, &val1);
-    int32_t result = val1 + val2;
+    int32_t result = (int32_t)((uint32_t)val1 + (uint32_t)val2);
     operand_stack_push(stack, result);
-    locals[7] = result;
-    printf("IADD: %d + %d = %d\n", val1, val2, result);
+    TRACE("IADD: %d + %d = %d\n", val1, val2, result);
     (*pc)++;
 }
 
-static void handle_isub(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_isub(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t val2, val1;
+    CHECK_STACK(stack, 2);
     operand_stack_pop(stack, &val2);
     operand_stack_pop(stack, &val1);
-    int32_t result = val1 - val2;
+    int32_t result = (int32_t)((uint32_t)val1 - (uint32_t)val2);
     operand_stack_push(stack, result);
-    locals[8] = result;
-    printf("ISUB: %d - %d = %d\n", val1, val2, result);
+    TRACE("ISUB: %d - %d = %d\n", val1, val2, result);
     (*pc)++;
 }
 
-static void handle_imul(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_imul(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t val2, val1;
+    CHECK_STACK(stack, 2);
     operand_stack_pop(stack, &val2);
     operand_stack_pop(stack, &val1);
-    int32_t result = val1 * val2;
+    int32_t result = (int32_t)((uint32_t)val1 * (uint32_t)val2);
     operand_stack_push(stack, result);
-    locals[9] = result;
-    printf("IMUL: %d * %d = %d\n", val1, val2, result);
+    TRACE("IMUL: %d * %d = %d\n", val1, val2, result);
     (*pc)++;
 }
 
-static void handle_idiv(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_idiv(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t val2, val1;
+    CHECK_STACK(stack, 2);
     operand_stack_pop(stack, &val2);
     operand_stack_pop(stack, &val1);
     if (val2 == 0) {
-        fprintf(stderr, "Division by zero\n");
+        throw_division_by_zero(jvm, pc, stack);
         return;
     }
-    int32_t result = val1 / val2;
+    // INT_MIN / -1 traps on x86, the JVM defines it as INT_MIN
+    int32_t result = (val2 == -1) ? (int32_t)(0u - (uint32_t)val1) : val1 / val2;
     operand_stack_push(stack, result);
-    locals[10] = result;
-    printf("IDIV: %d / %d = %d\n", val1, val2, result);
+    TRACE("IDIV: %d / %d = %d\n", val1, val2, result);
     (*pc)++;
 }
 
-static void handle_ior(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_ior(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t val2, val1;
+    CHECK_STACK(stack, 2);
     operand_stack_pop(stack, &val2);
     operand_stack_pop(stack, &val1);
     int32_t result = val1 | val2;
     operand_stack_push(stack, result);
-    locals[11] = result;
-    printf("IOR: %d | %d = %d\n", val1, val2, result);
+    TRACE("IOR: %d | %d = %d\n", val1, val2, result);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_iand(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    operand_stack_push(stack, val1 & val2);
+    TRACE("IAND: %d & %d = %d\n", val1, val2, val1 & val2);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_ixor(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    operand_stack_push(stack, val1 ^ val2);
+    TRACE("IXOR: %d ^ %d = %d\n", val1, val2, val1 ^ val2);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_irem(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    if (val2 == 0) {
+        throw_division_by_zero(jvm, pc, stack);
+        return;
+    }
+    // INT_MIN % -1 traps on x86, the JVM defines it as 0
+    int32_t result = (val2 == -1) ? 0 : val1 % val2;
+    operand_stack_push(stack, result);
+    TRACE("IREM: %d %% %d = %d\n", val1, val2, result);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_ineg(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t value;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &value);
+    operand_stack_push(stack, (int32_t)(0u - (uint32_t)value));
+    (*pc)++;
+}
+
+// Shifts only use the low 5 bits of the shift count
+static INLINE_HANDLER void handle_ishl(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    operand_stack_push(stack, (int32_t)((uint32_t)val1 << (val2 & 0x1F)));
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_ishr(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    operand_stack_push(stack, val1 >> (val2 & 0x1F));
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_iushr(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    operand_stack_push(stack, (int32_t)((uint32_t)val1 >> (val2 & 0x1F)));
+    (*pc)++;
+}
+
+// Push operations: iconst_<n>, bipush and sipush are all decoded to SIPUSH
+
+static INLINE_HANDLER void handle_sipush(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t value = code[*pc].a;
+    operand_stack_push(stack, value);
+    TRACE("SIPUSH: Pushed %d\n", value);
     (*pc)++;
 }
 
 // Load/Store operations
 
-static void handle_istore_n(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint8_t opcode = bytecode[*pc];
-    int32_t index = opcode - ISTORE_0;
+// iload_<n>/istore_<n> and the wide forms are decoded to ILOAD/ISTORE
+static INLINE_HANDLER void handle_istore(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t value;
+    CHECK_STACK(stack, 1);
     operand_stack_pop(stack, &value);
-    locals[index] = value;
+    locals[code[*pc].a] = value;
     (*pc)++;
 }
 
-static void handle_iload_n(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint8_t opcode = bytecode[*pc];
-    int32_t index = opcode - ILOAD_0;
-    operand_stack_push(stack, locals[index]);
+static INLINE_HANDLER void handle_iload(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    operand_stack_push(stack, locals[code[*pc].a]);
     (*pc)++;
 }
 
-static void handle_return(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+// References are int32 slots too, so aload/astore behave like iload/istore
+static INLINE_HANDLER void handle_aload(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    operand_stack_push(stack, locals[code[*pc].a]);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_astore(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t value;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &value);
+    locals[code[*pc].a] = value;
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_iinc(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    locals[code[*pc].a] += code[*pc].b;
+    (*pc)++;
+}
+
+// Control flow: branch operands hold the target instruction index
+
+// Taken backward branch of loop number loop - 1, with *pc already at the
+// loop header. Once the loop is hot the method is compiled and this very
+// activation continues in compiled code at the header (on-stack
+// replacement). The compiled code runs the method to completion, so the
+// interpreter then only has to reach the end sentinel and return.
+static void count_backedge(JVM *jvm, uint16_t loop, uint32_t *pc, OperandStack *stack) {
+    Frame *frame = jvm->current_frame;
+    Method *method = frame->method;
+    if (++method->loop_counters[loop - 1] < jvm->osr_threshold ||
+        !jvm->jit_enabled || method->jit_failed) {
+        return;
+    }
+    if (method->jit_code == NULL && !jit_compile(jvm, method)) {
+        return;
+    }
+
+    frame->stack.size = stack->size; // stack may be the interpreter's copy
+    method->jit_code(jvm, frame, *pc);
+    stack->size = frame->stack.size;
+    *pc = method->instruction_count;
+}
+
+static INLINE_HANDLER void handle_goto(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    *pc = insn->a;
+    if (insn->aux) {
+        count_backedge(jvm, insn->aux, pc, stack);
+    }
+}
+
+static bool compare_int(uint8_t condition, int32_t val1, int32_t val2) {
+    switch (condition) {
+        case 0: return val1 == val2;
+        case 1: return val1 != val2;
+        case 2: return val1 < val2;
+        case 3: return val1 >= val2;
+        case 4: return val1 > val2;
+        default: return val1 <= val2;
+    }
+}
+
+static INLINE_HANDLER void handle_if(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t value;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &value);
+    Instruction *insn = &code[*pc];
+    if (compare_int(insn->opcode - IFEQ, value, 0)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
+        }
+    } else {
+        (*pc)++;
+    }
+}
+
+static INLINE_HANDLER void handle_if_icmp(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    int32_t val2, val1;
+    CHECK_STACK(stack, 2);
+    operand_stack_pop(stack, &val2);
+    operand_stack_pop(stack, &val1);
+    Instruction *insn = &code[*pc];
+    if (compare_int(insn->opcode - IF_ICMPEQ, val1, val2)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
+        }
+    } else {
+        (*pc)++;
+    }
+}
+
+// Switch tables live in method->switch_data, see predecode_method
+static INLINE_HANDLER void handle_tableswitch(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    const int32_t *table = jvm->current_frame->method->switch_data + code[*pc].a;
+    int32_t key;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &key);
+    if (key < table[1] || key > table[2]) {
+        *pc = table[0];
+    } else {
+        *pc = table[3 + (key - table[1])];
+    }
+}
+
+static INLINE_HANDLER void handle_lookupswitch(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    const int32_t *table = jvm->current_frame->method->switch_data + code[*pc].a;
+    int32_t key;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &key);
+    // Pairs are sorted by match value
+    int32_t low = 0, high = table[1] - 1;
+    while (low <= high) {
+        int32_t mid = (low + high) / 2;
+        int32_t match = table[2 + 2 * mid];
+        if (key == match) {
+            *pc = table[3 + 2 * mid];
+            return;
+        }
+        if (key < match) high = mid - 1;
+        else low = mid + 1;
+    }
+    *pc = table[0];
+}
+
+static INLINE_HANDLER void handle_return(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     (*pc)++;
 }
 
 // Stack operations
-static void handle_dup(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_dup(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t value;
+    CHECK_STACK(stack, 1);
     operand_stack_pop(stack, &value);
     operand_stack_push(stack, value);
     operand_stack_push(stack, value);
-    printf("DUP: Duplicated %d\n", value);
+    TRACE("DUP: Duplicated %d\n", value);
     (*pc)++;
 }
 
-static void handle_pop(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+static INLINE_HANDLER void handle_pop(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
     int32_t value;
+    CHECK_STACK(stack, 1);
     operand_stack_pop(stack, &value);
-    printf("POP: Removed %d\n", value);
+    TRACE("POP: Removed %d\n", value);
     (*pc)++;
 }
 
-// 64-bit operations (category 2)
-static void handle_dadd(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    Cat2 val2 = operand_stack_pop_cat2(stack);
-    Cat2 val1 = operand_stack_pop_cat2(stack);
-    Cat2 result;
-    result.double_ = val1.double_ + val2.double_;
-    operand_stack_push_cat2(stack, result);
-    printf("DADD: %f + %f = %f\n", val1.double_, val2.double_, result.double_);
+// Long, float and double operations. A long or double takes two slots
+// holding its native 8-byte representation (see Cat2), so each access below
+// is a single 64-bit load or store. Floats are stored as their bit pattern
+// in one slot.
+
+static inline int64_t load_long(const int32_t *slots) {
+    int64_t value;
+    memcpy(&value, slots, sizeof(value));
+    return value;
+}
+
+static inline void store_long(int32_t *slots, int64_t value) {
+    memcpy(slots, &value, sizeof(value));
+}
+
+static inline double load_double(const int32_t *slots) {
+    double value;
+    memcpy(&value, slots, sizeof(value));
+    return value;
+}
+
+static inline void store_double(int32_t *slots, double value) {
+    memcpy(slots, &value, sizeof(value));
+}
+
+static inline float load_float(const int32_t *slot) {
+    float value;
+    memcpy(&value, slot, sizeof(value));
+    return value;
+}
+
+static inline void store_float(int32_t *slot, float value) {
+    memcpy(slot, &value, sizeof(value));
+}
+
+// Java float/double to int/long conversions: NaN is 0, out of range values
+// saturate
+static int32_t double_to_int(double value) {
+    if (value != value) return 0;
+    if (value >= 2147483647.0) return INT32_MAX;
+    if (value <= -2147483648.0) return INT32_MIN;
+    return (int32_t)value;
+}
+
+static int64_t double_to_long(double value) {
+    if (value != value) return 0;
+    if (value >= 9223372036854775807.0) return INT64_MAX;
+    if (value <= -9223372036854775808.0) return INT64_MIN;
+    return (int64_t)value;
+}
+
+// fcmpl/dcmpl give -1 when either value is NaN, fcmpg/dcmpg give 1
+static int32_t compare_floating(double val1, double val2, bool nan_greater) {
+    if (val1 > val2) return 1;
+    if (val1 < val2) return -1;
+    if (val1 == val2) return 0;
+    return nan_greater ? 1 : -1;
+}
+
+// dup_x1, dup_x2, dup2, dup2_x1, dup2_x2: copies the top `group` slots
+// below the `under` slots beneath them
+static inline void duplicate_slots(int32_t *top, int group, int under) {
+    int32_t copy[2];
+    memcpy(copy, top - group, sizeof(int32_t) * group);
+    memmove(top - under, top - group - under, sizeof(int32_t) * (group + under));
+    memcpy(top - group - under, copy, sizeof(int32_t) * group);
+}
+
+// Defines handle_<name> and, for verified methods, handle_<name>_verified
+// for an instruction that pops `pops` slots and pushes `pushes`. The body
+// works in place on top, the slot past the top of the stack on entry.
+#define SLOT_HANDLERS(name, pops, pushes, ...) \
+static INLINE_HANDLER void handle_##name(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) { \
+    CHECK_STACK(stack, pops); \
+    CHECK_ROOM(stack, (pushes) - (pops)); \
+    int32_t *top = stack->values + stack->size; \
+    __VA_ARGS__; \
+    stack->size += (pushes) - (pops); \
+    (*pc)++; \
+} \
+static INLINE_HANDLER void handle_##name##_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) { \
+    int32_t *top = stack->values + stack->size; \
+    __VA_ARGS__; \
+    stack->size += (pushes) - (pops); \
+    (*pc)++; \
+}
+
+#define LONG_BINARY_HANDLERS(name, expression) \
+    SLOT_HANDLERS(name, 4, 2, \
+        int64_t val1 = load_long(top - 4); \
+        int64_t val2 = load_long(top - 2); \
+        store_long(top - 4, expression))
+
+#define LONG_SHIFT_HANDLERS(name, expression) \
+    SLOT_HANDLERS(name, 3, 2, \
+        int64_t val1 = load_long(top - 3); \
+        int32_t shift = top[-1] & 0x3F; \
+        store_long(top - 3, expression))
+
+#define FLOAT_BINARY_HANDLERS(name, expression) \
+    SLOT_HANDLERS(name, 2, 1, \
+        float val1 = load_float(top - 2); \
+        float val2 = load_float(top - 1); \
+        store_float(top - 2, expression))
+
+#define DOUBLE_BINARY_HANDLERS(name, expression) \
+    SLOT_HANDLERS(name, 4, 2, \
+        double val1 = load_double(top - 4); \
+        double val2 = load_double(top - 2); \
+        store_double(top - 4, expression))
+
+// lconst_<n>, fconst_<n> and dconst_<n> push their opcode's offset
+SLOT_HANDLERS(lconst, 0, 2, store_long(top, code[*pc].opcode - LCONST_0))
+SLOT_HANDLERS(fconst, 0, 1, store_float(top, (float)(code[*pc].opcode - FCONST_0)))
+SLOT_HANDLERS(dconst, 0, 2, store_double(top, (double)(code[*pc].opcode - DCONST_0)))
+
+// lload/dload and lstore/dstore (fload/fstore share the int handlers)
+SLOT_HANDLERS(lload, 0, 2, store_long(top, load_long(locals + code[*pc].a)))
+SLOT_HANDLERS(lstore, 2, 0, store_long(locals + code[*pc].a, load_long(top - 2)))
+
+// Overflow wraps around, so the arithmetic is done unsigned
+LONG_BINARY_HANDLERS(ladd, (int64_t)((uint64_t)val1 + (uint64_t)val2))
+LONG_BINARY_HANDLERS(lsub, (int64_t)((uint64_t)val1 - (uint64_t)val2))
+LONG_BINARY_HANDLERS(lmul, (int64_t)((uint64_t)val1 * (uint64_t)val2))
+LONG_BINARY_HANDLERS(land, val1 & val2)
+LONG_BINARY_HANDLERS(lor, val1 | val2)
+LONG_BINARY_HANDLERS(lxor, val1 ^ val2)
+// LONG_MIN / -1 traps on x86, the JVM defines it as LONG_MIN (remainder 0)
+#define LONG_DIVISION_HANDLERS(name, expression) \
+    SLOT_HANDLERS(name, 4, 2, \
+        int64_t val1 = load_long(top - 4); \
+        int64_t val2 = load_long(top - 2); \
+        if (val2 == 0) { \
+            throw_division_by_zero(jvm, pc, stack); \
+            return; \
+        } \
+        store_long(top - 4, expression))
+
+LONG_DIVISION_HANDLERS(ldiv, val2 == -1 ? (int64_t)(0 - (uint64_t)val1) : val1 / val2)
+LONG_DIVISION_HANDLERS(lrem, val2 == -1 ? 0 : val1 % val2)
+SLOT_HANDLERS(lneg, 2, 2, store_long(top - 2, (int64_t)(0 - (uint64_t)load_long(top - 2))))
+
+// Shifts only use the low 6 bits of the shift count
+LONG_SHIFT_HANDLERS(lshl, (int64_t)((uint64_t)val1 << shift))
+LONG_SHIFT_HANDLERS(lshr, val1 >> shift)
+LONG_SHIFT_HANDLERS(lushr, (int64_t)((uint64_t)val1 >> shift))
+
+FLOAT_BINARY_HANDLERS(fadd, val1 + val2)
+FLOAT_BINARY_HANDLERS(fsub, val1 - val2)
+FLOAT_BINARY_HANDLERS(fmul, val1 * val2)
+FLOAT_BINARY_HANDLERS(fdiv, val1 / val2)
+FLOAT_BINARY_HANDLERS(frem, fmodf(val1, val2))
+SLOT_HANDLERS(fneg, 1, 1, store_float(top - 1, -load_float(top - 1)))
+
+DOUBLE_BINARY_HANDLERS(dadd, val1 + val2)
+DOUBLE_BINARY_HANDLERS(dsub, val1 - val2)
+DOUBLE_BINARY_HANDLERS(dmul, val1 * val2)
+DOUBLE_BINARY_HANDLERS(ddiv, val1 / val2)
+DOUBLE_BINARY_HANDLERS(drem, fmod(val1, val2))
+SLOT_HANDLERS(dneg, 2, 2, store_double(top - 2, -load_double(top - 2)))
+
+// Conversions
+SLOT_HANDLERS(i2l, 1, 2, store_long(top - 1, (int64_t)top[-1]))
+SLOT_HANDLERS(i2f, 1, 1, store_float(top - 1, (float)top[-1]))
+SLOT_HANDLERS(i2d, 1, 2, store_double(top - 1, (double)top[-1]))
+SLOT_HANDLERS(l2i, 2, 1, top[-2] = (int32_t)load_long(top - 2))
+SLOT_HANDLERS(l2f, 2, 1, store_float(top - 2, (float)load_long(top - 2)))
+SLOT_HANDLERS(l2d, 2, 2, store_double(top - 2, (double)load_long(top - 2)))
+SLOT_HANDLERS(f2i, 1, 1, top[-1] = double_to_int(load_float(top - 1)))
+SLOT_HANDLERS(f2l, 1, 2, store_long(top - 1, double_to_long(load_float(top - 1))))
+SLOT_HANDLERS(f2d, 1, 2, store_double(top - 1, (double)load_float(top - 1)))
+SLOT_HANDLERS(d2i, 2, 1, top[-2] = double_to_int(load_double(top - 2)))
+SLOT_HANDLERS(d2l, 2, 2, store_long(top - 2, double_to_long(load_double(top - 2))))
+SLOT_HANDLERS(d2f, 2, 1, store_float(top - 2, (float)load_double(top - 2)))
+SLOT_HANDLERS(i2b, 1, 1, top[-1] = (int8_t)top[-1])
+SLOT_HANDLERS(i2c, 1, 1, top[-1] = (uint16_t)top[-1])
+SLOT_HANDLERS(i2s, 1, 1, top[-1] = (int16_t)top[-1])
+
+// Comparisons
+SLOT_HANDLERS(lcmp, 4, 1,
+    int64_t val1 = load_long(top - 4);
+    int64_t val2 = load_long(top - 2);
+    top[-4] = (val1 > val2) - (val1 < val2))
+SLOT_HANDLERS(fcmp, 2, 1,
+    top[-2] = compare_floating(load_float(top - 2), load_float(top - 1), code[*pc].opcode == FCMPG))
+SLOT_HANDLERS(dcmp, 4, 1,
+    top[-4] = compare_floating(load_double(top - 4), load_double(top - 2), code[*pc].opcode == DCMPG))
+
+// Slot-wise stack manipulation; the verifier makes sure a long/double is
+// never split
+SLOT_HANDLERS(pop2, 2, 0, (void)top)
+SLOT_HANDLERS(dup_x1, 2, 3, duplicate_slots(top, 1, 1))
+SLOT_HANDLERS(dup_x2, 3, 4, duplicate_slots(top, 1, 2))
+SLOT_HANDLERS(dup2, 2, 4, duplicate_slots(top, 2, 0))
+SLOT_HANDLERS(dup2_x1, 3, 5, duplicate_slots(top, 2, 1))
+SLOT_HANDLERS(dup2_x2, 4, 6, duplicate_slots(top, 2, 2))
+SLOT_HANDLERS(swap, 2, 2,
+    int32_t value = top[-1];
+    top[-1] = top[-2];
+    top[-2] = value)
+
+// Arrays. Each array is one heap block: the Array header and then its
+// elements at their natural width (see Array). Elements spanning a cache
+// line or more start on a cache line boundary, so walking an array touches
+// no more lines than its elements need.
+static const uint8_t element_shifts[] = {
+    [ARRAY_TYPE_BOOLEAN] = 0, [ARRAY_TYPE_CHAR] = 1, [ARRAY_TYPE_FLOAT] = 2,
+    [ARRAY_TYPE_DOUBLE] = 3, [ARRAY_TYPE_BYTE] = 0, [ARRAY_TYPE_SHORT] = 1,
+    [ARRAY_TYPE_INT] = 2, [ARRAY_TYPE_LONG] = 3, [ARRAY_TYPE_REFERENCE] = 2,
+};
+
+// Zero-filled array of length (>= 0) elements of type
+static Array *new_array(JVM *jvm, uint8_t type, int32_t length) {
+    uint8_t shift = element_shifts[type];
+    size_t elements = (size_t)length << shift;
+    Array *array = elements < CACHE_LINE_SIZE
+        ? heap_allocate(jvm, sizeof(Array) + elements, HEAP_ARRAY)
+        : heap_allocate_aligned(jvm, sizeof(Array) + elements, HEAP_ARRAY, sizeof(Array));
+    array->length = length;
+    array->type = type;
+    array->element_shift = shift;
+    return array;
+}
+
+static bool valid_array_type(uint8_t type) {
+    return type >= ARRAY_TYPE_BOOLEAN && type <= ARRAY_TYPE_LONG;
+}
+
+static void throw_negative_array_size(JVM *jvm, uint32_t *pc, OperandStack *stack, int32_t count) {
+    char message[16];
+    snprintf(message, sizeof(message), "%d", count);
+    throw_new(jvm, pc, stack, "java/lang/NegativeArraySizeException", message);
+}
+
+// newarray and anewarray replace the count on top of the stack with the
+// new array
+SLOT_HANDLERS(newarray, 1, 1,
+    uint8_t type = (uint8_t)code[*pc].aux;
+    if (!valid_array_type(type)) {
+        fprintf(stderr, "Invalid newarray type %d\n", type);
+        exit(1);
+    }
+    if (top[-1] < 0) {
+        throw_negative_array_size(jvm, pc, stack, top[-1]);
+        return;
+    }
+    allocation_point(jvm, *pc);
+    top[-1] = make_reference(jvm, new_array(jvm, type, top[-1])))
+
+SLOT_HANDLERS(anewarray, 1, 1,
+    if (top[-1] < 0) {
+        throw_negative_array_size(jvm, pc, stack, top[-1]);
+        return;
+    }
+    allocation_point(jvm, *pc);
+    top[-1] = make_reference(jvm, new_array(jvm, ARRAY_TYPE_REFERENCE, top[-1])))
+
+// Array of counts[0] arrays of counts[1] ... for the remaining dimensions of
+// an array class with depth dimensions whose innermost arrays hold
+// leaf_type; levels that are not created stay null. The arrays under
+// construction are kept alive as local roots.
+static int32_t new_multi_array(JVM *jvm, const int32_t *counts, int created, int depth, uint8_t leaf_type) {
+    uint8_t type = depth == 1 ? leaf_type : ARRAY_TYPE_REFERENCE;
+    int32_t reference = make_reference(jvm, new_array(jvm, type, counts[0]));
+    if (created > 1) {
+        LocalRoot root = { &reference, jvm->local_roots };
+        jvm->local_roots = &root;
+        for (int32_t i = 0; i < counts[0]; i++) {
+            int32_t element = new_multi_array(jvm, counts + 1, created - 1, depth - 1, leaf_type);
+            int32_t *slot = (int32_t *)ARRAY_ELEMENTS(dereference(jvm, reference)) + i;
+            *slot = element;
+            card_mark(jvm, slot);
+        }
+        jvm->local_roots = root.next;
+    }
+    return reference;
+}
+
+// The shape of the array class was decoded at link time (array_shape)
+static INLINE_HANDLER void handle_multianewarray(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    int created = insn->aux;
+    if (insn->b < 0 || created == 0 || created > insn->b >> 8) {
+        fprintf(stderr, "Invalid multianewarray\n");
+        exit(1);
+    }
+    CHECK_STACK(stack, created);
+    int32_t *counts = stack->values + stack->size - created;
+    for (int i = 0; i < created; i++) {
+        if (counts[i] < 0) {
+            throw_negative_array_size(jvm, pc, stack, counts[i]);
+            return;
+        }
+    }
+    allocation_point(jvm, *pc);
+    int32_t array = new_multi_array(jvm, counts, created, insn->b >> 8, (uint8_t)insn->b);
+    stack->size -= created;
+    stack->values[stack->size++] = array;
     (*pc)++;
 }
 
-static void handle_newarray(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint8_t atype = bytecode[(*pc) + 1];
-    int32_t count;
-    operand_stack_pop(stack, &count);
-    
-    if (count < 0) {
-        // Throw NegativeArraySizeException
+SLOT_HANDLERS(arraylength, 1, 1,
+    Array *array = dereference(jvm, top[-1]);
+    if (!array) {
+        throw_null_pointer(jvm, pc, stack);
         return;
     }
-    
-    Array *array = malloc(sizeof(Array));
-    array->length = count;
-    array->type = atype;
-    array->elements = calloc(count, sizeof(int32_t));
+    top[-1] = array->length)
+
+// Array of the reference with element size 1 << shift in which index is
+// valid, or NULL after throwing. The element size check keeps code that
+// mixes up array types (nothing verifies element types) inside the block.
+static INLINE_HANDLER Array *checked_array(JVM *jvm, uint32_t *pc, OperandStack *stack,
+                                           int32_t reference, int32_t index, uint8_t shift) {
+    Array *array = dereference(jvm, reference);
+    if (!array) {
+        throw_null_pointer(jvm, pc, stack);
+        return NULL;
+    }
+    if ((uint32_t)index >= (uint32_t)array->length) {
+        throw_index_out_of_bounds(jvm, pc, stack, index, array->length);
+        return NULL;
+    }
+    if (array->element_shift != shift) {
+        fprintf(stderr, "Array element type mismatch\n");
+        exit(1);
+    }
+    return array;
+}
 
-    intptr_t arrayref = (intptr_t)array;
-    operand_stack_push(stack, arrayref);
-    *pc += 2;
+// <t>aload: arrayref, index -> value (pushes slots); the value is read as
+// element_type and written with store
+#define ARRAY_LOAD_HANDLERS(name, element_type, shift, pushes, store) \
+    SLOT_HANDLERS(name, 2, pushes, \
+        Array *array = checked_array(jvm, pc, stack, top[-2], top[-1], shift); \
+        if (!array) { \
+            return; \
+        } \
+        element_type value = ((element_type *)ARRAY_ELEMENTS(array))[top[-1]]; \
+        store)
+
+// <t>astore: arrayref, index, value (slots) -> ; barrier runs on the
+// stored element
+#define ARRAY_STORE_HANDLERS(name, element_type, shift, slots, value, barrier) \
+    SLOT_HANDLERS(name, 2 + (slots), 0, \
+        int32_t *operands = top - 2 - (slots); \
+        Array *array = checked_array(jvm, pc, stack, operands[0], operands[1], shift); \
+        if (!array) { \
+            return; \
+        } \
+        element_type *element = (element_type *)ARRAY_ELEMENTS(array) + operands[1]; \
+        *element = (element_type)(value); \
+        barrier)
+
+ARRAY_LOAD_HANDLERS(iaload, int32_t, 2, 1, top[-2] = value)
+ARRAY_LOAD_HANDLERS(laload, int64_t, 3, 2, store_long(top - 2, value))
+ARRAY_LOAD_HANDLERS(faload, float, 2, 1, store_float(top - 2, value))
+ARRAY_LOAD_HANDLERS(daload, double, 3, 2, store_double(top - 2, value))
+ARRAY_LOAD_HANDLERS(aaload, int32_t, 2, 1, top[-2] = value)
+ARRAY_LOAD_HANDLERS(baload, int8_t, 0, 1, top[-2] = value)
+ARRAY_LOAD_HANDLERS(caload, uint16_t, 1, 1, top[-2] = value)
+ARRAY_LOAD_HANDLERS(saload, int16_t, 1, 1, top[-2] = value)
+
+ARRAY_STORE_HANDLERS(iastore, int32_t, 2, 1, top[-1], )
+ARRAY_STORE_HANDLERS(lastore, int64_t, 3, 2, load_long(top - 2), )
+ARRAY_STORE_HANDLERS(fastore, float, 2, 1, load_float(top - 1), )
+ARRAY_STORE_HANDLERS(dastore, double, 3, 2, load_double(top - 2), )
+ARRAY_STORE_HANDLERS(aastore, int32_t, 2, 1, top[-1], card_mark(jvm, element))
+// bastore truncates to a byte, or to the low bit for boolean arrays
+ARRAY_STORE_HANDLERS(bastore, int8_t, 0, 1,
+    array->type == ARRAY_TYPE_BOOLEAN ? top[-1] & 1 : top[-1], )
+ARRAY_STORE_HANDLERS(castore, uint16_t, 1, 1, top[-1], )
+ARRAY_STORE_HANDLERS(sastore, int16_t, 1, 1, top[-1], )
+
+// Constant pool instructions are quickened: the first execution resolves the
+// entry into current_class->resolved and rewrites the instruction into its
+// _QUICK form, then re-dispatches without advancing pc. Later executions go
+// straight to the cached entry.
+#define CURRENT_CLASS(jvm) ((jvm)->current_frame->method->class)
+
+static INLINE_HANDLER void handle_new(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    if (!resolve_class(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a)) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].opcode = NEW_QUICK;
 }
 
-static void handle_iastore(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    int32_t value, index, arrayref;
-    operand_stack_pop(stack, &value);
-    operand_stack_pop(stack, &index);
-    operand_stack_pop(stack, &arrayref);
-    
-    Array *array = (Array *)(intptr_t)arrayref;
-    if (!array || index < 0 || index >= array->length) {
-        // Throw ArrayIndexOutOfBoundsException
+static INLINE_HANDLER void handle_new_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Class *class = CURRENT_CLASS(jvm)->resolved[code[*pc].a].class;
+    allocation_point(jvm, *pc);
+    operand_stack_push(stack, make_reference(jvm, new_object(jvm, class)));
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_getstatic(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    if (!resolve_static_field(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a)) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].opcode = GETSTATIC_QUICK;
+}
+
+static INLINE_HANDLER void handle_getstatic_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    ResolvedEntry *entry = &CURRENT_CLASS(jvm)->resolved[code[*pc].a];
+    operand_stack_push(stack, entry->static_value[0]);
+    if (entry->slots == 2) {
+        operand_stack_push(stack, entry->static_value[1]);
+    }
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_putstatic(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    if (!resolve_static_field(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a)) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].opcode = PUTSTATIC_QUICK;
+}
+
+static INLINE_HANDLER void handle_putstatic_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    ResolvedEntry *entry = &CURRENT_CLASS(jvm)->resolved[code[*pc].a];
+    if (entry->slots == 2) {
+        operand_stack_pop(stack, &entry->static_value[1]);
+    }
+    operand_stack_pop(stack, &entry->static_value[0]);
+    (*pc)++;
+}
+
+// getfield and putfield resolve the field, then quicken into the form for
+// its width with the field's offset in b, so that each later execution is
+// a single load or store
+static INLINE_HANDLER void handle_getfield(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    ResolvedEntry *entry = resolve_field(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a);
+    if (!entry) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].b = (int32_t)entry->field_offset;
+    switch (entry->field_type) {
+        case 'J': case 'D': code[*pc].opcode = GETFIELD_LONG_QUICK; break;
+        case 'B': case 'Z': code[*pc].opcode = GETFIELD_BYTE_QUICK; break;
+        case 'C': code[*pc].opcode = GETFIELD_CHAR_QUICK; break;
+        case 'S': code[*pc].opcode = GETFIELD_SHORT_QUICK; break;
+        default: code[*pc].opcode = GETFIELD_QUICK; break;
+    }
+}
+
+static INLINE_HANDLER void handle_putfield(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    ResolvedEntry *entry = resolve_field(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a);
+    if (!entry) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].b = (int32_t)entry->field_offset;
+    switch (entry->field_type) {
+        case 'J': case 'D': code[*pc].opcode = PUTFIELD_LONG_QUICK; break;
+        case 'L': case '[': code[*pc].opcode = PUTFIELD_REFERENCE_QUICK; break;
+        case 'B': code[*pc].opcode = PUTFIELD_BYTE_QUICK; break;
+        case 'Z': code[*pc].opcode = PUTFIELD_BOOLEAN_QUICK; break;
+        case 'C': case 'S': code[*pc].opcode = PUTFIELD_CHAR_QUICK; break;
+        default: code[*pc].opcode = PUTFIELD_QUICK; break;
+    }
+}
+
+// getfield_<width>_quick: objectref -> value (pushes slots)
+#define GETFIELD_HANDLERS(name, field_type, pushes, store) \
+    SLOT_HANDLERS(name, 1, pushes, \
+        Object *object = dereference(jvm, top[-1]); \
+        if (!object) { \
+            throw_null_pointer(jvm, pc, stack); \
+            return; \
+        } \
+        field_type value = *OBJECT_FIELD(object, field_type, code[*pc].b); \
+        store)
+
+// putfield_<width>_quick: objectref, value (slots) -> ; barrier runs on the
+// stored field
+#define PUTFIELD_HANDLERS(name, field_type, slots, value, barrier) \
+    SLOT_HANDLERS(name, 1 + (slots), 0, \
+        int32_t *operands = top - 1 - (slots); \
+        Object *object = dereference(jvm, operands[0]); \
+        if (!object) { \
+            throw_null_pointer(jvm, pc, stack); \
+            return; \
+        } \
+        field_type *field = OBJECT_FIELD(object, field_type, code[*pc].b); \
+        *field = (field_type)(value); \
+        barrier)
+
+GETFIELD_HANDLERS(getfield_quick, int32_t, 1, top[-1] = value)
+GETFIELD_HANDLERS(getfield_long_quick, int64_t, 2, store_long(top - 1, value))
+GETFIELD_HANDLERS(getfield_byte_quick, int8_t, 1, top[-1] = value)
+GETFIELD_HANDLERS(getfield_char_quick, uint16_t, 1, top[-1] = value)
+GETFIELD_HANDLERS(getfield_short_quick, int16_t, 1, top[-1] = value)
+PUTFIELD_HANDLERS(putfield_quick, int32_t, 1, operands[1], (void)0)
+PUTFIELD_HANDLERS(putfield_reference_quick, int32_t, 1, operands[1], card_mark(jvm, field))
+PUTFIELD_HANDLERS(putfield_long_quick, int64_t, 2, load_long(operands + 1), (void)0)
+PUTFIELD_HANDLERS(putfield_byte_quick, int8_t, 1, operands[1], (void)0)
+PUTFIELD_HANDLERS(putfield_boolean_quick, int8_t, 1, operands[1] & 1, (void)0)
+PUTFIELD_HANDLERS(putfield_char_quick, uint16_t, 1, operands[1], (void)0)
+
+static INLINE_HANDLER void handle_ldc(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    allocation_point(jvm, *pc); // a string constant is interned on first use
+    if (!resolve_constant(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a)) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].opcode = LDC_QUICK;
+}
+
+static INLINE_HANDLER void handle_ldc_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    operand_stack_push(stack, CURRENT_CLASS(jvm)->resolved[code[*pc].a].constant);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_ldc2_w(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    if (!resolve_constant(jvm, CURRENT_CLASS(jvm), (uint16_t)code[*pc].a)) {
+        unresolved_entry(&code[*pc]);
+    }
+    code[*pc].opcode = LDC2_W_QUICK;
+}
+
+SLOT_HANDLERS(ldc2_w_quick, 0, 2, store_long(top, CURRENT_CLASS(jvm)->resolved[code[*pc].a].wide_constant))
+
+// Method invocation. Arguments stay on the caller's operand stack and become
+// the callee's first locals (see frame_push); invoke_method leaves the return
+// value in their place. The slow handlers quicken into a direct call, a
+// native call or an inline cached virtual call.
+
+// The calling frame remembers the instruction of the call, which is where
+// a throw in the callee looks for its handlers
+static inline void invoke_from(JVM *jvm, uint32_t pc, Method *method, OperandStack *stack) {
+    jvm->current_frame->pc = pc;
+    invoke_method(jvm, method, stack);
+}
+
+static void quicken_direct_invoke(JVM *jvm, Instruction *insn, bool is_static) {
+    ResolvedEntry *entry = resolve_method(jvm, CURRENT_CLASS(jvm), (uint16_t)insn->a);
+    if (!entry) {
+        unresolved_entry(insn);
+    }
+    if (entry->kind == RESOLVED_NATIVE) {
+        insn->opcode = INVOKE_NATIVE_QUICK;
         return;
     }
-    
-    ((int32_t *)array->elements)[index] = value;
+    if (((entry->method->access_flags & ACC_STATIC) != 0) != is_static) {
+        fprintf(stderr, "IncompatibleClassChangeError: %s.%s%s\n", entry->method->class->name,
+                entry->method->name, entry->method->descriptor);
+        exit(1);
+    }
+    insn->opcode = INVOKE_DIRECT_QUICK;
+}
+
+static INLINE_HANDLER void handle_invokestatic(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    quicken_direct_invoke(jvm, &code[*pc], true);
+}
+
+static INLINE_HANDLER void handle_invokespecial(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    quicken_direct_invoke(jvm, &code[*pc], false);
+}
+
+// Instance methods bound directly (invokespecial, private and final
+// targets) still need a receiver
+static INLINE_HANDLER void handle_invoke_direct_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Method *method = CURRENT_CLASS(jvm)->resolved[code[*pc].a].method;
+    if (!(method->access_flags & ACC_STATIC) &&
+        dereference(jvm, stack->values[stack->size - method->arg_slots]) == NULL) {
+        throw_null_pointer(jvm, pc, stack);
+        return;
+    }
+    invoke_from(jvm, *pc, method, stack);
     (*pc)++;
 }
 
-static void handle_new(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint16_t index = (bytecode[(*pc) + 1] << 8) | bytecode[(*pc) + 2];
-    cp_info *classref = &jvm->class_file.constant_pool[index - 1];
-    
-    Object *obj = malloc(sizeof(Object));
-    obj->class = &jvm->class_file; // Should load actual class
-    obj->fields = calloc(1, 1024); // Fixed size for now
-    
-    intptr_t objref = (intptr_t)obj;
-    operand_stack_push(stack, (int32_t)obj);
-    *pc += 3;
+static INLINE_HANDLER void handle_invoke_native_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    CURRENT_CLASS(jvm)->resolved[code[*pc].a].native(jvm, stack);
+    (*pc)++;
 }
 
-static void handle_exception(JVM *jvm, Object *exception, uint32_t *pc, OperandStack *stack) {
-    // Find exception handler in current method
-    attribute_info *code_attr = NULL; // Get current method's Code attribute
-    
-    if (!code_attr) return;
-    
-    // Exception table is after bytecode
-    uint8_t *exception_table = code_attr->info + 8 + code_attr->attribute_length;
-    uint16_t exception_table_length = (exception_table[0] << 8) | exception_table[1];
-    
-    ExceptionHandler *handlers = (ExceptionHandler *)(exception_table + 2);
-    
-    for (int i = 0; i < exception_table_length; i++) {
-        if (*pc >= handlers[i].start_pc && *pc < handlers[i].end_pc) {
-            if (handlers[i].catch_type == 0 || handlers[i].catch_type == exception->class->this_class) {
-                // Found handler
-                *pc = handlers[i].handler_pc;
-                intptr_t exref = (intptr_t)exception;
-                operand_stack_push(stack, exref);
-                return;
-            }
+// Also used for invokeinterface. Private and final targets cannot be
+// overridden and are called directly; everything else goes through the call
+// site's inline cache, starting in the empty INVOKEVIRTUAL_QUICK state.
+static INLINE_HANDLER void handle_invokevirtual(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    ResolvedEntry *entry = resolve_method(jvm, CURRENT_CLASS(jvm), (uint16_t)insn->a);
+    if (!entry) {
+        unresolved_entry(insn);
+    }
+    if (entry->kind == RESOLVED_NATIVE) {
+        insn->opcode = INVOKE_NATIVE_QUICK;
+        return;
+    }
+    if (entry->method->access_flags & (ACC_PRIVATE | ACC_FINAL)) {
+        insn->opcode = INVOKE_DIRECT_QUICK;
+        return;
+    }
+    jvm->current_frame->method->call_sites[insn->b].arg_slots = entry->method->arg_slots;
+    insn->opcode = INVOKEVIRTUAL_QUICK;
+}
+
+#define CALL_SITE(jvm, insn) (&(jvm)->current_frame->method->call_sites[(insn)->b])
+#define RECEIVER(jvm, stack, site) \
+    ((Object *)dereference(jvm, (stack)->values[(stack)->size - (site)->arg_slots]))
+
+// receiver is not null: the handlers throw NullPointerException before
+// looking anything up
+static Method *lookup_receiver_target(JVM *jvm, Instruction *insn, Object *receiver) {
+    Method *declared = CURRENT_CLASS(jvm)->resolved[insn->a].method;
+    Method *target = lookup_virtual(object_class(jvm, receiver), declared);
+    if (target == NULL) {
+        fprintf(stderr, "AbstractMethodError: %s.%s%s\n", object_class(jvm, receiver)->name,
+                declared->name, declared->descriptor);
+        exit(1);
+    }
+    return target;
+}
+
+// Inline cache miss: look the target up, remember it for this receiver class
+// while there is room and move the site to the next state
+static void call_site_miss(JVM *jvm, uint32_t pc, Instruction *insn, CallSite *site, OperandStack *stack) {
+    Object *receiver = RECEIVER(jvm, stack, site);
+    Method *target = lookup_receiver_target(jvm, insn, receiver);
+
+    if (site->count < INLINE_CACHE_SIZE) {
+        site->classes[site->count] = object_class(jvm, receiver);
+        site->targets[site->count] = target;
+        site->count++;
+        insn->opcode = site->count == 1 ? INVOKEVIRTUAL_MONO : INVOKEVIRTUAL_POLY;
+    } else {
+        insn->opcode = INVOKEVIRTUAL_MEGA;
+    }
+    invoke_from(jvm, pc, target, stack);
+}
+
+static INLINE_HANDLER void handle_invokevirtual_quick(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    CallSite *site = CALL_SITE(jvm, &code[*pc]);
+    if (RECEIVER(jvm, stack, site) == NULL) {
+        throw_null_pointer(jvm, pc, stack);
+        return;
+    }
+    call_site_miss(jvm, *pc, &code[*pc], site, stack);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_invokevirtual_mono(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    CallSite *site = CALL_SITE(jvm, insn);
+    Object *receiver = RECEIVER(jvm, stack, site);
+    if (receiver && object_class(jvm, receiver) == site->classes[0]) {
+        invoke_from(jvm, *pc, site->targets[0], stack);
+    } else if (receiver) {
+        call_site_miss(jvm, *pc, insn, site, stack);
+    } else {
+        throw_null_pointer(jvm, pc, stack);
+        return;
+    }
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_invokevirtual_poly(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    CallSite *site = CALL_SITE(jvm, insn);
+    Object *receiver = RECEIVER(jvm, stack, site);
+    if (receiver == NULL) {
+        throw_null_pointer(jvm, pc, stack);
+        return;
+    }
+    for (int i = 0; i < site->count; i++) {
+        if (object_class(jvm, receiver) == site->classes[i]) {
+            invoke_from(jvm, *pc, site->targets[i], stack);
+            (*pc)++;
+            return;
         }
     }
-    
-    // No handler found, propagate to caller
+    call_site_miss(jvm, *pc, insn, site, stack);
+    (*pc)++;
 }
 
-static void handle_invokevirtual(JVM *jvm, uint8_t *bytecode, uint32_t *pc, OperandStack *stack, int32_t *locals) {
-    uint16_t index = (bytecode[*pc + 1] << 8) | bytecode[*pc + 2];
-    
-    if (!validate_constant_pool_index(&jvm->class_file, index)) {
+static INLINE_HANDLER void handle_invokevirtual_mega(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    Object *receiver = RECEIVER(jvm, stack, CALL_SITE(jvm, insn));
+    if (receiver == NULL) {
+        throw_null_pointer(jvm, pc, stack);
         return;
     }
+    invoke_from(jvm, *pc, lookup_receiver_target(jvm, insn, receiver), stack);
+    (*pc)++;
+}
 
-    cp_info *methodref = &jvm->class_file.constant_pool[index - 1];
-    if (methodref->tag == CONSTANT_Methodref) {
-        (void)methodref->info.Methodref.class_index; // Silence warning
-        uint16_t class_index = methodref->info.Methodref.class_index;
-        uint16_t name_and_type_index = methodref->info.Methodref.name_and_type_index;
-        
-        cp_info *name_and_type = &jvm->class_file.constant_pool[name_and_type_index - 1];
-        uint16_t name_index = name_and_type->info.NameAndType.name_index;
-        
-        const char *method_name = get_constant_pool_string(&jvm->class_file, name_index);
-        
-        if (method_name && strcmp(method_name, "println") == 0) {
-            int32_t value;
-            if (operand_stack_pop(stack, &value)) {
-                int32_t dummy;
-                operand_stack_pop(stack, &dummy);
-                printf("%d\n", value);
-            }
+// Superinstructions: each one runs a whole fused sequence and then skips
+// the original instructions, which are still in the stream behind it
+
+static INLINE_HANDLER void handle_iload_iload_iadd_istore(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    locals[insn->aux] = (int32_t)((uint32_t)locals[insn->a] + (uint32_t)locals[insn->b]);
+    *pc += 4;
+}
+
+static INLINE_HANDLER void handle_sipush_if_icmp(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    int32_t value;
+    CHECK_STACK(stack, 1);
+    operand_stack_pop(stack, &value);
+    if (compare_int(insn->reserved, value, insn->b)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
         }
+    } else {
+        *pc += 2;
     }
-    
+}
+
+static INLINE_HANDLER void handle_aload_iload_iaload(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    Array *array = dereference(jvm, locals[insn->a]);
+    int32_t index = locals[insn->b];
+    if (!array || (uint32_t)index >= (uint32_t)array->length || array->element_shift != 2) {
+        // Let iaload itself report the failure
+        *pc += 2;
+        operand_stack_push(stack, locals[insn->a]);
+        operand_stack_push(stack, index);
+        return;
+    }
+    operand_stack_push(stack, ((int32_t *)ARRAY_ELEMENTS(array))[index]);
     *pc += 3;
 }
 
+// Verified fast path. verify_method has proven the stack depth and slot
+// types at every instruction of these methods, so their handlers pop and
+// push without bounds checks. Only the instructions that do nothing but
+// move values around have a verified form; the rest keep their checked
+// handlers, whose checks are noise next to the work they do.
+
+static inline void push_verified(OperandStack *stack, int32_t value) {
+    stack->values[stack->size++] = value;
+}
+
+static inline int32_t pop_verified(OperandStack *stack) {
+    return stack->values[--stack->size];
+}
+
+#define VERIFIED_BINARY_HANDLER(name, expression) \
+static INLINE_HANDLER void handle_##name##_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) { \
+    int32_t val2 = pop_verified(stack); \
+    int32_t val1 = pop_verified(stack); \
+    push_verified(stack, expression); \
+    (*pc)++; \
+}
+
+VERIFIED_BINARY_HANDLER(iadd, (int32_t)((uint32_t)val1 + (uint32_t)val2))
+VERIFIED_BINARY_HANDLER(isub, (int32_t)((uint32_t)val1 - (uint32_t)val2))
+VERIFIED_BINARY_HANDLER(imul, (int32_t)((uint32_t)val1 * (uint32_t)val2))
+VERIFIED_BINARY_HANDLER(iand, val1 & val2)
+VERIFIED_BINARY_HANDLER(ior, val1 | val2)
+VERIFIED_BINARY_HANDLER(ixor, val1 ^ val2)
+VERIFIED_BINARY_HANDLER(ishl, (int32_t)((uint32_t)val1 << (val2 & 0x1F)))
+VERIFIED_BINARY_HANDLER(ishr, val1 >> (val2 & 0x1F))
+VERIFIED_BINARY_HANDLER(iushr, (int32_t)((uint32_t)val1 >> (val2 & 0x1F)))
+
+#undef VERIFIED_BINARY_HANDLER
+
+static INLINE_HANDLER void handle_ineg_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    push_verified(stack, (int32_t)(0u - (uint32_t)pop_verified(stack)));
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_sipush_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    push_verified(stack, code[*pc].a);
+    (*pc)++;
+}
+
+// Also aload: references are int32 slots
+static INLINE_HANDLER void handle_iload_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    push_verified(stack, locals[code[*pc].a]);
+    (*pc)++;
+}
+
+// Also astore
+static INLINE_HANDLER void handle_istore_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    locals[code[*pc].a] = pop_verified(stack);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_dup_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    push_verified(stack, stack->values[stack->size - 1]);
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_pop_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    stack->size--;
+    (*pc)++;
+}
+
+static INLINE_HANDLER void handle_if_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    if (compare_int(insn->opcode - IFEQ, pop_verified(stack), 0)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
+        }
+    } else {
+        (*pc)++;
+    }
+}
+
+static INLINE_HANDLER void handle_if_icmp_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    int32_t val2 = pop_verified(stack);
+    int32_t val1 = pop_verified(stack);
+    if (compare_int(insn->opcode - IF_ICMPEQ, val1, val2)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
+        }
+    } else {
+        (*pc)++;
+    }
+}
+
+static INLINE_HANDLER void handle_sipush_if_icmp_verified(JVM *jvm, Instruction *code, uint32_t *pc, OperandStack *stack, int32_t *locals) {
+    Instruction *insn = &code[*pc];
+    if (compare_int(insn->reserved, pop_verified(stack), insn->b)) {
+        *pc = insn->a;
+        if (insn->aux) {
+            count_backedge(jvm, insn->aux, pc, stack);
+        }
+    } else {
+        *pc += 2;
+    }
+}
+
 // ... more handler functions for each instruction
 
+// Opcode -> handler mapping shared by the function-table loop and the
+// threaded loop, indexed by decoded (normalized) opcodes. The return
+// opcodes are dispatched separately since they end execution.
+#define FOR_EACH_INSTRUCTION(X) \
+    X(NOP, handle_nop) \
+    X(SIPUSH, handle_sipush) \
+    X(IADD, handle_iadd) \
+    X(ISUB, handle_isub) \
+    X(IMUL, handle_imul) \
+    X(IDIV, handle_idiv) \
+    X(IREM, handle_irem) \
+    X(INEG, handle_ineg) \
+    X(ISHL, handle_ishl) \
+    X(ISHR, handle_ishr) \
+    X(IUSHR, handle_iushr) \
+    X(IAND, handle_iand) \
+    X(IOR, handle_ior) \
+    X(IXOR, handle_ixor) \
+    X(IINC, handle_iinc) \
+    X(ILOAD, handle_iload) \
+    X(ISTORE, handle_istore) \
+    X(ALOAD, handle_aload) \
+    X(ASTORE, handle_astore) \
+    X(IFEQ, handle_if) \
+    X(IFNE, handle_if) \
+    X(IFLT, handle_if) \
+    X(IFGE, handle_if) \
+    X(IFGT, handle_if) \
+    X(IFLE, handle_if) \
+    X(IF_ICMPEQ, handle_if_icmp) \
+    X(IF_ICMPNE, handle_if_icmp) \
+    X(IF_ICMPLT, handle_if_icmp) \
+    X(IF_ICMPGE, handle_if_icmp) \
+    X(IF_ICMPGT, handle_if_icmp) \
+    X(IF_ICMPLE, handle_if_icmp) \
+    X(GOTO, handle_goto) \
+    X(TABLESWITCH, handle_tableswitch) \
+    X(LOOKUPSWITCH, handle_lookupswitch) \
+    X(DUP, handle_dup) \
+    X(POP, handle_pop) \
+    X(FLOAD, handle_iload) \
+    X(FSTORE, handle_istore) \
+    X(LCONST_0, handle_lconst) \
+    X(LCONST_1, handle_lconst) \
+    X(FCONST_0, handle_fconst) \
+    X(FCONST_1, handle_fconst) \
+    X(FCONST_2, handle_fconst) \
+    X(DCONST_0, handle_dconst) \
+    X(DCONST_1, handle_dconst) \
+    X(LDC2_W_QUICK, handle_ldc2_w_quick) \
+    X(LLOAD, handle_lload) \
+    X(DLOAD, handle_lload) \
+    X(LSTORE, handle_lstore) \
+    X(DSTORE, handle_lstore) \
+    X(LADD, handle_ladd) \
+    X(LSUB, handle_lsub) \
+    X(LMUL, handle_lmul) \
+    X(LDIV, handle_ldiv) \
+    X(LREM, handle_lrem) \
+    X(LNEG, handle_lneg) \
+    X(LSHL, handle_lshl) \
+    X(LSHR, handle_lshr) \
+    X(LUSHR, handle_lushr) \
+    X(LAND, handle_land) \
+    X(LOR, handle_lor) \
+    X(LXOR, handle_lxor) \
+    X(FADD, handle_fadd) \
+    X(FSUB, handle_fsub) \
+    X(FMUL, handle_fmul) \
+    X(FDIV, handle_fdiv) \
+    X(FREM, handle_frem) \
+    X(FNEG, handle_fneg) \
+    X(DADD, handle_dadd) \
+    X(DSUB, handle_dsub) \
+    X(DMUL, handle_dmul) \
+    X(DDIV, handle_ddiv) \
+    X(DREM, handle_drem) \
+    X(DNEG, handle_dneg) \
+    X(I2L, handle_i2l) \
+    X(I2F, handle_i2f) \
+    X(I2D, handle_i2d) \
+    X(L2I, handle_l2i) \
+    X(L2F, handle_l2f) \
+    X(L2D, handle_l2d) \
+    X(F2I, handle_f2i) \
+    X(F2L, handle_f2l) \
+    X(F2D, handle_f2d) \
+    X(D2I, handle_d2i) \
+    X(D2L, handle_d2l) \
+    X(D2F, handle_d2f) \
+    X(I2B, handle_i2b) \
+    X(I2C, handle_i2c) \
+    X(I2S, handle_i2s) \
+    X(LCMP, handle_lcmp) \
+    X(FCMPL, handle_fcmp) \
+    X(FCMPG, handle_fcmp) \
+    X(DCMPL, handle_dcmp) \
+    X(DCMPG, handle_dcmp) \
+    X(POP2, handle_pop2) \
+    X(DUP_X1, handle_dup_x1) \
+    X(DUP_X2, handle_dup_x2) \
+    X(DUP2, handle_dup2) \
+    X(DUP2_X1, handle_dup2_x1) \
+    X(DUP2_X2, handle_dup2_x2) \
+    X(SWAP, handle_swap) \
+    X(NEW, handle_new) \
+    X(NEW_QUICK, handle_new_quick) \
+    X(GETSTATIC, handle_getstatic) \
+    X(GETSTATIC_QUICK, handle_getstatic_quick) \
+    X(PUTSTATIC, handle_putstatic) \
+    X(PUTSTATIC_QUICK, handle_putstatic_quick) \
+    X(GETFIELD, handle_getfield) \
+    X(PUTFIELD, handle_putfield) \
+    X(GETFIELD_QUICK, handle_getfield_quick) \
+    X(GETFIELD_LONG_QUICK, handle_getfield_long_quick) \
+    X(GETFIELD_BYTE_QUICK, handle_getfield_byte_quick) \
+    X(GETFIELD_CHAR_QUICK, handle_getfield_char_quick) \
+    X(GETFIELD_SHORT_QUICK, handle_getfield_short_quick) \
+    X(PUTFIELD_QUICK, handle_putfield_quick) \
+    X(PUTFIELD_REFERENCE_QUICK, handle_putfield_reference_quick) \
+    X(PUTFIELD_LONG_QUICK, handle_putfield_long_quick) \
+    X(PUTFIELD_BYTE_QUICK, handle_putfield_byte_quick) \
+    X(PUTFIELD_BOOLEAN_QUICK, handle_putfield_boolean_quick) \
+    X(PUTFIELD_CHAR_QUICK, handle_putfield_char_quick) \
+    X(LDC, handle_ldc) \
+    X(LDC_QUICK, handle_ldc_quick) \
+    X(LDC2_W, handle_ldc2_w) \
+    X(INVOKESTATIC, handle_invokestatic) \
+    X(INVOKESPECIAL, handle_invokespecial) \
+    X(INVOKEVIRTUAL, handle_invokevirtual) \
+    X(INVOKEINTERFACE, handle_invokevirtual) \
+    X(INVOKE_DIRECT_QUICK, handle_invoke_direct_quick) \
+    X(INVOKE_NATIVE_QUICK, handle_invoke_native_quick) \
+    X(INVOKEVIRTUAL_QUICK, handle_invokevirtual_quick) \
+    X(INVOKEVIRTUAL_MONO, handle_invokevirtual_mono) \
+    X(INVOKEVIRTUAL_POLY, handle_invokevirtual_poly) \
+    X(INVOKEVIRTUAL_MEGA, handle_invokevirtual_mega) \
+    X(NEWARRAY, handle_newarray) \
+    X(ANEWARRAY, handle_anewarray) \
+    X(MULTIANEWARRAY, handle_multianewarray) \
+    X(ARRAYLENGTH, handle_arraylength) \
+    X(ATHROW, handle_athrow) \
+    X(IALOAD, handle_iaload) \
+    X(LALOAD, handle_laload) \
+    X(FALOAD, handle_faload) \
+    X(DALOAD, handle_daload) \
+    X(AALOAD, handle_aaload) \
+    X(BALOAD, handle_baload) \
+    X(CALOAD, handle_caload) \
+    X(SALOAD, handle_saload) \
+    X(IASTORE, handle_iastore) \
+    X(LASTORE, handle_lastore) \
+    X(FASTORE, handle_fastore) \
+    X(DASTORE, handle_dastore) \
+    X(AASTORE, handle_aastore) \
+    X(BASTORE, handle_bastore) \
+    X(CASTORE, handle_castore) \
+    X(SASTORE, handle_sastore) \
+    X(ILOAD_ILOAD_IADD_ISTORE, handle_iload_iload_iadd_istore) \
+    X(SIPUSH_IF_ICMP, handle_sipush_if_icmp) \
+    X(ALOAD_ILOAD_IALOAD, handle_aload_iload_iaload)
+
+// Overrides of the mapping above for verified methods
+#define FOR_EACH_VERIFIED_INSTRUCTION(X) \
+    X(SIPUSH, handle_sipush_verified) \
+    X(IADD, handle_iadd_verified) \
+    X(ISUB, handle_isub_verified) \
+    X(IMUL, handle_imul_verified) \
+    X(INEG, handle_ineg_verified) \
+    X(ISHL, handle_ishl_verified) \
+    X(ISHR, handle_ishr_verified) \
+    X(IUSHR, handle_iushr_verified) \
+    X(IAND, handle_iand_verified) \
+    X(IOR, handle_ior_verified) \
+    X(IXOR, handle_ixor_verified) \
+    X(ILOAD, handle_iload_verified) \
+    X(ISTORE, handle_istore_verified) \
+    X(ALOAD, handle_iload_verified) \
+    X(ASTORE, handle_istore_verified) \
+    X(IFEQ, handle_if_verified) \
+    X(IFNE, handle_if_verified) \
+    X(IFLT, handle_if_verified) \
+    X(IFGE, handle_if_verified) \
+    X(IFGT, handle_if_verified) \
+    X(IFLE, handle_if_verified) \
+    X(IF_ICMPEQ, handle_if_icmp_verified) \
+    X(IF_ICMPNE, handle_if_icmp_verified) \
+    X(IF_ICMPLT, handle_if_icmp_verified) \
+    X(IF_ICMPGE, handle_if_icmp_verified) \
+    X(IF_ICMPGT, handle_if_icmp_verified) \
+    X(IF_ICMPLE, handle_if_icmp_verified) \
+    X(DUP, handle_dup_verified) \
+    X(POP, handle_pop_verified) \
+    X(SIPUSH_IF_ICMP, handle_sipush_if_icmp_verified) \
+    X(FLOAD, handle_iload_verified) \
+    X(FSTORE, handle_istore_verified) \
+    X(LCONST_0, handle_lconst_verified) \
+    X(LCONST_1, handle_lconst_verified) \
+    X(FCONST_0, handle_fconst_verified) \
+    X(FCONST_1, handle_fconst_verified) \
+    X(FCONST_2, handle_fconst_verified) \
+    X(DCONST_0, handle_dconst_verified) \
+    X(DCONST_1, handle_dconst_verified) \
+    X(LDC2_W_QUICK, handle_ldc2_w_quick_verified) \
+    X(GETFIELD_QUICK, handle_getfield_quick_verified) \
+    X(GETFIELD_LONG_QUICK, handle_getfield_long_quick_verified) \
+    X(GETFIELD_BYTE_QUICK, handle_getfield_byte_quick_verified) \
+    X(GETFIELD_CHAR_QUICK, handle_getfield_char_quick_verified) \
+    X(GETFIELD_SHORT_QUICK, handle_getfield_short_quick_verified) \
+    X(PUTFIELD_QUICK, handle_putfield_quick_verified) \
+    X(PUTFIELD_REFERENCE_QUICK, handle_putfield_reference_quick_verified) \
+    X(PUTFIELD_LONG_QUICK, handle_putfield_long_quick_verified) \
+    X(PUTFIELD_BYTE_QUICK, handle_putfield_byte_quick_verified) \
+    X(PUTFIELD_BOOLEAN_QUICK, handle_putfield_boolean_quick_verified) \
+    X(PUTFIELD_CHAR_QUICK, handle_putfield_char_quick_verified) \
+    X(LLOAD, handle_lload_verified) \
+    X(DLOAD, handle_lload_verified) \
+    X(LSTORE, handle_lstore_verified) \
+    X(DSTORE, handle_lstore_verified) \
+    X(LADD, handle_ladd_verified) \
+    X(LSUB, handle_lsub_verified) \
+    X(LMUL, handle_lmul_verified) \
+    X(LDIV, handle_ldiv_verified) \
+    X(LREM, handle_lrem_verified) \
+    X(LNEG, handle_lneg_verified) \
+    X(LSHL, handle_lshl_verified) \
+    X(LSHR, handle_lshr_verified) \
+    X(LUSHR, handle_lushr_verified) \
+    X(LAND, handle_land_verified) \
+    X(LOR, handle_lor_verified) \
+    X(LXOR, handle_lxor_verified) \
+    X(FADD, handle_fadd_verified) \
+    X(FSUB, handle_fsub_verified) \
+    X(FMUL, handle_fmul_verified) \
+    X(FDIV, handle_fdiv_verified) \
+    X(FREM, handle_frem_verified) \
+    X(FNEG, handle_fneg_verified) \
+    X(DADD, handle_dadd_verified) \
+    X(DSUB, handle_dsub_verified) \
+    X(DMUL, handle_dmul_verified) \
+    X(DDIV, handle_ddiv_verified) \
+    X(DREM, handle_drem_verified) \
+    X(DNEG, handle_dneg_verified) \
+    X(I2L, handle_i2l_verified) \
+    X(I2F, handle_i2f_verified) \
+    X(I2D, handle_i2d_verified) \
+    X(L2I, handle_l2i_verified) \
+    X(L2F, handle_l2f_verified) \
+    X(L2D, handle_l2d_verified) \
+    X(F2I, handle_f2i_verified) \
+    X(F2L, handle_f2l_verified) \
+    X(F2D, handle_f2d_verified) \
+    X(D2I, handle_d2i_verified) \
+    X(D2L, handle_d2l_verified) \
+    X(D2F, handle_d2f_verified) \
+    X(I2B, handle_i2b_verified) \
+    X(I2C, handle_i2c_verified) \
+    X(I2S, handle_i2s_verified) \
+    X(LCMP, handle_lcmp_verified) \
+    X(FCMPL, handle_fcmp_verified) \
+    X(FCMPG, handle_fcmp_verified) \
+    X(DCMPL, handle_dcmp_verified) \
+    X(DCMPG, handle_dcmp_verified) \
+    X(POP2, handle_pop2_verified) \
+    X(DUP_X1, handle_dup_x1_verified) \
+    X(DUP_X2, handle_dup_x2_verified) \
+    X(DUP2, handle_dup2_verified) \
+    X(DUP2_X1, handle_dup2_x1_verified) \
+    X(DUP2_X2, handle_dup2_x2_verified) \
+    X(SWAP, handle_swap_verified) \
+    X(NEWARRAY, handle_newarray_verified) \
+    X(ANEWARRAY, handle_anewarray_verified) \
+    X(ARRAYLENGTH, handle_arraylength_verified) \
+    X(IALOAD, handle_iaload_verified) \
+    X(LALOAD, handle_laload_verified) \
+    X(FALOAD, handle_faload_verified) \
+    X(DALOAD, handle_daload_verified) \
+    X(AALOAD, handle_aaload_verified) \
+    X(BALOAD, handle_baload_verified) \
+    X(CALOAD, handle_caload_verified) \
+    X(SALOAD, handle_saload_verified) \
+    X(IASTORE, handle_iastore_verified) \
+    X(LASTORE, handle_lastore_verified) \
+    X(FASTORE, handle_fastore_verified) \
+    X(DASTORE, handle_dastore_verified) \
+    X(AASTORE, handle_aastore_verified) \
+    X(BASTORE, handle_bastore_verified) \
+    X(CASTORE, handle_castore_verified) \
+    X(SASTORE, handle_sastore_verified)
+
+#ifndef JVM_THREADED_DISPATCH
 static instruction_handler instruction_table[256] = {0};  // Initialize all to NULL
+static instruction_handler verified_instruction_table[256] = {0};
 
 static void init_instruction_table(void) {
-    instruction_table[NOP] = handle_nop;
-    instruction_table[ICONST_M1] = handle_iconst;
-    instruction_table[ICONST_0] = handle_iconst;
-    instruction_table[ICONST_1] = handle_iconst;
-    instruction_table[ICONST_2] = handle_iconst;
-    instruction_table[ICONST_3] = handle_iconst;
-    instruction_table[ICONST_4] = handle_iconst;
-    instruction_table[ICONST_5] = handle_iconst;
-    instruction_table[IADD] = handle_iadd;
-    instruction_table[ISUB] = handle_isub;
-    instruction_table[IMUL] = handle_imul;
-    instruction_table[IDIV] = handle_idiv;
-    instruction_table[IOR] = handle_ior;
-    instruction_table[ILOAD_0] = handle_iload_n;
-    instruction_table[ILOAD_1] = handle_iload_n;
-    instruction_table[ILOAD_2] = handle_iload_n;
-    instruction_table[ILOAD_3] = handle_iload_n;
-    instruction_table[ISTORE_0] = handle_istore_n;
-    instruction_table[ISTORE_1] = handle_istore_n;
-    instruction_table[ISTORE_2] = handle_istore_n;
-    instruction_table[ISTORE_3] = handle_istore_n;
-    instruction_table[DUP] = handle_dup;
-    instruction_table[POP] = handle_pop;
-    instruction_table[DADD] = handle_dadd;
-    instruction_table[NEW] = handle_new;
-    instruction_table[NEWARRAY] = handle_newarray;
-    instruction_table[IASTORE] = handle_iastore;
-    instruction_table[IRETURN] = handle_return;
+#define X(opcode, handler) instruction_table[opcode] = handler;
+    FOR_EACH_INSTRUCTION(X)
+#undef X
+    for (int opcode = IRETURN; opcode <= RETURN; opcode++) {
+        instruction_table[opcode] = handle_return;
+    }
+    memcpy(verified_instruction_table, instruction_table, sizeof(instruction_table));
+#define X(opcode, handler) verified_instruction_table[opcode] = handler;
+    FOR_EACH_VERIFIED_INSTRUCTION(X)
+#undef X
 }
+#endif
 
 void check_stack_bounds(OperandStack *stack, int required_space) {
     if (stack->size + required_space > stack->capacity) {
@@ -344,14 +1705,14 @@ void print_operation(const char* op, int32_t val1, int32_t val2, int32_t result)
 }
 
 
-void print_local_vars(int32_t *local_vars) {
+void print_local_vars(int32_t *local_vars, uint16_t count) {
     printf("\nFinal state:\n\n");
     printf("Final Local Variables State:\n");
     
     bool printed = false;
     
     // For clarity, only print non-zero local variables
-    for (int i = 0; i < 256; i++) {
+    for (int i = 0; i < count; i++) {
         if (local_vars[i] != 0) {
             printed = true;
             printf("local_%d: %d\n", i, local_vars[i]);
@@ -447,8 +1808,8 @@ void operand_stack_push_cat2(OperandStack *stack, Cat2 val) {
         fprintf(stderr, "Stack overflow in push_cat2\n");
         return;
     }
-    stack->values[stack->size++] = val.high;
-    stack->values[stack->size++] = val.low;
+    store_long(stack->values + stack->size, val.long_);
+    stack->size += 2;
 }
 
 bool operand_stack_pop(OperandStack *stack, int32_t *value) {
@@ -466,8 +1827,8 @@ Cat2 operand_stack_pop_cat2(OperandStack *stack) {
         val.high = val.low = 0;
         return val;
     }
-    val.low = stack->values[--stack->size];
-    val.high = stack->values[--stack->size];
+    stack->size -= 2;
+    val.long_ = load_long(stack->values + stack->size);
     return val;
 }
 
@@ -564,146 +1925,340 @@ bool validate_constant_pool_index(ClassFile *class_file, uint16_t index) {
     return true;
 }
 
-void execute_bytecode(JVM *jvm, uint8_t *bytecode, uint32_t bytecode_length) {
-    int32_t local_vars[256] = {0};
-    OperandStack operand_stack;
-    operand_stack_init(&operand_stack, STACK_SIZE);
-    
+#ifdef JVM_PROFILE_SEQUENCES
+
+// Sequence profiling (make PROFILE=1): counts every run of 2 to 4
+// instructions executed back to back without a branch in between, so the
+// superinstruction set can be tuned from real workloads.
+#define PROFILE_MAX_LENGTH 4
+#define PROFILE_TABLE_SIZE 8192
+
+typedef struct {
+    uint64_t key;    // length << 32 | opcodes, first opcode in the high byte
+    uint64_t count;
+} SequenceCount;
+
+static SequenceCount sequence_counts[PROFILE_TABLE_SIZE];
+static const Instruction *profile_code;
+static uint32_t profile_pc;
+static uint32_t profile_window;
+static int profile_length;
+
+static void record_sequence(uint64_t key) {
+    uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 51) & (PROFILE_TABLE_SIZE - 1);
+    for (uint32_t probe = 0; probe < PROFILE_TABLE_SIZE; probe++) {
+        SequenceCount *entry = &sequence_counts[(slot + probe) & (PROFILE_TABLE_SIZE - 1)];
+        if (entry->key == key || entry->key == 0) {
+            entry->key = key;
+            entry->count++;
+            return;
+        }
+    }
+}
+
+static void profile_instruction(const Instruction *code, uint32_t pc) {
+    if (code != profile_code || pc != profile_pc + 1) {
+        profile_length = 0; // branch taken or method changed
+    }
+    profile_code = code;
+    profile_pc = pc;
+    profile_window = (profile_window << 8) | code[pc].opcode;
+    if (profile_length < PROFILE_MAX_LENGTH) {
+        profile_length++;
+    }
+    for (int length = 2; length <= profile_length; length++) {
+        uint32_t mask = length == 4 ? 0xFFFFFFFFu : (1u << (8 * length)) - 1;
+        record_sequence(((uint64_t)length << 32) | (profile_window & mask));
+    }
+}
+
+static int compare_sequence_weight(const void *a, const void *b) {
+    const SequenceCount *x = a, *y = b;
+    // Weight by the dispatches a fused handler would save
+    uint64_t wx = x->count * ((x->key >> 32) - 1);
+    uint64_t wy = y->count * ((y->key >> 32) - 1);
+    return wx < wy ? 1 : (wx > wy ? -1 : 0);
+}
+
+void print_sequence_profile(void) {
+    qsort(sequence_counts, PROFILE_TABLE_SIZE, sizeof(SequenceCount), compare_sequence_weight);
+    printf("\nHot instruction sequences (superinstruction candidates):\n");
+    printf("%14s %14s  %s\n", "count", "saved", "sequence");
+    for (int i = 0; i < 20 && sequence_counts[i].key != 0; i++) {
+        int length = (int)(sequence_counts[i].key >> 32);
+        uint32_t opcodes = (uint32_t)sequence_counts[i].key;
+        printf("%14llu %14llu  ", (unsigned long long)sequence_counts[i].count,
+               (unsigned long long)(sequence_counts[i].count * (length - 1)));
+        for (int k = length - 1; k >= 0; k--) {
+            printf("%s%s", opcode_name((opcodes >> (8 * k)) & 0xFF), k ? " " : "\n");
+        }
+    }
+    memset(sequence_counts, 0, sizeof(sequence_counts));
+}
+
+#define PROFILE_INSTRUCTION(code, pc) profile_instruction(code, pc)
+#else
+#define PROFILE_INSTRUCTION(code, pc) ((void)0)
+#endif
+
+#ifdef JVM_THREADED_DISPATCH
+
+// Threaded interpreter: every opcode body ends in its own indirect jump, so
+// the branch predictor sees one dispatch site per opcode instead of a single
+// shared one. pc, the operand stack and locals are locals of this function
+// and the handlers are inlined into the labels, which lets the compiler keep
+// them in registers across instructions. Verified methods dispatch through
+// a second table whose entries for the FOR_EACH_VERIFIED_INSTRUCTION opcodes
+// lead to the unchecked handlers.
+static void execute_threaded(JVM *jvm, Instruction *code, uint32_t start,
+                             OperandStack *stack, int32_t *locals, bool verified) {
+#define X(opcode, handler) [opcode] = &&op_##opcode,
+    static void *checked_table[256] = {
+        [0 ... 255] = &&op_unknown,
+        FOR_EACH_INSTRUCTION(X)
+        [IRETURN ... RETURN] = &&op_return,
+    };
+    static void *verified_table[256] = {
+        [0 ... 255] = &&op_unknown,
+        FOR_EACH_INSTRUCTION(X)
+#undef X
+#define X(opcode, handler) [opcode] = &&verified_##opcode,
+        FOR_EACH_VERIFIED_INSTRUCTION(X)
+#undef X
+        [IRETURN ... RETURN] = &&op_return,
+    };
+    void **dispatch_table = verified ? verified_table : checked_table;
+
+    uint32_t pc = start;
+    OperandStack operand_stack = *stack;
+
+    // The decoded stream always ends in a RETURN sentinel, so there is no
+    // bounds check on pc here
+#define DISPATCH() \
+    do { \
+        PROFILE_INSTRUCTION(code, pc); \
+        goto *dispatch_table[code[pc].opcode]; \
+    } while (0)
+
+    DISPATCH();
+
+#define X(opcode, handler) \
+op_##opcode: \
+    handler(jvm, code, &pc, &operand_stack, locals); \
+    DISPATCH();
+    FOR_EACH_INSTRUCTION(X)
+#undef X
+
+#define X(opcode, handler) \
+verified_##opcode: \
+    handler(jvm, code, &pc, &operand_stack, locals); \
+    DISPATCH();
+    FOR_EACH_VERIFIED_INSTRUCTION(X)
+#undef X
+
+op_return:
+    handle_return(jvm, code, &pc, &operand_stack, locals);
+    goto done;
+
+op_unknown:
+    unknown_opcode(code[pc].opcode);
+
+#undef DISPATCH
+
+done:
+    *stack = operand_stack;
+}
+
+#else
+
+static void execute_table(JVM *jvm, Instruction *code, uint32_t instruction_count, uint32_t start,
+                          OperandStack *stack, int32_t *locals, bool verified) {
     static bool table_initialized = false;
     if (!table_initialized) {
         init_instruction_table();
         table_initialized = true;
     }
+    instruction_handler *table = verified ? verified_instruction_table : instruction_table;
 
-    uint32_t pc = 0;
-    while (pc < bytecode_length) {
-        uint8_t opcode = bytecode[pc];
-        instruction_handler handler = instruction_table[opcode];
+    uint32_t pc = start;
+    while (pc <= instruction_count) {
+        PROFILE_INSTRUCTION(code, pc);
+        uint8_t opcode = code[pc].opcode;
+        instruction_handler handler = table[opcode];
         
-        if (handler) {
-            handler(jvm, bytecode, &pc, &operand_stack, local_vars);
-        } else {
-            fprintf(stderr, "Unknown opcode: 0x%02x\n", opcode);
-            pc++;
+        if (handler == NULL) {
+            unknown_opcode(opcode);
         }
+        handler(jvm, code, &pc, stack, locals);
 
-        if (opcode == IRETURN) break;
+        if (opcode >= IRETURN && opcode <= RETURN) break;
     }
+}
 
-    print_local_vars(local_vars);
-    free(operand_stack.values);
+#endif
+
+// Runs the instruction at pc, including the quickened form it may rewrite
+// itself into, and returns the index of the next one. Compiled code calls
+// this for every instruction it has no template for.
+uint32_t interpret_instruction(JVM *jvm, Frame *frame, uint32_t pc) {
+    Instruction *code = frame->method->code;
+    for (;;) {
+        uint8_t opcode = code[pc].opcode;
+        uint32_t next = pc;
+        switch (opcode) {
+#define X(opcode, handler) \
+            case opcode: \
+                handler(jvm, code, &next, &frame->stack, frame->locals); \
+                break;
+            FOR_EACH_INSTRUCTION(X)
+#undef X
+            default:
+                unknown_opcode(opcode);
+        }
+        if (next != pc || code[pc].opcode == opcode) {
+            return next;
+        }
+    }
 }
 
-void invoke_method(JVM *jvm, void *method_handle) {
-    if (!method_handle) {
-        fprintf(stderr, "Error: Null method handle\n");
+// Runs frame from instruction start, compiled if possible
+static void run_code(JVM *jvm, Frame *frame, uint32_t start) {
+    Method *method = frame->method;
+    if (method->jit_code) {
+        method->jit_code(jvm, frame, start);
         return;
     }
 
-    struct {
-        void *method_handle;
-        const char *name;
-        const char *descriptor;
-    } *resolved_method = method_handle;
+    // Trace builds keep every method on the checked handlers, which are
+    // the ones that print
+#ifdef JVM_TRACE
+    bool verified = false;
+#else
+    bool verified = method->verified;
+#endif
+#ifdef JVM_THREADED_DISPATCH
+    execute_threaded(jvm, method->code, start, &frame->stack, frame->locals, verified);
+#else
+    execute_table(jvm, method->code, method->instruction_count, start,
+                  &frame->stack, frame->locals, verified);
+#endif
+}
 
-    // Check if name and descriptor are valid
-    if (!resolved_method->name || !resolved_method->descriptor) {
-        fprintf(stderr, "Error: Invalid method name or descriptor\n");
+// Methods with exception handlers run behind a catch point for exceptions
+// thrown further down the call chain (see throw_exception). When one lands
+// here, frame->pc is the handler and the stack holds just the exception.
+// This is a separate function so that other calls do not carry a jmp_buf
+// on the C stack.
+static __attribute__((noinline)) void run_catching_frame(JVM *jvm, Frame *frame) {
+    CatchPoint point;
+    point.frame = frame;
+    point.outer = jvm->catch_points;
+    jvm->catch_points = &point;
+    setjmp(point.buffer);
+    run_code(jvm, frame, frame->pc);
+    jvm->catch_points = point.outer;
+}
+
+// Methods are compiled once they have been called jit_threshold times; the
+// compiled code then runs every later activation
+static void run_frame(JVM *jvm, Frame *frame) {
+    Method *method = frame->method;
+    if (method->jit_code == NULL && jvm->jit_enabled && !method->jit_failed &&
+        ++method->invocation_count >= jvm->jit_threshold) {
+        jit_compile(jvm, method);
+    }
+    if (method->exception_table_length > 0) {
+        run_catching_frame(jvm, frame);
+    } else {
+        run_code(jvm, frame, 0);
+    }
+}
+
+void execute_bytecode(JVM *jvm, Method *method) {
+    if (!method->code) {
+        fprintf(stderr, "Method %s has no code\n", method->name);
         return;
     }
 
-    printf("Invoking method: %s with descriptor: %s\n", 
-           resolved_method->name, 
-           resolved_method->descriptor);
+    // Locals and operand stack are sized from the Code attribute and carved
+    // out of the contiguous Java stack
+    Frame *frame = frame_push(jvm, method, NULL, 0);
+    run_frame(jvm, frame);
+    print_local_vars(frame->locals, method->max_locals);
+    frame_pop(jvm);
+}
 
-    // Get the bytecode
-    uint8_t *bytecode = get_method_bytecode(&jvm->class_file, 
-                                          resolved_method->name, 
-                                          resolved_method->descriptor);
-    if (!bytecode) {
-        fprintf(stderr, "Failed to get bytecode for method: %s\n", 
-                resolved_method->name);
+// Calls method with its arguments on top of stack and replaces them with
+// the return value, if any
+void invoke_method(JVM *jvm, Method *method, OperandStack *stack) {
+    if (method->native) {
+        method->native(jvm, stack);
+        return;
+    }
+    if (!method->code) {
+        fprintf(stderr, "Method %s has no code\n", method->name);
+        stack->size -= method->arg_slots;
         return;
     }
 
-    // Execute bytecode
-    execute_bytecode(jvm, bytecode, /* bytecode_length */ 0);
+    Frame *frame = frame_push(jvm, method, stack, method->arg_slots);
+    run_frame(jvm, frame);
+
+    // The return instruction left the value on top of the callee's stack.
+    // Copying it can overwrite the callee's header, which starts right at
+    // the caller's stack top, so the frame is popped first.
+    int32_t *result = frame->stack.values + frame->stack.size - method->return_slots;
+    frame_pop(jvm);
+    for (int i = 0; i < method->return_slots; i++) {
+        stack->values[stack->size++] = result[i];
+    }
 }
 
 void jvm_execute(JVM *jvm) {
-    printf("Executing JVM\n");
+    TRACE("Executing JVM\n");
     ClassFile *class_file = &jvm->class_file;
-    method_info *main_method = NULL;
 
     // Debug print to see all methods
+#ifdef JVM_TRACE
     for (int i = 0; i < class_file->methods_count; i++) {
         const char *method_name = get_constant_pool_string(class_file, class_file->methods[i].name_index);
         const char *method_descriptor = get_constant_pool_string(class_file, class_file->methods[i].descriptor_index);
-        printf("Found method: %s with descriptor: %s\n", method_name, method_descriptor);
+        TRACE("Found method: %s with descriptor: %s\n", method_name, method_descriptor);
     }
-
-    // Look for main method
-    for (int i = 0; i < class_file->methods_count; i++) {
-        const char *method_name = get_constant_pool_string(class_file, class_file->methods[i].name_index);
-        const char *method_descriptor = get_constant_pool_string(class_file, class_file->methods[i].descriptor_index);
-        
-        if (method_name && method_descriptor) {
-            printf("Checking method: %s with descriptor: %s\n", method_name, method_descriptor);
-            if (strcmp(method_name, "main") == 0 &&
-                strcmp(method_descriptor, "([Ljava/lang/String;)V") == 0) {
-                main_method = &class_file->methods[i];
-                printf("Found main method!\n");
-                break;
-            }
+#endif
+
+    // Link the class: decodes every method's bytecode once
+    if (jvm->main_class == NULL) {
+        jvm->main_class = jvm_link_class(jvm, class_file);
+        if (jvm->main_class == NULL) {
+            fprintf(stderr, "Failed to link class\n");
+            return;
         }
     }
 
+    // Look for main method
+    Method *main_method = find_method(jvm->main_class, "main", "([Ljava/lang/String;)V");
     if (main_method == NULL) {
         fprintf(stderr, "Main method not found\n");
         return;
     }
-
-    // Fetch the bytecode array from the main method's code attribute
-    attribute_info *code_attribute = NULL;
-    const char *code_attribute_name = "Code";
-    for (int i = 0; i < main_method->attributes_count; i++) {
-        const char *attribute_name = get_constant_pool_string(class_file, main_method->attributes[i].attribute_name_index);
-        if (attribute_name && strcmp(attribute_name, code_attribute_name) == 0) {
-            code_attribute = &main_method->attributes[i];
-            break;
-        }
-    }
-    if (code_attribute == NULL) {
-        fprintf(stderr, "Code attribute not found\n");
-        return;
-    }
-
-    // Fix bytecode length calculation
-    uint32_t code_length = 
-        ((uint32_t)code_attribute->info[4] << 24) |
-        ((uint32_t)code_attribute->info[5] << 16) |
-        ((uint32_t)code_attribute->info[6] << 8) |
-        (uint32_t)code_attribute->info[7];
+    TRACE("Found main method!\n");
 
     // Debug print
-    printf("Code length: %u\n", code_length);
+    TRACE("Code length: %u (%u instructions)\n", main_method->code_length,
+           main_method->instruction_count);
 
-    // Validate code length
-    if (code_length > code_attribute->attribute_length - 8) {
-        fprintf(stderr, "Invalid code length\n");
-        return;
-    }
-
-    // Get bytecode array with proper offset
-    uint8_t *bytecode = code_attribute->info + 8;
-
-    // Debug print first few bytes
-    printf("First few bytecode bytes: ");
-    for (int i = 0; i < 8 && i < code_length; i++) {
-        printf("%02x ", bytecode[i]);
+    // Debug print first few bytecode bytes
+    TRACE("First few bytecode bytes: ");
+    for (uint32_t i = 0; i < 8 && i < main_method->code_length; i++) {
+        TRACE("%02x ", main_method->bytecode[i]);
     }
-    printf("\n");
+    TRACE("\n");
 
     // Execute the bytecode
-    execute_bytecode(jvm, bytecode, code_length);
+    execute_bytecode(jvm, main_method);
+
+#ifdef JVM_PROFILE_SEQUENCES
+    print_sequence_profile();
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,511 @@
+#define _DEFAULT_SOURCE
+#include "jvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// JAR (ZIP) archives on the classpath. The archive is mapped once and its
+// central directory indexed by name when it is opened; an entry is only
+// touched when a class is looked up in it. Stored entries are handed out in
+// place, deflated ones are inflated into a fresh buffer.
+
+#define ZIP_LOCAL_HEADER 0x04034b50
+#define ZIP_CENTRAL_HEADER 0x02014b50
+#define ZIP_END_OF_DIRECTORY 0x06054b50
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_OF_DIRECTORY_SIZE 22
+#define ZIP_MAX_COMMENT 0xFFFF
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_ENCRYPTED 0x0001
+
+static uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const JarEntry *index_lookup(const JarFile *jar, const char *name, size_t length, uint32_t hash) {
+    uint32_t mask = jar->index_capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        const JarIndexSlot *slot = &jar->index[i];
+        if (slot->entry == 0) {
+            return NULL;
+        }
+        const JarEntry *entry = &jar->entries[slot->entry - 1];
+        if (slot->hash == hash && entry->name_length == length && memcmp(entry->name, name, length) == 0) {
+            return entry;
+        }
+    }
+}
+
+// Finds the end of central directory record, which sits behind an optional
+// comment of up to 64 KB at the end of the archive
+static const uint8_t *find_end_of_directory(const uint8_t *data, size_t size) {
+    if (size < ZIP_END_OF_DIRECTORY_SIZE) {
+        return NULL;
+    }
+    size_t last = size - ZIP_END_OF_DIRECTORY_SIZE;
+    size_t first = last > ZIP_MAX_COMMENT ? last - ZIP_MAX_COMMENT : 0;
+    for (size_t at = last + 1; at-- > first;) {
+        if (read_u32(data + at) == ZIP_END_OF_DIRECTORY &&
+            at + ZIP_END_OF_DIRECTORY_SIZE + read_u16(data + at + 20) == size) {
+            return data + at;
+        }
+    }
+    return NULL;
+}
+
+static bool index_entries(JarFile *jar, const char *path) {
+    const uint8_t *end = find_end_of_directory(jar->data, jar->size);
+    if (end == NULL) {
+        fprintf(stderr, "Not a ZIP archive: %s\n", path);
+        return false;
+    }
+    uint32_t count = read_u16(end + 10);
+    uint32_t directory_size = read_u32(end + 12);
+    uint32_t directory_offset = read_u32(end + 16);
+    if (count == 0xFFFF || directory_offset == 0xFFFFFFFFu) {
+        fprintf(stderr, "ZIP64 archives are not supported: %s\n", path);
+        return false;
+    }
+    if ((size_t)directory_offset + directory_size > (size_t)(end - jar->data)) {
+        fprintf(stderr, "Corrupt central directory: %s\n", path);
+        return false;
+    }
+
+    uint32_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    jar->entries = malloc(sizeof(JarEntry) * (count ? count : 1));
+    jar->index = calloc(capacity, sizeof(JarIndexSlot));
+    if (!jar->entries || !jar->index) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    jar->index_capacity = capacity;
+
+    const uint8_t *p = jar->data + directory_offset;
+    const uint8_t *directory_end = p + directory_size;
+    for (uint32_t i = 0; i < count; i++) {
+        if (p + ZIP_CENTRAL_HEADER_SIZE > directory_end || read_u32(p) != ZIP_CENTRAL_HEADER) {
+            fprintf(stderr, "Corrupt central directory: %s\n", path);
+            return false;
+        }
+        uint16_t name_length = read_u16(p + 28);
+        size_t header_size = ZIP_CENTRAL_HEADER_SIZE + name_length + read_u16(p + 30) + read_u16(p + 32);
+        if (p + header_size > directory_end) {
+            fprintf(stderr, "Corrupt central directory: %s\n", path);
+            return false;
+        }
+        JarEntry *entry = &jar->entries[jar->entry_count];
+        entry->name = (const char *)p + ZIP_CENTRAL_HEADER_SIZE;
+        entry->name_length = name_length;
+        entry->flags = read_u16(p + 8);
+        entry->method = read_u16(p + 10);
+        entry->crc = read_u32(p + 16);
+        entry->compressed_size = read_u32(p + 20);
+        entry->size = read_u32(p + 24);
+        entry->local_offset = read_u32(p + 42);
+        p += header_size;
+
+        // A repeated name keeps its first entry, like java.util.zip
+        uint32_t hash = name_hash(entry->name, name_length);
+        if (index_lookup(jar, entry->name, name_length, hash) != NULL) {
+            continue;
+        }
+        uint32_t mask = capacity - 1;
+        uint32_t slot = hash & mask;
+        while (jar->index[slot].entry != 0) {
+            slot = (slot + 1) & mask;
+        }
+        jar->index[slot].hash = hash;
+        jar->index[slot].entry = ++jar->entry_count;
+    }
+    return true;
+}
+
+// Maps the archive at path and indexes its central directory. The mapping
+// is private and writable, so a stored class file can be parsed in place
+// like one read from a directory.
+JarFile *jar_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening archive: %s\n", path);
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        fprintf(stderr, "Not a ZIP archive: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error mapping archive: %s\n", path);
+        return NULL;
+    }
+
+    JarFile *jar = calloc(1, sizeof(JarFile));
+    if (!jar) {
+        fprintf(stderr, "Memory allocation error\n");
+        munmap(data, (size_t)info.st_size);
+        return NULL;
+    }
+    jar->data = data;
+    jar->size = (size_t)info.st_size;
+    if (!index_entries(jar, path)) {
+        jar_close(jar);
+        return NULL;
+    }
+    return jar;
+}
+
+void jar_close(JarFile *jar) {
+    if (jar == NULL) {
+        return;
+    }
+    munmap(jar->data, jar->size);
+    free(jar->entries);
+    free(jar->index);
+    free(jar);
+}
+
+const JarEntry *jar_find(const JarFile *jar, const char *name) {
+    size_t length = strlen(name);
+    return index_lookup(jar, name, length, name_hash(name, length));
+}
+
+// --- Inflater (RFC 1951) ---
+//
+// A canonical Huffman decoder in the style of zlib's puff: codes are decoded
+// a bit at a time from the count of codes of each length, which needs no
+// lookup tables and is plenty for class files.
+
+#define MAX_CODE_BITS 15
+#define MAX_LITERAL_CODES 288
+#define MAX_DISTANCE_CODES 30
+
+typedef struct {
+    const uint8_t *in;
+    size_t in_size;
+    size_t in_position;
+    uint32_t bit_buffer;
+    int bit_count;
+    uint8_t *out;
+    size_t out_size;
+    size_t out_position;
+    bool error;            // ran out of input or found an invalid code
+} Inflater;
+
+typedef struct {
+    uint16_t count[MAX_CODE_BITS + 1]; // codes of each length
+    uint16_t symbol[MAX_LITERAL_CODES]; // symbols ordered by code
+} Huffman;
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static uint32_t inflate_bits(Inflater *s, int count) {
+    while (s->bit_count < count) {
+        if (s->in_position == s->in_size) {
+            s->error = true;
+            return 0;
+        }
+        s->bit_buffer |= (uint32_t)s->in[s->in_position++] << s->bit_count;
+        s->bit_count += 8;
+    }
+    uint32_t value = s->bit_buffer & ((1u << count) - 1);
+    s->bit_buffer >>= count;
+    s->bit_count -= count;
+    return value;
+}
+
+// Builds the decoder for a set of code lengths; false if they are
+// over-subscribed. Incomplete codes are allowed (a lone distance code is).
+static bool huffman_build(Huffman *h, const uint8_t *lengths, int n) {
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+    }
+    int left = 1;
+    for (int length = 1; length <= MAX_CODE_BITS; length++) {
+        left <<= 1;
+        left -= h->count[length];
+        if (left < 0) {
+            return false;
+        }
+    }
+    uint16_t offsets[MAX_CODE_BITS + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < MAX_CODE_BITS; length++) {
+        offsets[length + 1] = offsets[length] + h->count[length];
+    }
+    for (int symbol = 0; symbol < n; symbol++) {
+        if (lengths[symbol] != 0) {
+            h->symbol[offsets[lengths[symbol]]++] = (uint16_t)symbol;
+        }
+    }
+    return true;
+}
+
+static int huffman_decode(Inflater *s, const Huffman *h) {
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length <= MAX_CODE_BITS; length++) {
+        code |= (int)inflate_bits(s, 1);
+        int count = h->count[length];
+        if (code - first < count) {
+            return h->symbol[index + code - first];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    s->error = true;
+    return -1;
+}
+
+static bool inflate_stored(Inflater *s) {
+    s->bit_buffer = 0; // the block starts on a byte boundary
+    s->bit_count = 0;
+    if (s->in_size - s->in_position < 4) {
+        return false;
+    }
+    uint16_t length = read_u16(s->in + s->in_position);
+    uint16_t complement = read_u16(s->in + s->in_position + 2);
+    s->in_position += 4;
+    if (length != (uint16_t)~complement || s->in_size - s->in_position < length ||
+        s->out_size - s->out_position < length) {
+        return false;
+    }
+    memcpy(s->out + s->out_position, s->in + s->in_position, length);
+    s->in_position += length;
+    s->out_position += length;
+    return true;
+}
+
+static bool inflate_codes(Inflater *s, const Huffman *literals, const Huffman *distances) {
+    for (;;) {
+        int symbol = huffman_decode(s, literals);
+        if (s->error) {
+            return false;
+        }
+        if (symbol < 256) {
+            if (s->out_position == s->out_size) {
+                return false;
+            }
+            s->out[s->out_position++] = (uint8_t)symbol;
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        size_t length = length_base[symbol] + inflate_bits(s, length_extra[symbol]);
+        int code = huffman_decode(s, distances);
+        if (s->error || code < 0 || code >= MAX_DISTANCE_CODES) {
+            return false;
+        }
+        size_t distance = distance_base[code] + inflate_bits(s, distance_extra[code]);
+        if (s->error || distance > s->out_position || length > s->out_size - s->out_position) {
+            return false;
+        }
+        // Byte by byte: the copy may overlap what it writes
+        uint8_t *to = s->out + s->out_position;
+        const uint8_t *from = to - distance;
+        for (size_t i = 0; i < length; i++) {
+            to[i] = from[i];
+        }
+        s->out_position += length;
+    }
+}
+
+static bool inflate_fixed(Inflater *s) {
+    uint8_t lengths[MAX_LITERAL_CODES + MAX_DISTANCE_CODES];
+    int symbol = 0;
+    for (; symbol < 144; symbol++) lengths[symbol] = 8;
+    for (; symbol < 256; symbol++) lengths[symbol] = 9;
+    for (; symbol < 280; symbol++) lengths[symbol] = 7;
+    for (; symbol < MAX_LITERAL_CODES; symbol++) lengths[symbol] = 8;
+    for (int i = 0; i < MAX_DISTANCE_CODES; i++) lengths[MAX_LITERAL_CODES + i] = 5;
+    Huffman literals, distances;
+    huffman_build(&literals, lengths, MAX_LITERAL_CODES);
+    huffman_build(&distances, lengths + MAX_LITERAL_CODES, MAX_DISTANCE_CODES);
+    return inflate_codes(s, &literals, &distances);
+}
+
+static bool inflate_dynamic(Inflater *s) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int literal_count = (int)inflate_bits(s, 5) + 257;
+    int distance_count = (int)inflate_bits(s, 5) + 1;
+    int code_length_count = (int)inflate_bits(s, 4) + 4;
+    if (s->error || literal_count > MAX_LITERAL_CODES || distance_count > MAX_DISTANCE_CODES) {
+        return false;
+    }
+
+    uint8_t lengths[MAX_LITERAL_CODES + MAX_DISTANCE_CODES] = { 0 };
+    for (int i = 0; i < code_length_count; i++) {
+        lengths[order[i]] = (uint8_t)inflate_bits(s, 3);
+    }
+    Huffman code_lengths;
+    if (s->error || !huffman_build(&code_lengths, lengths, 19)) {
+        return false;
+    }
+
+    int total = literal_count + distance_count;
+    for (int i = 0; i < total;) {
+        int symbol = huffman_decode(s, &code_lengths);
+        if (s->error) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[i++] = (uint8_t)symbol;
+            continue;
+        }
+        uint8_t repeated = 0;
+        int times;
+        if (symbol == 16) {
+            if (i == 0) {
+                return false;
+            }
+            repeated = lengths[i - 1];
+            times = 3 + (int)inflate_bits(s, 2);
+        } else if (symbol == 17) {
+            times = 3 + (int)inflate_bits(s, 3);
+        } else {
+            times = 11 + (int)inflate_bits(s, 7);
+        }
+        if (s->error || i + times > total) {
+            return false;
+        }
+        while (times-- > 0) {
+            lengths[i++] = repeated;
+        }
+    }
+    if (lengths[256] == 0) {
+        return false; // no end-of-block code
+    }
+
+    Huffman literals, distances;
+    if (!huffman_build(&literals, lengths, literal_count) ||
+        !huffman_build(&distances, lengths + literal_count, distance_count)) {
+        return false;
+    }
+    return inflate_codes(s, &literals, &distances);
+}
+
+// Inflates raw DEFLATE data into out, which must come out exactly out_size
+// bytes long
+static bool inflate(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    Inflater s = { in, in_size, 0, 0, 0, out, out_size, 0, false };
+    bool last;
+    do {
+        last = inflate_bits(&s, 1) != 0;
+        uint32_t type = inflate_bits(&s, 2);
+        if (s.error) {
+            return false;
+        }
+        bool ok;
+        switch (type) {
+            case 0: ok = inflate_stored(&s); break;
+            case 1: ok = inflate_fixed(&s); break;
+            case 2: ok = inflate_dynamic(&s); break;
+            default: ok = false; break;
+        }
+        if (!ok) {
+            return false;
+        }
+    } while (!last);
+    return s.out_position == out_size;
+}
+
+static uint32_t crc32_of(const uint8_t *data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Returns the bytes of entry. A stored entry is returned in place, inside
+// the archive's mapping (*copied is false); a deflated one is inflated into
+// a malloc'ed buffer the caller frees. NULL if the entry cannot be read.
+uint8_t *jar_read(JarFile *jar, const JarEntry *entry, bool *copied) {
+    const char *problem = NULL;
+    uint8_t *header = jar->data + entry->local_offset;
+    if ((size_t)entry->local_offset + ZIP_LOCAL_HEADER_SIZE > jar->size || read_u32(header) != ZIP_LOCAL_HEADER) {
+        problem = "bad local header";
+    } else if (entry->flags & ZIP_ENCRYPTED) {
+        problem = "encrypted";
+    } else if (entry->method != ZIP_STORED && entry->method != ZIP_DEFLATED) {
+        problem = "unsupported compression method";
+    }
+    // The name and extra field lengths are only read once the header is
+    // known to lie inside the archive
+    size_t start = 0;
+    if (problem == NULL) {
+        start = (size_t)entry->local_offset + ZIP_LOCAL_HEADER_SIZE + read_u16(header + 26) + read_u16(header + 28);
+        if (start > jar->size || jar->size - start < entry->compressed_size) {
+            problem = "truncated";
+        }
+    }
+    if (problem == NULL && entry->method == ZIP_STORED) {
+        if (entry->compressed_size != entry->size) {
+            problem = "bad size";
+        } else {
+            *copied = false;
+            return jar->data + start;
+        }
+    }
+
+    uint8_t *bytes = NULL;
+    if (problem == NULL) {
+        bytes = malloc(entry->size ? entry->size : 1);
+        if (!bytes) {
+            fprintf(stderr, "Memory allocation error\n");
+            return NULL;
+        }
+        if (!inflate(jar->data + start, entry->compressed_size, bytes, entry->size)) {
+            problem = "invalid deflate data";
+        } else if (crc32_of(bytes, entry->size) != entry->crc) {
+            problem = "CRC mismatch";
+        }
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "Cannot read %.*s from archive: %s\n", (int)entry->name_length, entry->name, problem);
+        free(bytes);
+        return NULL;
+    }
+    *copied = true;
+    return bytes;
+}
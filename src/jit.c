@@ -0,0 +1,783 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include "jvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+// Baseline template JIT. Each decoded instruction of a hot method is
+// translated into a fixed x86-64 template that works directly on the frame
+// the interpreter would have used: locals and operand stack stay in the
+// Java stack, so compiled and interpreted frames are interchangeable.
+//
+// Register assignment inside compiled code:
+//   rbx  locals base         r13  JVM *
+//   r12  operand stack top   r14  Frame *
+//        (next free slot)
+//
+// Instructions without a template (invocations, allocation, arrays, ...)
+// call jit_step, which runs the interpreter handler for that single
+// instruction and returns the index of the next one. Control continues at
+// the compiled code of that index, so a method is always compiled whole.
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JVM_JIT_SUPPORTED 1
+#endif
+
+#ifdef JVM_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
+
+#ifdef JVM_JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define JIT_CACHE_SIZE (16 * 1024 * 1024)
+#define JIT_MAX_TEMPLATE 160  // upper bound of one instruction's template
+
+#define FRAME_LOCALS offsetof(Frame, locals)
+#define FRAME_VALUES (offsetof(Frame, stack) + offsetof(OperandStack, values))
+#define FRAME_SIZE   (offsetof(Frame, stack) + offsetof(OperandStack, size))
+
+typedef struct {
+    uint8_t *base;
+    size_t used;
+    size_t page_size;
+} CodeCache;
+
+static CodeCache code_cache;
+
+typedef struct {
+    uint32_t position;     // rel32 field to patch
+    uint32_t target;       // instruction index
+} Fixup;
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *cur;
+    uint32_t *offsets;     // native offset of every instruction index
+    Fixup *fixups;
+    uint32_t fixups_count;
+} Assembler;
+
+static void emit(Assembler *as, const uint8_t *bytes, size_t length) {
+    memcpy(as->cur, bytes, length);
+    as->cur += length;
+}
+
+#define EMIT(as, ...) \
+    do { \
+        static const uint8_t bytes_[] = { __VA_ARGS__ }; \
+        emit(as, bytes_, sizeof(bytes_)); \
+    } while (0)
+
+static void emit_u8(Assembler *as, uint8_t value) {
+    *as->cur++ = value;
+}
+
+static void emit_u32(Assembler *as, uint32_t value) {
+    memcpy(as->cur, &value, 4);
+    as->cur += 4;
+}
+
+static void emit_u64(Assembler *as, uint64_t value) {
+    memcpy(as->cur, &value, 8);
+    as->cur += 8;
+}
+
+static uint32_t position(Assembler *as) {
+    return (uint32_t)(as->cur - as->start);
+}
+
+// rel32 jump to the code of instruction index target, patched at the end
+static void emit_target(Assembler *as, uint32_t target) {
+    Fixup *fixup = &as->fixups[as->fixups_count++];
+    fixup->position = position(as);
+    fixup->target = target;
+    emit_u32(as, 0);
+}
+
+static void emit_jmp(Assembler *as, uint32_t target) {
+    emit_u8(as, 0xE9);
+    emit_target(as, target);
+}
+
+// Condition codes of the 0F 8x jcc encoding
+enum { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+static const uint8_t int_conditions[6] = { CC_E, CC_NE, CC_L, CC_GE, CC_G, CC_LE };
+
+static void emit_jcc(Assembler *as, uint8_t condition, uint32_t target) {
+    emit_u8(as, 0x0F);
+    emit_u8(as, 0x80 | condition);
+    emit_target(as, target);
+}
+
+// Forward jcc inside a template; returns the rel32 field for patch_here
+static uint8_t *emit_jcc_forward(Assembler *as, uint8_t condition) {
+    emit_u8(as, 0x0F);
+    emit_u8(as, 0x80 | condition);
+    uint8_t *field = as->cur;
+    emit_u32(as, 0);
+    return field;
+}
+
+static uint8_t *emit_jmp_forward(Assembler *as) {
+    emit_u8(as, 0xE9);
+    uint8_t *field = as->cur;
+    emit_u32(as, 0);
+    return field;
+}
+
+static void patch_here(Assembler *as, uint8_t *field) {
+    int32_t rel = (int32_t)(as->cur - (field + 4));
+    memcpy(field, &rel, 4);
+}
+
+// push eax / pop eax / pop ecx on the operand stack
+static void emit_push_eax(Assembler *as) {
+    EMIT(as, 0x41, 0x89, 0x04, 0x24);       // mov [r12], eax
+    EMIT(as, 0x49, 0x83, 0xC4, 0x04);       // add r12, 4
+}
+
+static void emit_pop_eax(Assembler *as) {
+    EMIT(as, 0x49, 0x83, 0xEC, 0x04);       // sub r12, 4
+    EMIT(as, 0x41, 0x8B, 0x04, 0x24);       // mov eax, [r12]
+}
+
+static void emit_pop_ecx(Assembler *as) {
+    EMIT(as, 0x49, 0x83, 0xEC, 0x04);       // sub r12, 4
+    EMIT(as, 0x41, 0x8B, 0x0C, 0x24);       // mov ecx, [r12]
+}
+
+// push rax / pop rax: a long or double in its two slots
+static void emit_push_rax(Assembler *as) {
+    EMIT(as, 0x49, 0x89, 0x04, 0x24);       // mov [r12], rax
+    EMIT(as, 0x49, 0x83, 0xC4, 0x08);       // add r12, 8
+}
+
+static void emit_pop_rax(Assembler *as) {
+    EMIT(as, 0x49, 0x83, 0xEC, 0x08);       // sub r12, 8
+    EMIT(as, 0x49, 0x8B, 0x04, 0x24);       // mov rax, [r12]
+}
+
+static void emit_push_imm64(Assembler *as, int64_t value) {
+    EMIT(as, 0x48, 0xB8);                   // mov rax, imm64
+    emit_u64(as, (uint64_t)value);
+    emit_push_rax(as);
+}
+
+static void emit_push_imm(Assembler *as, int32_t value) {
+    EMIT(as, 0x41, 0xC7, 0x04, 0x24);       // mov dword [r12], imm32
+    emit_u32(as, (uint32_t)value);
+    EMIT(as, 0x49, 0x83, 0xC4, 0x04);       // add r12, 4
+}
+
+static void emit_load_local(Assembler *as, int32_t index) {
+    EMIT(as, 0x8B, 0x83);                   // mov eax, [rbx + disp32]
+    emit_u32(as, (uint32_t)(index * 4));
+}
+
+static void emit_store_local(Assembler *as, int32_t index) {
+    EMIT(as, 0x89, 0x83);                   // mov [rbx + disp32], eax
+    emit_u32(as, (uint32_t)(index * 4));
+}
+
+// frame->stack.size = r12 - frame->stack.values, before leaving compiled code
+static void emit_sync_stack(Assembler *as) {
+    EMIT(as, 0x4C, 0x89, 0xE0);             // mov rax, r12
+    EMIT(as, 0x49, 0x2B, 0x46, FRAME_VALUES); // sub rax, [r14 + values]
+    EMIT(as, 0x48, 0xC1, 0xF8, 0x02);       // sar rax, 2
+    EMIT(as, 0x41, 0x89, 0x46, FRAME_SIZE); // mov [r14 + size], eax
+}
+
+// r12 = frame->stack.values + frame->stack.size
+static void emit_reload_stack(Assembler *as) {
+    EMIT(as, 0x49, 0x63, 0x4E, FRAME_SIZE); // movsxd rcx, [r14 + size]
+    EMIT(as, 0x4D, 0x8B, 0x66, FRAME_VALUES); // mov r12, [r14 + values]
+    EMIT(as, 0x4D, 0x8D, 0x24, 0x8C);       // lea r12, [r12 + rcx*4]
+}
+
+// Jumps to the code of the instruction index in eax
+static void emit_dispatch(Assembler *as, void **targets) {
+    EMIT(as, 0x48, 0xB9);                   // mov rcx, imm64
+    emit_u64(as, (uint64_t)(uintptr_t)targets);
+    EMIT(as, 0xFF, 0x24, 0xC1);             // jmp [rcx + rax*8]
+}
+
+static void emit_epilogue(Assembler *as) {
+    emit_sync_stack(as);
+    EMIT(as, 0x41, 0x5F,                    // pop r15
+         0x41, 0x5E,                        // pop r14
+         0x41, 0x5D,                        // pop r13
+         0x41, 0x5C,                        // pop r12
+         0x5B,                              // pop rbx
+         0xC3);                             // ret
+}
+
+// Runs the instruction at pc in the interpreter on behalf of compiled code
+static uint32_t jit_step(JVM *jvm, Frame *frame, uint32_t pc) {
+    return interpret_instruction(jvm, frame, pc);
+}
+
+static void emit_interpreter_call(Assembler *as, uint32_t pc, void **targets) {
+    emit_sync_stack(as);
+    EMIT(as, 0x4C, 0x89, 0xEF);             // mov rdi, r13
+    EMIT(as, 0x4C, 0x89, 0xF6);             // mov rsi, r14
+    emit_u8(as, 0xBA);                      // mov edx, pc
+    emit_u32(as, pc);
+    EMIT(as, 0x48, 0xB8);                   // mov rax, jit_step
+    emit_u64(as, (uint64_t)(uintptr_t)jit_step);
+    EMIT(as, 0xFF, 0xD0);                   // call rax
+    emit_reload_stack(as);
+    emit_u8(as, 0x3D);                      // cmp eax, pc + 1
+    emit_u32(as, pc + 1);
+    emit_jcc(as, CC_E, pc + 1);
+    emit_dispatch(as, targets);
+}
+
+// Binary int operation on the two top slots, result replaces val1.
+// ModRM byte selects the operation for the [r12 - 4] memory form.
+static void emit_binary(Assembler *as, uint8_t opcode) {
+    emit_pop_ecx(as);
+    emit_u8(as, 0x41);
+    emit_u8(as, opcode);                    // op [r12 - 4], ecx
+    EMIT(as, 0x4C, 0x24, 0xFC);
+}
+
+// Same for longs: op [r12 - 8], rax after popping val2
+static void emit_long_binary(Assembler *as, uint8_t opcode) {
+    emit_pop_rax(as);
+    emit_u8(as, 0x49);
+    emit_u8(as, opcode);                    // op [r12 - 8], rax
+    EMIT(as, 0x44, 0x24, 0xF8);
+}
+
+// addsd/subsd/mulsd/divsd (prefix 0xF2, 8-byte slots pair) or the ss forms
+// (prefix 0xF3, one slot) on the two top values through xmm0
+static void emit_floating_binary(Assembler *as, uint8_t prefix, uint8_t opcode) {
+    uint8_t size = prefix == 0xF2 ? 8 : 4;
+    uint8_t below = (uint8_t)-size;
+    const uint8_t bytes[] = {
+        0x49, 0x83, 0xEC, size,                     // sub r12, size
+        prefix, 0x41, 0x0F, 0x10, 0x44, 0x24, below, // movs xmm0, [r12 - size]
+        prefix, 0x41, 0x0F, opcode, 0x04, 0x24,     // op xmm0, [r12]
+        prefix, 0x41, 0x0F, 0x11, 0x44, 0x24, below, // movs [r12 - size], xmm0
+    };
+    emit(as, bytes, sizeof(bytes));
+}
+
+static void emit_shift(Assembler *as, uint8_t modrm) {
+    emit_pop_ecx(as);
+    EMIT(as, 0x41, 0xD3);                   // shl/sar/shr dword [r12 - 4], cl
+    emit_u8(as, modrm);
+    EMIT(as, 0x24, 0xFC);
+}
+
+// idiv/irem. A zero divisor is left to the interpreter handler; -1 is
+// special-cased since INT_MIN / -1 traps on x86.
+static void emit_division(Assembler *as, bool remainder, uint32_t pc, void **targets) {
+    emit_pop_ecx(as);
+    EMIT(as, 0x85, 0xC9);                   // test ecx, ecx
+    uint8_t *zero = emit_jcc_forward(as, CC_E);
+    EMIT(as, 0x83, 0xF9, 0xFF);             // cmp ecx, -1
+    uint8_t *minus_one = emit_jcc_forward(as, CC_E);
+    EMIT(as, 0x41, 0x8B, 0x44, 0x24, 0xFC); // mov eax, [r12 - 4]
+    EMIT(as, 0x99);                         // cdq
+    EMIT(as, 0xF7, 0xF9);                   // idiv ecx
+    if (remainder) {
+        EMIT(as, 0x41, 0x89, 0x54, 0x24, 0xFC); // mov [r12 - 4], edx
+    } else {
+        EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+    }
+    uint8_t *done = emit_jmp_forward(as);
+
+    patch_here(as, minus_one);
+    if (remainder) {
+        EMIT(as, 0x41, 0xC7, 0x44, 0x24, 0xFC, 0, 0, 0, 0); // mov dword [r12 - 4], 0
+    } else {
+        EMIT(as, 0x41, 0xF7, 0x5C, 0x24, 0xFC); // neg dword [r12 - 4]
+    }
+    uint8_t *done_minus_one = emit_jmp_forward(as);
+
+    patch_here(as, zero);
+    EMIT(as, 0x49, 0x83, 0xC4, 0x04);       // add r12, 4 (divisor back)
+    emit_interpreter_call(as, pc, targets);
+
+    patch_here(as, done);
+    patch_here(as, done_minus_one);
+}
+
+// rcx = address of the object whose reference is in the slot at r12 +
+// reference. A null reference takes the returned forward branch, for the
+// interpreter handler to throw.
+static uint8_t *emit_object_address(Assembler *as, int8_t reference) {
+    EMIT(as, 0x41, 0x8B, 0x44, 0x24);       // mov eax, [r12 + reference]
+    emit_u8(as, (uint8_t)reference);
+    EMIT(as, 0x85, 0xC0);                   // test eax, eax
+    uint8_t *null = emit_jcc_forward(as, CC_E);
+    EMIT(as, 0x49, 0x8B, 0x8D);             // mov rcx, [r13 + heap base]
+    emit_u32(as, (uint32_t)offsetof(JVM, heap.heap));
+    EMIT(as, 0x48, 0x8D, 0x0C, 0xC1);       // lea rcx, [rcx + rax*8]
+    return null;
+}
+
+// getfield/putfield at the resolved offset, with the interpreter call as
+// the null receiver path
+static void emit_field_access(Assembler *as, Instruction *insn, uint32_t pc, void **targets) {
+    uint32_t offset = (uint32_t)insn->b;
+    uint8_t *null;
+    switch (insn->opcode) {
+        case GETFIELD_QUICK:
+            null = emit_object_address(as, -4);
+            EMIT(as, 0x8B, 0x81);           // mov eax, [rcx + offset]
+            emit_u32(as, offset);
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+        case GETFIELD_BYTE_QUICK:
+            null = emit_object_address(as, -4);
+            EMIT(as, 0x0F, 0xBE, 0x81);     // movsx eax, byte [rcx + offset]
+            emit_u32(as, offset);
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+        case GETFIELD_CHAR_QUICK:
+            null = emit_object_address(as, -4);
+            EMIT(as, 0x0F, 0xB7, 0x81);     // movzx eax, word [rcx + offset]
+            emit_u32(as, offset);
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+        case GETFIELD_SHORT_QUICK:
+            null = emit_object_address(as, -4);
+            EMIT(as, 0x0F, 0xBF, 0x81);     // movsx eax, word [rcx + offset]
+            emit_u32(as, offset);
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+        case GETFIELD_LONG_QUICK:
+            null = emit_object_address(as, -4);
+            EMIT(as, 0x48, 0x8B, 0x81);     // mov rax, [rcx + offset]
+            emit_u32(as, offset);
+            EMIT(as, 0x49, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], rax
+            EMIT(as, 0x49, 0x83, 0xC4, 0x04); // add r12, 4
+            break;
+        case PUTFIELD_LONG_QUICK:
+            null = emit_object_address(as, -12);
+            EMIT(as, 0x49, 0x8B, 0x54, 0x24, 0xF8); // mov rdx, [r12 - 8]
+            EMIT(as, 0x48, 0x89, 0x91);     // mov [rcx + offset], rdx
+            emit_u32(as, offset);
+            EMIT(as, 0x49, 0x83, 0xEC, 0x0C); // sub r12, 12
+            break;
+        default:
+            null = emit_object_address(as, -8);
+            EMIT(as, 0x41, 0x8B, 0x54, 0x24, 0xFC); // mov edx, [r12 - 4]
+            if (insn->opcode == PUTFIELD_BOOLEAN_QUICK) {
+                EMIT(as, 0x83, 0xE2, 0x01); // and edx, 1
+            }
+            if (insn->opcode == PUTFIELD_BYTE_QUICK || insn->opcode == PUTFIELD_BOOLEAN_QUICK) {
+                EMIT(as, 0x88, 0x91);       // mov [rcx + offset], dl
+            } else if (insn->opcode == PUTFIELD_CHAR_QUICK) {
+                EMIT(as, 0x66, 0x89, 0x91); // mov [rcx + offset], dx
+            } else {
+                EMIT(as, 0x89, 0x91);       // mov [rcx + offset], edx
+            }
+            emit_u32(as, offset);
+            if (insn->opcode == PUTFIELD_REFERENCE_QUICK) {
+                // card_mark: the card of the field's heap offset, rax * 8 + offset
+                EMIT(as, 0x89, 0xC2);       // mov edx, eax
+                EMIT(as, 0x48, 0xC1, 0xE2, REFERENCE_SHIFT); // shl rdx, REFERENCE_SHIFT
+                EMIT(as, 0x48, 0x81, 0xC2); // add rdx, offset
+                emit_u32(as, offset);
+                EMIT(as, 0x48, 0xC1, 0xEA, CARD_SHIFT); // shr rdx, CARD_SHIFT
+                EMIT(as, 0x49, 0x8B, 0xB5); // mov rsi, [r13 + cards]
+                emit_u32(as, (uint32_t)offsetof(JVM, heap.cards));
+                EMIT(as, 0xC6, 0x04, 0x16, CARD_DIRTY); // mov byte [rsi + rdx], CARD_DIRTY
+            }
+            EMIT(as, 0x49, 0x83, 0xEC, 0x08); // sub r12, 8
+            break;
+    }
+    uint8_t *done = emit_jmp_forward(as);
+
+    patch_here(as, null);
+    emit_interpreter_call(as, pc, targets);
+
+    patch_here(as, done);
+}
+
+static void emit_instruction(Assembler *as, Method *method, uint32_t pc, void **targets) {
+    Instruction *insn = &method->code[pc];
+    ResolvedEntry *entry;
+
+    switch (insn->opcode) {
+        case NOP:
+            break;
+        case SIPUSH:
+            emit_push_imm(as, insn->a);
+            break;
+        case ILOAD:
+        case ALOAD:
+            emit_load_local(as, insn->a);
+            emit_push_eax(as);
+            break;
+        case ISTORE:
+        case ASTORE:
+            emit_pop_eax(as);
+            emit_store_local(as, insn->a);
+            break;
+        case LLOAD:
+        case DLOAD:
+            EMIT(as, 0x48, 0x8B, 0x83);     // mov rax, [rbx + disp32]
+            emit_u32(as, (uint32_t)(insn->a * 4));
+            emit_push_rax(as);
+            break;
+        case LSTORE:
+        case DSTORE:
+            emit_pop_rax(as);
+            EMIT(as, 0x48, 0x89, 0x83);     // mov [rbx + disp32], rax
+            emit_u32(as, (uint32_t)(insn->a * 4));
+            break;
+        case FLOAD:
+            emit_load_local(as, insn->a);
+            emit_push_eax(as);
+            break;
+        case FSTORE:
+            emit_pop_eax(as);
+            emit_store_local(as, insn->a);
+            break;
+        case IINC:
+            EMIT(as, 0x81, 0x83);           // add dword [rbx + disp32], imm32
+            emit_u32(as, (uint32_t)(insn->a * 4));
+            emit_u32(as, (uint32_t)insn->b);
+            break;
+
+        case IADD: emit_binary(as, 0x01); break;
+        case ISUB: emit_binary(as, 0x29); break;
+        case IAND: emit_binary(as, 0x21); break;
+        case IOR:  emit_binary(as, 0x09); break;
+        case IXOR: emit_binary(as, 0x31); break;
+        case IMUL:
+            emit_pop_ecx(as);
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, 0xFC); // mov eax, [r12 - 4]
+            EMIT(as, 0x0F, 0xAF, 0xC1);             // imul eax, ecx
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+        case IDIV: emit_division(as, false, pc, targets); break;
+        case IREM: emit_division(as, true, pc, targets); break;
+        case INEG:
+            EMIT(as, 0x41, 0xF7, 0x5C, 0x24, 0xFC); // neg dword [r12 - 4]
+            break;
+        case ISHL:  emit_shift(as, 0x64); break;
+        case ISHR:  emit_shift(as, 0x7C); break;
+        case IUSHR: emit_shift(as, 0x6C); break;
+
+        case LADD: emit_long_binary(as, 0x01); break;
+        case LSUB: emit_long_binary(as, 0x29); break;
+        case LAND: emit_long_binary(as, 0x21); break;
+        case LOR:  emit_long_binary(as, 0x09); break;
+        case LXOR: emit_long_binary(as, 0x31); break;
+        case LMUL:
+            emit_pop_rax(as);
+            EMIT(as, 0x49, 0x0F, 0xAF, 0x44, 0x24, 0xF8); // imul rax, [r12 - 8]
+            EMIT(as, 0x49, 0x89, 0x44, 0x24, 0xF8);       // mov [r12 - 8], rax
+            break;
+        case LNEG:
+            EMIT(as, 0x49, 0xF7, 0x5C, 0x24, 0xF8); // neg qword [r12 - 8]
+            break;
+        case LCMP:
+            EMIT(as, 0x49, 0x8B, 0x44, 0x24, 0xF0); // mov rax, [r12 - 16]
+            EMIT(as, 0x49, 0x3B, 0x44, 0x24, 0xF8); // cmp rax, [r12 - 8]
+            EMIT(as, 0x0F, 0x9F, 0xC0);             // setg al
+            EMIT(as, 0x0F, 0x9C, 0xC1);             // setl cl
+            EMIT(as, 0x28, 0xC8);                   // sub al, cl
+            EMIT(as, 0x0F, 0xBE, 0xC0);             // movsx eax, al
+            EMIT(as, 0x49, 0x83, 0xEC, 0x0C);       // sub r12, 12
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], eax
+            break;
+
+        case FADD: emit_floating_binary(as, 0xF3, 0x58); break;
+        case FSUB: emit_floating_binary(as, 0xF3, 0x5C); break;
+        case FMUL: emit_floating_binary(as, 0xF3, 0x59); break;
+        case FDIV: emit_floating_binary(as, 0xF3, 0x5E); break;
+        case DADD: emit_floating_binary(as, 0xF2, 0x58); break;
+        case DSUB: emit_floating_binary(as, 0xF2, 0x5C); break;
+        case DMUL: emit_floating_binary(as, 0xF2, 0x59); break;
+        case DDIV: emit_floating_binary(as, 0xF2, 0x5E); break;
+
+        // Conversions without a range check; f2i, d2l and friends saturate
+        // and are left to the interpreter
+        case I2L:
+            EMIT(as, 0x49, 0x63, 0x44, 0x24, 0xFC); // movsxd rax, [r12 - 4]
+            EMIT(as, 0x49, 0x89, 0x44, 0x24, 0xFC); // mov [r12 - 4], rax
+            EMIT(as, 0x49, 0x83, 0xC4, 0x04);       // add r12, 4
+            break;
+        case L2I:
+            EMIT(as, 0x49, 0x83, 0xEC, 0x04);       // sub r12, 4 (keeps the low half)
+            break;
+        case I2D:
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x2A, 0x44, 0x24, 0xFC); // cvtsi2sd xmm0, dword [r12 - 4]
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x11, 0x44, 0x24, 0xFC); // movsd [r12 - 4], xmm0
+            EMIT(as, 0x49, 0x83, 0xC4, 0x04);                   // add r12, 4
+            break;
+        case L2D:
+            EMIT(as, 0xF2, 0x49, 0x0F, 0x2A, 0x44, 0x24, 0xF8); // cvtsi2sd xmm0, qword [r12 - 8]
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x11, 0x44, 0x24, 0xF8); // movsd [r12 - 8], xmm0
+            break;
+        case I2F:
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x2A, 0x44, 0x24, 0xFC); // cvtsi2ss xmm0, dword [r12 - 4]
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x11, 0x44, 0x24, 0xFC); // movss [r12 - 4], xmm0
+            break;
+        case F2D:
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x5A, 0x44, 0x24, 0xFC); // cvtss2sd xmm0, [r12 - 4]
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x11, 0x44, 0x24, 0xFC); // movsd [r12 - 4], xmm0
+            EMIT(as, 0x49, 0x83, 0xC4, 0x04);                   // add r12, 4
+            break;
+        case D2F:
+            EMIT(as, 0xF2, 0x41, 0x0F, 0x5A, 0x44, 0x24, 0xF8); // cvtsd2ss xmm0, [r12 - 8]
+            EMIT(as, 0x49, 0x83, 0xEC, 0x04);                   // sub r12, 4
+            EMIT(as, 0xF3, 0x41, 0x0F, 0x11, 0x44, 0x24, 0xFC); // movss [r12 - 4], xmm0
+            break;
+        case I2B:
+            EMIT(as, 0x41, 0x0F, 0xBE, 0x44, 0x24, 0xFC); // movsx eax, byte [r12 - 4]
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC);       // mov [r12 - 4], eax
+            break;
+        case I2C:
+            EMIT(as, 0x41, 0x0F, 0xB7, 0x44, 0x24, 0xFC); // movzx eax, word [r12 - 4]
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC);       // mov [r12 - 4], eax
+            break;
+        case I2S:
+            EMIT(as, 0x41, 0x0F, 0xBF, 0x44, 0x24, 0xFC); // movsx eax, word [r12 - 4]
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xFC);       // mov [r12 - 4], eax
+            break;
+
+        case DUP:
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, 0xFC); // mov eax, [r12 - 4]
+            emit_push_eax(as);
+            break;
+        case POP:
+            EMIT(as, 0x49, 0x83, 0xEC, 0x04);       // sub r12, 4
+            break;
+        case DUP2:
+            EMIT(as, 0x49, 0x8B, 0x44, 0x24, 0xF8); // mov rax, [r12 - 8]
+            emit_push_rax(as);
+            break;
+        case POP2:
+            EMIT(as, 0x49, 0x83, 0xEC, 0x08);       // sub r12, 8
+            break;
+        case SWAP:
+            EMIT(as, 0x41, 0x8B, 0x44, 0x24, 0xFC); // mov eax, [r12 - 4]
+            EMIT(as, 0x41, 0x8B, 0x4C, 0x24, 0xF8); // mov ecx, [r12 - 8]
+            EMIT(as, 0x41, 0x89, 0x44, 0x24, 0xF8); // mov [r12 - 8], eax
+            EMIT(as, 0x41, 0x89, 0x4C, 0x24, 0xFC); // mov [r12 - 4], ecx
+            break;
+
+        case GOTO:
+            emit_jmp(as, insn->a);
+            break;
+        case IFEQ: case IFNE: case IFLT: case IFGE: case IFGT: case IFLE:
+            emit_pop_eax(as);
+            EMIT(as, 0x85, 0xC0);                   // test eax, eax
+            emit_jcc(as, int_conditions[insn->opcode - IFEQ], insn->a);
+            break;
+        case IF_ICMPEQ: case IF_ICMPNE: case IF_ICMPLT:
+        case IF_ICMPGE: case IF_ICMPGT: case IF_ICMPLE:
+            EMIT(as, 0x49, 0x83, 0xEC, 0x08);       // sub r12, 8
+            EMIT(as, 0x41, 0x8B, 0x04, 0x24);       // mov eax, [r12]
+            EMIT(as, 0x41, 0x3B, 0x44, 0x24, 0x04); // cmp eax, [r12 + 4]
+            emit_jcc(as, int_conditions[insn->opcode - IF_ICMPEQ], insn->a);
+            break;
+
+        case ILOAD_ILOAD_IADD_ISTORE:
+            emit_load_local(as, insn->a);
+            EMIT(as, 0x03, 0x83);                   // add eax, [rbx + disp32]
+            emit_u32(as, (uint32_t)(insn->b * 4));
+            emit_store_local(as, insn->aux);
+            emit_jmp(as, pc + 4);
+            break;
+        case SIPUSH_IF_ICMP:
+            emit_pop_eax(as);
+            emit_u8(as, 0x3D);                      // cmp eax, imm32
+            emit_u32(as, (uint32_t)insn->b);
+            emit_jcc(as, int_conditions[insn->reserved], insn->a);
+            emit_jmp(as, pc + 2);
+            break;
+
+        // Quickened constant pool accesses: the entry is resolved for good,
+        // so its address or value is baked into the code
+        case GETSTATIC_QUICK:
+            entry = &method->class->resolved[insn->a];
+            EMIT(as, 0x48, 0xB9);                   // mov rcx, imm64
+            emit_u64(as, (uint64_t)(uintptr_t)entry->static_value);
+            EMIT(as, 0x8B, 0x01);                   // mov eax, [rcx]
+            emit_push_eax(as);
+            if (entry->slots == 2) {
+                EMIT(as, 0x8B, 0x41, 0x04);         // mov eax, [rcx + 4]
+                emit_push_eax(as);
+            }
+            break;
+        case PUTSTATIC_QUICK:
+            entry = &method->class->resolved[insn->a];
+            EMIT(as, 0x48, 0xB9);                   // mov rcx, imm64
+            emit_u64(as, (uint64_t)(uintptr_t)entry->static_value);
+            if (entry->slots == 2) {
+                emit_pop_eax(as);
+                EMIT(as, 0x89, 0x41, 0x04);         // mov [rcx + 4], eax
+            }
+            emit_pop_eax(as);
+            EMIT(as, 0x89, 0x01);                   // mov [rcx], eax
+            break;
+        case GETFIELD_QUICK: case GETFIELD_LONG_QUICK: case GETFIELD_BYTE_QUICK:
+        case GETFIELD_CHAR_QUICK: case GETFIELD_SHORT_QUICK: case PUTFIELD_QUICK:
+        case PUTFIELD_REFERENCE_QUICK: case PUTFIELD_LONG_QUICK: case PUTFIELD_BYTE_QUICK:
+        case PUTFIELD_BOOLEAN_QUICK: case PUTFIELD_CHAR_QUICK:
+            emit_field_access(as, insn, pc, targets);
+            break;
+        case LDC_QUICK:
+            emit_push_imm(as, method->class->resolved[insn->a].constant);
+            break;
+        case LDC2_W_QUICK:
+            emit_push_imm64(as, method->class->resolved[insn->a].wide_constant);
+            break;
+        case LCONST_0: case LCONST_1:
+            emit_push_imm64(as, insn->opcode - LCONST_0);
+            break;
+        case DCONST_0: case DCONST_1: {
+            double value = insn->opcode - DCONST_0;
+            int64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            emit_push_imm64(as, bits);
+            break;
+        }
+        case FCONST_0: case FCONST_1: case FCONST_2: {
+            float value = (float)(insn->opcode - FCONST_0);
+            int32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            emit_push_imm(as, bits);
+            break;
+        }
+
+        case IRETURN: case LRETURN: case FRETURN:
+        case DRETURN: case ARETURN: case RETURN:
+            emit_epilogue(as);
+            break;
+
+        default:
+            emit_interpreter_call(as, pc, targets);
+            break;
+    }
+}
+
+static bool code_cache_init(void) {
+    if (code_cache.base) {
+        return true;
+    }
+    void *base = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to reserve the JIT code cache\n");
+        return false;
+    }
+    code_cache.base = base;
+    code_cache.used = 0;
+    code_cache.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return true;
+}
+
+// Code pages are writable only while a method is being emitted into them
+static bool set_writable(size_t start, size_t end, bool writable) {
+    size_t first = start & ~(code_cache.page_size - 1);
+    return mprotect(code_cache.base + first, end - first,
+                    writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+bool jit_compile(JVM *jvm, Method *method) {
+    method->jit_failed = true; // until proven otherwise
+    // The templates do not check the operand stack, so methods that did not
+    // verify stay on the interpreter's checked handlers
+    if (!method->code || !method->verified || !code_cache_init()) {
+        return false;
+    }
+
+    uint32_t count = method->instruction_count + 1; // with the sentinel
+    size_t budget = 64 + (size_t)count * JIT_MAX_TEMPLATE;
+    size_t start = (code_cache.used + 15) & ~(size_t)15;
+    if (start + budget > JIT_CACHE_SIZE) {
+        TRACE("JIT code cache full, %s stays interpreted\n", method->name);
+        return false;
+    }
+
+    void **targets = malloc(sizeof(void *) * count);
+    Assembler as;
+    as.start = code_cache.base + start;
+    as.cur = as.start;
+    as.offsets = malloc(sizeof(uint32_t) * count);
+    as.fixups = malloc(sizeof(Fixup) * count * 3);
+    as.fixups_count = 0;
+    if (!targets || !as.offsets || !as.fixups ||
+        !set_writable(start, start + budget, true)) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(targets);
+        free(as.offsets);
+        free(as.fixups);
+        return false;
+    }
+
+    // Prologue: jit_code(jvm, frame, pc) enters at instruction pc
+    EMIT(&as, 0x53,                         // push rbx
+         0x41, 0x54,                        // push r12
+         0x41, 0x55,                        // push r13
+         0x41, 0x56,                        // push r14
+         0x41, 0x57);                       // push r15 (keeps rsp 16-byte aligned)
+    EMIT(&as, 0x49, 0x89, 0xFD);            // mov r13, rdi
+    EMIT(&as, 0x49, 0x89, 0xF6);            // mov r14, rsi
+    EMIT(&as, 0x49, 0x8B, 0x5E, FRAME_LOCALS); // mov rbx, [r14 + locals]
+    emit_reload_stack(&as);
+    EMIT(&as, 0x89, 0xD0);                  // mov eax, edx
+    EMIT(&as, 0x85, 0xC0);                  // test eax, eax
+    emit_jcc(&as, CC_E, 0);
+    emit_dispatch(&as, targets);
+
+    for (uint32_t pc = 0; pc < count; pc++) {
+        as.offsets[pc] = position(&as);
+        emit_instruction(&as, method, pc, targets);
+    }
+
+    for (uint32_t i = 0; i < as.fixups_count; i++) {
+        Fixup *fixup = &as.fixups[i];
+        int32_t rel = (int32_t)as.offsets[fixup->target] - (int32_t)(fixup->position + 4);
+        memcpy(as.start + fixup->position, &rel, 4);
+    }
+    for (uint32_t pc = 0; pc < count; pc++) {
+        targets[pc] = as.start + as.offsets[pc];
+    }
+
+    size_t end = start + position(&as);
+    set_writable(start, start + budget, false);
+    code_cache.used = end;
+    free(as.offsets);
+    free(as.fixups);
+
+    method->jit_targets = targets;
+    method->jit_code = (compiled_method)(void *)as.start;
+    method->jit_failed = false;
+    TRACE("JIT compiled %s.%s%s: %u instructions, %zu bytes\n", method->class ? method->class->name : "",
+              method->name, method->descriptor ? method->descriptor : "", count, end - start);
+    return true;
+}
+
+bool jit_supported(void) {
+    return true;
+}
+
+#else
+
+bool jit_compile(JVM *jvm, Method *method) {
+    method->jit_failed = true;
+    return false;
+}
+
+bool jit_supported(void) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,1418 @@
+#include "jvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONSTANT_Class              7
+#define CONSTANT_Fieldref           9
+#define CONSTANT_Methodref          10
+#define CONSTANT_InterfaceMethodref 11
+#define CONSTANT_String             8
+#define CONSTANT_Integer            3
+#define CONSTANT_Float              4
+#define CONSTANT_Long               5
+#define CONSTANT_Double             6
+
+#define ACC_PRIVATE   0x0002
+#define ACC_STATIC    0x0008
+#define ACC_INTERFACE 0x0200
+
+// Byte length of every fixed-size opcode, 0 for variable-length or
+// undefined ones (tableswitch, lookupswitch and wide are handled apart).
+static const uint8_t opcode_lengths[256] = {
+    [0x00 ... 0x0F] = 1,
+    [0x10] = 2, [0x11] = 3, [0x12] = 2, [0x13] = 3, [0x14] = 3,
+    [0x15 ... 0x19] = 2,
+    [0x1A ... 0x35] = 1,
+    [0x36 ... 0x3A] = 2,
+    [0x3B ... 0x83] = 1,
+    [0x84] = 3,
+    [0x85 ... 0x98] = 1,
+    [0x99 ... 0xA8] = 3,
+    [0xA9] = 2,
+    [0xAC ... 0xB1] = 1,
+    [0xB2 ... 0xB8] = 3,
+    [0xB9] = 5, [0xBA] = 5,
+    [0xBB] = 3, [0xBC] = 2, [0xBD] = 3, [0xBE] = 1, [0xBF] = 1,
+    [0xC0] = 3, [0xC1] = 3, [0xC2] = 1, [0xC3] = 1,
+    [0xC5] = 4, [0xC6] = 3, [0xC7] = 3, [0xC8] = 5, [0xC9] = 5,
+};
+
+static const char *opcode_names[256] = {
+    [0x00] = "nop", [0x01] = "aconst_null", [0x02] = "iconst_m1", [0x03] = "iconst_0",
+    [0x04] = "iconst_1", [0x05] = "iconst_2", [0x06] = "iconst_3", [0x07] = "iconst_4",
+    [0x08] = "iconst_5", [0x09] = "lconst_0", [0x0A] = "lconst_1", [0x0B] = "fconst_0",
+    [0x0C] = "fconst_1", [0x0D] = "fconst_2", [0x0E] = "dconst_0", [0x0F] = "dconst_1",
+    [0x10] = "bipush", [0x11] = "sipush", [0x12] = "ldc", [0x13] = "ldc_w",
+    [0x14] = "ldc2_w", [0x15] = "iload", [0x16] = "lload", [0x17] = "fload",
+    [0x18] = "dload", [0x19] = "aload", [0x1A] = "iload_0", [0x1B] = "iload_1",
+    [0x1C] = "iload_2", [0x1D] = "iload_3", [0x1E] = "lload_0", [0x1F] = "lload_1",
+    [0x20] = "lload_2", [0x21] = "lload_3", [0x22] = "fload_0", [0x23] = "fload_1",
+    [0x24] = "fload_2", [0x25] = "fload_3", [0x26] = "dload_0", [0x27] = "dload_1",
+    [0x28] = "dload_2", [0x29] = "dload_3", [0x2A] = "aload_0", [0x2B] = "aload_1",
+    [0x2C] = "aload_2", [0x2D] = "aload_3", [0x2E] = "iaload", [0x2F] = "laload",
+    [0x30] = "faload", [0x31] = "daload", [0x32] = "aaload", [0x33] = "baload",
+    [0x34] = "caload", [0x35] = "saload", [0x36] = "istore", [0x37] = "lstore",
+    [0x38] = "fstore", [0x39] = "dstore", [0x3A] = "astore", [0x3B] = "istore_0",
+    [0x3C] = "istore_1", [0x3D] = "istore_2", [0x3E] = "istore_3", [0x3F] = "lstore_0",
+    [0x40] = "lstore_1", [0x41] = "lstore_2", [0x42] = "lstore_3", [0x43] = "fstore_0",
+    [0x44] = "fstore_1", [0x45] = "fstore_2", [0x46] = "fstore_3", [0x47] = "dstore_0",
+    [0x48] = "dstore_1", [0x49] = "dstore_2", [0x4A] = "dstore_3", [0x4B] = "astore_0",
+    [0x4C] = "astore_1", [0x4D] = "astore_2", [0x4E] = "astore_3", [0x4F] = "iastore",
+    [0x50] = "lastore", [0x51] = "fastore", [0x52] = "dastore", [0x53] = "aastore",
+    [0x54] = "bastore", [0x55] = "castore", [0x56] = "sastore", [0x57] = "pop",
+    [0x58] = "pop2", [0x59] = "dup", [0x5A] = "dup_x1", [0x5B] = "dup_x2",
+    [0x5C] = "dup2", [0x5D] = "dup2_x1", [0x5E] = "dup2_x2", [0x5F] = "swap",
+    [0x60] = "iadd", [0x61] = "ladd", [0x62] = "fadd", [0x63] = "dadd",
+    [0x64] = "isub", [0x65] = "lsub", [0x66] = "fsub", [0x67] = "dsub",
+    [0x68] = "imul", [0x69] = "lmul", [0x6A] = "fmul", [0x6B] = "dmul",
+    [0x6C] = "idiv", [0x6D] = "ldiv", [0x6E] = "fdiv", [0x6F] = "ddiv",
+    [0x70] = "irem", [0x71] = "lrem", [0x72] = "frem", [0x73] = "drem",
+    [0x74] = "ineg", [0x75] = "lneg", [0x76] = "fneg", [0x77] = "dneg",
+    [0x78] = "ishl", [0x79] = "lshl", [0x7A] = "ishr", [0x7B] = "lshr",
+    [0x7C] = "iushr", [0x7D] = "lushr", [0x7E] = "iand", [0x7F] = "land",
+    [0x80] = "ior", [0x81] = "lor", [0x82] = "ixor", [0x83] = "lxor", [0x84] = "iinc",
+    [0x85] = "i2l", [0x86] = "i2f", [0x87] = "i2d", [0x88] = "l2i", [0x89] = "l2f",
+    [0x8A] = "l2d", [0x8B] = "f2i", [0x8C] = "f2l", [0x8D] = "f2d", [0x8E] = "d2i",
+    [0x8F] = "d2l", [0x90] = "d2f", [0x91] = "i2b", [0x92] = "i2c", [0x93] = "i2s",
+    [0x94] = "lcmp", [0x95] = "fcmpl", [0x96] = "fcmpg", [0x97] = "dcmpl",
+    [0x98] = "dcmpg", [0x99] = "ifeq", [0x9A] = "ifne", [0x9B] = "iflt",
+    [0x9C] = "ifge", [0x9D] = "ifgt", [0x9E] = "ifle", [0x9F] = "if_icmpeq",
+    [0xA0] = "if_icmpne", [0xA1] = "if_icmplt", [0xA2] = "if_icmpge",
+    [0xA3] = "if_icmpgt", [0xA4] = "if_icmple", [0xA5] = "if_acmpeq",
+    [0xA6] = "if_acmpne", [0xA7] = "goto", [0xA8] = "jsr", [0xA9] = "ret",
+    [0xAA] = "tableswitch", [0xAB] = "lookupswitch", [0xAC] = "ireturn",
+    [0xAD] = "lreturn", [0xAE] = "freturn", [0xAF] = "dreturn", [0xB0] = "areturn",
+    [0xB1] = "return", [0xB2] = "getstatic", [0xB3] = "putstatic", [0xB4] = "getfield",
+    [0xB5] = "putfield", [0xB6] = "invokevirtual", [0xB7] = "invokespecial",
+    [0xB8] = "invokestatic", [0xB9] = "invokeinterface", [0xBA] = "invokedynamic",
+    [0xBB] = "new", [0xBC] = "newarray", [0xBD] = "anewarray", [0xBE] = "arraylength",
+    [0xBF] = "athrow", [0xC0] = "checkcast", [0xC1] = "instanceof",
+    [0xC2] = "monitorenter", [0xC3] = "monitorexit", [0xC4] = "wide",
+    [0xC5] = "multianewarray", [0xC6] = "ifnull", [0xC7] = "ifnonnull",
+    [0xC8] = "goto_w", [0xC9] = "jsr_w",
+    [GETSTATIC_QUICK] = "getstatic_quick", [PUTSTATIC_QUICK] = "putstatic_quick",
+    [INVOKEVIRTUAL_QUICK] = "invokevirtual_quick", [NEW_QUICK] = "new_quick",
+    [LDC_QUICK] = "ldc_quick", [LDC2_W_QUICK] = "ldc2_w_quick", [ILOAD_ILOAD_IADD_ISTORE] = "iload_iload_iadd_istore",
+    [SIPUSH_IF_ICMP] = "sipush_if_icmp", [ALOAD_ILOAD_IALOAD] = "aload_iload_iaload",
+    [INVOKE_DIRECT_QUICK] = "invoke_direct_quick", [INVOKE_NATIVE_QUICK] = "invoke_native_quick",
+    [INVOKEVIRTUAL_MONO] = "invokevirtual_mono", [INVOKEVIRTUAL_POLY] = "invokevirtual_poly",
+    [INVOKEVIRTUAL_MEGA] = "invokevirtual_mega",
+    [GETFIELD_QUICK] = "getfield_quick", [GETFIELD_LONG_QUICK] = "getfield_long_quick",
+    [GETFIELD_BYTE_QUICK] = "getfield_byte_quick", [GETFIELD_CHAR_QUICK] = "getfield_char_quick",
+    [GETFIELD_SHORT_QUICK] = "getfield_short_quick", [PUTFIELD_QUICK] = "putfield_quick",
+    [PUTFIELD_REFERENCE_QUICK] = "putfield_reference_quick", [PUTFIELD_LONG_QUICK] = "putfield_long_quick",
+    [PUTFIELD_BYTE_QUICK] = "putfield_byte_quick", [PUTFIELD_BOOLEAN_QUICK] = "putfield_boolean_quick",
+    [PUTFIELD_CHAR_QUICK] = "putfield_char_quick",
+};
+
+const char *opcode_name(uint8_t opcode) {
+    return opcode_names[opcode] ? opcode_names[opcode] : "<unknown>";
+}
+
+static int16_t read_s2(const uint8_t *p) {
+    return (int16_t)((p[0] << 8) | p[1]);
+}
+
+static uint16_t read_u2(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int32_t read_s4(const uint8_t *p) {
+    return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                     ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+// Returns the byte length of the instruction at bci, or 0 if it is malformed
+// or runs past the end of the code. Switch sizes are computed in 64 bits so
+// a huge count cannot wrap around into a small length.
+static uint32_t instruction_length(const uint8_t *bytecode, uint32_t code_length, uint32_t bci) {
+    uint8_t opcode = bytecode[bci];
+
+    if (opcode == TABLESWITCH || opcode == LOOKUPSWITCH) {
+        uint64_t base = (bci + 4) & ~3u; // operands are 4-byte aligned
+        uint64_t end;
+        if (opcode == TABLESWITCH) {
+            if (base + 12 > code_length) return 0;
+            int64_t low = read_s4(bytecode + base + 4);
+            int64_t high = read_s4(bytecode + base + 8);
+            if (high < low) return 0;
+            end = base + 12 + 4 * (uint64_t)(high - low + 1);
+        } else {
+            if (base + 8 > code_length) return 0;
+            int64_t npairs = read_s4(bytecode + base + 4);
+            if (npairs < 0) return 0;
+            end = base + 8 + 8 * (uint64_t)npairs;
+        }
+        if (end > code_length) return 0;
+        return (uint32_t)(end - bci);
+    }
+
+    if (opcode == WIDE) {
+        if (bci + 1 >= code_length) return 0;
+        return bytecode[bci + 1] == IINC ? 6 : 4;
+    }
+
+    return opcode_lengths[opcode];
+}
+
+static const char *class_name_at(ClassFile *class_file, uint16_t class_index);
+
+// Shape of the array class at class_index for multianewarray: its number of
+// dimensions << 8 | the ARRAY_TYPE_* of the innermost arrays, or -1 if it
+// is not an array class
+static int32_t array_shape(ClassFile *class_file, uint16_t class_index) {
+    const char *name = class_name_at(class_file, class_index);
+    if (!name) {
+        return -1;
+    }
+    int32_t dimensions = 0;
+    while (name[dimensions] == '[') {
+        dimensions++;
+    }
+    if (dimensions == 0 || dimensions > 255) {
+        return -1;
+    }
+    uint8_t type;
+    switch (name[dimensions]) {
+        case 'Z': type = ARRAY_TYPE_BOOLEAN; break;
+        case 'C': type = ARRAY_TYPE_CHAR; break;
+        case 'F': type = ARRAY_TYPE_FLOAT; break;
+        case 'D': type = ARRAY_TYPE_DOUBLE; break;
+        case 'B': type = ARRAY_TYPE_BYTE; break;
+        case 'S': type = ARRAY_TYPE_SHORT; break;
+        case 'I': type = ARRAY_TYPE_INT; break;
+        case 'J': type = ARRAY_TYPE_LONG; break;
+        case 'L': type = ARRAY_TYPE_REFERENCE; break;
+        default: return -1;
+    }
+    return dimensions << 8 | type;
+}
+
+// Rewrites one instruction into its normalized internal form. Branch
+// operands are left as bytecode offsets and patched once every bci is known.
+static void decode_instruction(Method *method, uint32_t bci, Instruction *insn,
+                               int32_t *switch_data, uint32_t *switch_used) {
+    const uint8_t *p = method->bytecode + bci;
+    uint8_t opcode = p[0];
+
+    insn->opcode = opcode;
+    insn->reserved = 0;
+    insn->aux = 0;
+    insn->a = 0;
+    insn->b = 0;
+
+    switch (opcode) {
+        // iconst_<n>, bipush and sipush all push an int immediate
+        case ICONST_M1: case ICONST_0: case ICONST_1: case ICONST_2:
+        case ICONST_3: case ICONST_4: case ICONST_5:
+            insn->opcode = SIPUSH;
+            insn->a = opcode - ICONST_0;
+            break;
+        case BIPUSH:
+            insn->opcode = SIPUSH;
+            insn->a = (int8_t)p[1];
+            break;
+        case SIPUSH:
+            insn->a = read_s2(p + 1);
+            break;
+
+        case LDC:
+            insn->a = p[1];
+            break;
+        case LDC_W:
+            insn->opcode = LDC;
+            insn->a = read_u2(p + 1);
+            break;
+
+        // <t>load/<t>store with an explicit index
+        case 0x15 ... 0x19:
+        case 0x36 ... 0x3A:
+            insn->a = p[1];
+            break;
+        // <t>load_<n>: iload_0 is 0x1A, lload_0 0x1E, ... aload_3 0x2D
+        case 0x1A ... 0x2D:
+            insn->opcode = ILOAD + (opcode - 0x1A) / 4;
+            insn->a = (opcode - 0x1A) % 4;
+            break;
+        // <t>store_<n>: istore_0 is 0x3B ... astore_3 0x4E
+        case 0x3B ... 0x4E:
+            insn->opcode = ISTORE + (opcode - 0x3B) / 4;
+            insn->a = (opcode - 0x3B) % 4;
+            break;
+
+        case IINC:
+            insn->a = p[1];
+            insn->b = (int8_t)p[2];
+            break;
+
+        case WIDE:
+            insn->opcode = p[1];
+            insn->a = read_u2(p + 2);
+            if (p[1] == IINC) {
+                insn->b = read_s2(p + 4);
+            }
+            break;
+
+        case 0x99 ... 0xA8: // if<cond>, if_icmp<cond>, if_acmp<cond>, goto, jsr
+        case 0xC6: case 0xC7: // ifnull, ifnonnull
+            insn->a = (int32_t)bci + read_s2(p + 1);
+            break;
+        case GOTO_W:
+            insn->opcode = GOTO;
+            insn->a = (int32_t)bci + read_s4(p + 1);
+            break;
+
+        // Switch tables are copied out as
+        //   tableswitch:  default, low, high, targets[high - low + 1]
+        //   lookupswitch: default, npairs, (match, target)[npairs]
+        // with every target patched to an instruction index later.
+        case TABLESWITCH: {
+            uint32_t base = (bci + 4) & ~3u;
+            int32_t low = read_s4(method->bytecode + base + 4);
+            int32_t high = read_s4(method->bytecode + base + 8);
+            int32_t count = high - low + 1;
+            int32_t *table = switch_data + *switch_used;
+            table[0] = (int32_t)bci + read_s4(method->bytecode + base);
+            table[1] = low;
+            table[2] = high;
+            for (int32_t i = 0; i < count; i++) {
+                table[3 + i] = (int32_t)bci + read_s4(method->bytecode + base + 12 + 4 * i);
+            }
+            insn->a = (int32_t)*switch_used;
+            insn->b = count;
+            *switch_used += 3 + count;
+            break;
+        }
+        case LOOKUPSWITCH: {
+            uint32_t base = (bci + 4) & ~3u;
+            int32_t npairs = read_s4(method->bytecode + base + 4);
+            int32_t *table = switch_data + *switch_used;
+            table[0] = (int32_t)bci + read_s4(method->bytecode + base);
+            table[1] = npairs;
+            for (int32_t i = 0; i < npairs; i++) {
+                table[2 + 2 * i] = read_s4(method->bytecode + base + 8 + 8 * i);
+                table[3 + 2 * i] = (int32_t)bci + read_s4(method->bytecode + base + 12 + 8 * i);
+            }
+            insn->a = (int32_t)*switch_used;
+            insn->b = npairs;
+            *switch_used += 2 + 2 * npairs;
+            break;
+        }
+
+        case NEWARRAY:
+            insn->aux = p[1];
+            break;
+        case MULTIANEWARRAY:
+            insn->a = read_u2(p + 1);
+            insn->aux = p[3]; // dimensions to create
+            insn->b = array_shape(method->class_file, (uint16_t)insn->a);
+            break;
+
+        default:
+            // Constant pool references (new, getstatic, invoke*, ...) keep
+            // the cp index; everything else has no operands.
+            if (opcode_lengths[opcode] >= 3) {
+                insn->a = read_u2(p + 1);
+            }
+            if (opcode == 0xB9) {
+                insn->aux = p[3]; // invokeinterface count
+            }
+            break;
+    }
+}
+
+static bool is_branch(uint8_t opcode) {
+    return (opcode >= IFEQ && opcode <= 0xA8) || opcode == 0xC6 || opcode == 0xC7;
+}
+
+#ifndef JVM_PROFILE_SEQUENCES
+// Replaces the first instruction of each known hot sequence with a single
+// superinstruction that executes the whole sequence and skips over the
+// rest. The remaining instructions stay in place, so a branch into the
+// middle of a fused sequence still runs the original tail and no
+// instruction index changes. Profiling builds leave the stream unfused so
+// the profile shows the real sequences.
+static void fuse_superinstructions(Method *method) {
+    Instruction *code = method->code;
+    uint32_t count = method->instruction_count;
+
+    for (uint32_t i = 0; i + 1 < count; i++) {
+        Instruction *insn = &code[i];
+
+        // iload a; iload b; iadd; istore k
+        if (i + 3 < count && insn->opcode == ILOAD && code[i + 1].opcode == ILOAD &&
+            code[i + 2].opcode == IADD && code[i + 3].opcode == ISTORE &&
+            code[i + 3].a <= UINT16_MAX) {
+            insn->b = code[i + 1].a;
+            insn->aux = (uint16_t)code[i + 3].a;
+            insn->opcode = ILOAD_ILOAD_IADD_ISTORE;
+            i += 3;
+            continue;
+        }
+
+        // iconst/bipush/sipush c; if_icmp<cond> target
+        if (insn->opcode == SIPUSH && code[i + 1].opcode >= IF_ICMPEQ &&
+            code[i + 1].opcode <= IF_ICMPLE) {
+            insn->b = insn->a;
+            insn->a = code[i + 1].a;
+            insn->reserved = code[i + 1].opcode - IF_ICMPEQ;
+            insn->aux = code[i + 1].aux;
+            insn->opcode = SIPUSH_IF_ICMP;
+            i += 1;
+            continue;
+        }
+
+        // aload a; iload b; iaload
+        if (i + 2 < count && insn->opcode == ALOAD && code[i + 1].opcode == ILOAD &&
+            code[i + 2].opcode == IALOAD) {
+            insn->b = code[i + 1].a;
+            insn->opcode = ALOAD_ILOAD_IALOAD;
+            i += 2;
+            continue;
+        }
+    }
+}
+#endif
+
+// Translates method->bytecode into method->code. Runs once per method; the
+// interpreter then never looks at the raw bytes again.
+bool predecode_method(Method *method) {
+    uint32_t code_length = method->code_length;
+    uint8_t *bytecode = method->bytecode;
+
+    // First pass: find instruction boundaries and the switch table size
+    int32_t *index_of = malloc(sizeof(int32_t) * (code_length + 1));
+    if (!index_of) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    for (uint32_t i = 0; i <= code_length; i++) {
+        index_of[i] = -1;
+    }
+
+    uint32_t count = 0;
+    uint32_t switch_size = 0;
+    for (uint32_t bci = 0; bci < code_length;) {
+        uint32_t length = instruction_length(bytecode, code_length, bci);
+        if (length == 0 || bci + length > code_length) {
+            fprintf(stderr, "Malformed bytecode at %u in %s\n", bci,
+                    method->name ? method->name : "<anonymous>");
+            free(index_of);
+            return false;
+        }
+        if (bytecode[bci] == TABLESWITCH || bytecode[bci] == LOOKUPSWITCH) {
+            switch_size += length; // generous upper bound in int32 units
+        }
+        index_of[bci] = (int32_t)count++;
+        bci += length;
+    }
+
+    // One extra slot for the end sentinel, so dispatch never needs a
+    // bounds check on pc
+    method->code = malloc(sizeof(Instruction) * (count + 1));
+    method->switch_data = switch_size ? malloc(sizeof(int32_t) * switch_size) : NULL;
+    if (!method->code || (switch_size && !method->switch_data)) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(index_of);
+        return false;
+    }
+
+    // Second pass: decode operands
+    uint32_t switch_used = 0;
+    for (uint32_t bci = 0; bci < code_length;) {
+        decode_instruction(method, bci, &method->code[index_of[bci]],
+                           method->switch_data, &switch_used);
+        bci += instruction_length(bytecode, code_length, bci);
+    }
+
+    // Third pass: turn bytecode offsets into instruction indexes and number
+    // the virtual call sites and the loops (backward branches)
+    bool valid = true;
+    uint32_t call_site_count = 0;
+    uint32_t loop_count = 0;
+    #define TARGET_INDEX(target) \
+        (((target) >= 0 && (uint32_t)(target) < code_length && index_of[target] >= 0) \
+            ? index_of[target] : (valid = false, 0))
+    for (uint32_t i = 0; i < count; i++) {
+        Instruction *insn = &method->code[i];
+        if (is_branch(insn->opcode)) {
+            insn->a = TARGET_INDEX(insn->a);
+            if ((uint32_t)insn->a <= i && insn->opcode != 0xA8 && loop_count < UINT16_MAX) { // not jsr
+                insn->aux = (uint16_t)++loop_count;
+            }
+        } else if (insn->opcode == TABLESWITCH) {
+            int32_t *table = method->switch_data + insn->a;
+            table[0] = TARGET_INDEX(table[0]);
+            for (int32_t k = 0; k < insn->b; k++) {
+                table[3 + k] = TARGET_INDEX(table[3 + k]);
+            }
+        } else if (insn->opcode == LOOKUPSWITCH) {
+            int32_t *table = method->switch_data + insn->a;
+            table[0] = TARGET_INDEX(table[0]);
+            for (int32_t k = 0; k < insn->b; k++) {
+                table[3 + 2 * k] = TARGET_INDEX(table[3 + 2 * k]);
+            }
+        } else if (insn->opcode == INVOKEVIRTUAL || insn->opcode == INVOKEINTERFACE) {
+            insn->b = (int32_t)call_site_count++;
+        }
+    }
+    #undef TARGET_INDEX
+
+    if (!valid) {
+        fprintf(stderr, "Branch target outside of instruction boundaries in %s\n",
+                method->name ? method->name : "<anonymous>");
+        free(index_of);
+        return false;
+    }
+
+    method->loop_count = (uint16_t)loop_count;
+    if (loop_count) {
+        method->loop_counters = calloc(loop_count, sizeof(uint32_t));
+        if (!method->loop_counters) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(index_of);
+            return false;
+        }
+    }
+
+    if (call_site_count > UINT16_MAX) {
+        fprintf(stderr, "Too many call sites in %s\n", method->name);
+        free(index_of);
+        return false;
+    }
+    method->call_site_count = (uint16_t)call_site_count;
+    if (call_site_count) {
+        method->call_sites = calloc(call_site_count, sizeof(CallSite));
+        if (!method->call_sites) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(index_of);
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            if (method->code[i].opcode == INVOKEINTERFACE) {
+                method->call_sites[method->code[i].b].interface = true;
+            }
+        }
+    }
+
+    memset(&method->code[count], 0, sizeof(Instruction));
+    method->code[count].opcode = RETURN;
+    method->instruction_count = count;
+
+    // Exception table: start_pc(2) end_pc(2) handler_pc(2) catch_type(2),
+    // big-endian bytecode offsets. end_pc may be code_length.
+    if (method->exception_table_length) {
+        method->handlers = malloc(sizeof(ExceptionHandler) * method->exception_table_length);
+        if (!method->handlers) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(index_of);
+            return false;
+        }
+        index_of[code_length] = (int32_t)count;
+        for (uint16_t i = 0; i < method->exception_table_length; i++) {
+            const uint8_t *entry = method->exception_table + 8 * i;
+            uint16_t start = read_u2(entry), end = read_u2(entry + 2), handler = read_u2(entry + 4);
+            if (start >= end || end > code_length || handler >= code_length ||
+                index_of[start] < 0 || index_of[end] < 0 || index_of[handler] < 0) {
+                fprintf(stderr, "Invalid exception table in %s\n", method->name);
+                free(index_of);
+                return false;
+            }
+            method->handlers[i].start = (uint32_t)index_of[start];
+            method->handlers[i].end = (uint32_t)index_of[end];
+            method->handlers[i].handler = (uint32_t)index_of[handler];
+            method->handlers[i].catch_type = read_u2(entry + 6);
+        }
+        index_of[code_length] = -1;
+    }
+
+    // Verified methods run without stack checks. This has to see the
+    // stream before superinstructions are fused into it.
+    method->verified = verify_method(method, index_of);
+    free(index_of);
+
+#ifndef JVM_PROFILE_SEQUENCES
+    fuse_superinstructions(method);
+#endif
+    return true;
+}
+
+static attribute_info *find_code_attribute(ClassFile *class_file, method_info *info) {
+    for (int i = 0; i < info->attributes_count; i++) {
+        const char *name = get_constant_pool_string(class_file, info->attributes[i].attribute_name_index);
+        if (name && strcmp(name, "Code") == 0) {
+            return &info->attributes[i];
+        }
+    }
+    return NULL;
+}
+
+// Counts the argument and return value slots of a method descriptor; long
+// and double take two, everything else one
+static bool descriptor_arg_slots(const char *descriptor, uint16_t *arg_slots, uint8_t *return_slots) {
+    const char *p = descriptor;
+    if (*p++ != '(') return false;
+
+    uint16_t slots = 0;
+    while (*p && *p != ')') {
+        bool wide = (*p == 'J' || *p == 'D');
+        while (*p == '[') p++;
+        if (*p == 'L') {
+            p = strchr(p, ';');
+            if (!p) return false;
+        }
+        p++;
+        slots += wide ? 2 : 1;
+    }
+    if (*p++ != ')') return false;
+
+    *arg_slots = slots;
+    *return_slots = (*p == 'V') ? 0 : ((*p == 'J' || *p == 'D') ? 2 : 1);
+    return true;
+}
+
+static bool link_method(Class *class, method_info *info, Method *method) {
+    ClassFile *class_file = class->class_file;
+    memset(method, 0, sizeof(Method));
+    method->class = class;
+    method->class_file = class_file;
+    method->info = info;
+    method->access_flags = info->access_flags;
+    method->name = get_constant_pool_string(class_file, info->name_index);
+    method->descriptor = get_constant_pool_string(class_file, info->descriptor_index);
+    if (!method->name || !method->descriptor ||
+        !descriptor_arg_slots(method->descriptor, &method->arg_slots, &method->return_slots)) {
+        fprintf(stderr, "Invalid method descriptor in %s\n", class->name);
+        return false;
+    }
+    if (!(method->access_flags & ACC_STATIC)) {
+        method->arg_slots++; // this
+    }
+
+    attribute_info *code_attribute = find_code_attribute(class_file, info);
+    if (code_attribute == NULL) {
+        return true; // abstract or native
+    }
+
+    // Code: max_stack(2) max_locals(2) code_length(4) code[code_length] ...
+    if (code_attribute->attribute_length < 8) {
+        fprintf(stderr, "Invalid Code attribute in %s\n", method->name);
+        return false;
+    }
+    uint8_t *info_bytes = code_attribute->info;
+    method->max_stack = read_u2(info_bytes);
+    method->max_locals = read_u2(info_bytes + 2);
+    method->code_length = (uint32_t)read_s4(info_bytes + 4);
+    if (method->code_length > code_attribute->attribute_length - 8) {
+        fprintf(stderr, "Invalid code length in %s\n", method->name);
+        return false;
+    }
+    method->bytecode = info_bytes + 8;
+
+    // ... exception_table_length(2) exception_table[8 * n]
+    //     attributes_count(2) attributes[]
+    const uint8_t *end = info_bytes + code_attribute->attribute_length;
+    const uint8_t *p = method->bytecode + method->code_length;
+    if (end - p < 2 || (end - p - 2) / 8 < read_u2(p)) {
+        fprintf(stderr, "Invalid exception table in %s\n", method->name);
+        return false;
+    }
+    method->exception_table_length = read_u2(p);
+    method->exception_table = p + 2;
+    p += 2 + 8 * method->exception_table_length;
+
+    uint16_t attributes_count = end - p >= 2 ? read_u2(p) : 0;
+    p += 2;
+    for (uint16_t i = 0; i < attributes_count && end - p >= 6; i++) {
+        uint32_t length = (uint32_t)read_s4(p + 2);
+        if (length > (uint32_t)(end - p - 6)) {
+            break;
+        }
+        const char *name = get_constant_pool_string(class_file, read_u2(p));
+        if (name && strcmp(name, "StackMapTable") == 0) {
+            method->stack_map = p + 6;
+            method->stack_map_length = length;
+        }
+        p += 6 + length;
+    }
+
+    return predecode_method(method);
+}
+
+static uint16_t descriptor_slots(const char *descriptor) {
+    return (descriptor[0] == 'J' || descriptor[0] == 'D') ? 2 : 1;
+}
+
+// Bytes an instance field of this descriptor takes in an object
+static uint32_t field_size(const char *descriptor) {
+    switch (descriptor[0]) {
+        case 'J': case 'D': return 8;
+        case 'B': case 'Z': return 1;
+        case 'C': case 'S': return 2;
+        default: return 4; // int, float and references
+    }
+}
+
+#define UNPLACED UINT32_MAX
+
+// Places the unplaced instance fields of size bytes at aligned offsets from
+// *offset, stopping before end
+static void place_fields(Class *class, uint32_t size, uint32_t *offset, uint32_t end) {
+    for (int i = 0; i < class->fields_count; i++) {
+        Field *field = &class->fields[i];
+        if (field->offset != UNPLACED || field_size(field->descriptor) != size) {
+            continue;
+        }
+        uint32_t aligned = (*offset + size - 1) & ~(size - 1);
+        if (aligned + size > end) {
+            return;
+        }
+        field->offset = aligned;
+        *offset = aligned + size;
+    }
+}
+
+// Instance fields follow those of the superclass, largest first, so each is
+// naturally aligned and little space goes to padding. When the superclass
+// leaves the offset short of 8-byte alignment, smaller fields fill the gap
+// before the first long or double.
+static void lay_out_fields(Class *class) {
+    uint32_t offset = class->super ? class->super->instance_size : 0;
+    bool wide = false;
+    for (int i = 0; i < class->fields_count; i++) {
+        Field *field = &class->fields[i];
+        if (field->access_flags & ACC_STATIC) {
+            continue;
+        }
+        field->offset = UNPLACED;
+        wide |= field_size(field->descriptor) == 8;
+    }
+
+    if (wide && (offset & 7) != 0) {
+        uint32_t gap_end = (offset + 7) & ~7u;
+        for (uint32_t size = 4; size >= 1; size /= 2) {
+            place_fields(class, size, &offset, gap_end);
+        }
+        offset = gap_end;
+    }
+    for (uint32_t size = 8; size >= 1; size /= 2) {
+        place_fields(class, size, &offset, UINT32_MAX);
+    }
+    class->instance_size = offset;
+}
+
+// Static fields get consecutive slots in class->static_values; long and
+// double take two, like on the operand stack. Instance fields get byte
+// offsets from lay_out_fields.
+static bool link_fields(Class *class) {
+    ClassFile *class_file = class->class_file;
+    class->fields_count = class_file->fields_count;
+    class->fields = calloc(class->fields_count ? class->fields_count : 1, sizeof(Field));
+    if (!class->fields) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+
+    uint16_t static_slots = 0;
+    for (int i = 0; i < class->fields_count; i++) {
+        Field *field = &class->fields[i];
+        field->info = &class_file->fields[i];
+        field->access_flags = field->info->access_flags;
+        field->name = get_constant_pool_string(class_file, field->info->name_index);
+        field->descriptor = get_constant_pool_string(class_file, field->info->descriptor_index);
+        if (!field->name || !field->descriptor) {
+            fprintf(stderr, "Invalid field %d in %s\n", i, class->name);
+            return false;
+        }
+        if (field->access_flags & ACC_STATIC) {
+            field->slot = static_slots;
+            static_slots += descriptor_slots(field->descriptor);
+        }
+    }
+    lay_out_fields(class);
+
+    // Instance fields the collector traces: the superclass ones, then ours
+    uint16_t inherited = class->super ? class->super->reference_offsets_count : 0;
+    class->reference_offsets = malloc(sizeof(uint32_t) * (inherited + class->fields_count + 1));
+    if (!class->reference_offsets) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    if (inherited) {
+        memcpy(class->reference_offsets, class->super->reference_offsets, sizeof(uint32_t) * inherited);
+    }
+    class->reference_offsets_count = inherited;
+    for (int i = 0; i < class->fields_count; i++) {
+        Field *field = &class->fields[i];
+        if (!(field->access_flags & ACC_STATIC) &&
+            (field->descriptor[0] == 'L' || field->descriptor[0] == '[')) {
+            class->reference_offsets[class->reference_offsets_count++] = field->offset;
+        }
+    }
+
+    class->static_slots = static_slots;
+    class->static_values = calloc(static_slots ? static_slots : 1, sizeof(int32_t));
+    if (!class->static_values) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a, for the class registry and the other tables keyed by class name
+uint32_t name_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t class_name_hash(const char *name) {
+    return name_hash(name, strlen(name));
+}
+
+static Class *registry_lookup(ClassRegistry *registry, const char *name) {
+    if (registry->capacity == 0) {
+        return NULL;
+    }
+    uint32_t hash = class_name_hash(name);
+    uint32_t mask = registry->capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        ClassRegistrySlot *slot = &registry->slots[i];
+        if (slot->class == NULL) {
+            return NULL;
+        }
+        if (slot->hash == hash && strcmp(slot->class->name, name) == 0) {
+            return slot->class;
+        }
+    }
+}
+
+static void registry_place(ClassRegistrySlot *slots, uint32_t capacity, uint32_t hash, Class *class) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = hash & mask;
+    while (slots[i].class != NULL) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].class = class;
+}
+
+// Adds class, doubling the table before it gets three quarters full
+static bool registry_add(ClassRegistry *registry, Class *class) {
+    if ((registry->count + 1) * 4 > registry->capacity * 3) {
+        uint32_t capacity = registry->capacity ? registry->capacity * 2 : 64;
+        ClassRegistrySlot *slots = calloc(capacity, sizeof(ClassRegistrySlot));
+        if (!slots) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
+        for (uint32_t i = 0; i < registry->capacity; i++) {
+            if (registry->slots[i].class != NULL) {
+                registry_place(slots, capacity, registry->slots[i].hash, registry->slots[i].class);
+            }
+        }
+        free(registry->slots);
+        registry->slots = slots;
+        registry->capacity = capacity;
+    }
+    registry_place(registry->slots, registry->capacity, class_name_hash(class->name), class);
+    registry->count++;
+    return true;
+}
+
+static bool register_class(JVM *jvm, Class *class) {
+    if (jvm->classes_count == jvm->classes_capacity) {
+        int32_t capacity = jvm->classes_capacity ? jvm->classes_capacity * 2 : 16;
+        Class **classes = realloc(jvm->classes, sizeof(Class *) * capacity);
+        if (!classes) {
+            fprintf(stderr, "Memory allocation error\n");
+            return false;
+        }
+        jvm->classes = classes;
+        jvm->classes_capacity = capacity;
+    }
+    if (!registry_add(&jvm->class_registry, class)) {
+        return false;
+    }
+    class->id = (uint32_t)jvm->classes_count;
+    jvm->classes[jvm->classes_count++] = class;
+    return true;
+}
+
+static bool is_virtual(Method *method) {
+    return !(method->access_flags & (ACC_STATIC | ACC_PRIVATE)) && method->name[0] != '<';
+}
+
+// Starts from a copy of the superclass vtable; a method with the same name
+// and descriptor as an inherited one takes over its slot, any other virtual
+// method gets a new slot at the end. An interface only numbers its own
+// methods, which is what its implementors' itables are indexed by.
+static bool build_vtable(Class *class) {
+    bool interface = (class->access_flags & ACC_INTERFACE) != 0;
+    uint32_t inherited = (class->super && !interface) ? class->super->vtable_length : 0;
+
+    class->vtable = malloc(sizeof(Method *) * (inherited + class->methods_count + 1));
+    if (!class->vtable) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    if (inherited) {
+        memcpy(class->vtable, class->super->vtable, sizeof(Method *) * inherited);
+    }
+
+    uint32_t length = inherited;
+    for (int i = 0; i < class->methods_count; i++) {
+        Method *method = &class->methods[i];
+        method->vtable_index = -1;
+        if (!is_virtual(method)) {
+            continue;
+        }
+        for (uint32_t slot = 0; slot < inherited; slot++) {
+            Method *overridden = class->vtable[slot];
+            if (strcmp(overridden->name, method->name) == 0 &&
+                strcmp(overridden->descriptor, method->descriptor) == 0) {
+                method->vtable_index = (int32_t)slot;
+                break;
+            }
+        }
+        if (method->vtable_index < 0) {
+            method->vtable_index = (int32_t)length++;
+        }
+        class->vtable[method->vtable_index] = method;
+    }
+    class->vtable_length = length;
+    return true;
+}
+
+static void add_interface(Class **set, uint16_t *count, Class *interface) {
+    for (uint16_t i = 0; i < *count; i++) {
+        if (set[i] == interface) return;
+    }
+    set[(*count)++] = interface;
+    for (uint16_t i = 0; i < interface->interfaces_count; i++) {
+        add_interface(set, count, interface->interfaces[i]);
+    }
+}
+
+// One itable per interface the class implements, including the ones it
+// inherits from its superclass and superinterfaces. Each slot holds the
+// vtable method with the same signature or, failing that, the interface's
+// default method.
+static bool build_itables(Class *class) {
+    uint16_t capacity = class->interfaces_count;
+    if (class->super) {
+        capacity += class->super->itables_count;
+    }
+    for (uint16_t i = 0; i < class->interfaces_count; i++) {
+        capacity += class->interfaces[i]->itables_count;
+    }
+    if (capacity == 0) {
+        return true;
+    }
+
+    Class **set = malloc(sizeof(Class *) * capacity);
+    if (!set) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    uint16_t count = 0;
+    if (class->super) {
+        for (uint16_t i = 0; i < class->super->itables_count; i++) {
+            add_interface(set, &count, class->super->itables[i].interface);
+        }
+    }
+    for (uint16_t i = 0; i < class->interfaces_count; i++) {
+        add_interface(set, &count, class->interfaces[i]);
+    }
+
+    class->itables = calloc(count, sizeof(Itable));
+    if (!class->itables) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(set);
+        return false;
+    }
+    class->itables_count = count;
+
+    bool interface = (class->access_flags & ACC_INTERFACE) != 0;
+    for (uint16_t i = 0; i < count; i++) {
+        Itable *itable = &class->itables[i];
+        itable->interface = set[i];
+        if (interface) {
+            continue; // only the set of superinterfaces matters
+        }
+        itable->methods = calloc(set[i]->vtable_length + 1, sizeof(Method *));
+        if (!itable->methods) {
+            fprintf(stderr, "Memory allocation error\n");
+            free(set);
+            return false;
+        }
+        for (uint32_t slot = 0; slot < set[i]->vtable_length; slot++) {
+            Method *declared = set[i]->vtable[slot];
+            Method *implementation = declared->code ? declared : NULL;
+            for (uint32_t k = 0; k < class->vtable_length; k++) {
+                if (strcmp(class->vtable[k]->name, declared->name) == 0 &&
+                    strcmp(class->vtable[k]->descriptor, declared->descriptor) == 0) {
+                    implementation = class->vtable[k];
+                    break;
+                }
+            }
+            itable->methods[slot] = implementation;
+        }
+    }
+    free(set);
+    return true;
+}
+
+// Loads the superclass and superinterfaces before the class itself
+static bool link_hierarchy(JVM *jvm, Class *class) {
+    ClassFile *class_file = class->class_file;
+
+    if (class_file->super_class != 0) {
+        const char *super_name = class_name_at(class_file, class_file->super_class);
+        class->super = super_name ? find_class(jvm, super_name) : NULL;
+        if (!class->super) {
+            fprintf(stderr, "Failed to load superclass of %s\n", class->name);
+            return false;
+        }
+    }
+
+    class->interfaces_count = class_file->interfaces_count;
+    class->interfaces = calloc(class->interfaces_count + 1, sizeof(Class *));
+    if (!class->interfaces) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    for (int i = 0; i < class->interfaces_count; i++) {
+        const char *interface_name = class_name_at(class_file, class_file->interfaces[i]);
+        class->interfaces[i] = interface_name ? find_class(jvm, interface_name) : NULL;
+        if (!class->interfaces[i]) {
+            fprintf(stderr, "Failed to load interface %d of %s\n", i, class->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+Class *jvm_link_class(JVM *jvm, ClassFile *class_file) {
+    Class *class = calloc(1, sizeof(Class));
+    if (!class) {
+        fprintf(stderr, "Memory allocation error\n");
+        return NULL;
+    }
+    class->class_file = class_file;
+    class->access_flags = class_file->access_flags;
+
+    uint16_t name_index = class_file->constant_pool[class_file->this_class - 1].info.Class.name_index;
+    class->name = get_constant_pool_string(class_file, name_index);
+
+    if (!link_hierarchy(jvm, class)) {
+        return NULL;
+    }
+
+    class->methods_count = class_file->methods_count;
+    class->methods = calloc(class->methods_count ? class->methods_count : 1, sizeof(Method));
+    if (!class->methods) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(class);
+        return NULL;
+    }
+    for (int i = 0; i < class->methods_count; i++) {
+        if (!link_method(class, &class_file->methods[i], &class->methods[i])) {
+            fprintf(stderr, "Failed to link method %d of %s\n", i, class->name);
+            return NULL;
+        }
+    }
+
+    if (!link_fields(class)) {
+        return NULL;
+    }
+
+    // Constant pool cache, filled lazily by the quickening handlers
+    class->resolved = calloc(class_file->constant_pool_count, sizeof(ResolvedEntry));
+    if (!class->resolved) {
+        fprintf(stderr, "Memory allocation error\n");
+        return NULL;
+    }
+
+    if (!build_vtable(class) || !build_itables(class) || !register_class(jvm, class)) {
+        return NULL;
+    }
+    return class;
+}
+
+// There is no class library on disk, so library classes that are only used
+// as superclasses or interfaces (java/lang/Object above all) get an empty
+// stand-in. Their methods are provided by native.c.
+// Superclasses of the library exceptions, which the VM throws itself and
+// programs catch by any of their supertypes. Other library classes extend
+// java/lang/Object.
+static const char *const library_superclasses[][2] = {
+    { "java/lang/Exception", "java/lang/Throwable" },
+    { "java/lang/Error", "java/lang/Throwable" },
+    { "java/lang/RuntimeException", "java/lang/Exception" },
+    { "java/lang/ArithmeticException", "java/lang/RuntimeException" },
+    { "java/lang/IndexOutOfBoundsException", "java/lang/RuntimeException" },
+    { "java/lang/ArrayIndexOutOfBoundsException", "java/lang/IndexOutOfBoundsException" },
+    { "java/lang/NegativeArraySizeException", "java/lang/RuntimeException" },
+    { "java/lang/NullPointerException", "java/lang/RuntimeException" },
+    { "java/lang/ClassCastException", "java/lang/RuntimeException" },
+    { "java/lang/IllegalArgumentException", "java/lang/RuntimeException" },
+    { "java/lang/IllegalStateException", "java/lang/RuntimeException" },
+};
+
+static const char *library_superclass(const char *name) {
+    for (size_t i = 0; i < sizeof(library_superclasses) / sizeof(library_superclasses[0]); i++) {
+        if (strcmp(library_superclasses[i][0], name) == 0) {
+            return library_superclasses[i][1];
+        }
+    }
+    return "java/lang/Object";
+}
+
+// The virtual natives of a library class become its methods, so they get
+// vtable slots that user subclasses inherit and can override
+static bool define_native_methods(Class *class) {
+    const char *name, *descriptor;
+    uint16_t count = 0;
+    while (find_native_virtual(class->name, count, &name, &descriptor)) {
+        count++;
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    class->methods = calloc(count, sizeof(Method));
+    if (!class->methods) {
+        fprintf(stderr, "Memory allocation error\n");
+        return false;
+    }
+    class->methods_count = count;
+    for (uint16_t i = 0; i < count; i++) {
+        Method *method = &class->methods[i];
+        method->class = class;
+        method->access_flags = 0x0001; // public
+        method->native = find_native_virtual(class->name, i, &method->name, &method->descriptor);
+        if (!descriptor_arg_slots(method->descriptor, &method->arg_slots, &method->return_slots)) {
+            fprintf(stderr, "Invalid method descriptor in %s\n", class->name);
+            return false;
+        }
+        method->arg_slots++; // this
+    }
+    return true;
+}
+
+static Class *define_library_class(JVM *jvm, const char *name) {
+    Class *class = calloc(1, sizeof(Class));
+    char *class_name = malloc(strlen(name) + 1);
+    if (!class || !class_name) {
+        fprintf(stderr, "Memory allocation error\n");
+        return NULL;
+    }
+    strcpy(class_name, name);
+    class->name = class_name;
+    class->access_flags = 0x0001; // public
+    if (strcmp(name, "java/lang/Object") != 0) {
+        class->super = find_class(jvm, library_superclass(name));
+        if (!class->super) {
+            return NULL;
+        }
+        class->instance_size = class->super->instance_size;
+        class->reference_offsets = class->super->reference_offsets;
+        class->reference_offsets_count = class->super->reference_offsets_count;
+    }
+    if (strcmp(name, "java/lang/Throwable") == 0) {
+        static uint32_t throwable_references[] = { THROWABLE_MESSAGE };
+        class->instance_size = THROWABLE_MESSAGE + sizeof(int32_t);
+        class->reference_offsets = throwable_references;
+        class->reference_offsets_count = 1;
+    }
+    if (!define_native_methods(class) || !build_vtable(class) || !register_class(jvm, class)) {
+        return NULL;
+    }
+    return class;
+}
+
+// Returns the linked class with this internal name, loading it from the
+// classpath on first use
+Class *find_class(JVM *jvm, const char *name) {
+    Class *class = registry_lookup(&jvm->class_registry, name);
+    if (class) {
+        return class;
+    }
+
+    ClassFile *class_file = arena_allocate(&jvm->metadata, sizeof(ClassFile));
+    if (!class_file) {
+        fprintf(stderr, "Memory allocation error\n");
+        return NULL;
+    }
+    if (take_preloaded_class(jvm, name, class_file) ||
+        read_class_from_class_path(jvm, name, class_file, &jvm->metadata)) {
+        return jvm_link_class(jvm, class_file);
+    }
+    if (strncmp(name, "java/", 5) == 0) {
+        return define_library_class(jvm, name);
+    }
+    fprintf(stderr, "NoClassDefFoundError: %s\n", name);
+    return NULL;
+}
+
+bool is_subclass_of(Class *class, Class *other) {
+    for (Class *c = class; c != NULL; c = c->super) {
+        if (c == other) return true;
+    }
+    for (uint16_t i = 0; i < class->itables_count; i++) {
+        if (class->itables[i].interface == other) return true;
+    }
+    return false;
+}
+
+Method *find_method(Class *class, const char *name, const char *descriptor) {
+    for (int i = 0; i < class->methods_count; i++) {
+        Method *method = &class->methods[i];
+        if (method->name && method->descriptor &&
+            strcmp(method->name, name) == 0 &&
+            strcmp(method->descriptor, descriptor) == 0) {
+            return method;
+        }
+    }
+    return NULL;
+}
+
+// Selects the method a virtual call to declared runs for a receiver of the
+// given class: an indexed vtable load, or the itable of the declaring
+// interface for interface methods
+Method *lookup_virtual(Class *class, Method *declared) {
+    if (declared->vtable_index < 0) {
+        return NULL;
+    }
+    if (declared->class->access_flags & ACC_INTERFACE) {
+        for (uint16_t i = 0; i < class->itables_count; i++) {
+            if (class->itables[i].interface == declared->class) {
+                return class->itables[i].methods[declared->vtable_index];
+            }
+        }
+        return NULL;
+    }
+    if ((uint32_t)declared->vtable_index >= class->vtable_length) {
+        return NULL; // not a subclass of the declaring class
+    }
+    return class->vtable[declared->vtable_index];
+}
+
+// Method resolution: the class and its superclasses first, then the
+// superinterfaces
+static Method *find_method_in_hierarchy(Class *class, const char *name, const char *descriptor) {
+    for (Class *c = class; c != NULL; c = c->super) {
+        Method *method = find_method(c, name, descriptor);
+        if (method) return method;
+    }
+    for (Class *c = class; c != NULL; c = c->super) {
+        for (uint16_t i = 0; i < c->interfaces_count; i++) {
+            Method *method = find_method_in_hierarchy(c->interfaces[i], name, descriptor);
+            if (method) return method;
+        }
+    }
+    return NULL;
+}
+
+// Constant pool resolution. Each function fills class->resolved[index] the
+// first time it is asked and returns NULL when the entry cannot be resolved.
+
+static const char *class_name_at(ClassFile *class_file, uint16_t class_index) {
+    if (!validate_constant_pool_index(class_file, class_index) ||
+        class_file->constant_pool[class_index - 1].tag != CONSTANT_Class) {
+        return NULL;
+    }
+    return get_constant_pool_string(class_file, class_file->constant_pool[class_index - 1].info.Class.name_index);
+}
+
+// Reads the class, name and descriptor of a Fieldref/Methodref entry
+static bool member_ref_at(ClassFile *class_file, uint16_t index, uint8_t tag,
+                          const char **class_name, const char **name, const char **descriptor) {
+    if (!validate_constant_pool_index(class_file, index)) {
+        return false;
+    }
+    cp_info *ref = &class_file->constant_pool[index - 1];
+    if (ref->tag != tag && !(tag == CONSTANT_Methodref && ref->tag == CONSTANT_InterfaceMethodref)) {
+        fprintf(stderr, "Unexpected constant pool tag %d at %d\n", ref->tag, index);
+        return false;
+    }
+    uint16_t name_and_type_index = ref->info.Fieldref.name_and_type_index;
+    if (!validate_constant_pool_index(class_file, name_and_type_index)) {
+        return false;
+    }
+    cp_info *name_and_type = &class_file->constant_pool[name_and_type_index - 1];
+
+    *class_name = class_name_at(class_file, ref->info.Fieldref.class_index);
+    *name = get_constant_pool_string(class_file, name_and_type->info.NameAndType.name_index);
+    *descriptor = get_constant_pool_string(class_file, name_and_type->info.NameAndType.descriptor_index);
+    return *class_name && *name && *descriptor;
+}
+
+ResolvedEntry *resolve_static_field(JVM *jvm, Class *class, uint16_t index) {
+    ResolvedEntry *entry = &class->resolved[index];
+    if (entry->kind != RESOLVED_NONE) {
+        return entry;
+    }
+
+    const char *class_name, *name, *descriptor;
+    if (!member_ref_at(class->class_file, index, CONSTANT_Fieldref, &class_name, &name, &descriptor)) {
+        return NULL;
+    }
+
+    int32_t *value = find_native_static(class_name, name);
+    if (value) {
+        entry->static_value = value;
+        entry->slots = 1;
+        entry->kind = RESOLVED_STATIC_FIELD;
+        return entry;
+    }
+
+    // Static fields are inherited from superclasses
+    for (Class *owner = find_class(jvm, class_name); owner != NULL; owner = owner->super) {
+        for (int i = 0; i < owner->fields_count; i++) {
+            Field *field = &owner->fields[i];
+            if ((field->access_flags & ACC_STATIC) &&
+                strcmp(field->name, name) == 0 && strcmp(field->descriptor, descriptor) == 0) {
+                entry->static_value = &owner->static_values[field->slot];
+                entry->slots = (uint8_t)descriptor_slots(descriptor);
+                entry->kind = RESOLVED_STATIC_FIELD;
+                return entry;
+            }
+        }
+    }
+
+    fprintf(stderr, "Unresolved static field %s.%s:%s\n", class_name, name, descriptor);
+    return NULL;
+}
+
+ResolvedEntry *resolve_field(JVM *jvm, Class *class, uint16_t index) {
+    ResolvedEntry *entry = &class->resolved[index];
+    if (entry->kind != RESOLVED_NONE) {
+        return entry;
+    }
+
+    const char *class_name, *name, *descriptor;
+    if (!member_ref_at(class->class_file, index, CONSTANT_Fieldref, &class_name, &name, &descriptor)) {
+        return NULL;
+    }
+
+    // The field may be declared by a superclass of the named class
+    for (Class *owner = find_class(jvm, class_name); owner != NULL; owner = owner->super) {
+        for (int i = 0; i < owner->fields_count; i++) {
+            Field *field = &owner->fields[i];
+            if (!(field->access_flags & ACC_STATIC) &&
+                strcmp(field->name, name) == 0 && strcmp(field->descriptor, descriptor) == 0) {
+                entry->field_offset = field->offset;
+                entry->field_type = descriptor[0];
+                entry->kind = RESOLVED_INSTANCE_FIELD;
+                return entry;
+            }
+        }
+    }
+
+    fprintf(stderr, "Unresolved field %s.%s:%s\n", class_name, name, descriptor);
+    return NULL;
+}
+
+ResolvedEntry *resolve_method(JVM *jvm, Class *class, uint16_t index) {
+    ResolvedEntry *entry = &class->resolved[index];
+    if (entry->kind != RESOLVED_NONE) {
+        return entry;
+    }
+
+    const char *class_name, *name, *descriptor;
+    if (!member_ref_at(class->class_file, index, CONSTANT_Methodref, &class_name, &name, &descriptor)) {
+        return NULL;
+    }
+
+    // Natives no subclass can override are called directly; the others are
+    // methods of their library class and dispatched like Java methods
+    native_method native = find_native_method(class_name, name, descriptor);
+    if (native) {
+        entry->native = native;
+        entry->kind = RESOLVED_NATIVE;
+        return entry;
+    }
+
+    Class *owner = find_class(jvm, class_name);
+    Method *method = owner ? find_method_in_hierarchy(owner, name, descriptor) : NULL;
+    if (method) {
+        entry->method = method;
+        entry->kind = RESOLVED_METHOD;
+        return entry;
+    }
+
+    // Members inherited from a library class, e.g. the constructor of an
+    // exception subclass calling java/lang/Exception.<init>
+    for (Class *c = owner ? owner->super : NULL; c != NULL; c = c->super) {
+        native = find_native_method(c->name, name, descriptor);
+        if (native) {
+            entry->native = native;
+            entry->kind = RESOLVED_NATIVE;
+            return entry;
+        }
+    }
+
+    fprintf(stderr, "Unresolved method %s.%s%s\n", class_name, name, descriptor);
+    return NULL;
+}
+
+ResolvedEntry *resolve_class(JVM *jvm, Class *class, uint16_t index) {
+    ResolvedEntry *entry = &class->resolved[index];
+    if (entry->kind != RESOLVED_NONE) {
+        return entry;
+    }
+
+    const char *class_name = class_name_at(class->class_file, index);
+    Class *resolved = class_name ? find_class(jvm, class_name) : NULL;
+    if (resolved) {
+        entry->class = resolved;
+        entry->kind = RESOLVED_CLASS;
+        return entry;
+    }
+
+    fprintf(stderr, "Unresolved class %s\n", class_name ? class_name : "<invalid>");
+    return NULL;
+}
+
+ResolvedEntry *resolve_constant(JVM *jvm, Class *class, uint16_t index) {
+    ResolvedEntry *entry = &class->resolved[index];
+    if (entry->kind != RESOLVED_NONE) {
+        return entry;
+    }
+    if (!validate_constant_pool_index(class->class_file, index)) {
+        return NULL;
+    }
+
+    cp_info *constant = &class->class_file->constant_pool[index - 1];
+    switch (constant->tag) {
+        case CONSTANT_Integer:
+            entry->constant = constant->info.Integer.bytes;
+            break;
+        case CONSTANT_Float:
+            memcpy(&entry->constant, &constant->info.Float.bytes, sizeof(int32_t));
+            break;
+        case CONSTANT_String: {
+            uint16_t utf8_index = constant->info.String.string_index;
+            if (!validate_constant_pool_index(class->class_file, utf8_index)) {
+                return NULL;
+            }
+            cp_info *utf8 = &class->class_file->constant_pool[utf8_index - 1];
+            entry->constant = intern_string(jvm, utf8->info.Utf8.bytes, utf8->info.Utf8.length);
+            break;
+        }
+        case CONSTANT_Long:
+        case CONSTANT_Double:
+            entry->wide_constant = constant->info.Long.bytes; // raw bits of either
+            break;
+        default:
+            fprintf(stderr, "Unsupported ldc constant tag %d at %d\n", constant->tag, index);
+            return NULL;
+    }
+    entry->kind = RESOLVED_CONSTANT;
+    return entry;
+}
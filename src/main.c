@@ -2,9 +2,62 @@
 #include "../leitor-exibidor/read_count_func.h"
 #include <stdio.h>
 
+// Parses the N of an --option=N flag; false if it is not a positive number
+static bool parse_count_option(const char *arg, const char *option, uint32_t *out) {
+    size_t length = strlen(option);
+    if (strncmp(arg, option, length) != 0 || arg[length] != '=') {
+        return false;
+    }
+    char *end;
+    unsigned long value = strtoul(arg + length + 1, &end, 10);
+    if (*end != '\0' || end == arg + length + 1 || value == 0 || value > UINT32_MAX) {
+        fprintf(stderr, "Invalid value for %s: %s\n", option, arg + length + 1);
+        exit(1);
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+// Parses the size of a -Xms64m style flag: bytes, or k, m or g of them
+static bool parse_size_option(const char *arg, const char *option, size_t *out) {
+    size_t length = strlen(option);
+    if (strncmp(arg, option, length) != 0) {
+        return false;
+    }
+    char *end;
+    unsigned long long value = strtoull(arg + length, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || end == arg + length || value == 0 || value > (SIZE_MAX >> shift)) {
+        fprintf(stderr, "Invalid value for %s: %s\n", option, arg + length);
+        exit(1);
+    }
+    *out = (size_t)value << shift;
+    return true;
+}
+
+// The options that size the VM, which have to be known before jvm_init
+static bool parse_vm_option(const char *arg, VMOptions *options) {
+    if (strcmp(arg, "--huge-pages") == 0) {
+        options->huge_pages = true;
+        return true;
+    }
+    return parse_size_option(arg, "-Xms", &options->initial_heap) ||
+           parse_size_option(arg, "-Xmx", &options->max_heap) ||
+           parse_size_option(arg, "-Xss", &options->stack_size);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <class file>\n", argv[0]);
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <class file | main class> --leitor | --jvm [--jit | --no-jit] "
+                "[--jit-threshold=N] [--osr-threshold=N] [--verbose-gc] [--gc-threads=N] "
+                "[-Xms<size>] [-Xmx<size>] [-Xss<size>] [--huge-pages] [-cp <dir|jar>:<dir|jar>...] "
+                "[--preload[=<class list>]] [--preload-threads=N]\n", argv[0]);
         return 1;
     }
 
@@ -32,10 +85,83 @@ int main(int argc, char *argv[]) {
     }
 
     if (strcmp(argv[2], "--jvm") == 0) {
+        // -Xms and -Xmx are the initial and the maximum heap size, -Xss the
+        // Java stack size; --huge-pages backs the heap with transparent huge
+        // pages
+        VMOptions options;
+        vm_options_default(&options);
+        for (int i = 3; i < argc; i++) {
+            parse_vm_option(argv[i], &options);
+        }
+        if (options.initial_heap > options.max_heap) {
+            if (options.initial_heap != DEFAULT_INITIAL_HEAP) {
+                fprintf(stderr, "Initial heap size larger than the maximum heap size\n");
+                return 1;
+            }
+            options.initial_heap = options.max_heap;
+        }
+
         JVM jvm;
-        jvm_init(&jvm);
-        jvm_load_class(&jvm, argv[1]);
+        jvm_init_with_options(&jvm, &options);
+
+        // -cp (or -classpath) lists the directories and .jar/.zip archives,
+        // separated by ':', that the classes the program uses are loaded
+        // from; without it they come from the main class's directory. With
+        // it, the main class may be given by name (com.example.Main).
+        // --preload parses every class on the classpath up front, on
+        // --preload-threads threads (one per processor by default);
+        // --preload=<file> only the classes listed in it, one per line.
+        // They are still linked one by one on first use.
+        // The JIT is on by default where it is supported; --no-jit runs
+        // everything in the interpreter (handy to diff results). A method is
+        // compiled after --jit-threshold calls, or as soon as one of its loops
+        // has taken --osr-threshold backedges (on-stack replacement)
+        bool preload = false;
+        const char *preload_list = NULL;
+        uint32_t preload_threads = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "-cp") == 0 || strcmp(argv[i], "-classpath") == 0) {
+                if (i + 1 == argc) {
+                    fprintf(stderr, "%s requires a class path\n", argv[i]);
+                    return 1;
+                }
+                if (!jvm_set_class_path(&jvm, argv[++i])) {
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--jit") == 0) {
+                if (!jit_supported()) {
+                    fprintf(stderr, "JIT not supported on this platform\n");
+                }
+                jvm.jit_enabled = jit_supported();
+            } else if (strcmp(argv[i], "--no-jit") == 0) {
+                jvm.jit_enabled = false;
+            } else if (strcmp(argv[i], "--preload") == 0) {
+                preload = true;
+            } else if (strncmp(argv[i], "--preload=", 10) == 0) {
+                preload = true;
+                preload_list = argv[i] + 10;
+            } else if (strcmp(argv[i], "--verbose-gc") == 0) {
+                jvm.verbose_gc = true;
+            } else if (parse_vm_option(argv[i], &options) ||
+                       parse_count_option(argv[i], "--jit-threshold", &jvm.jit_threshold) ||
+                       parse_count_option(argv[i], "--osr-threshold", &jvm.osr_threshold) ||
+                       parse_count_option(argv[i], "--gc-threads", &jvm.gc_threads) ||
+                       parse_count_option(argv[i], "--preload-threads", &preload_threads)) {
+                continue;
+            } else {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+
+        if (!jvm_load_class(&jvm, argv[1])) {
+            return 1;
+        }
+        if (preload && !class_preload(&jvm, preload_list, preload_threads)) {
+            return 1;
+        }
         jvm_execute(&jvm);
+        class_loader_release(&jvm);
 
         return 0;
     }
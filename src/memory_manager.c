@@ -1,57 +1,461 @@
+#define _DEFAULT_SOURCE
 #include "jvm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 // Function prototypes
-void heap_init(Heap *heap);
-void stack_init(JVMStack *stack);
+void stack_init(JVMStack *stack, size_t slots);
+
+void vm_options_default(VMOptions *options) {
+    options->initial_heap = DEFAULT_INITIAL_HEAP;
+    options->max_heap = DEFAULT_MAX_HEAP;
+    options->stack_size = DEFAULT_STACK_SIZE;
+    options->huge_pages = false;
+}
 
 void jvm_init(JVM *jvm) {
+    VMOptions options;
+    vm_options_default(&options);
+    jvm_init_with_options(jvm, &options);
+}
+
+void jvm_init_with_options(JVM *jvm, const VMOptions *options) {
     // Initialize JVM state
     printf("Initializing JVM\n");
 
     // Initialize heap
-    heap_init(&jvm->heap);
+    heap_init(&jvm->heap, options->initial_heap, options->max_heap, options->huge_pages);
 
     // Initialize stack
-    stack_init(&jvm->jvm_stack);
+    stack_init(&jvm->jvm_stack, options->stack_size / sizeof(int32_t));
+
+    // Nothing is linked or running yet
+    jvm->main_class = NULL;
+    jvm->current_frame = NULL;
+    jvm->catch_points = NULL;
+    jvm->tlab.top = NULL;
+    jvm->tlab.end = NULL;
+    jvm->local_roots = NULL;
+    jvm->verbose_gc = false;
+    jvm->gc_count = 0;
+    jvm->gc_threads = 1;
+    jvm->gc_workers = NULL;
+    jvm->classes = NULL;
+    jvm->classes_count = 0;
+    jvm->classes_capacity = 0;
+    memset(&jvm->class_registry, 0, sizeof(jvm->class_registry));
+    jvm->class_path = NULL;
+    jvm->class_path_count = 0;
+    memset(&jvm->preloaded, 0, sizeof(jvm->preloaded));
+    memset(&jvm->class_file, 0, sizeof(jvm->class_file));
+    jvm->metadata.chunks = NULL;
+    jvm->metadata.allocated = 0;
+    jvm->jit_enabled = jit_supported();
+    jvm->jit_threshold = JIT_COMPILE_THRESHOLD;
+    jvm->osr_threshold = JIT_OSR_THRESHOLD;
+
+    memset(&jvm->strings, 0, sizeof(jvm->strings));
+}
+
+// Returns size bytes of the arena, 8-byte aligned, or NULL when out of
+// memory. Allocations are bumped out of the newest chunk; one that does not
+// fit starts a new chunk, at least ARENA_CHUNK_SIZE bytes. The rest of the
+// old chunk is left unused, so metadata parsed together stays together.
+void *arena_allocate(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t data_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + data_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        chunk->size = data_size;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+    void *memory = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return memory;
+}
+
+// Moves every chunk of other into arena, behind the one being filled, so
+// they are released with it. other is left empty.
+void arena_adopt(Arena *arena, Arena *other) {
+    if (other->chunks == NULL) {
+        return;
+    }
+    ArenaChunk *last = other->chunks;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    if (arena->chunks == NULL) {
+        arena->chunks = other->chunks;
+    } else {
+        last->next = arena->chunks->next;
+        arena->chunks->next = other->chunks;
+    }
+    arena->allocated += other->allocated;
+    other->chunks = NULL;
+    other->allocated = 0;
+}
+
+void arena_release(Arena *arena) {
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->allocated = 0;
+}
+
+// A quarter of the heap is the nursery, and an eighth of the nursery each
+// survivor space. Every boundary falls on a page, and so on a card.
+#define NURSERY_FRACTION 4
+#define SURVIVOR_FRACTION 8
+
+// Committing and releasing memory. The heap is one reservation of address
+// space with no access; the parts in use are made accessible (committed)
+// with mprotect. The kernel only backs a committed page with memory when it
+// is first touched, and madvise(MADV_DONTNEED) gives the memory of free
+// pages back without uncommitting them.
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// The old generation grows when a full collection leaves less than
+// MIN_FREE_PERCENT of it free, and shrinks when it leaves more than
+// MAX_FREE_PERCENT
+#define MIN_FREE_PERCENT 40
+#define MAX_FREE_PERCENT 70
+
+static size_t round_up(size_t size, size_t unit) {
+    return (size + unit - 1) / unit * unit;
+}
+
+static void commit(uint8_t *start, size_t size) {
+    if (size > 0 && mprotect(start, size, PROT_READ | PROT_WRITE) != 0) {
+        perror("Failed to commit heap memory");
+        exit(1);
+    }
 }
 
-#define HEAP_SIZE 1024 * 1024 // 1 MB heap size
+static void uncommit(uint8_t *start, size_t size) {
+    if (size > 0) {
+        madvise(start, size, MADV_DONTNEED);
+        mprotect(start, size, PROT_NONE);
+    }
+}
+
+// Reserves size bytes of address space, aligned to alignment
+static uint8_t *reserve(size_t size, size_t alignment) {
+    size_t length = size + alignment;
+    uint8_t *base = mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    uint8_t *start = (uint8_t *)round_up((uintptr_t)base, alignment);
+    if (start > base) {
+        munmap(base, (size_t)(start - base));
+    }
+    munmap(start + size, (size_t)(base + length - (start + size)));
+    return start;
+}
+
+// Reserves max bytes (-Xmx) and commits the nursery and enough of the old
+// generation for the heap to start at initial bytes (-Xms). The layout is
+// fixed by max; only old_limit moves.
+void heap_init(Heap *heap, size_t initial, size_t max, bool huge_pages) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = max & ~(size_t)(CARD_SIZE - 1);
+    size_t survivor = (size / NURSERY_FRACTION / SURVIVOR_FRACTION) & ~(size_t)(page - 1);
+    size_t nursery = (size / NURSERY_FRACTION) & ~(size_t)(page - 1);
+    size = size & ~(size_t)(page - 1);
+    // References address HEAP_ALIGNMENT units with 32 bits
+    if (survivor == 0 || nursery < 4 * survivor || size / HEAP_ALIGNMENT > UINT32_MAX ||
+        initial > max) {
+        fprintf(stderr, "Invalid heap size: %zu bytes\n", max);
+        exit(1);
+    }
 
-void heap_init(Heap *heap) {
-    heap->heap = (uint8_t *)malloc(HEAP_SIZE);
-    if (heap->heap == NULL) {
+    heap->heap = reserve(size, huge_pages ? HUGE_PAGE_SIZE : page);
+    heap->cards = calloc(size / CARD_SIZE, 1);
+    heap->card_starts = calloc(size / CARD_SIZE, sizeof(uint32_t));
+    if (heap->heap == NULL || heap->cards == NULL || heap->card_starts == NULL) {
         fprintf(stderr, "Failed to allocate heap memory\n");
         exit(1);
     }
-    heap->heap_size = HEAP_SIZE;
-    heap->heap_top = 0;
+    if (huge_pages && madvise(heap->heap, size, MADV_HUGEPAGE) != 0) {
+        perror("Transparent huge pages are not available");
+    }
+    heap->heap_size = size;
+    heap->old_size = size - nursery;
+    heap->page_size = page;
+    size_t old_initial = initial > nursery ? round_up(initial - nursery, page) : page;
+    heap->old_initial = old_initial < heap->old_size ? old_initial : heap->old_size;
+    heap->old_limit = heap->old_initial;
+    heap->survivor_size = survivor;
+    heap->eden = heap->heap + heap->old_size;
+    heap->eden_top = heap->eden;
+    heap->eden_pinned = heap->eden;
+    heap->eden_end = heap->heap + size - 2 * survivor;
+    heap->from = heap->eden_end;
+    heap->from_top = heap->from;
+    heap->to = heap->from + survivor;
+    heap->to_start = heap->to;
+    commit(heap->heap, heap->old_limit);
+    commit(heap->eden, nursery);
+
+    heap_fill(heap->heap, heap->heap + OLD_GENERATION_START);
+    heap->heap_top = OLD_GENERATION_START;
+    record_old_blocks(heap, 0, heap->heap_top);
+}
+
+// Commits old generation space for bytes more past heap_top; false if the
+// reservation is too small
+bool heap_expand(Heap *heap, size_t bytes) {
+    if (heap->old_size - heap->heap_top < bytes) {
+        return false;
+    }
+    size_t needed = heap->heap_top + bytes;
+    if (needed <= heap->old_limit) {
+        return true;
+    }
+    // At least double, so that a growing heap commits rarely
+    size_t limit = round_up(needed, heap->page_size);
+    if (limit < 2 * heap->old_limit) {
+        limit = 2 * heap->old_limit;
+    }
+    if (limit > heap->old_size) {
+        limit = heap->old_size;
+    }
+    commit(heap->heap + heap->old_limit, limit - heap->old_limit);
+    heap->old_limit = limit;
+    return true;
+}
+
+// After a full collection: sizes the old generation for its live data
+// (heap_top) to take between 100 - MAX_FREE_PERCENT and 100 -
+// MIN_FREE_PERCENT of it, with at least wanted_free bytes free if the
+// reservation allows, and gives back the memory of the free pages
+void heap_resize_old(Heap *heap, size_t wanted_free) {
+    size_t live = heap->heap_top;
+    size_t low = live / (100 - MIN_FREE_PERCENT) * 100;
+    size_t high = live / (100 - MAX_FREE_PERCENT) * 100;
+    if (low < live + wanted_free) {
+        low = live + wanted_free;
+    }
+    size_t limit = heap->old_limit;
+    if (limit < low) {
+        limit = low;
+    } else if (limit > high) {
+        limit = high;
+    }
+    limit = round_up(limit, heap->page_size);
+    if (limit < heap->old_initial) {
+        limit = heap->old_initial;
+    }
+    if (limit > heap->old_size) {
+        limit = heap->old_size;
+    }
+
+    if (limit > heap->old_limit) {
+        commit(heap->heap + heap->old_limit, limit - heap->old_limit);
+    } else {
+        uncommit(heap->heap + limit, heap->old_limit - limit);
+    }
+    heap->old_limit = limit;
+    size_t free_start = round_up(live, heap->page_size);
+    if (free_start < limit) {
+        madvise(heap->heap + free_start, limit - free_start, MADV_DONTNEED);
+    }
+}
+
+// Allocation. Blocks are bump-allocated from the thread's TLAB (see
+// heap_allocate in jvm.h); this is the path for when the TLAB is full and
+// for blocks that need a particular alignment.
+
+#define NO_ALIGNMENT ((size_t)-1)
+
+// Turns [start, end) into a filler block so the heap stays walkable
+void heap_fill(uint8_t *start, uint8_t *end) {
+    if (start < end) {
+        HeapHeader *header = (HeapHeader *)start;
+        header->size = (uint32_t)(end - start);
+        header->kind = HEAP_FILLER;
+        header->gc_flags = 0;
+    }
+}
+
+// Bytes to skip at top so that payload + line_offset of a block placed
+// after them falls on a cache line. Always a multiple of HEAP_ALIGNMENT.
+static size_t line_padding(const uint8_t *top, size_t line_offset) {
+    if (line_offset == NO_ALIGNMENT) {
+        return 0;
+    }
+    uintptr_t target = (uintptr_t)top + sizeof(HeapHeader) + line_offset;
+    return (CACHE_LINE_SIZE - target % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+}
+
+// Places a block at *top if it fits before end and returns its payload
+static void *place_block(uint8_t **top, uint8_t *end, size_t block, uint8_t kind, size_t line_offset) {
+    size_t padding = line_padding(*top, line_offset);
+    if ((size_t)(end - *top) < padding + block) {
+        return NULL;
+    }
+    heap_fill(*top, *top + padding);
+    HeapHeader *header = (HeapHeader *)(*top + padding);
+    header->size = (uint32_t)block;
+    header->kind = kind;
+    header->gc_flags = 0;
+    header->age = 0;
+    header->pinned = 0;
+    header->forward = 0;
+    header->class_id = 0;
+    *top += padding + block;
+    return header + 1;
+}
+
+// Gives the unused rest of the TLAB back to the heap as a filler block
+void tlab_retire(JVM *jvm) {
+    heap_fill(jvm->tlab.top, jvm->tlab.end);
+    jvm->tlab.top = NULL;
+    jvm->tlab.end = NULL;
+}
+
+// Points the cards of the old generation whose first byte falls in one of
+// the blocks of [start, end) at that block (its offset in HEAP_ALIGNMENT
+// units), so that a dirty card can be scanned from the block covering it
+void record_old_blocks(Heap *heap, size_t start, size_t end) {
+    while (start < end) {
+        size_t size = ((HeapHeader *)(heap->heap + start))->size;
+        for (size_t card = (start + CARD_SIZE - 1) >> CARD_SHIFT;
+             card << CARD_SHIFT < start + size; card++) {
+            heap->card_starts[card] = (uint32_t)(start / HEAP_ALIGNMENT);
+        }
+        start += size;
+    }
+}
+
+// Retires the current TLAB and carves a new one from eden, big enough for
+// block. Below eden_pinned, TLABs are carved from the fillers between the
+// pinned blocks.
+static bool tlab_refill(JVM *jvm, size_t block) {
+    Heap *heap = &jvm->heap;
+    tlab_retire(jvm);
+    uint8_t *end = heap->eden_end;
+    while (heap->eden_top < heap->eden_pinned) {
+        HeapHeader *header = (HeapHeader *)heap->eden_top;
+        if (header->kind == HEAP_FILLER && header->size >= block + CACHE_LINE_SIZE) {
+            end = heap->eden_top + header->size;
+            break;
+        }
+        heap->eden_top += header->size;
+    }
+    size_t available = (size_t)(end - heap->eden_top);
+    size_t size = available < TLAB_SIZE ? available : TLAB_SIZE;
+    if (size == 0) {
+        return false;
+    }
+    jvm->tlab.top = heap->eden_top;
+    jvm->tlab.end = jvm->tlab.top + size;
+    heap->eden_top += size;
+    if (end < heap->eden_end) {
+        heap_fill(heap->eden_top, end);
+    }
+    memset(jvm->tlab.top, 0, size);
+    return true;
+}
+
+// Blocks that would use up much of a TLAB, or of eden, skip the nursery
+static bool is_large(Heap *heap, size_t block) {
+    return block > TLAB_SIZE / 2 || block > (size_t)(heap->eden_end - heap->eden) / 2;
+}
+
+static void *try_allocate(JVM *jvm, size_t block, uint8_t kind, size_t line_offset, bool tenured) {
+    Heap *heap = &jvm->heap;
+    if (tenured) {
+        // Large blocks go straight to the old generation
+        uint8_t *top = heap->heap + heap->heap_top;
+        void *payload = place_block(&top, heap->heap + heap->old_limit, block, kind, line_offset);
+        if (payload) {
+            size_t start = heap->heap_top;
+            heap->heap_top = (size_t)(top - heap->heap);
+            record_old_blocks(heap, start, heap->heap_top);
+            memset(payload, 0, block - sizeof(HeapHeader));
+        }
+        return payload;
+    }
+
+    void *payload = place_block(&jvm->tlab.top, jvm->tlab.end, block, kind, line_offset);
+    if (payload) {
+        return payload;
+    }
+    if (tlab_refill(jvm, block)) {
+        return place_block(&jvm->tlab.top, jvm->tlab.end, block, kind, line_offset);
+    }
+    return NULL;
 }
 
-void *heap_alloc(Heap *heap, size_t size) {
-    if (heap->heap_top + size > heap->heap_size) {
-        fprintf(stderr, "Heap overflow\n");
+// When eden is full a minor collection empties it; when the old generation
+// is, a full collection compacts it. The allocation is retried after each
+// before giving up. Tenured blocks are placed in the old generation.
+static void *allocate_block(JVM *jvm, size_t size, uint8_t kind, size_t line_offset, bool tenured) {
+    size_t block = (sizeof(HeapHeader) + size + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+    void *payload = NULL;
+    if (block <= UINT32_MAX) {
+        tenured = tenured || is_large(&jvm->heap, block);
+        payload = try_allocate(jvm, block, kind, line_offset, tenured);
+        if (!payload && !tenured) {
+            collect_garbage(jvm);
+            payload = try_allocate(jvm, block, kind, line_offset, tenured);
+        }
+        if (!payload) {
+            collect_full(jvm);
+            payload = try_allocate(jvm, block, kind, line_offset, tenured);
+        }
+        if (!payload && tenured && heap_expand(&jvm->heap, block + CACHE_LINE_SIZE)) {
+            payload = try_allocate(jvm, block, kind, line_offset, tenured);
+        }
+    }
+    if (!payload) {
+        fprintf(stderr, "OutOfMemoryError: cannot allocate %zu bytes\n", size);
         exit(1);
     }
-    void *ptr = heap->heap + heap->heap_top;
-    heap->heap_top += size;
-    return ptr;
+    return payload;
 }
 
-void heap_free(Heap *heap) {
-    free(heap->heap);
+void *heap_allocate_slow(JVM *jvm, size_t size, uint8_t kind) {
+    return allocate_block(jvm, size, kind, NO_ALIGNMENT, false);
 }
 
-#define STACK_SIZE 1024
+// Allocates like heap_allocate, with payload + line_offset on a cache line
+void *heap_allocate_aligned(JVM *jvm, size_t size, uint8_t kind, size_t line_offset) {
+    return allocate_block(jvm, size, kind, line_offset, false);
+}
 
-void stack_init(JVMStack *stack) {
-    stack->stack = (int32_t *)malloc(STACK_SIZE * sizeof(int32_t));
-    if (stack->stack == NULL) {
+// Allocates like heap_allocate, in the old generation and for good at that
+// address: for blocks whose reference the VM keeps where the collector does
+// not look (constant pool caches, compiled code)
+void *heap_allocate_pinned(JVM *jvm, size_t size, uint8_t kind) {
+    void *payload = allocate_block(jvm, size, kind, NO_ALIGNMENT, true);
+    ((HeapHeader *)payload - 1)->pinned = 1;
+    return payload;
+}
+
+void stack_init(JVMStack *stack, size_t slots) {
+    stack->stack = (int32_t *)malloc(slots * sizeof(int32_t));
+    if (stack->stack == NULL || slots == 0) {
         fprintf(stderr, "Failed to allocate stack memory\n");
         exit(1);
     }
-    stack->stack_size = STACK_SIZE;
+    stack->stack_size = slots;
     stack->stack_top = 0;
 }
 
@@ -73,4 +477,84 @@ int32_t stack_pop(JVMStack *stack) {
 
 void stack_free(JVMStack *stack) {
     free(stack->stack);
-}
\ No newline at end of file
+}
+
+// Frames are laid out in jvm_stack as
+//   [locals: max_locals][Frame header][operand stack: max_stack]
+// A caller passes arguments by leaving them on top of its operand stack and
+// the callee's locals start right at those slots, so nothing is copied.
+// Pushing and popping a frame only moves stack_top.
+#define FRAME_HEADER_SLOTS ((sizeof(Frame) + sizeof(int32_t) - 1) / sizeof(int32_t))
+
+Frame *frame_push(JVM *jvm, Method *method, OperandStack *caller_stack, uint16_t arg_slots) {
+    JVMStack *stack = &jvm->jvm_stack;
+
+    size_t locals_start = stack->stack_top;
+    if (caller_stack != NULL) {
+        locals_start = (size_t)(caller_stack->values + caller_stack->size - arg_slots - stack->stack);
+        caller_stack->size -= arg_slots;
+    }
+
+    uint16_t locals_count = method->max_locals > arg_slots ? method->max_locals : arg_slots;
+    size_t header_start = (locals_start + locals_count + 1) & ~(size_t)1; // 8-byte aligned header
+    size_t operands_start = header_start + FRAME_HEADER_SLOTS;
+    size_t top = operands_start + method->max_stack;
+    if (top > stack->stack_size) {
+        fprintf(stderr, "Stack overflow\n");
+        exit(1);
+    }
+
+    int32_t *locals = stack->stack + locals_start;
+    memset(locals + arg_slots, 0, sizeof(int32_t) * (locals_count - arg_slots));
+
+    Frame *frame = (Frame *)(stack->stack + header_start);
+    frame->caller = jvm->current_frame;
+    frame->method = method;
+    frame->locals = locals;
+    frame->stack.values = stack->stack + operands_start;
+    frame->stack.size = 0;
+    frame->stack.capacity = method->max_stack;
+    frame->pc = 0;
+    frame->saved_top = stack->stack_top;
+
+    stack->stack_top = top;
+    jvm->current_frame = frame;
+    return frame;
+}
+
+void frame_pop(JVM *jvm) {
+    Frame *frame = jvm->current_frame;
+    jvm->jvm_stack.stack_top = frame->saved_top;
+    jvm->current_frame = frame->caller;
+}
+
+// Returns the reference of the unique JavaString with these contents,
+// creating it on first use. bytes must outlive the JVM (constant pool data).
+int32_t intern_string(JVM *jvm, const uint8_t *bytes, uint16_t length) {
+    StringTable *table = &jvm->strings;
+    for (int32_t i = 0; i < table->count; i++) {
+        JavaString *string = dereference(jvm, table->references[i]);
+        if (string->length == length && memcmp(string->bytes, bytes, length) == 0) {
+            return table->references[i];
+        }
+    }
+
+    if (table->count >= table->capacity) {
+        int32_t capacity = table->capacity ? table->capacity * 2 : 64;
+        int32_t *references = realloc(table->references, sizeof(int32_t) * capacity);
+        if (references == NULL) {
+            fprintf(stderr, "Failed to grow string table\n");
+            exit(1);
+        }
+        table->references = references;
+        table->capacity = capacity;
+    }
+
+    // Pinned, as ldc caches the reference (see resolve_constant)
+    JavaString *string = heap_allocate_pinned(jvm, sizeof(JavaString), HEAP_STRING);
+    string->length = length;
+    string->bytes = bytes;
+
+    table->references[table->count] = make_reference(jvm, string);
+    return table->references[table->count++];
+}
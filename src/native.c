@@ -0,0 +1,259 @@
+#include "jvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// There is no class library, so the few library members that test programs
+// touch (System.out, PrintStream.println, ...) are implemented here.
+
+// Values of the java/lang/System stream fields. The PrintStream natives use
+// the receiver to pick the C stream.
+#define STREAM_OUT 1
+#define STREAM_ERR 2
+
+static int32_t system_out = STREAM_OUT;
+static int32_t system_err = STREAM_ERR;
+
+static FILE *pop_stream(OperandStack *stack) {
+    int32_t receiver = 0;
+    operand_stack_pop(stack, &receiver);
+    return receiver == STREAM_ERR ? stderr : stdout;
+}
+
+// Formats a double the way Double.toString does: plain notation between
+// 1e-3 and 1e7, computerized scientific notation otherwise, and always with
+// the shortest digit string that reads back to the same value.
+static void format_double(char *buffer, size_t size, double value, int max_digits) {
+    if (isnan(value)) {
+        snprintf(buffer, size, "NaN");
+        return;
+    }
+    if (isinf(value)) {
+        snprintf(buffer, size, value > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+    if (value == 0) {
+        snprintf(buffer, size, signbit(value) ? "-0.0" : "0.0");
+        return;
+    }
+
+    char digits[40];
+    int precision = 1;
+    for (; precision < max_digits; precision++) {
+        snprintf(digits, sizeof(digits), "%.*e", precision - 1, value);
+        double parsed = strtod(digits, NULL);
+        if (max_digits <= 9 ? (float)parsed == (float)value : parsed == value) {
+            break;
+        }
+    }
+    snprintf(digits, sizeof(digits), "%.*e", precision - 1, value);
+
+    // digits is [-]d[.ddd]e[+-]xx
+    char *exponent_part = strchr(digits, 'e');
+    int exponent = atoi(exponent_part + 1);
+    *exponent_part = '\0';
+    const char *mantissa = digits[0] == '-' ? digits + 1 : digits;
+    char significant[40];
+    size_t n = 0;
+    for (const char *p = mantissa; *p; p++) {
+        if (*p != '.') significant[n++] = *p;
+    }
+    significant[n] = '\0';
+
+    double magnitude = fabs(value);
+    char *out = buffer;
+    char *end = buffer + size - 1;
+    if (value < 0 && out < end) *out++ = '-';
+
+    if (magnitude >= 1e-3 && magnitude < 1e7) {
+        if (exponent < 0) {
+            out += snprintf(out, end - out + 1, "0.");
+            for (int i = -1; i > exponent && out < end; i--) *out++ = '0';
+            for (size_t i = 0; i < n && out < end; i++) *out++ = significant[i];
+        } else {
+            for (int i = 0; i <= exponent && out < end; i++) {
+                *out++ = (size_t)i < n ? significant[i] : '0';
+            }
+            if (out < end) *out++ = '.';
+            if ((size_t)exponent + 1 < n) {
+                for (size_t i = exponent + 1; i < n && out < end; i++) *out++ = significant[i];
+            } else if (out < end) {
+                *out++ = '0';
+            }
+        }
+        *out = '\0';
+    } else {
+        snprintf(out, end - out + 1, "%c.%sE%d", significant[0],
+                 n > 1 ? significant + 1 : "0", exponent);
+    }
+}
+
+static void print_string(JVM *jvm, FILE *stream, int32_t reference) {
+    JavaString *string = dereference(jvm, reference);
+    if (string == NULL) {
+        fputs("null", stream);
+        return;
+    }
+    fwrite(string->bytes, 1, string->length, stream);
+}
+
+static void native_println_void(JVM *jvm, OperandStack *stack) {
+    fputc('\n', pop_stream(stack));
+}
+
+static void native_print_int(JVM *jvm, OperandStack *stack) {
+    int32_t value = 0;
+    operand_stack_pop(stack, &value);
+    fprintf(pop_stream(stack), "%d", value);
+}
+
+static void native_println_int(JVM *jvm, OperandStack *stack) {
+    int32_t value = 0;
+    operand_stack_pop(stack, &value);
+    fprintf(pop_stream(stack), "%d\n", value);
+}
+
+static void native_println_boolean(JVM *jvm, OperandStack *stack) {
+    int32_t value = 0;
+    operand_stack_pop(stack, &value);
+    fprintf(pop_stream(stack), "%s\n", value ? "true" : "false");
+}
+
+static void native_println_char(JVM *jvm, OperandStack *stack) {
+    int32_t value = 0;
+    operand_stack_pop(stack, &value);
+    fprintf(pop_stream(stack), "%c\n", (char)value);
+}
+
+static void native_println_long(JVM *jvm, OperandStack *stack) {
+    Cat2 value = operand_stack_pop_cat2(stack);
+    fprintf(pop_stream(stack), "%lld\n", (long long)value.long_);
+}
+
+static void native_println_float(JVM *jvm, OperandStack *stack) {
+    int32_t bits = 0;
+    float value;
+    char buffer[64];
+    operand_stack_pop(stack, &bits);
+    memcpy(&value, &bits, sizeof(value));
+    format_double(buffer, sizeof(buffer), value, 9);
+    fprintf(pop_stream(stack), "%s\n", buffer);
+}
+
+static void native_println_double(JVM *jvm, OperandStack *stack) {
+    char buffer[64];
+    Cat2 value = operand_stack_pop_cat2(stack);
+    format_double(buffer, sizeof(buffer), value.double_, 17);
+    fprintf(pop_stream(stack), "%s\n", buffer);
+}
+
+static void native_print_string(JVM *jvm, OperandStack *stack) {
+    int32_t reference = 0;
+    operand_stack_pop(stack, &reference);
+    print_string(jvm, pop_stream(stack), reference);
+}
+
+static void native_println_string(JVM *jvm, OperandStack *stack) {
+    int32_t reference = 0;
+    operand_stack_pop(stack, &reference);
+    FILE *stream = pop_stream(stack);
+    print_string(jvm, stream, reference);
+    fputc('\n', stream);
+}
+
+// java/lang/Object has no state, so its constructor only drops the receiver
+static void native_object_init(JVM *jvm, OperandStack *stack) {
+    int32_t receiver = 0;
+    operand_stack_pop(stack, &receiver);
+}
+
+// java/lang/Throwable: the message is the only state kept
+static void native_throwable_init(JVM *jvm, OperandStack *stack) {
+    int32_t receiver = 0;
+    operand_stack_pop(stack, &receiver);
+}
+
+static void native_throwable_init_message(JVM *jvm, OperandStack *stack) {
+    int32_t message = 0, receiver = 0;
+    operand_stack_pop(stack, &message);
+    operand_stack_pop(stack, &receiver);
+    Object *throwable = dereference(jvm, receiver);
+    if (throwable) {
+        int32_t *slot = OBJECT_FIELD(throwable, int32_t, THROWABLE_MESSAGE);
+        *slot = message;
+        card_mark(jvm, slot);
+    }
+}
+
+static void native_throwable_get_message(JVM *jvm, OperandStack *stack) {
+    int32_t receiver = 0;
+    operand_stack_pop(stack, &receiver);
+    Object *throwable = dereference(jvm, receiver);
+    operand_stack_push(stack, throwable ? *OBJECT_FIELD(throwable, int32_t, THROWABLE_MESSAGE) : 0);
+}
+
+// Natives a user subclass can override are marked virtual: the library class
+// gets a Method for each (see define_library_class) and calls to them go
+// through the vtable. The others, constructors and the PrintStream methods,
+// whose receivers are the System stream values rather than objects, are
+// called directly.
+typedef struct {
+    const char *class_name;
+    const char *name;
+    const char *descriptor;
+    native_method function;
+    bool virtual;
+} NativeMethod;
+
+static const NativeMethod native_methods[] = {
+    { "java/lang/Object", "<init>", "()V", native_object_init },
+    { "java/lang/Throwable", "<init>", "()V", native_throwable_init },
+    { "java/lang/Throwable", "<init>", "(Ljava/lang/String;)V", native_throwable_init_message },
+    { "java/lang/Throwable", "getMessage", "()Ljava/lang/String;", native_throwable_get_message, true },
+    { "java/io/PrintStream", "println", "()V", native_println_void },
+    { "java/io/PrintStream", "println", "(I)V", native_println_int },
+    { "java/io/PrintStream", "println", "(S)V", native_println_int },
+    { "java/io/PrintStream", "println", "(B)V", native_println_int },
+    { "java/io/PrintStream", "println", "(Z)V", native_println_boolean },
+    { "java/io/PrintStream", "println", "(C)V", native_println_char },
+    { "java/io/PrintStream", "println", "(J)V", native_println_long },
+    { "java/io/PrintStream", "println", "(F)V", native_println_float },
+    { "java/io/PrintStream", "println", "(D)V", native_println_double },
+    { "java/io/PrintStream", "println", "(Ljava/lang/String;)V", native_println_string },
+    { "java/io/PrintStream", "print", "(I)V", native_print_int },
+    { "java/io/PrintStream", "print", "(Ljava/lang/String;)V", native_print_string },
+};
+
+native_method find_native_method(const char *class_name, const char *name, const char *descriptor) {
+    for (size_t i = 0; i < sizeof(native_methods) / sizeof(native_methods[0]); i++) {
+        const NativeMethod *native = &native_methods[i];
+        if (strcmp(native->class_name, class_name) == 0 &&
+            strcmp(native->name, name) == 0 &&
+            strcmp(native->descriptor, descriptor) == 0 && !native->virtual) {
+            return native->function;
+        }
+    }
+    return NULL;
+}
+
+// The index-th virtual native of class_name, or NULL past the last one
+native_method find_native_virtual(const char *class_name, uint16_t index, const char **name, const char **descriptor) {
+    for (size_t i = 0; i < sizeof(native_methods) / sizeof(native_methods[0]); i++) {
+        const NativeMethod *native = &native_methods[i];
+        if (native->virtual && strcmp(native->class_name, class_name) == 0 && index-- == 0) {
+            *name = native->name;
+            *descriptor = native->descriptor;
+            return native->function;
+        }
+    }
+    return NULL;
+}
+
+int32_t *find_native_static(const char *class_name, const char *name) {
+    if (strcmp(class_name, "java/lang/System") == 0) {
+        if (strcmp(name, "out") == 0) return &system_out;
+        if (strcmp(name, "err") == 0) return &system_err;
+    }
+    return NULL;
+}
@@ -0,0 +1,731 @@
+#include "jvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Load-time bytecode verifier. A data-flow pass over the decoded instruction
+// stream proves, for every reachable instruction, the operand stack depth and
+// the type of each stack slot and local. Methods that pass run on the
+// unchecked interpreter handlers (see FOR_EACH_VERIFIED_INSTRUCTION); the
+// others keep the checked ones.
+//
+// Types are only as precise as the fast path needs: int, float, long, double
+// or reference. Long and double take two slots, the second one is TOP. When
+// the method has a StackMapTable its frames are taken as the fixed state at
+// their instruction and incoming states are only checked against them, so a
+// single pass suffices; without one the states are merged to a fixed point.
+
+#define CONSTANT_Class              7
+#define CONSTANT_Fieldref           9
+#define CONSTANT_Methodref          10
+#define CONSTANT_InterfaceMethodref 11
+#define CONSTANT_String             8
+#define CONSTANT_Integer            3
+#define CONSTANT_Float              4
+#define CONSTANT_Long               5
+#define CONSTANT_Double             6
+#define CONSTANT_NameAndType        12
+#define CONSTANT_MethodHandle       15
+#define CONSTANT_MethodType         16
+
+#define ACC_STATIC 0x0008
+
+enum {
+    T_TOP = 0,     // unusable, or the second slot of a long/double
+    T_INT,         // boolean, byte, char, short and int
+    T_FLOAT,
+    T_LONG,
+    T_DOUBLE,
+    T_REF,         // any reference, including null
+};
+
+#define IS_CAT2(type) ((type) == T_LONG || (type) == T_DOUBLE)
+
+#define UNREACHED -1
+
+typedef struct {
+    Method *method;
+    uint32_t count;           // instructions
+    uint16_t max_locals;
+    uint16_t max_stack;
+    uint32_t width;           // max_locals + max_stack
+
+    uint8_t *states;          // width types per instruction: locals, then stack
+    int32_t *depths;          // stack depth per instruction, UNREACHED if none
+    bool *pinned;             // state comes from the StackMapTable
+    bool *reached;
+    uint32_t *worklist;
+    bool *queued;
+    uint32_t worklist_size;
+
+    uint8_t *locals;          // state of the instruction being checked
+    uint8_t *stack;
+    int32_t depth;
+
+    uint32_t *bci_of;         // bytecode offset of each instruction
+    uint32_t *handler_index;  // instruction index of each exception handler
+} Verifier;
+
+static uint16_t read_u2(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Type of the field or return descriptor at p, T_TOP for void
+static uint8_t descriptor_type(const char *p) {
+    switch (*p) {
+        case 'Z': case 'B': case 'C': case 'S': case 'I': return T_INT;
+        case 'F': return T_FLOAT;
+        case 'J': return T_LONG;
+        case 'D': return T_DOUBLE;
+        case 'L': case '[': return T_REF;
+        default: return T_TOP;
+    }
+}
+
+// Skips one field descriptor, NULL if it is malformed
+static const char *skip_descriptor(const char *p) {
+    while (*p == '[') p++;
+    if (*p == 'L') {
+        p = strchr(p, ';');
+        return p ? p + 1 : NULL;
+    }
+    return descriptor_type(p) != T_TOP ? p + 1 : NULL;
+}
+
+static uint8_t return_type(const char *descriptor) {
+    const char *p = strchr(descriptor, ')');
+    return p ? descriptor_type(p + 1) : T_TOP;
+}
+
+static bool push(Verifier *v, uint8_t type) {
+    int32_t slots = IS_CAT2(type) ? 2 : 1;
+    if (v->depth + slots > v->max_stack) {
+        return false;
+    }
+    v->stack[v->depth++] = type;
+    if (slots == 2) {
+        v->stack[v->depth++] = T_TOP;
+    }
+    return true;
+}
+
+static bool pop(Verifier *v, uint8_t type) {
+    if (IS_CAT2(type)) {
+        if (v->depth < 2 || v->stack[v->depth - 1] != T_TOP || v->stack[v->depth - 2] != type) {
+            return false;
+        }
+        v->depth -= 2;
+        return true;
+    }
+    if (v->depth < 1 || v->stack[v->depth - 1] != type) {
+        return false;
+    }
+    v->depth--;
+    return true;
+}
+
+static bool load(Verifier *v, int32_t index, uint8_t type) {
+    int32_t slots = IS_CAT2(type) ? 2 : 1;
+    if (index < 0 || index + slots > v->max_locals || v->locals[index] != type) {
+        return false;
+    }
+    return push(v, type);
+}
+
+static bool store(Verifier *v, int32_t index, uint8_t type) {
+    int32_t slots = IS_CAT2(type) ? 2 : 1;
+    if (index < 0 || index + slots > v->max_locals || !pop(v, type)) {
+        return false;
+    }
+    // Overwriting the second half of a long/double kills it
+    if (index > 0 && IS_CAT2(v->locals[index - 1])) {
+        v->locals[index - 1] = T_TOP;
+    }
+    v->locals[index] = type;
+    if (slots == 2) {
+        v->locals[index + 1] = T_TOP;
+    }
+    return true;
+}
+
+// dup, dup_x1, dup_x2, dup2, dup2_x1 and dup2_x2: copies the top `group`
+// slots below the `under` slots beneath them. Neither block may split a
+// long/double, which is the case when the slot starting it is not TOP.
+static bool duplicate(Verifier *v, int32_t group, int32_t under) {
+    int32_t depth = v->depth;
+    if (depth < group + under || depth + group > v->max_stack ||
+        v->stack[depth - group] == T_TOP ||
+        (under > 0 && v->stack[depth - group - under] == T_TOP)) {
+        return false;
+    }
+    uint8_t copy[2];
+    memcpy(copy, v->stack + depth - group, group);
+    memmove(v->stack + depth - group - under + group, v->stack + depth - group - under, group + under);
+    memcpy(v->stack + depth - group - under, copy, group);
+    v->depth += group;
+    return true;
+}
+
+// Pops and pushes of the instructions whose effect is fixed, written as
+// "<popped>><pushed>" with the popped types in push order. I is int, F float,
+// J long, D double and A a reference. Only opcodes the interpreter has a
+// handler for are listed: a method using any other one stays unverified and
+// runs on the checked handlers.
+static const char *const effects[256] = {
+    [NOP] = ">",
+    [LCONST_0] = ">J", [LCONST_1] = ">J",
+    [FCONST_0] = ">F", [FCONST_1] = ">F", [FCONST_2] = ">F",
+    [DCONST_0] = ">D", [DCONST_1] = ">D",
+    [SIPUSH] = ">I",
+    [0x2E] = "AI>I", [0x2F] = "AI>J", [0x30] = "AI>F", [0x31] = "AI>D",
+    [0x32] = "AI>A", [0x33] = "AI>I", [0x34] = "AI>I", [0x35] = "AI>I",
+    [0x4F] = "AII>", [0x50] = "AIJ>", [0x51] = "AIF>", [0x52] = "AID>",
+    [0x53] = "AIA>", [0x54] = "AII>", [0x55] = "AII>", [0x56] = "AII>",
+    [0x60] = "II>I", [0x61] = "JJ>J", [0x62] = "FF>F", [0x63] = "DD>D", // add
+    [0x64] = "II>I", [0x65] = "JJ>J", [0x66] = "FF>F", [0x67] = "DD>D", // sub
+    [0x68] = "II>I", [0x69] = "JJ>J", [0x6A] = "FF>F", [0x6B] = "DD>D", // mul
+    [0x6C] = "II>I", [0x6D] = "JJ>J", [0x6E] = "FF>F", [0x6F] = "DD>D", // div
+    [0x70] = "II>I", [0x71] = "JJ>J", [0x72] = "FF>F", [0x73] = "DD>D", // rem
+    [0x74] = "I>I", [0x75] = "J>J", [0x76] = "F>F", [0x77] = "D>D",     // neg
+    [0x78] = "II>I", [0x79] = "JI>J", [0x7A] = "II>I", [0x7B] = "JI>J", // shifts
+    [0x7C] = "II>I", [0x7D] = "JI>J",
+    [0x7E] = "II>I", [0x7F] = "JJ>J", [0x80] = "II>I", [0x81] = "JJ>J", // and/or/xor
+    [0x82] = "II>I", [0x83] = "JJ>J",
+    [0x85] = "I>J", [0x86] = "I>F", [0x87] = "I>D", [0x88] = "J>I",     // conversions
+    [0x89] = "J>F", [0x8A] = "J>D", [0x8B] = "F>I", [0x8C] = "F>J",
+    [0x8D] = "F>D", [0x8E] = "D>I", [0x8F] = "D>J", [0x90] = "D>F",
+    [0x91] = "I>I", [0x92] = "I>I", [0x93] = "I>I",
+    [0x94] = "JJ>I", [0x95] = "FF>I", [0x96] = "FF>I", [0x97] = "DD>I", [0x98] = "DD>I",
+    [IFEQ] = "I>", [IFNE] = "I>", [IFLT] = "I>", [IFGE] = "I>", [IFGT] = "I>", [IFLE] = "I>",
+    [IF_ICMPEQ] = "II>", [IF_ICMPNE] = "II>", [IF_ICMPLT] = "II>",
+    [IF_ICMPGE] = "II>", [IF_ICMPGT] = "II>", [IF_ICMPLE] = "II>",
+    [GOTO] = ">",
+    [TABLESWITCH] = "I>", [LOOKUPSWITCH] = "I>",
+    [NEW] = ">A", [NEWARRAY] = "I>A", [0xBD] = "I>A", [0xBE] = "A>I",  // anewarray, arraylength
+    [0xBF] = "A>",                                                     // athrow
+};
+
+static uint8_t effect_type(char c) {
+    switch (c) {
+        case 'I': return T_INT;
+        case 'F': return T_FLOAT;
+        case 'J': return T_LONG;
+        case 'D': return T_DOUBLE;
+        default: return T_REF;
+    }
+}
+
+static bool apply_effect(Verifier *v, const char *effect) {
+    const char *arrow = strchr(effect, '>');
+    for (const char *p = arrow; p > effect; p--) {
+        if (!pop(v, effect_type(p[-1]))) return false;
+    }
+    for (const char *p = arrow + 1; *p; p++) {
+        if (!push(v, effect_type(*p))) return false;
+    }
+    return true;
+}
+
+// Descriptor of the field or method a Fieldref/Methodref/InterfaceMethodref
+// at index refers to
+static const char *member_descriptor(ClassFile *class_file, int32_t index, uint8_t tag) {
+    if (!class_file || index <= 0 || index >= class_file->constant_pool_count) {
+        return NULL;
+    }
+    cp_info *ref = &class_file->constant_pool[index - 1];
+    if (ref->tag != tag && !(tag == CONSTANT_Methodref && ref->tag == CONSTANT_InterfaceMethodref)) {
+        return NULL;
+    }
+    uint16_t name_and_type = ref->info.Methodref.name_and_type_index;
+    if (name_and_type == 0 || name_and_type >= class_file->constant_pool_count ||
+        class_file->constant_pool[name_and_type - 1].tag != CONSTANT_NameAndType) {
+        return NULL;
+    }
+    uint16_t descriptor = class_file->constant_pool[name_and_type - 1].info.NameAndType.descriptor_index;
+    if (descriptor == 0 || descriptor >= class_file->constant_pool_count) {
+        return NULL;
+    }
+    return get_constant_pool_string(class_file, descriptor);
+}
+
+static bool apply_field(Verifier *v, const Instruction *insn) {
+    const char *descriptor = member_descriptor(v->method->class_file, insn->a, CONSTANT_Fieldref);
+    uint8_t type = descriptor ? descriptor_type(descriptor) : T_TOP;
+    if (type == T_TOP) {
+        return false;
+    }
+    switch (insn->opcode) {
+        case GETSTATIC: return push(v, type);
+        case PUTSTATIC: return pop(v, type);
+        case GETFIELD:  return pop(v, T_REF) && push(v, type);
+        default:        return pop(v, type) && pop(v, T_REF); // putfield
+    }
+}
+
+static bool apply_invoke(Verifier *v, const Instruction *insn) {
+    const char *descriptor = member_descriptor(v->method->class_file, insn->a, CONSTANT_Methodref);
+    if (!descriptor || *descriptor != '(') {
+        return false;
+    }
+
+    uint8_t args[255];
+    int count = 0;
+    const char *p = descriptor + 1;
+    while (*p != ')') {
+        if (count == 255) return false;
+        args[count++] = descriptor_type(p);
+        p = skip_descriptor(p);
+        if (!p) return false;
+    }
+    while (count > 0) {
+        if (!pop(v, args[--count])) return false;
+    }
+    if (insn->opcode != INVOKESTATIC && !pop(v, T_REF)) {
+        return false;
+    }
+    uint8_t result = descriptor_type(p + 1);
+    return result == T_TOP || push(v, result);
+}
+
+static bool apply_ldc(Verifier *v, const Instruction *insn) {
+    ClassFile *class_file = v->method->class_file;
+    if (!class_file || insn->a <= 0 || insn->a >= class_file->constant_pool_count) {
+        return false;
+    }
+    uint8_t tag = class_file->constant_pool[insn->a - 1].tag;
+    if (insn->opcode == 0x14) { // ldc2_w
+        return (tag == CONSTANT_Long && push(v, T_LONG)) ||
+               (tag == CONSTANT_Double && push(v, T_DOUBLE));
+    }
+    switch (tag) {
+        case CONSTANT_Integer: return push(v, T_INT);
+        case CONSTANT_Float: return push(v, T_FLOAT);
+        case CONSTANT_String: case CONSTANT_Class:
+        case CONSTANT_MethodHandle: case CONSTANT_MethodType:
+            return push(v, T_REF);
+        default: return false;
+    }
+}
+
+// Applies the instruction at pc to the current state
+static bool apply(Verifier *v, const Instruction *insn) {
+    uint8_t opcode = insn->opcode;
+    switch (opcode) {
+        case ILOAD: case LLOAD: case FLOAD: case DLOAD: case ALOAD: {
+            static const uint8_t types[] = { T_INT, T_LONG, T_FLOAT, T_DOUBLE, T_REF };
+            return load(v, insn->a, types[opcode - ILOAD]);
+        }
+        case ISTORE: case LSTORE: case FSTORE: case DSTORE: case ASTORE: {
+            static const uint8_t types[] = { T_INT, T_LONG, T_FLOAT, T_DOUBLE, T_REF };
+            return store(v, insn->a, types[opcode - ISTORE]);
+        }
+        case IINC:
+            return insn->a < v->max_locals && v->locals[insn->a] == T_INT;
+
+        case POP:
+            if (v->depth < 1 || v->stack[v->depth - 1] == T_TOP) return false;
+            v->depth--;
+            return true;
+        case 0x58: // pop2
+            if (v->depth < 2 || v->stack[v->depth - 2] == T_TOP) return false;
+            v->depth -= 2;
+            return true;
+        case DUP:  return duplicate(v, 1, 0);
+        case 0x5A: return duplicate(v, 1, 1); // dup_x1
+        case 0x5B: return duplicate(v, 1, 2); // dup_x2
+        case 0x5C: return duplicate(v, 2, 0); // dup2
+        case 0x5D: return duplicate(v, 2, 1); // dup2_x1
+        case 0x5E: return duplicate(v, 2, 2); // dup2_x2
+        case 0x5F: { // swap
+            if (v->depth < 2 || v->stack[v->depth - 1] == T_TOP || v->stack[v->depth - 2] == T_TOP) {
+                return false;
+            }
+            uint8_t top = v->stack[v->depth - 1];
+            v->stack[v->depth - 1] = v->stack[v->depth - 2];
+            v->stack[v->depth - 2] = top;
+            return true;
+        }
+
+        case LDC: case 0x14:
+            return apply_ldc(v, insn);
+        case GETSTATIC: case PUTSTATIC: case GETFIELD: case PUTFIELD:
+            return apply_field(v, insn);
+        case INVOKEVIRTUAL: case INVOKESPECIAL: case INVOKESTATIC: case INVOKEINTERFACE:
+            return apply_invoke(v, insn);
+        case MULTIANEWARRAY:
+            if (insn->aux == 0 || insn->b < 0 || insn->aux > insn->b >> 8) return false;
+            for (int i = 0; i < insn->aux; i++) {
+                if (!pop(v, T_INT)) return false;
+            }
+            return push(v, T_REF);
+
+        case IRETURN: case LRETURN: case FRETURN: case DRETURN: case ARETURN: {
+            static const uint8_t types[] = { T_INT, T_LONG, T_FLOAT, T_DOUBLE, T_REF };
+            uint8_t type = types[opcode - IRETURN];
+            return return_type(v->method->descriptor) == type && pop(v, type);
+        }
+        case RETURN:
+            return return_type(v->method->descriptor) == T_TOP;
+
+        default:
+            // jsr/ret, invokedynamic and anything unknown are not verified
+            return effects[opcode] && apply_effect(v, effects[opcode]);
+    }
+}
+
+static void enqueue(Verifier *v, uint32_t index) {
+    if (!v->queued[index]) {
+        v->queued[index] = true;
+        v->worklist[v->worklist_size++] = index;
+    }
+}
+
+// Flows the given state into instruction target
+static bool merge(Verifier *v, uint32_t target, const uint8_t *locals,
+                  const uint8_t *stack, int32_t depth) {
+    if (target >= v->count) {
+        return false; // falls off the end of the code
+    }
+    uint8_t *state = v->states + (size_t)target * v->width;
+    uint8_t *state_stack = state + v->max_locals;
+
+    if (v->pinned[target]) {
+        // Must be assignable to the StackMapTable frame
+        if (depth != v->depths[target] || memcmp(stack, state_stack, depth) != 0) {
+            return false;
+        }
+        for (uint16_t i = 0; i < v->max_locals; i++) {
+            if (state[i] != T_TOP && state[i] != locals[i]) return false;
+        }
+        if (!v->reached[target]) {
+            v->reached[target] = true;
+            enqueue(v, target);
+        }
+        return true;
+    }
+
+    if (!v->reached[target]) {
+        memcpy(state, locals, v->max_locals);
+        memcpy(state_stack, stack, depth);
+        v->depths[target] = depth;
+        v->reached[target] = true;
+        enqueue(v, target);
+        return true;
+    }
+
+    if (depth != v->depths[target] || memcmp(stack, state_stack, depth) != 0) {
+        return false;
+    }
+    bool changed = false;
+    for (uint16_t i = 0; i < v->max_locals; i++) {
+        if (state[i] != locals[i] && state[i] != T_TOP) {
+            state[i] = T_TOP;
+            changed = true;
+        }
+    }
+    if (changed) {
+        enqueue(v, target);
+    }
+    return true;
+}
+
+// Every instruction covered by an exception handler can transfer to it with
+// its locals and only the exception on the stack
+static bool merge_handlers(Verifier *v, uint32_t pc) {
+    const uint8_t *table = v->method->exception_table;
+    static const uint8_t exception_stack[1] = { T_REF };
+    if (v->method->exception_table_length > 0 && v->max_stack < 1) {
+        return false;
+    }
+    for (uint16_t i = 0; i < v->method->exception_table_length; i++) {
+        const uint8_t *entry = table + 8 * i;
+        if (v->bci_of[pc] >= read_u2(entry) && v->bci_of[pc] < read_u2(entry + 2) &&
+            !merge(v, v->handler_index[i], v->locals, exception_stack, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks the instruction at pc and flows its result to its successors
+static bool verify_instruction(Verifier *v, uint32_t pc) {
+    const Instruction *insn = &v->method->code[pc];
+    memcpy(v->locals, v->states + (size_t)pc * v->width, v->width);
+    v->depth = v->depths[pc];
+
+    if (!merge_handlers(v, pc) || !apply(v, insn) || !merge_handlers(v, pc)) {
+        return false;
+    }
+
+    uint8_t opcode = insn->opcode;
+    if ((opcode >= IFEQ && opcode <= GOTO) || opcode == 0xC6 || opcode == 0xC7) {
+        if (!merge(v, (uint32_t)insn->a, v->locals, v->stack, v->depth)) return false;
+        if (opcode == GOTO) return true;
+    } else if (opcode == TABLESWITCH || opcode == LOOKUPSWITCH) {
+        const int32_t *table = v->method->switch_data + insn->a;
+        if (!merge(v, (uint32_t)table[0], v->locals, v->stack, v->depth)) return false;
+        for (int32_t k = 0; k < insn->b; k++) {
+            int32_t target = opcode == TABLESWITCH ? table[3 + k] : table[3 + 2 * k];
+            if (!merge(v, (uint32_t)target, v->locals, v->stack, v->depth)) return false;
+        }
+        return true;
+    } else if ((opcode >= IRETURN && opcode <= RETURN) || opcode == 0xBF) { // athrow
+        return true;
+    }
+    return merge(v, pc + 1, v->locals, v->stack, v->depth);
+}
+
+// Appends one verification_type_info to types; returns the bytes read or 0
+static uint32_t read_type_info(Verifier *v, const uint8_t *p, const uint8_t *end,
+                               uint8_t *types, uint32_t *count, uint32_t limit) {
+    if (p >= end) return 0;
+    uint8_t tag = p[0];
+    uint32_t length = (tag == 7 || tag == 8) ? 3 : 1; // Object, Uninitialized
+    static const uint8_t tag_types[] = {
+        T_TOP, T_INT, T_FLOAT, T_DOUBLE, T_LONG, T_REF, T_REF, T_REF, T_REF
+    };
+    if (tag > 8 || p + length > end) return 0;
+    uint8_t type = tag_types[tag];
+    uint32_t slots = IS_CAT2(type) ? 2 : 1;
+    if (*count + slots > limit) return 0;
+    types[(*count)++] = type;
+    if (slots == 2) types[(*count)++] = T_TOP;
+    return length;
+}
+
+// Pins the state of every instruction with a StackMapTable frame. Frames
+// describe locals as a list where long/double count once, so the list is
+// kept in slots and chop walks back over whole values.
+static bool load_stack_map(Verifier *v, const int32_t *index_of, const uint8_t *initial) {
+    const uint8_t *p = v->method->stack_map;
+    const uint8_t *end = p + v->method->stack_map_length;
+    if (p + 2 > end) return false;
+    uint16_t frames = read_u2(p);
+    p += 2;
+
+    uint8_t *locals = malloc(v->max_locals + 1);
+    uint8_t *stack = malloc(v->max_stack + 1);
+    if (!locals || !stack) {
+        free(locals);
+        free(stack);
+        return false;
+    }
+    uint32_t local_count = 0;
+    // Initial locals up to the last non-TOP value
+    for (uint32_t i = 0; i < v->max_locals; i++) {
+        locals[i] = initial[i];
+        if (initial[i] != T_TOP) local_count = i + 1 + (IS_CAT2(initial[i]) ? 1 : 0);
+    }
+
+    bool ok = true;
+    int64_t offset = -1;
+    for (uint16_t f = 0; f < frames && ok; f++) {
+        if (p >= end) { ok = false; break; }
+        uint8_t frame_type = *p++;
+        uint32_t stack_count = 0;
+        uint32_t delta;
+
+        if (frame_type < 64) {                      // same_frame
+            delta = frame_type;
+        } else if (frame_type < 128) {              // same_locals_1_stack_item
+            delta = frame_type - 64;
+            uint32_t n = read_type_info(v, p, end, stack, &stack_count, v->max_stack);
+            ok = n != 0;
+            p += n;
+        } else if (frame_type < 247) {
+            ok = false;                             // reserved
+            break;
+        } else {
+            if (p + 2 > end) { ok = false; break; }
+            delta = read_u2(p);
+            p += 2;
+            if (frame_type == 247) {                // same_locals_1_stack_item_extended
+                uint32_t n = read_type_info(v, p, end, stack, &stack_count, v->max_stack);
+                ok = n != 0;
+                p += n;
+            } else if (frame_type < 251) {          // chop
+                for (int k = 0; k < 251 - frame_type && ok; k++) {
+                    ok = local_count > 0;
+                    if (ok && local_count >= 2 && IS_CAT2(locals[local_count - 2]) &&
+                        locals[local_count - 1] == T_TOP) {
+                        local_count--;
+                    }
+                    if (ok) local_count--;
+                }
+            } else if (frame_type == 251) {         // same_frame_extended
+            } else if (frame_type < 255) {          // append
+                for (int k = 0; k < frame_type - 251 && ok; k++) {
+                    uint32_t n = read_type_info(v, p, end, locals, &local_count, v->max_locals);
+                    ok = n != 0;
+                    p += n;
+                }
+            } else {                                // full_frame
+                local_count = 0;
+                if (p + 2 > end) { ok = false; break; }
+                uint16_t n_locals = read_u2(p);
+                p += 2;
+                for (uint16_t k = 0; k < n_locals && ok; k++) {
+                    uint32_t n = read_type_info(v, p, end, locals, &local_count, v->max_locals);
+                    ok = n != 0;
+                    p += n;
+                }
+                if (!ok || p + 2 > end) { ok = false; break; }
+                uint16_t n_stack = read_u2(p);
+                p += 2;
+                for (uint16_t k = 0; k < n_stack && ok; k++) {
+                    uint32_t n = read_type_info(v, p, end, stack, &stack_count, v->max_stack);
+                    ok = n != 0;
+                    p += n;
+                }
+            }
+        }
+        if (!ok) break;
+
+        offset += delta + 1;
+        if (offset >= v->method->code_length || index_of[offset] < 0) {
+            ok = false;
+            break;
+        }
+        uint32_t index = (uint32_t)index_of[offset];
+        uint8_t *state = v->states + (size_t)index * v->width;
+        memset(state, T_TOP, v->width);
+        memcpy(state, locals, local_count);
+        memcpy(state + v->max_locals, stack, stack_count);
+        v->depths[index] = (int32_t)stack_count;
+        v->pinned[index] = true;
+    }
+
+    free(locals);
+    free(stack);
+    return ok;
+}
+
+// Locals on entry: this, then the arguments, then unusable slots
+static bool initial_locals(Verifier *v, uint8_t *locals) {
+    Method *method = v->method;
+    memset(locals, T_TOP, v->max_locals);
+    if (!method->descriptor || method->descriptor[0] != '(') {
+        return false;
+    }
+    uint32_t slot = 0;
+    if (!(method->access_flags & ACC_STATIC)) {
+        if (slot >= v->max_locals) return false;
+        locals[slot++] = T_REF;
+    }
+    for (const char *p = method->descriptor + 1; *p != ')';) {
+        uint8_t type = descriptor_type(p);
+        uint32_t slots = IS_CAT2(type) ? 2 : 1;
+        p = skip_descriptor(p);
+        if (!p || slot + slots > v->max_locals) return false;
+        locals[slot] = type;
+        slot += slots;
+    }
+    return true;
+}
+
+static bool run_verifier(Verifier *v, const int32_t *index_of) {
+    Method *method = v->method;
+
+    for (uint32_t bci = 0; bci < method->code_length; bci++) {
+        if (index_of[bci] >= 0) v->bci_of[index_of[bci]] = bci;
+    }
+    for (uint16_t i = 0; i < method->exception_table_length; i++) {
+        uint16_t handler = read_u2(method->exception_table + 8 * i + 4);
+        if (handler >= method->code_length || index_of[handler] < 0) return false;
+        v->handler_index[i] = (uint32_t)index_of[handler];
+    }
+    for (uint32_t i = 0; i < v->count; i++) {
+        v->depths[i] = UNREACHED;
+    }
+
+    uint8_t *initial = v->locals;
+    if (!initial_locals(v, initial)) {
+        return false;
+    }
+    if (method->stack_map && !load_stack_map(v, index_of, initial)) {
+        return false;
+    }
+    uint8_t *entry = malloc(v->max_locals + 1);
+    if (!entry) return false;
+    memcpy(entry, initial, v->max_locals);
+    bool ok = merge(v, 0, entry, v->stack, 0);
+    free(entry);
+
+    while (ok && v->worklist_size > 0) {
+        uint32_t pc = v->worklist[--v->worklist_size];
+        v->queued[pc] = false;
+        ok = verify_instruction(v, pc);
+    }
+    return ok;
+}
+
+// Leaves the collector a bit per local and stack slot of every instruction,
+// set where the slot holds a reference when the instruction starts.
+// Unreachable instructions never run, so their maps stay empty.
+static bool build_reference_maps(Verifier *v) {
+    Method *method = v->method;
+    uint32_t stride = (v->width + 7) / 8;
+    uint8_t *maps = calloc((size_t)v->count * stride + 1, 1);
+    if (!maps) {
+        return false;
+    }
+    for (uint32_t pc = 0; pc < v->count; pc++) {
+        if (v->depths[pc] == UNREACHED) {
+            continue;
+        }
+        const uint8_t *state = v->states + (size_t)pc * v->width;
+        uint8_t *map = maps + (size_t)pc * stride;
+        uint32_t live = (uint32_t)v->max_locals + (uint32_t)v->depths[pc];
+        for (uint32_t slot = 0; slot < live; slot++) {
+            if (state[slot] == T_REF) {
+                map[slot / 8] |= (uint8_t)(1u << (slot % 8));
+            }
+        }
+    }
+    free(method->reference_maps);
+    method->reference_maps = maps;
+    method->reference_map_stride = stride;
+    return true;
+}
+
+// Verifies method->code, which must not be fused into superinstructions
+// yet. index_of maps each bytecode offset that starts an instruction to its
+// index (-1 elsewhere).
+bool verify_method(Method *method, const int32_t *index_of) {
+    Verifier v = {0};
+    v.method = method;
+    v.count = method->instruction_count;
+    v.max_locals = method->max_locals;
+    v.max_stack = method->max_stack;
+    v.width = (uint32_t)v.max_locals + v.max_stack;
+    if (v.count == 0) {
+        return false;
+    }
+
+    // +1 keeps every allocation non-empty
+    v.states = malloc((size_t)v.count * v.width + 1);
+    v.depths = malloc(sizeof(int32_t) * v.count);
+    v.pinned = calloc(v.count, sizeof(bool));
+    v.reached = calloc(v.count, sizeof(bool));
+    v.queued = calloc(v.count, sizeof(bool));
+    v.worklist = malloc(sizeof(uint32_t) * v.count);
+    v.locals = malloc(v.width + 1);
+    v.bci_of = malloc(sizeof(uint32_t) * v.count);
+    v.handler_index = malloc(sizeof(uint32_t) * (method->exception_table_length + 1));
+    v.stack = v.locals + v.max_locals;
+
+    bool verified = v.states && v.depths && v.pinned && v.reached && v.queued &&
+                    v.worklist && v.locals && v.bci_of && v.handler_index &&
+                    run_verifier(&v, index_of) && build_reference_maps(&v);
+
+    free(v.states);
+    free(v.depths);
+    free(v.pinned);
+    free(v.reached);
+    free(v.queued);
+    free(v.worklist);
+    free(v.locals);
+    free(v.bci_of);
+    free(v.handler_index);
+    return verified;
+}
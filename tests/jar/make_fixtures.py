@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Regenerates the JAR fixtures of tests/jar_test.sh from bin/Test.class.
+# Written by hand rather than with zipfile so each archive pins down the
+# compression it exercises: stored entries, deflate with dynamic and with
+# fixed Huffman codes, deflate made of stored blocks, and broken archives.
+import os
+import struct
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CLASS = open(os.path.join(HERE, '..', '..', 'bin', 'Test.class'), 'rb').read()
+MANIFEST = b'Manifest-Version: 1.0\r\nMain-Class: Test\r\n\r\n'
+
+
+def deflate(data, level=9, strategy=zlib.Z_DEFAULT_STRATEGY):
+    compressor = zlib.compressobj(level, zlib.DEFLATED, -15, 8, strategy)
+    return compressor.compress(data) + compressor.flush()
+
+
+# entries: (name, data, method, payload, crc)
+def archive(entries):
+    local = b''
+    central = b''
+    for name, data, method, payload, crc in entries:
+        name = name.encode()
+        offset = len(local)
+        fields = struct.pack('<HHHHHIII', 20, 0, method, 0, 0x21, crc, len(payload), len(data))
+        local += struct.pack('<I', 0x04034b50) + fields + struct.pack('<HH', len(name), 0) + name + payload
+        central += (struct.pack('<IH', 0x02014b50, 20) + fields +
+                    struct.pack('<HHHHHII', len(name), 0, 0, 0, 0, 0, offset) + name)
+    end = struct.pack('<IHHHHIIH', 0x06054b50, 0, 0, len(entries), len(entries),
+                      len(central), len(local), 0)
+    return local + central + end
+
+
+def entry(name, data, method=8, payload=None, crc=None):
+    if payload is None:
+        payload = data if method == 0 else deflate(data)
+    return (name, data, method, payload, zlib.crc32(data) if crc is None else crc)
+
+
+def write(name, data):
+    with open(os.path.join(HERE, name), 'wb') as f:
+        f.write(data)
+
+
+def both(method, **deflate_options):
+    payload = None if method == 0 else deflate(CLASS, **deflate_options)
+    return archive([entry('META-INF/MANIFEST.MF', MANIFEST, method),
+                    entry('Test.class', CLASS, method, payload)])
+
+
+write('stored.jar', both(0))
+write('deflated.jar', both(8))
+write('fixed.jar', both(8, strategy=zlib.Z_FIXED))
+write('stored-blocks.jar', both(8, level=0))
+
+good = both(8)
+write('truncated.jar', good[:len(good) // 2])
+write('bad-crc.jar', archive([entry('Test.class', CLASS, crc=zlib.crc32(CLASS) ^ 1)]))
+# Block type 3 is reserved
+write('bad-deflate.jar', archive([entry('Test.class', CLASS, payload=b'\x07' + deflate(CLASS)[1:])]))
+# The central directory points past the end of the archive
+bad_offset = bytearray(good)
+central = bad_offset.rfind(b'PK\x01\x02')
+bad_offset[central + 42:central + 46] = struct.pack('<I', len(bad_offset) - 4)
+write('bad-offset.jar', bytes(bad_offset))
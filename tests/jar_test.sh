@@ -0,0 +1,45 @@
+#!/bin/sh
+# Runs Test from each JAR fixture in tests/jar and diffs the output against
+# the same class loaded from a directory, with and without --preload. The
+# broken archives must be rejected with an error, not crash the VM.
+# Usage: tests/jar_test.sh [path to jvm], from the repository root.
+JVM=${1:-bin/jvm}
+FIXTURES=tests/jar
+OUT=${TMPDIR:-/tmp}/jar_test.$$
+failures=0
+
+fail() {
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+mkdir -p "$OUT" || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+"$JVM" Test --jvm -cp bin > "$OUT/expected" 2>&1 || fail "Test from bin"
+
+for jar in stored deflated fixed stored-blocks; do
+    for preload in "" --preload; do
+        "$JVM" Test --jvm -cp "$FIXTURES/$jar.jar" $preload > "$OUT/actual" 2>&1
+        status=$?
+        if [ $status -ne 0 ]; then
+            fail "$jar.jar $preload exited with status $status"
+        elif ! diff -u "$OUT/expected" "$OUT/actual"; then
+            fail "$jar.jar $preload output differs"
+        fi
+    done
+done
+
+for jar in truncated bad-crc bad-deflate bad-offset; do
+    "$JVM" Test --jvm -cp "$FIXTURES/$jar.jar" > "$OUT/actual" 2>&1
+    status=$?
+    if [ $status -ne 1 ]; then
+        fail "$jar.jar exited with status $status, expected 1"
+    fi
+done
+
+if [ $failures -ne 0 ]; then
+    echo "$failures JAR test(s) failed"
+    exit 1
+fi
+echo "JAR tests passed"
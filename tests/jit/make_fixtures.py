@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+# Regenerates the class fixtures of tests/jit_test.sh. Loops.class runs the
+# opcode mixes of bench/dispatch_bench.c as static methods returning their
+# accumulator; main stores each result in a local, so the final locals show
+# whether compiled and interpreted code agree. Underflow.class calls a method
+# that pops more than it pushes, which must not verify and so must not be
+# compiled either. Overrides.class catches a Failure, an Exception subclass
+# overriding getMessage, as Exception and prints its message, then the
+# message of a plain Exception.
+import os
+import struct
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ITERATIONS = 1000
+
+MIXES = [
+    [0x1c, 0x1b, 0x60, 0x1b, 0x64, 0x06, 0x68, 0x3d],              # arith
+    [0x1b, 0x08, 0x6c, 0x1b, 0x10, 7, 0x70, 0x60, 0x3d],           # div/rem
+    [0x1b, 0x3d, 0x1c, 0x36, 4, 0x15, 4, 0x3d],                    # locals
+    [0x1c, 0x1b, 0x82, 0x04, 0x78, 0x1b, 0x7e, 0x05, 0x80, 0x3d],  # bitwise
+    [0x1b, 0x04, 0x7e, 0x99, 0, 6, 0x84, 2, 1],                    # branchy
+]
+
+
+class ConstantPool:
+    def __init__(self):
+        self.entries = []
+
+    def add(self, data):
+        self.entries.append(data)
+        return len(self.entries)
+
+    def utf8(self, text):
+        data = text.encode()
+        return self.add(struct.pack('>BH', 1, len(data)) + data)
+
+    def klass(self, name):
+        return self.add(struct.pack('>BH', 7, self.utf8(name)))
+
+    def string(self, text):
+        return self.add(struct.pack('>BH', 8, self.utf8(text)))
+
+    def member(self, tag, klass, name, descriptor):
+        name_and_type = self.add(struct.pack('>BHH', 12, self.utf8(name), self.utf8(descriptor)))
+        return self.add(struct.pack('>BHH', tag, klass, name_and_type))
+
+    def fieldref(self, klass, name, descriptor):
+        return self.member(9, klass, name, descriptor)
+
+    def methodref(self, klass, name, descriptor):
+        return self.member(10, klass, name, descriptor)
+
+    def bytes(self):
+        return struct.pack('>H', len(self.entries) + 1) + b''.join(self.entries)
+
+
+# handlers are (start, end, handler, catch class index) tuples
+def method(pool, name, descriptor, max_stack, max_locals, code, flags=0x0009, handlers=()):
+    body = (struct.pack('>HHI', max_stack, max_locals, len(code)) + bytes(code) +
+            struct.pack('>H', len(handlers)) + b''.join(struct.pack('>HHHH', *h) for h in handlers) +
+            struct.pack('>H', 0))
+    return (struct.pack('>HHHH', flags, pool.utf8(name), pool.utf8(descriptor), 1) +
+            struct.pack('>HI', pool.utf8('Code'), len(body)) + body)
+
+
+def class_file(name, methods, super_name='java/lang/Object'):
+    pool = ConstantPool()
+    this = pool.klass(name)
+    super_class = pool.klass(super_name)
+    encoded = [m(pool, this) for m in methods]
+    return (struct.pack('>IHH', 0xCAFEBABE, 0, 49) + pool.bytes() +
+            struct.pack('>HHHHHH', 0x0021, this, super_class, 0, 0, len(encoded)) +
+            b''.join(encoded) + struct.pack('>H', 0))
+
+
+def mix_method(index, body):
+    # local_3 = ITERATIONS; local_1 = 0; local_2 = 0; do body while
+    # ++local_1 < local_3; return local_2
+    code = [0x11, ITERATIONS >> 8, ITERATIONS & 0xFF, 0x3e, 0x03, 0x3c, 0x03, 0x3d]
+    loop = len(code)
+    code += body + [0x84, 1, 1, 0x1b, 0x1d]
+    offset = (loop - len(code)) & 0xFFFF
+    code += [0xa1, offset >> 8, offset & 0xFF, 0x1c, 0xac]
+    return lambda pool, this: method(pool, 'mix%d' % index, '()I', 4, 5, code)
+
+
+def loops_main(pool, this):
+    code = []
+    for i in range(len(MIXES)):
+        ref = pool.methodref(this, 'mix%d' % i, '()I')
+        code += [0xb8, ref >> 8, ref & 0xFF, 0x36, i + 1]  # invokestatic; istore
+    code += [0xb1]
+    return method(pool, 'main', '([Ljava/lang/String;)V', 1, len(MIXES) + 1, code)
+
+
+with open(os.path.join(HERE, 'Loops.class'), 'wb') as f:
+    f.write(class_file('Loops', [mix_method(i, body) for i, body in enumerate(MIXES)] + [loops_main]))
+
+
+def underflow_main(pool, this):
+    ref = pool.methodref(this, 'underflow', '()V')
+    return method(pool, 'main', '([Ljava/lang/String;)V', 0, 1, [0xb8, ref >> 8, ref & 0xFF, 0xb1])
+
+
+# istore_0; istore_0; istore_0; return
+underflow = lambda pool, this: method(pool, 'underflow', '()V', 1, 1, [0x3b, 0x3b, 0x3b, 0xb1])
+with open(os.path.join(HERE, 'Underflow.class'), 'wb') as f:
+    f.write(class_file('Underflow', [underflow, underflow_main]))
+
+
+def u2(index):
+    return [index >> 8, index & 0xFF]
+
+
+def failure_init(pool, this):
+    ref = pool.methodref(pool.klass('java/lang/Exception'), '<init>', '()V')
+    return method(pool, '<init>', '()V', 1, 1, [0x2a, 0xb7] + u2(ref) + [0xb1], flags=0x0001)
+
+
+def failure_get_message(pool, this):
+    # ldc "overridden"; areturn
+    return method(pool, 'getMessage', '()Ljava/lang/String;', 1, 1,
+                  [0x12, pool.string('overridden'), 0xb0], flags=0x0001)
+
+
+def overrides_main(pool, this):
+    failure = pool.klass('Failure')
+    exception = pool.klass('java/lang/Exception')
+    out = pool.fieldref(pool.klass('java/lang/System'), 'out', 'Ljava/io/PrintStream;')
+    println = pool.methodref(pool.klass('java/io/PrintStream'), 'println', '(Ljava/lang/String;)V')
+    get_message = pool.methodref(exception, 'getMessage', '()Ljava/lang/String;')
+    code = [0xbb] + u2(failure) + [0x59, 0xb7] + u2(pool.methodref(failure, '<init>', '()V'))
+    code += [0xbf]                                               # athrow
+    handler = len(code)
+    code += [0x4c, 0xb2] + u2(out) + [0x2b]                      # astore_1; getstatic; aload_1
+    code += [0xb6] + u2(get_message) + [0xb6] + u2(println)
+    code += [0xb2] + u2(out) + [0xbb] + u2(exception) + [0x59]   # getstatic; new; dup
+    code += [0x12, pool.string('plain'), 0xb7]
+    code += u2(pool.methodref(exception, '<init>', '(Ljava/lang/String;)V'))
+    code += [0xb6] + u2(get_message) + [0xb6] + u2(println) + [0xb1]
+    return method(pool, 'main', '([Ljava/lang/String;)V', 4, 2, code,
+                  handlers=[(0, handler, handler, exception)])
+
+
+with open(os.path.join(HERE, 'Failure.class'), 'wb') as f:
+    f.write(class_file('Failure', [failure_init, failure_get_message], 'java/lang/Exception'))
+with open(os.path.join(HERE, 'Overrides.class'), 'wb') as f:
+    f.write(class_file('Overrides', [overrides_main]))
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Runs Test, tests/jit/Loops and tests/jit/Overrides in the interpreter and under the JIT, both
+# compiled on the first call and entered through on-stack replacement, and
+# diffs the output. Test's final locals are also checked against their
+# known values, Underflow's unverifiable method must not be compiled and
+# Overrides must call the getMessage override of its exception.
+# Usage: tests/jit_test.sh [path to jvm], from the repository root.
+JVM=${1:-bin/jvm}
+OUT=${TMPDIR:-/tmp}/jit_test.$$
+failures=0
+
+fail() {
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+mkdir -p "$OUT" || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+for class in bin/Test.class tests/jit/Loops.class tests/jit/Overrides.class; do
+    "$JVM" "$class" --jvm --no-jit > "$OUT/expected" 2>&1 || fail "$class --no-jit"
+    for mode in "--jit-threshold=1" "--jit-threshold=1000000 --osr-threshold=1"; do
+        "$JVM" "$class" --jvm --jit $mode > "$OUT/actual" 2>&1
+        status=$?
+        if [ $status -ne 0 ]; then
+            fail "$class --jit $mode exited with status $status"
+        elif ! diff -u "$OUT/expected" "$OUT/actual"; then
+            fail "$class --jit $mode output differs from the interpreter"
+        fi
+    done
+done
+
+# A method that fails verification stays on the checked handlers even once
+# it is hot enough to compile
+"$JVM" tests/jit/Underflow.class --jvm --jit --jit-threshold=1 > "$OUT/actual" 2>&1
+status=$?
+if [ $status -ne 1 ] || ! grep -q "Stack underflow" "$OUT/actual"; then
+    fail "Underflow exited with status $status without a stack underflow"
+fi
+
+"$JVM" bin/Test.class --jvm --jit --jit-threshold=1 | grep '^local_' > "$OUT/actual"
+printf 'local_%s\n' "1: 8" "2: 2" "3: 15" "4: 1" "5: 7" "6: 4" "7: 8" "8: 2" "9: 15" \
+    "10: 1" "11: 7" > "$OUT/expected"
+diff -u "$OUT/expected" "$OUT/actual" || fail "Test locals"
+
+# A user override of a library native wins over the native
+"$JVM" tests/jit/Overrides.class --jvm --jit --jit-threshold=1 | sed -n 2,3p > "$OUT/actual"
+printf '%s\n' overridden plain > "$OUT/expected"
+diff -u "$OUT/expected" "$OUT/actual" || fail "Overrides messages"
+
+if [ $failures -ne 0 ]; then
+    echo "$failures JIT test(s) failed"
+    exit 1
+fi
+echo "JIT tests passed"